@@ -28,6 +28,8 @@ typedef int32 *DWORD_PTR;
 #define STB_DXT_IMPLEMENTATION
 #include "stb_dxt.h"
 
+#include "imagesimd.h"
+
 // Should be last include
 #include "tier0/memdbgon.h"
 
@@ -1855,6 +1857,276 @@ bool SwapAxes( uint8 *src, int widthHeight, ImageFormat imageFormat )
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// SIMD pixel kernels
+//
+// SSE2/SSSE3 (NEON through sse2neon) versions of the common 8-bit conversions.
+// Each handles as many whole pixel groups as it safely can and returns how many
+// pixels it did; the scalar loop finishes the rest. Only integer shuffles,
+// shifts and masks are used, so the output matches the scalar code byte for byte.
+//-----------------------------------------------------------------------------
+static bool s_bImageSIMDEnabled = true;
+
+bool EnableImageSIMD( bool bEnable )
+{
+	bool bWasEnabled = s_bImageSIMDEnabled;
+	s_bImageSIMDEnabled = bEnable;
+	return bWasEnabled;
+}
+
+bool IsImageSIMDEnabled()
+{
+#if defined( IMAGE_SIMD ) && ( defined(__arm__) || defined(__aarch64__) )
+	return s_bImageSIMDEnabled;
+#elif defined( IMAGE_SIMD )
+	return s_bImageSIMDEnabled && GetCPUInformation()->m_bSSE2;
+#else
+	return false;
+#endif
+}
+
+static inline bool IsImageSSSE3Enabled()
+{
+#if defined( IMAGE_SIMD_SSSE3 ) && ( defined(__arm__) || defined(__aarch64__) )
+	return s_bImageSIMDEnabled;
+#elif defined( IMAGE_SIMD_SSSE3 )
+	return s_bImageSIMDEnabled && GetCPUInformation()->m_bSSSE3;
+#else
+	return false;
+#endif
+}
+
+#ifdef IMAGE_SIMD_SSSE3
+
+// Reorders the bytes of each 4-byte pixel, then ORs in constant bytes (usually alpha)
+static int SIMDShuffle4( const uint8 *src, uint8 *dst, int numPixels, __m128i shuffle, __m128i orMask )
+{
+	int i = 0;
+	for ( ; i + 4 <= numPixels; i += 4 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i *)( src + i * 4 ) );
+		_mm_storeu_si128( (__m128i *)( dst + i * 4 ), _mm_or_si128( _mm_shuffle_epi8( v, shuffle ), orMask ) );
+	}
+	return i;
+}
+
+// Like SIMDShuffle4, but byte 3 of each destination pixel is left as it was
+static int SIMDShuffle4KeepDstAlpha( const uint8 *src, uint8 *dst, int numPixels, __m128i shuffle )
+{
+	const __m128i alphaMask = _mm_set1_epi32( 0xFF000000 );
+	int i = 0;
+	for ( ; i + 4 <= numPixels; i += 4 )
+	{
+		__m128i v = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( src + i * 4 ) ), shuffle );
+		__m128i d = _mm_loadu_si128( (const __m128i *)( dst + i * 4 ) );
+		_mm_storeu_si128( (__m128i *)( dst + i * 4 ), _mm_or_si128( _mm_andnot_si128( alphaMask, v ), _mm_and_si128( alphaMask, d ) ) );
+	}
+	return i;
+}
+
+// 3 bytes per pixel to 4. Loads are 16 bytes wide, so stop while 6 pixels remain
+// to never read past the end of the source
+static int SIMDExpand3To4( const uint8 *src, uint8 *dst, int numPixels, __m128i shuffle, __m128i orMask )
+{
+	int i = 0;
+	for ( ; i + 6 <= numPixels; i += 4 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i *)( src + i * 3 ) );
+		_mm_storeu_si128( (__m128i *)( dst + i * 4 ), _mm_or_si128( _mm_shuffle_epi8( v, shuffle ), orMask ) );
+	}
+	return i;
+}
+
+// 4 bytes per pixel to 3; the shuffle packs 12 bytes at the bottom of the register
+static int SIMDPack4To3( const uint8 *src, uint8 *dst, int numPixels, __m128i shuffle )
+{
+	int i = 0;
+	for ( ; i + 4 <= numPixels; i += 4 )
+	{
+		__m128i v = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( src + i * 4 ) ), shuffle );
+		_mm_storel_epi64( (__m128i *)( dst + i * 3 ), v );
+		uint32 nHigh = _mm_cvtsi128_si32( _mm_srli_si128( v, 8 ) );
+		memcpy( dst + i * 3 + 8, &nHigh, sizeof( nHigh ) );
+	}
+	return i;
+}
+
+// 1 or 2 bytes per pixel to 4 (I8, A8, IA88, UV88)
+static int SIMDExpandTo4( const uint8 *src, uint8 *dst, int numPixels, int nSrcBytes, __m128i shuffle, __m128i orMask )
+{
+	int i = 0;
+	for ( ; i + 4 <= numPixels; i += 4 )
+	{
+		__m128i v;
+		if ( nSrcBytes == 1 )
+		{
+			int32 nSrc;
+			memcpy( &nSrc, src + i, sizeof( nSrc ) );
+			v = _mm_cvtsi32_si128( nSrc );
+		}
+		else
+		{
+			v = _mm_loadl_epi64( (const __m128i *)( src + i * 2 ) );
+		}
+		_mm_storeu_si128( (__m128i *)( dst + i * 4 ), _mm_or_si128( _mm_shuffle_epi8( v, shuffle ), orMask ) );
+	}
+	return i;
+}
+
+#endif // IMAGE_SIMD_SSSE3
+
+#ifdef IMAGE_SIMD
+
+// Packs four RGBA8888 pixels into the low 16 bits of each 32-bit lane
+template< ImageFormat FMT >
+static FORCEINLINE __m128i SIMDPackRGBA8888To16( __m128i p )
+{
+	const __m128i byteMask = _mm_set1_epi32( 0xFF );
+	__m128i r = _mm_and_si128( p, byteMask );
+	__m128i g = _mm_and_si128( _mm_srli_epi32( p, 8 ), byteMask );
+	__m128i b = _mm_and_si128( _mm_srli_epi32( p, 16 ), byteMask );
+	__m128i a = _mm_srli_epi32( p, 24 );
+
+	switch ( FMT )
+	{
+	case IMAGE_FORMAT_BGR565:
+		return _mm_or_si128( _mm_or_si128( _mm_slli_epi32( _mm_srli_epi32( r, 3 ), 11 ), _mm_slli_epi32( _mm_srli_epi32( g, 2 ), 5 ) ), _mm_srli_epi32( b, 3 ) );
+	case IMAGE_FORMAT_BGRX5551:
+		return _mm_or_si128( _mm_or_si128( _mm_slli_epi32( _mm_srli_epi32( r, 3 ), 10 ), _mm_slli_epi32( _mm_srli_epi32( g, 3 ), 5 ) ), _mm_srli_epi32( b, 3 ) );
+	case IMAGE_FORMAT_BGRA5551:
+		return _mm_or_si128( _mm_or_si128( _mm_slli_epi32( _mm_srli_epi32( r, 3 ), 10 ), _mm_slli_epi32( _mm_srli_epi32( g, 3 ), 5 ) ),
+			_mm_or_si128( _mm_srli_epi32( b, 3 ), _mm_slli_epi32( _mm_srli_epi32( a, 7 ), 15 ) ) );
+	default: // IMAGE_FORMAT_BGRA4444
+		return _mm_or_si128( _mm_or_si128( _mm_slli_epi32( _mm_srli_epi32( r, 4 ), 8 ), _mm_slli_epi32( _mm_srli_epi32( g, 4 ), 4 ) ),
+			_mm_or_si128( _mm_srli_epi32( b, 4 ), _mm_slli_epi32( _mm_srli_epi32( a, 4 ), 12 ) ) );
+	}
+}
+
+template< ImageFormat FMT >
+static int SIMDRGBA8888To16( const uint8 *src, uint8 *dst, int numPixels )
+{
+	int i = 0;
+	for ( ; i + 8 <= numPixels; i += 8 )
+	{
+		__m128i lo = SIMDPackRGBA8888To16<FMT>( _mm_loadu_si128( (const __m128i *)( src + i * 4 ) ) );
+		__m128i hi = SIMDPackRGBA8888To16<FMT>( _mm_loadu_si128( (const __m128i *)( src + i * 4 + 16 ) ) );
+
+		// Sign extend so the signed saturating pack keeps all 16 bits
+		lo = _mm_srai_epi32( _mm_slli_epi32( lo, 16 ), 16 );
+		hi = _mm_srai_epi32( _mm_slli_epi32( hi, 16 ), 16 );
+		_mm_storeu_si128( (__m128i *)( dst + i * 2 ), _mm_packs_epi32( lo, hi ) );
+	}
+	return i;
+}
+
+// Expands four 16-bit pixels (zero extended to 32-bit lanes) to RGBA8888
+template< ImageFormat FMT >
+static FORCEINLINE __m128i SIMDUnpack16ToRGBA8888( __m128i v )
+{
+	__m128i r, g, b, a;
+	switch ( FMT )
+	{
+	case IMAGE_FORMAT_BGR565:
+		b = _mm_and_si128( v, _mm_set1_epi32( 0x1F ) );
+		g = _mm_and_si128( _mm_srli_epi32( v, 5 ), _mm_set1_epi32( 0x3F ) );
+		r = _mm_and_si128( _mm_srli_epi32( v, 11 ), _mm_set1_epi32( 0x1F ) );
+		r = _mm_or_si128( _mm_slli_epi32( r, 3 ), _mm_srli_epi32( r, 2 ) );
+		g = _mm_or_si128( _mm_slli_epi32( g, 2 ), _mm_srli_epi32( g, 4 ) );
+		b = _mm_or_si128( _mm_slli_epi32( b, 3 ), _mm_srli_epi32( b, 2 ) );
+		a = _mm_set1_epi32( 255 );
+		break;
+	case IMAGE_FORMAT_BGRX5551:
+	case IMAGE_FORMAT_BGRA5551:
+		b = _mm_and_si128( v, _mm_set1_epi32( 0x1F ) );
+		g = _mm_and_si128( _mm_srli_epi32( v, 5 ), _mm_set1_epi32( 0x1F ) );
+		r = _mm_and_si128( _mm_srli_epi32( v, 10 ), _mm_set1_epi32( 0x1F ) );
+		r = _mm_or_si128( _mm_slli_epi32( r, 3 ), _mm_srli_epi32( r, 2 ) );
+		g = _mm_or_si128( _mm_slli_epi32( g, 3 ), _mm_srli_epi32( g, 2 ) );
+		b = _mm_or_si128( _mm_slli_epi32( b, 3 ), _mm_srli_epi32( b, 2 ) );
+		if ( FMT == IMAGE_FORMAT_BGRA5551 )
+		{
+			// 0 or 255 from the top bit
+			a = _mm_srli_epi32( v, 15 );
+			a = _mm_sub_epi32( _mm_slli_epi32( a, 8 ), a );
+		}
+		else
+		{
+			a = _mm_set1_epi32( 255 );
+		}
+		break;
+	default: // IMAGE_FORMAT_BGRA4444
+		b = _mm_and_si128( v, _mm_set1_epi32( 0xF ) );
+		g = _mm_and_si128( _mm_srli_epi32( v, 4 ), _mm_set1_epi32( 0xF ) );
+		r = _mm_and_si128( _mm_srli_epi32( v, 8 ), _mm_set1_epi32( 0xF ) );
+		a = _mm_and_si128( _mm_srli_epi32( v, 12 ), _mm_set1_epi32( 0xF ) );
+		r = _mm_or_si128( _mm_slli_epi32( r, 4 ), _mm_srli_epi32( r, 4 ) );
+		g = _mm_or_si128( _mm_slli_epi32( g, 4 ), _mm_srli_epi32( g, 4 ) );
+		b = _mm_or_si128( _mm_slli_epi32( b, 4 ), _mm_srli_epi32( b, 4 ) );
+		a = _mm_or_si128( _mm_slli_epi32( a, 4 ), _mm_srli_epi32( a, 4 ) );
+		break;
+	}
+	return _mm_or_si128( _mm_or_si128( r, _mm_slli_epi32( g, 8 ) ), _mm_or_si128( _mm_slli_epi32( b, 16 ), _mm_slli_epi32( a, 24 ) ) );
+}
+
+template< ImageFormat FMT >
+static int SIMD16ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for ( ; i + 8 <= numPixels; i += 8 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i *)( src + i * 2 ) );
+		_mm_storeu_si128( (__m128i *)( dst + i * 4 ), SIMDUnpack16ToRGBA8888<FMT>( _mm_unpacklo_epi16( v, zero ) ) );
+		_mm_storeu_si128( (__m128i *)( dst + i * 4 + 16 ), SIMDUnpack16ToRGBA8888<FMT>( _mm_unpackhi_epi16( v, zero ) ) );
+	}
+	return i;
+}
+
+// min( 255, c >> 4 ) for color, min( 255, a >> 8 ) for alpha; packus does the min
+static int SIMDRGBA16161616ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
+{
+	const __m128i alphaLanes = _mm_setr_epi16( 0, 0, 0, -1, 0, 0, 0, -1 );
+	int i = 0;
+	for ( ; i + 4 <= numPixels; i += 4 )
+	{
+		__m128i v0 = _mm_loadu_si128( (const __m128i *)( src + i * 8 ) );
+		__m128i v1 = _mm_loadu_si128( (const __m128i *)( src + i * 8 + 16 ) );
+		v0 = _mm_or_si128( _mm_andnot_si128( alphaLanes, _mm_srli_epi16( v0, 4 ) ), _mm_and_si128( alphaLanes, _mm_srli_epi16( v0, 8 ) ) );
+		v1 = _mm_or_si128( _mm_andnot_si128( alphaLanes, _mm_srli_epi16( v1, 4 ) ), _mm_and_si128( alphaLanes, _mm_srli_epi16( v1, 8 ) ) );
+		_mm_storeu_si128( (__m128i *)( dst + i * 4 ), _mm_packus_epi16( v0, v1 ) );
+	}
+	return i;
+}
+
+#endif // IMAGE_SIMD
+
+#define SIMD_NO_BYTES		_mm_setzero_si128()
+#define SIMD_ALPHA_BYTES	_mm_set1_epi32( (int)0xFF000000 )
+
+// Helpers to run a kernel and advance past the pixels it handled
+#ifdef IMAGE_SIMD_SSSE3
+#define SIMD_SHUFFLE4( b0, b1, b2, b3, orMask )																	\
+	if ( IsImageSSSE3Enabled() )																				\
+	{																											\
+		int nDone = SIMDShuffle4( src, dst, numPixels, _mm_setr_epi8( b0, b1, b2, b3, b0+4, b1+4, b2+4, b3+4,	\
+			b0+8, b1+8, b2+8, b3+8, b0+12, b1+12, b2+12, b3+12 ), orMask );										\
+		src += nDone * 4; dst += nDone * 4; numPixels -= nDone;													\
+	}
+#else
+#define SIMD_SHUFFLE4( b0, b1, b2, b3, orMask )
+#endif
+
+#ifdef IMAGE_SIMD
+#define SIMD_RUN( kernel, nSrcBytes, nDstBytes )													\
+	if ( IsImageSIMDEnabled() )																		\
+	{																								\
+		int nDone = kernel( src, dst, numPixels );													\
+		src += nDone * (nSrcBytes); dst += nDone * (nDstBytes); numPixels -= nDone;					\
+	}
+#else
+#define SIMD_RUN( kernel, nSrcBytes, nDstBytes )
+#endif
+
 void RGBA8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
 	memcpy( dst, src, 4 * numPixels );
@@ -1862,6 +2134,8 @@ void RGBA8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToABGR8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_SHUFFLE4( 3, 2, 1, 0, SIMD_NO_BYTES );
+
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 4 )
 	{
@@ -1874,6 +2148,13 @@ void RGBA8888ToABGR8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToRGB888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDPack4To3( src, dst, numPixels, _mm_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128 ) );
+		src += nDone * 4; dst += nDone * 3; numPixels -= nDone;
+	}
+#endif
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 3 )
 	{
@@ -1885,6 +2166,13 @@ void RGBA8888ToRGB888( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToBGR888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDPack4To3( src, dst, numPixels, _mm_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -128, -128, -128, -128 ) );
+		src += nDone * 4; dst += nDone * 3; numPixels -= nDone;
+	}
+#endif
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 3 )
 	{
@@ -1979,6 +2267,8 @@ void RGBA8888ToBGR888_BLUESCREEN( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToARGB8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_SHUFFLE4( 3, 0, 1, 2, SIMD_NO_BYTES );
+
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 4 )
 	{
@@ -1991,6 +2281,8 @@ void RGBA8888ToARGB8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToBGRA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_SHUFFLE4( 2, 1, 0, 3, SIMD_NO_BYTES );
+
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 4 )
 	{
@@ -2003,6 +2295,14 @@ void RGBA8888ToBGRA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToBGRX8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDShuffle4KeepDstAlpha( src, dst, numPixels, _mm_setr_epi8( 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15 ) );
+		src += nDone * 4; dst += nDone * 4; numPixels -= nDone;
+	}
+#endif
+
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 4 )
 	{
@@ -2014,6 +2314,8 @@ void RGBA8888ToBGRX8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToBGR565( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_RUN( SIMDRGBA8888To16<IMAGE_FORMAT_BGR565>, 4, 2 );
+
 	unsigned short* pDstShort = (unsigned short*)dst;
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, pDstShort ++ )
@@ -2026,6 +2328,8 @@ void RGBA8888ToBGR565( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToBGRX5551( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_RUN( SIMDRGBA8888To16<IMAGE_FORMAT_BGRX5551>, 4, 2 );
+
 	unsigned short* pDstShort = (unsigned short*)dst;
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, pDstShort ++ )
@@ -2038,6 +2342,8 @@ void RGBA8888ToBGRX5551( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToBGRA5551( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_RUN( SIMDRGBA8888To16<IMAGE_FORMAT_BGRA5551>, 4, 2 );
+
 	unsigned short* pDstShort = (unsigned short*)dst;
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, pDstShort ++ )
@@ -2051,6 +2357,8 @@ void RGBA8888ToBGRA5551( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGBA8888ToBGRA4444( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_RUN( SIMDRGBA8888To16<IMAGE_FORMAT_BGRA4444>, 4, 2 );
+
 	unsigned short* pDstShort = (unsigned short*)dst;
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, pDstShort ++ )
@@ -2084,6 +2392,8 @@ void RGBA8888ToUVLX8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void ABGR8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_SHUFFLE4( 3, 2, 1, 0, SIMD_NO_BYTES );
+
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 4 )
 	{
@@ -2096,6 +2406,14 @@ void ABGR8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void RGB888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDExpand3To4( src, dst, numPixels, _mm_setr_epi8( 0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128 ), SIMD_ALPHA_BYTES );
+		src += nDone * 3; dst += nDone * 4; numPixels -= nDone;
+	}
+#endif
+
 	const uint8 *endSrc = src + numPixels * 3;
 	for ( ; src < endSrc; src += 3, dst += 4 )
 	{
@@ -2108,6 +2426,14 @@ void RGB888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void BGR888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDExpand3To4( src, dst, numPixels, _mm_setr_epi8( 2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128 ), SIMD_ALPHA_BYTES );
+		src += nDone * 3; dst += nDone * 4; numPixels -= nDone;
+	}
+#endif
+
 	const uint8 *endSrc = src + numPixels * 3;
 	for ( ; src < endSrc; src += 3, dst += 4 )
 	{
@@ -2129,6 +2455,14 @@ void RGB565ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void I8ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDExpandTo4( src, dst, numPixels, 1, _mm_setr_epi8( 0, 0, 0, -128, 1, 1, 1, -128, 2, 2, 2, -128, 3, 3, 3, -128 ), SIMD_ALPHA_BYTES );
+		src += nDone * 1; dst += nDone * 4; numPixels -= nDone;
+	}
+#endif
+
 	const uint8 *endSrc = src + numPixels;
 	for ( ; src < endSrc; src += 1, dst += 4 )
 	{
@@ -2141,6 +2475,14 @@ void I8ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void IA88ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDExpandTo4( src, dst, numPixels, 2, _mm_setr_epi8( 0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7 ), SIMD_NO_BYTES );
+		src += nDone * 2; dst += nDone * 4; numPixels -= nDone;
+	}
+#endif
+
 	const uint8 *endSrc = src + numPixels * 2;
 	for ( ; src < endSrc; src += 2, dst += 4 )
 	{
@@ -2158,6 +2500,14 @@ void P8ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void A8ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDExpandTo4( src, dst, numPixels, 1, _mm_setr_epi8( 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 ), SIMD_NO_BYTES );
+		src += nDone * 1; dst += nDone * 4; numPixels -= nDone;
+	}
+#endif
+
 	const uint8 *endSrc = src + numPixels;
 	for ( ; src < endSrc; src += 1, dst += 4 )
 	{
@@ -2214,6 +2564,8 @@ void BGR888_BLUESCREENToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void ARGB8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_SHUFFLE4( 1, 2, 3, 0, SIMD_NO_BYTES );
+
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 4 )
 	{
@@ -2226,6 +2578,8 @@ void ARGB8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void BGRA8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_SHUFFLE4( 2, 1, 0, 3, SIMD_NO_BYTES );
+
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 4 )
 	{
@@ -2238,6 +2592,8 @@ void BGRA8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void BGRX8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_SHUFFLE4( 2, 1, 0, 3, SIMD_ALPHA_BYTES );
+
 	const uint8 *endSrc = src + numPixels * 4;
 	for ( ; src < endSrc; src += 4, dst += 4 )
 	{
@@ -2250,6 +2606,8 @@ void BGRX8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void BGR565ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_RUN( SIMD16ToRGBA8888<IMAGE_FORMAT_BGR565>, 2, 4 );
+
 	unsigned short* pSrcShort = (unsigned short*)src;
 	unsigned short* pEndSrc = pSrcShort + numPixels;
 	for ( ; pSrcShort < pEndSrc; pSrcShort++, dst += 4 )
@@ -2268,6 +2626,8 @@ void BGR565ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void BGRX5551ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_RUN( SIMD16ToRGBA8888<IMAGE_FORMAT_BGRX5551>, 2, 4 );
+
 	unsigned short* pSrcShort = (unsigned short*)src;
 	unsigned short* pEndSrc = pSrcShort + numPixels;
 	for ( ; pSrcShort < pEndSrc; pSrcShort++, dst += 4 )
@@ -2286,6 +2646,8 @@ void BGRX5551ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void BGRA5551ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_RUN( SIMD16ToRGBA8888<IMAGE_FORMAT_BGRA5551>, 2, 4 );
+
 	unsigned short* pSrcShort = (unsigned short*)src;
 	unsigned short* pEndSrc = pSrcShort + numPixels;
 	for ( ; pSrcShort < pEndSrc; pSrcShort++, dst += 4 )
@@ -2313,6 +2675,8 @@ void BGRA5551ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void BGRA4444ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+	SIMD_RUN( SIMD16ToRGBA8888<IMAGE_FORMAT_BGRA4444>, 2, 4 );
+
 	unsigned short* pSrcShort = (unsigned short*)src;
 	unsigned short* pEndSrc = pSrcShort + numPixels;
 	for ( ; pSrcShort < pEndSrc; pSrcShort++, dst += 4 )
@@ -2333,6 +2697,14 @@ void BGRA4444ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 
 void UV88ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD_SSSE3
+	if ( IsImageSSSE3Enabled() )
+	{
+		int nDone = SIMDExpandTo4( src, dst, numPixels, 2, _mm_setr_epi8( 0, 1, -128, -128, 2, 3, -128, -128, 4, 5, -128, -128, 6, 7, -128, -128 ), SIMD_NO_BYTES );
+		src += nDone * 2; dst += nDone * 4; numPixels -= nDone;
+	}
+#endif
+
 	const uint8* pEndSrc = src + numPixels * 2;
 	for ( ; src < pEndSrc; src += 2, dst += 4 )
 	{
@@ -2356,6 +2728,14 @@ void UVLX8888ToRGBA8888( const uint8 *src, uint8 *dst, int numPixels )
 // HDRFIXME: This assumes that the 16-bit integer values are 4.12 fixed-point.
 void RGBA16161616ToRGBA8888( const uint8 *src_, uint8 *dst, int numPixels )
 {
+#ifdef IMAGE_SIMD
+	if ( IsImageSIMDEnabled() )
+	{
+		int nDone = SIMDRGBA16161616ToRGBA8888( src_, dst, numPixels );
+		src_ += nDone * 8; dst += nDone * 4; numPixels -= nDone;
+	}
+#endif
+
 	unsigned short *src = ( unsigned short * )src_;
 	unsigned short *pEndSrc = src + numPixels * 4;
 	for ( ; src < pEndSrc; src += 4, dst += 4 )
@@ -0,0 +1,28 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Which SIMD instruction sets the image conversion and resampling
+//			kernels are built with. IMAGE_SIMD is SSE2 (or NEON through
+//			sse2neon), IMAGE_SIMD_SSSE3 adds the byte shuffles.
+//
+//=============================================================================//
+
+#ifndef IMAGESIMD_H
+#define IMAGESIMD_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#if defined(__arm__) || defined(__aarch64__)
+#include "sse2neon.h"
+#define IMAGE_SIMD 1
+#define IMAGE_SIMD_SSSE3 1
+#elif !defined( _GAMECONSOLE ) && ( defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64) )
+#include <emmintrin.h>
+#define IMAGE_SIMD 1
+#if defined( __SSSE3__ ) || defined( _MSC_VER )
+#include <tmmintrin.h>
+#define IMAGE_SIMD_SSSE3 1
+#endif
+#endif
+
+#endif // IMAGESIMD_H
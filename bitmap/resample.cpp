@@ -13,8 +13,11 @@
 #include "mathlib/vector.h"
 #include "tier1/utlmemory.h"
 #include "tier1/strtools.h"
+#include "tier0/threadtools.h"
 #include "mathlib/compressed_vector.h"
 
+#include "imagesimd.h"
+
 // Should be last include
 #include "tier0/memdbgon.h"
 
@@ -56,20 +59,15 @@ void ConstructGammaTable( unsigned char* pTable, float srcGamma, float dstGamma
 void GammaCorrectRGBA8888( unsigned char *pSrc, unsigned char* pDst, int width, int height, int depth,
 						  unsigned char* pGammaTable )
 {
-	for (int h = 0; h < depth; ++h )
+	// The slices, rows and pixels are contiguous, so walk them as one run.
+	// (A 256 entry byte table has no useful SIMD form short of AVX-512 gathers.)
+	int nPixels = width * height * depth;
+	for ( int i = 0; i < nPixels; ++i, pSrc += 4, pDst += 4 )
 	{
-		for (int i = 0; i < height; ++i )
-		{
-			for (int j = 0; j < width; ++j )
-			{
-				int idx = (h * width * height + i * width + j) * 4;
-
-				// don't gamma correct alpha
-				pDst[idx] = pGammaTable[pSrc[idx]];
-				pDst[idx+1] = pGammaTable[pSrc[idx+1]];
-				pDst[idx+2] = pGammaTable[pSrc[idx+2]];
-			}
-		}
+		// don't gamma correct alpha
+		pDst[0] = pGammaTable[pSrc[0]];
+		pDst[1] = pGammaTable[pSrc[1]];
+		pDst[2] = pGammaTable[pSrc[2]];
 	}
 }
 
@@ -330,6 +328,60 @@ public:
 		}	
 	}
 
+#ifdef IMAGE_SIMD
+	// ComputeAveragedColor with the four channels in one register. Each lane sees the
+	// same multiplies and adds in the same order as the scalar sums, so totals match
+	// exactly. (Alpha-tested texels below the cutoff add 0, which leaves the sum as is.)
+	static void ComputeAveragedColorSIMD( const KernelInfo_t &kernel, const ResampleInfo_t &info, 
+		int startX, int startY, int startZ, float *gammaToLinear, float *total )
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128 vTotal = _mm_setzero_ps();
+		for ( int j = 0, srcZ = startZ; j < kernel.m_nDepth; ++j, ++srcZ )
+		{
+			int sz = ActualZ( srcZ, info );
+			sz *= info.m_nSrcWidth * info.m_nSrcHeight;
+
+			for ( int k = 0, srcY = startY; k < kernel.m_nHeight; ++k, ++srcY )
+			{
+				int sy = ActualY( srcY, info );
+				sy *= info.m_nSrcWidth;
+
+				int kernelIdx = bNiceFilter ? kernel.m_nWidth * ( k + j * kernel.m_nHeight ) : 0;
+				for ( int l = 0, srcX = startX; l < kernel.m_nWidth; ++l, ++srcX, ++kernelIdx )
+				{
+					int sx = ActualX( srcX, info );					
+					const unsigned char *pSrc = &info.m_pSrc[ (sz + sy + sx) << 2 ];
+
+					float flKernelFactor = kernel.m_pKernel[ bNiceFilter ? kernelIdx : 0 ];
+					if ( bNiceFilter && flKernelFactor == 0.0f )
+						continue;
+
+					__m128 vColor;
+					if ( type == KERNEL_NORMALMAP )
+					{
+						int32 nTexel;
+						memcpy( &nTexel, pSrc, sizeof( nTexel ) );
+						__m128i vTexel = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( nTexel ), zero ), zero );
+						vColor = _mm_cvtepi32_ps( vTexel );
+					}
+					else if ( type == KERNEL_ALPHATEST )
+					{
+						vColor = _mm_setr_ps( gammaToLinear[ pSrc[0] ], gammaToLinear[ pSrc[1] ], gammaToLinear[ pSrc[2] ], ( pSrc[3] > 192 ) ? 255.0f : 0.0f );
+					}
+					else
+					{
+						vColor = _mm_setr_ps( gammaToLinear[ pSrc[0] ], gammaToLinear[ pSrc[1] ], gammaToLinear[ pSrc[2] ], pSrc[3] );
+					}
+
+					vTotal = _mm_add_ps( vTotal, _mm_mul_ps( _mm_set1_ps( flKernelFactor ), vColor ) );
+				}
+			}
+		}
+		_mm_storeu_ps( total, vTotal );
+	}
+#endif
+
 	static void AddAlphaToAlphaResult( const KernelInfo_t &kernel, const ResampleInfo_t &info, 
 		int startX, int startY, int startZ, float flAlpha, float *pAlphaResult )
 	{
@@ -458,6 +510,9 @@ public:
 		int nInitialX = (wratio >> 1) - ((wratio * kernel.m_nDiameter) >> 1);
 
 		float flAlphaThreshhold = (info.m_flAlphaThreshhold >= 0 ) ? 255.0f * info.m_flAlphaThreshhold : 255.0f * 0.4f;
+#ifdef IMAGE_SIMD
+		bool bSIMD = IsImageSIMDEnabled();
+#endif
 		for ( int k = 0; k < info.m_nDestDepth; ++k )
 		{
 			int startZ = dratio * k + nInitialZ;
@@ -472,7 +527,16 @@ public:
 					int startX = wratio * j + nInitialX;
 
 					float total[4];
-					ComputeAveragedColor( kernel, info, startX, startY, startZ, gammaToLinear, total );
+#ifdef IMAGE_SIMD
+					if ( bSIMD )
+					{
+						ComputeAveragedColorSIMD( kernel, info, startX, startY, startZ, gammaToLinear, total );
+					}
+					else
+#endif
+					{
+						ComputeAveragedColor( kernel, info, startX, startY, startZ, gammaToLinear, total );
+					}
 
 					// NOTE: Can't use a table here, we lose too many bits
 					if( type == KERNEL_NORMALMAP )
@@ -529,6 +593,9 @@ static ApplyKernelFunc_t g_KernelFuncNice[] =
 	ApplyKernelAlphatestNice_t::ApplyKernel,
 };
 
+// Guards the gamma table and NICE kernel cache in ResampleRGBA8888
+static CThreadFastMutex s_ResampleCacheMutex;
+
 bool ResampleRGBA8888( const ResampleInfo_t& info )
 {
 	// No resampling needed, just gamma correction
@@ -553,13 +620,21 @@ bool ResampleRGBA8888( const ResampleInfo_t& info )
 	}
 
 	// Compute gamma tables...
-	static float gammaToLinear[256];
+	// The cached table and filter kernels are shared by every caller; vtf resamples
+	// several faces and mip levels at once, so they're only touched under a lock
+	// and each call works from its own copy of the gamma table.
+	static float s_GammaToLinear[256];
 	static float lastSrcGamma = -1;
+	float gammaToLinear[256];
 
-	if (lastSrcGamma != info.m_flSrcGamma)
 	{
-		ConstructFloatGammaTable( gammaToLinear, info.m_flSrcGamma, 1.0f );
-		lastSrcGamma =  info.m_flSrcGamma;
+		AUTO_LOCK( s_ResampleCacheMutex );
+		if (lastSrcGamma != info.m_flSrcGamma)
+		{
+			ConstructFloatGammaTable( s_GammaToLinear, info.m_flSrcGamma, 1.0f );
+			lastSrcGamma =  info.m_flSrcGamma;
+		}
+		memcpy( gammaToLinear, s_GammaToLinear, sizeof( gammaToLinear ) );
 	}
 
 	int wratio = info.m_nSrcWidth / info.m_nDestWidth;
@@ -610,6 +685,7 @@ bool ResampleRGBA8888( const ResampleInfo_t& info )
 
 		if (power >= 0)
 		{
+			AUTO_LOCK( s_ResampleCacheMutex );
 			if (!kernelCache[power])
 			{
 				kernelCache[power] = new float[kernel.m_nWidth * kernel.m_nHeight];
@@ -887,6 +963,38 @@ void GenerateMipmapLevels( unsigned char* pSrc, unsigned char* pDst, int width,
 	}
 }
 
+#ifdef IMAGE_SIMD
+//-----------------------------------------------------------------------------
+// Four destination pixels of GenerateMipmapLevelsLQ at a time. Widened to 16 bits,
+// summed and shifted exactly like the scalar loop (including its truncation)
+//-----------------------------------------------------------------------------
+static int GenerateMipmapRowLQ_SIMD( const unsigned char *pSrcRow0, const unsigned char *pSrcRow1, unsigned char *pDst, int nDstWidth )
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for ( ; i + 4 <= nDstWidth; i += 4 )
+	{
+		__m128i a0 = _mm_loadu_si128( (const __m128i *)( pSrcRow0 + i * 8 ) );
+		__m128i a1 = _mm_loadu_si128( (const __m128i *)( pSrcRow0 + i * 8 + 16 ) );
+		__m128i b0 = _mm_loadu_si128( (const __m128i *)( pSrcRow1 + i * 8 ) );
+		__m128i b1 = _mm_loadu_si128( (const __m128i *)( pSrcRow1 + i * 8 + 16 ) );
+
+		// Vertical sums; each register holds a horizontal pair of source pixels
+		__m128i s0 = _mm_add_epi16( _mm_unpacklo_epi8( a0, zero ), _mm_unpacklo_epi8( b0, zero ) );
+		__m128i s1 = _mm_add_epi16( _mm_unpackhi_epi8( a0, zero ), _mm_unpackhi_epi8( b0, zero ) );
+		__m128i s2 = _mm_add_epi16( _mm_unpacklo_epi8( a1, zero ), _mm_unpacklo_epi8( b1, zero ) );
+		__m128i s3 = _mm_add_epi16( _mm_unpackhi_epi8( a1, zero ), _mm_unpackhi_epi8( b1, zero ) );
+
+		// Horizontal sums: fold the right pixel of each pair onto the left one
+		__m128i d01 = _mm_unpacklo_epi64( _mm_add_epi16( s0, _mm_srli_si128( s0, 8 ) ), _mm_add_epi16( s1, _mm_srli_si128( s1, 8 ) ) );
+		__m128i d23 = _mm_unpacklo_epi64( _mm_add_epi16( s2, _mm_srli_si128( s2, 8 ) ), _mm_add_epi16( s3, _mm_srli_si128( s3, 8 ) ) );
+
+		_mm_storeu_si128( (__m128i *)( pDst + i * 4 ), _mm_packus_epi16( _mm_srli_epi16( d01, 2 ), _mm_srli_epi16( d23, 2 ) ) );
+	}
+	return i;
+}
+#endif
+
 void GenerateMipmapLevelsLQ( unsigned char* pSrc, unsigned char* pDst, int width, int height,
 		                     ImageFormat imageFormat, int numLevels )
 {
@@ -930,9 +1038,23 @@ void GenerateMipmapLevelsLQ( unsigned char* pSrc, unsigned char* pDst, int width
 		const unsigned char* pSrcPixel = pSrcLevel;
 		unsigned char* pDstPixel = pDstLevel;
 
+#ifdef IMAGE_SIMD
+		// The SIMD rows need a real 2x2 footprint; 1 pixel wide or tall levels stay scalar
+		bool bSIMD = IsImageSIMDEnabled() && ( cSrcStride != 0 ) && ( cSrcPitch != 0 );
+#endif
+
 		for ( int j = 0; j < dstHeight; ++j )
 		{
-			for ( int i = 0; i < dstWidth; ++i ) 
+			int i = 0;
+#ifdef IMAGE_SIMD
+			if ( bSIMD )
+			{
+				i = GenerateMipmapRowLQ_SIMD( pSrcPixel, pSrcPixel + cSrcPitch, pDstPixel, dstWidth );
+				pSrcPixel += i * cStride * 2;
+				pDstPixel += i * cStride;
+			}
+#endif
+			for ( ; i < dstWidth; ++i ) 
 			{
 				// This doesn't round. It's crappy. It's a simple bilerp. 
 				pDstPixel[ 0 ] = ( ( unsigned int ) pSrcPixel[ 0 ] + ( unsigned int ) pSrcPixel[ 0 + cSrcStride ] + ( unsigned int ) pSrcPixel[ 0 + cSrcPitch ] + ( unsigned int ) pSrcPixel[ 0 + cSrcPitch + cSrcStride ] ) >> 2;
@@ -115,6 +115,7 @@ bool CGameEvent::IsReliable() const
 
 CGameEventManager::CGameEventManager()
 {
+	m_pClientEventEncoding = NULL;
 	Reset();
 }
 
@@ -388,6 +389,55 @@ void CGameEventManager::ConPrintEvent( IGameEvent *event)
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: SVC_GameEvent for the event being fired, serialized by the first
+//			client stub that asks for it
+//-----------------------------------------------------------------------------
+class CClientEventEncoding
+{
+public:
+	CClientEventEncoding( IGameEvent *event )
+	{
+		m_pEvent = event;
+		m_bSerialized = false;
+		m_bValid = false;
+	}
+
+	bool Serialize()
+	{
+		if ( !m_bSerialized )
+		{
+			m_Msg.m_DataOut.StartWriting( m_Data, sizeof( m_Data ) );
+			m_bValid = g_GameEventManager.SerializeEvent( m_pEvent, &m_Msg.m_DataOut ) && m_Encoded.Encode( m_Msg );
+			m_bSerialized = true;
+		}
+		return m_bValid;
+	}
+
+	// a listener may have changed the event's keys
+	void Invalidate() { m_bSerialized = false; }
+
+	IGameEvent		*m_pEvent;
+	char			m_Data[ MAX_EVENT_BYTES ];
+	SVC_GameEvent	m_Msg;
+	CEncodedNetMsg	m_Encoded;
+	bool			m_bSerialized;
+	bool			m_bValid;
+};
+
+bool CGameEventManager::GetClientEventEncoding( IGameEvent *event, SVC_GameEvent *&pMsg, CEncodedNetMsg *&pEncoded )
+{
+	if ( !m_pClientEventEncoding || m_pClientEventEncoding->m_pEvent != event )
+		return false;
+
+	if ( !m_pClientEventEncoding->Serialize() )
+		return false;
+
+	pMsg = &m_pClientEventEncoding->m_Msg;
+	pEncoded = &m_pClientEventEncoding->m_Encoded;
+	return true;
+}
+
 bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bool bClientOnly )
 {
 	if ( event == NULL )
@@ -424,6 +474,11 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 		}
 	}
 
+	// client stubs serialize the event once and share the bits
+	CClientEventEncoding clientEncoding( event );
+	CClientEventEncoding *pOuterEncoding = m_pClientEventEncoding;
+	m_pClientEventEncoding = &clientEncoding;
+
 	for ( int i = 0; i < descriptor->listeners.Count(); i++ )
 	{
 		CGameEventCallback *listener = descriptor->listeners.Element( i );
@@ -446,8 +501,6 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 		if ( listener->m_nListenerType == CLIENTSTUB && (bServerOnly || bClientOnly) )
 			continue;
 
-		// TODO optimized the serialize event for clients, call only once and not per client
-
 		// fire event in this listener module
 		if ( listener->m_nListenerType == CLIENTSIDE_OLD ||
 			 listener->m_nListenerType == SERVERSIDE_OLD )
@@ -469,8 +522,15 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 
 			pCallback->FireGameEvent( event );
 		}	 
+
+		if ( listener->m_nListenerType != CLIENTSTUB )
+		{
+			clientEncoding.Invalidate();
+		}
 	}
 
+	m_pClientEventEncoding = pOuterEncoding;
+
 	// free event resources
 	FreeEvent( event );
 
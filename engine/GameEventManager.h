@@ -20,7 +20,10 @@
 #include <utlsymbol.h>
 
 class SVC_GameEventList;
+class SVC_GameEvent;
 class CLC_ListenEvents;
+class CEncodedNetMsg;
+class CClientEventEncoding;
 
 class CGameEventCallback
 {
@@ -121,6 +124,9 @@ public:	// IGameEventManager functions
 	bool SerializeEvent( IGameEvent *event, bf_write *buf );
 	IGameEvent *UnserializeEvent( bf_read *buf );
 
+	// client stubs share one serialization of the event currently being fired
+	bool GetClientEventEncoding( IGameEvent *event, SVC_GameEvent *&pMsg, CEncodedNetMsg *&pEncoded );
+
 public:
 	bool Init();
 	void Shutdown();
@@ -157,6 +163,8 @@ protected:
 	CUtlVector<CUtlSymbol>				m_EventFileNames; 
 
 	bool	m_bClientListenersChanged;	// true every time client changed listeners
+
+	CClientEventEncoding	*m_pClientEventEncoding;	// event being fired, see GetClientEventEncoding
 };
 
 extern CGameEventManager &g_GameEventManager;
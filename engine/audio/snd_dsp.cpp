@@ -14,6 +14,9 @@
 #include "iprediction.h"
 #include "common.h"		// for parsing routines
 #include "vstdlib/random.h"
+#include "tier1/kernelbenchmark.h"
+#include "snd_simd.h"
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -1712,6 +1715,285 @@ inline int DLY_GetNextXfade ( dly_t *pdly, int x )
 	}		
 }
 
+///////////////////////////////////////////////////////////////////////////////////
+// Block processing for delay lines
+//
+// A delay line whose shortest tap is >= N never reads a sample written during
+// the last N samples, so N input samples can be run through it at once: gather
+// the taps for the whole block, do the per-sample arithmetic with SSE2/NEON,
+// then write the block back into the circular buffer.  Recursive filters in the
+// feedback path still run per sample over the gathered taps.  All arithmetic
+// stays in PBITS fixed point, so results are identical to DLY_GetNext.
+///////////////////////////////////////////////////////////////////////////////////
+
+#define DLY_BLOCK_MAX		256			// max samples per block, multiple of 4
+#define DLY_BLOCK_MIN		8			// delays with shorter taps use the per-sample path
+
+ConVar dsp_simd( "dsp_simd", "1", FCVAR_ALLOWED_IN_COMPETITIVE, "Run room dsp delays, reverbs and diffusors in SSE2/NEON blocks." );
+
+#ifdef SND_SIMD
+
+// -1 follows dsp_simd, 0/1 forces per-sample/block processing (used by dsp_benchmark)
+static int s_nDspSIMDOverride = -1;
+
+inline bool DSP_UseSIMD()
+{
+	return SND_UseSIMD( dsp_simd, s_nDspSIMDOverride );
+}
+
+// (x * g) >> PBITS for 4 lanes
+static FORCEINLINE __m128i DSP_MulGain( __m128i x, __m128i g )
+{
+	return _mm_srai_epi32( SND_MulLo32( x, g ), PBITS );
+}
+
+#define DSP_LOAD( p )		_mm_loadu_si128( (const __m128i *)(p) )
+#define DSP_STORE( p, v )	_mm_storeu_si128( (__m128i *)(p), (v) )
+
+// round count up to the SIMD width; block arrays are padded with zeros to this size
+inline int DSP_BlockPad( int count ) { return ( count + 3 ) & ~3; }
+
+// copy one channel of pbuffer into a zero padded block
+inline void DSP_LoadBlock( const portable_samplepair_t *pb, int count, int op, int *pdest )
+{
+	if ( op == OP_RIGHT )
+	{
+		for ( int k = 0; k < count; k++ )
+			pdest[k] = pb[k].right;
+	}
+	else
+	{
+		for ( int k = 0; k < count; k++ )
+			pdest[k] = pb[k].left;
+	}
+
+	for ( int k = count; k < DSP_BlockPad( count ); k++ )
+		pdest[k] = 0;
+}
+
+inline void DSP_StoreBlock( portable_samplepair_t *pb, int count, int op, const int *psrc )
+{
+	switch ( op )
+	{
+	default:
+	case OP_LEFT:
+		for ( int k = 0; k < count; k++ )
+			pb[k].left = psrc[k];
+		return;
+	case OP_RIGHT:
+		for ( int k = 0; k < count; k++ )
+			pb[k].right = psrc[k];
+		return;
+	case OP_LEFT_DUPLICATE:
+		for ( int k = 0; k < count; k++ )
+			pb[k].left = pb[k].right = psrc[k];
+		return;
+	}
+}
+
+// index of tap t relative to circular buffer index i, as in GetDly
+
+inline int DLY_TapIndex( int D, int i, int t )
+{
+	i += t;
+	return ( i > D ) ? i - D - 1 : i;
+}
+
+// pdest[k] = w[start - k] for k = 0..count-1, wrapping from w[0] to w[D], zero padded
+
+static void DLY_GatherReverse( const int *w, int D, int start, int count, int *pdest )
+{
+	int padded = DSP_BlockPad( count );
+
+	while ( count > 0 )
+	{
+		int run = min( count, start + 1 );
+		const int *psrc = w + start;
+		int k = 0;
+
+		for ( ; k + 4 <= run; k += 4 )
+		{
+			__m128i v = DSP_LOAD( psrc - k - 3 );
+			DSP_STORE( pdest + k, _mm_shuffle_epi32( v, _MM_SHUFFLE( 0, 1, 2, 3 ) ) );
+		}
+		for ( ; k < run; k++ )
+			pdest[k] = psrc[-k];
+
+		pdest += run;
+		padded -= run;
+		count -= run;
+		start = D;
+	}
+
+	for ( int k = 0; k < padded; k++ )
+		pdest[k] = 0;
+}
+
+// w[start - k] = psrc[k] for k = 0..count-1, wrapping from w[0] to w[D]
+
+static void DLY_ScatterReverse( int *w, int D, int start, int count, const int *psrc )
+{
+	while ( count > 0 )
+	{
+		int run = min( count, start + 1 );
+		int *pdest = w + start;
+		int k = 0;
+
+		for ( ; k + 4 <= run; k += 4 )
+		{
+			__m128i v = DSP_LOAD( psrc + k );
+			DSP_STORE( pdest - k - 3, _mm_shuffle_epi32( v, _MM_SHUFFLE( 0, 1, 2, 3 ) ) );
+		}
+		for ( ; k < run; k++ )
+			pdest[-k] = psrc[k];
+
+		psrc += run;
+		count -= run;
+		start = D;
+	}
+}
+
+// largest block pdly can process without reading its own output
+
+inline int DLY_BlockLimit( const dly_t *pdly )
+{
+	int t = pdly->t;
+
+	if ( DLY_HAS_MULTITAP( pdly->type ) )
+		t = min( min( t, pdly->t1 ), min( pdly->t2, pdly->t3 ) );
+
+	return min( t, DLY_BLOCK_MAX );
+}
+
+// run count samples from pin through pdly, storing or adding (bAccumulate) output to pout.
+// pin and pout are zero padded block arrays and may be the same array.
+// count must be <= DLY_BlockLimit( pdly ).
+
+static void DLY_ProcessBlock( dly_t *pdly, const int *pin, int *pout, int count, bool bAccumulate )
+{
+	int sD[DLY_BLOCK_MAX];			// delay output at the (last) feedback tap
+	int sFb[DLY_BLOCK_MAX];			// filtered feedback for lowpass delays
+	int sSum[DLY_BLOCK_MAX];		// sum of the other three taps for multitap delays
+	int s0[DLY_BLOCK_MAX];			// values written back into the delay
+
+	Assert( count <= DLY_BlockLimit( pdly ) );
+
+	int *w = pdly->w;
+	int D = pdly->D;
+	int i = pdly->p - w;
+	int type = pdly->type;
+	int padded = DSP_BlockPad( count );
+	bool bMultitap = DLY_HAS_MULTITAP( type );
+
+	DLY_GatherReverse( w, D, DLY_TapIndex( D, i, bMultitap ? pdly->t3 : pdly->t ), count, sD );
+
+	if ( bMultitap )
+	{
+		int tap[DLY_BLOCK_MAX];
+
+		DLY_GatherReverse( w, D, DLY_TapIndex( D, i, pdly->t ), count, sSum );
+		DLY_GatherReverse( w, D, DLY_TapIndex( D, i, pdly->t1 ), count, tap );
+		for ( int k = 0; k < padded; k += 4 )
+			DSP_STORE( sSum + k, _mm_add_epi32( DSP_LOAD( sSum + k ), DSP_LOAD( tap + k ) ) );
+
+		DLY_GatherReverse( w, D, DLY_TapIndex( D, i, pdly->t2 ), count, tap );
+		for ( int k = 0; k < padded; k += 4 )
+			DSP_STORE( sSum + k, _mm_add_epi32( DSP_LOAD( sSum + k ), DSP_LOAD( tap + k ) ) );
+	}
+
+	if ( DLY_HAS_FILTER( type ) )
+	{
+		// recursive - stays per sample
+		flt_t *pflt = pdly->pflt;
+
+		for ( int k = 0; k < count; k++ )
+			sFb[k] = IIRFilter_Update_Order1( pflt->a, pflt->L, pflt->b, pflt->w, sD[k] );
+		for ( int k = count; k < padded; k++ )
+			sFb[k] = 0;
+	}
+
+	__m128i a = _mm_set1_epi32( pdly->a );
+	__m128i b = _mm_set1_epi32( pdly->b );
+
+	for ( int k = 0; k < padded; k += 4 )
+	{
+		__m128i in = DSP_LOAD( pin + k );
+		__m128i d = DSP_LOAD( sD + k );
+		__m128i s, out;
+
+		switch ( type )
+		{
+		default:
+		case DLY_PLAIN:
+			s = _mm_add_epi32( in, DSP_MulGain( d, a ) );
+			out = DSP_MulGain( s, b );
+			break;
+		case DLY_ALLPASS:
+			s = _mm_add_epi32( in, DSP_MulGain( d, a ) );
+			out = DSP_MulGain( _mm_add_epi32( DSP_MulGain( s, _mm_sub_epi32( _mm_setzero_si128(), a ) ), d ), b );
+			break;
+		case DLY_LOWPASS:
+			s = _mm_add_epi32( in, DSP_LOAD( sFb + k ) );
+			out = DSP_MulGain( s, b );
+			break;
+		case DLY_LINEAR:
+			s = in;
+			out = d;
+			break;
+		case DLY_FLINEAR:
+			s = in;
+			out = DSP_MulGain( DSP_LOAD( sFb + k ), b );
+			break;
+		case DLY_PLAIN_4TAP:
+			s = _mm_add_epi32( in, DSP_MulGain( d, a ) );
+			out = DSP_MulGain( _mm_add_epi32( _mm_add_epi32( DSP_LOAD( sSum + k ), d ), in ), b );
+			break;
+		case DLY_LOWPASS_4TAP:
+			s = _mm_add_epi32( in, DSP_LOAD( sFb + k ) );
+			out = DSP_MulGain( _mm_add_epi32( _mm_add_epi32( DSP_LOAD( sSum + k ), d ), in ), b );
+			break;
+		}
+
+		DSP_STORE( s0 + k, s );
+
+		if ( bAccumulate )
+			out = _mm_add_epi32( out, DSP_LOAD( pout + k ) );
+		DSP_STORE( pout + k, out );
+	}
+
+	DLY_ScatterReverse( w, D, i, count, s0 );
+
+	// advance the circular pointer count samples, as DlyUpdate does per sample
+
+	i -= count;
+	if ( i < 0 )
+		i += D + 1;
+	pdly->p = w + i;
+}
+
+// block version of DLY_GetNextN. returns false if the delay's taps are too short for blocks.
+
+static bool DLY_GetNextN_Block( dly_t *pdly, portable_samplepair_t *pbuffer, int SampleCount, int op )
+{
+	int limit = DLY_BlockLimit( pdly );
+	if ( limit < DLY_BLOCK_MIN )
+		return false;
+
+	int block[DLY_BLOCK_MAX];
+
+	for ( int start = 0; start < SampleCount; start += limit )
+	{
+		int count = min( limit, SampleCount - start );
+
+		DSP_LoadBlock( pbuffer + start, count, op, block );
+		DLY_ProcessBlock( pdly, block, block, count, false );
+		DSP_StoreBlock( pbuffer + start, count, op, block );
+	}
+	return true;
+}
+
+#endif // SND_SIMD
+
 // batch version for performance
 // UNDONE: a) unwind this more - pb increments by 2 to avoid pb->left or pb->right deref.
 // UNDONE: b) all filter and delay params are dereferenced outside of DLY_GetNext and passed as register values
@@ -1721,6 +2003,11 @@ inline void DLY_GetNextN( dly_t *pdly, portable_samplepair_t *pbuffer, int Sampl
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
+
+#ifdef SND_SIMD
+	if ( DSP_UseSIMD() && DLY_GetNextN_Block( pdly, pbuffer, SampleCount, op ) )
+		return;
+#endif
 	
 	switch (op)
 	{
@@ -2546,6 +2833,48 @@ inline int RVA_GetNext( rva_t *prva, int x )
 }
 
 
+#ifdef SND_SIMD
+
+// block version of RVA_GetNextN: every parallel delay runs over the block, then the series filter.
+// returns false if mod delays are in use or any delay's taps are too short for blocks.
+
+static bool RVA_GetNextN_Block( rva_t *prva, portable_samplepair_t *pbuffer, int SampleCount, int op )
+{
+	if ( prva->fmoddly )
+		return false;
+
+	int limit = DLY_BLOCK_MAX;
+	for ( int i = 0; i < prva->m; i++ )
+		limit = min( limit, DLY_BlockLimit( prva->pdlys[i] ) );
+
+	if ( limit < DLY_BLOCK_MIN )
+		return false;
+
+	int in[DLY_BLOCK_MAX];
+	int y[DLY_BLOCK_MAX];
+
+	for ( int start = 0; start < SampleCount; start += limit )
+	{
+		int count = min( limit, SampleCount - start );
+
+		DSP_LoadBlock( pbuffer + start, count, op, in );
+
+		for ( int i = 0; i < prva->m; i++ )
+			DLY_ProcessBlock( prva->pdlys[i], in, y, count, i > 0 );
+
+		if ( !prva->fparallel && prva->pflt )
+		{
+			for ( int k = 0; k < count; k++ )
+				y[k] = FLT_GetNext( prva->pflt, y[k] );
+		}
+
+		DSP_StoreBlock( pbuffer + start, count, op, y );
+	}
+	return true;
+}
+
+#endif // SND_SIMD
+
 // batch version for performance
 // UNDONE: unwind RVA_GetNextN so that it directly calls DLY_GetNextN or MDY_GetNextN
 
@@ -2553,6 +2882,11 @@ inline void RVA_GetNextN( rva_t *prva, portable_samplepair_t *pbuffer, int Sampl
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
+
+#ifdef SND_SIMD
+	if ( DSP_UseSIMD() && RVA_GetNextN_Block( prva, pbuffer, SampleCount, op ) )
+		return;
+#endif
 	
 	switch (op)
 	{
@@ -3051,12 +3385,49 @@ inline int DFR_GetNext( dfr_t *pdfr, int x )
 	return y;
 }
 
+#ifdef SND_SIMD
+
+// block version of DFR_GetNextN: each series allpass stage runs over the whole block in turn.
+// returns false if any delay's taps are too short for blocks.
+
+static bool DFR_GetNextN_Block( dfr_t *pdfr, portable_samplepair_t *pbuffer, int SampleCount, int op )
+{
+	int limit = DLY_BLOCK_MAX;
+	for ( int i = 0; i < pdfr->n; i++ )
+		limit = min( limit, DLY_BlockLimit( pdfr->pdlys[i] ) );
+
+	if ( limit < DLY_BLOCK_MIN )
+		return false;
+
+	int block[DLY_BLOCK_MAX];
+
+	for ( int start = 0; start < SampleCount; start += limit )
+	{
+		int count = min( limit, SampleCount - start );
+
+		DSP_LoadBlock( pbuffer + start, count, op, block );
+
+		for ( int i = 0; i < pdfr->n; i++ )
+			DLY_ProcessBlock( pdfr->pdlys[i], block, block, count, false );
+
+		DSP_StoreBlock( pbuffer + start, count, op, block );
+	}
+	return true;
+}
+
+#endif // SND_SIMD
+
 // batch version for performance
 
 inline void DFR_GetNextN( dfr_t *pdfr, portable_samplepair_t *pbuffer, int SampleCount, int op )
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
+
+#ifdef SND_SIMD
+	if ( DSP_UseSIMD() && DFR_GetNextN_Block( pdfr, pbuffer, SampleCount, op ) )
+		return;
+#endif
 	
 	switch (op)
 	{
@@ -8646,6 +9017,62 @@ bool DSP_RoomDSPIsOff()
 	return DSP_PresetIsOff( Get_idsp_room() );
 }
 
+//-----------------------------------------------------------------------------
+// Per preset cost of DSP_Process, shown by dsp_cost
+//-----------------------------------------------------------------------------
+#define DSP_COST_PRESETS	256
+
+struct dsp_cost_t
+{
+	double	flSeconds;
+	int64	nSamples;
+	int		nCalls;
+};
+
+static dsp_cost_t g_DspPresetCost[DSP_COST_PRESETS];
+
+class CDspCostScope
+{
+public:
+	CDspCostScope( int ipset, int sampleCount ) : m_ipset( ipset ), m_nSamples( sampleCount ), m_flStart( Plat_FloatTime() ) {}
+	~CDspCostScope()
+	{
+		if ( m_ipset < 0 || m_ipset >= DSP_COST_PRESETS )
+			return;
+
+		dsp_cost_t &cost = g_DspPresetCost[m_ipset];
+		cost.flSeconds += Plat_FloatTime() - m_flStart;
+		cost.nSamples += m_nSamples;
+		cost.nCalls++;
+	}
+
+private:
+	int		m_ipset;
+	int		m_nSamples;
+	double	m_flStart;
+};
+
+CON_COMMAND( dsp_cost, "Show time spent processing each dsp preset: dsp_cost [reset]" )
+{
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		V_memset( g_DspPresetCost, 0, sizeof( g_DspPresetCost ) );
+		ConMsg( "dsp_cost: reset\n" );
+		return;
+	}
+
+	ConMsg( "preset    calls      samples   total ms  us/1k samples\n" );
+	for ( int i = 0; i < DSP_COST_PRESETS; i++ )
+	{
+		const dsp_cost_t &cost = g_DspPresetCost[i];
+		if ( !cost.nCalls )
+			continue;
+
+		ConMsg( "%6d %8d %12lld %10.2f %14.2f\n", i, cost.nCalls, (long long)cost.nSamples, cost.flSeconds * 1000.0,
+			cost.nSamples ? cost.flSeconds * 1e9 / (double)cost.nSamples : 0.0 );
+	}
+}
+
 // Main DSP processing routine:
 // process samples in buffers using pdsp processor
 // continue crossfade between 2 dsp processors if crossfading on switch
@@ -8702,6 +9129,8 @@ void DSP_Process( int idsp, portable_samplepair_t *pbfront, portable_samplepair_
 	if ( !pdsp->ipset && !pdsp->ipsetprev )
 		return;
 
+	CDspCostScope costScope( pdsp->ipset ? pdsp->ipset : pdsp->ipsetprev, sampleCount );
+
 	cchan_in = (pbrear ? 4 : 2) + (pbcenter ? 1 : 0);
 	cprocs = pdsp->cchan;
 
@@ -8793,6 +9222,157 @@ void DSP_Process( int idsp, portable_samplepair_t *pbfront, portable_samplepair_
 
 }
 
+//-----------------------------------------------------------------------------
+// Runs one preset over synthetic input, per-sample (mode 0) and in blocks
+// (mode 1). One iteration processes one paintbuffer.
+//-----------------------------------------------------------------------------
+class CDspBenchmark : public CKernelBenchmark< portable_samplepair_t >
+{
+public:
+	CDspBenchmark( int nBlocks ) : CKernelBenchmark< portable_samplepair_t >( 1 ), m_nPreset( 0 ), m_pPreset( NULL )
+	{
+		m_Input.SetCount( nBlocks * PAINTBUFFER_SIZE );
+		for ( int i = 0; i < m_Input.Count(); i++ )
+		{
+			m_Input[i].left = m_Input[i].right = m_Random.RandomInt( -16384, 16383 );
+		}
+	}
+
+	void SetPreset( int ipset ) { m_nPreset = ipset; }
+	int GetSampleCount() const { return m_Input.Count(); }
+
+	// largest difference between the per-sample and block output
+	int GetMaxDiff() const
+	{
+		int nMaxDiff = 0;
+		for ( int i = 0; i < m_Input.Count(); i++ )
+		{
+			nMaxDiff = max( nMaxDiff, abs( m_Output[0][i].left - m_Output[1][i].left ) );
+		}
+		return nMaxDiff;
+	}
+
+protected:
+	virtual bool BeginMode( int nMode )
+	{
+#ifdef SND_SIMD
+		s_nDspSIMDOverride = nMode;
+#endif
+		// presets with random modulation must see the same sequence in both modes
+		RandomSeed( 1 );
+
+		m_pPreset = PSET_Alloc( m_nPreset );
+		if ( !m_pPreset )
+			return false;
+
+		m_Output[nMode].CopyArray( m_Input.Base(), m_Input.Count() );
+		return true;
+	}
+
+	virtual void RunIteration( int nMode, int nBlock )
+	{
+		portable_samplepair_t *pbuf = m_Output[nMode].Base() + nBlock * PAINTBUFFER_SIZE;
+
+		if ( FBatchPreset( m_pPreset ) )
+		{
+			PSET_GetNextN( m_pPreset, pbuf, PAINTBUFFER_SIZE, OP_LEFT_DUPLICATE );
+		}
+		else
+		{
+			for ( int k = 0; k < PAINTBUFFER_SIZE; k++ )
+				pbuf[k].left = pbuf[k].right = PSET_GetNext( m_pPreset, pbuf[k].left );
+		}
+	}
+
+	virtual void EndMode( int nMode )
+	{
+		PSET_Free( m_pPreset );
+		m_pPreset = NULL;
+	}
+
+private:
+	CUtlVector< portable_samplepair_t > m_Input;
+	int m_nPreset;
+	pset_t *m_pPreset;
+};
+
+//-----------------------------------------------------------------------------
+// Runs every preset over the same synthetic input with per-sample and block
+// processing, and reports the cost of each and the largest output difference.
+// Does not need an active sound device.
+//-----------------------------------------------------------------------------
+CON_COMMAND( dsp_benchmark, "Benchmark all dsp presets: dsp_benchmark [seconds of audio per preset]" )
+{
+	float flSeconds = ( args.ArgC() > 1 ) ? clamp( (float)atof( args[1] ), 0.1f, 60.0f ) : 2.0f;
+	int nBlocks = max( 1, (int)( SEC_TO_SAMPS( flSeconds ) / PAINTBUFFER_SIZE ) );
+
+	if ( !g_psettemplates || g_cpsettemplates < 2 )
+	{
+		ConMsg( "dsp_benchmark: no dsp presets loaded\n" );
+		return;
+	}
+
+	// the preset and processor pools are shared with the mixer
+	extern CThreadMutex g_SndMutex;
+	AUTO_LOCK( g_SndMutex );
+
+	int nModes = 1;
+#ifdef SND_SIMD
+	if ( SND_CPUSupportsSIMD() )
+	{
+		nModes = 2;
+	}
+#endif
+
+	CDspBenchmark benchmark( nBlocks );
+	double flTotal[2] = { 0, 0 };
+	int nMismatched = 0;
+
+	ConMsg( "dsp_benchmark: %d samples per preset\n", benchmark.GetSampleCount() );
+	ConMsg( "preset  per-sample ms   block ms  speedup  max diff\n" );
+
+	for ( int ipset = 1; ipset < g_cpsettemplates; ipset++ )
+	{
+		benchmark.SetPreset( ipset );
+		if ( !benchmark.Run( nModes, nBlocks ) )
+		{
+			ConMsg( "%6d  failed to allocate\n", ipset );
+			continue;
+		}
+
+		flTotal[0] += benchmark.GetTime( 0 );
+		if ( nModes < 2 )
+		{
+			ConMsg( "%6d %14.2f\n", ipset, benchmark.GetTime( 0 ) * 1000.0 );
+			continue;
+		}
+
+		flTotal[1] += benchmark.GetTime( 1 );
+
+		int nMaxDiff = benchmark.GetMaxDiff();
+		if ( nMaxDiff )
+		{
+			nMismatched++;
+		}
+
+		ConMsg( "%6d %14.2f %10.2f %7.2fx %9d\n", ipset, benchmark.GetTime( 0 ) * 1000.0, benchmark.GetTime( 1 ) * 1000.0,
+			benchmark.GetSpeedup(), nMaxDiff );
+	}
+
+#ifdef SND_SIMD
+	s_nDspSIMDOverride = -1;
+#endif
+
+	if ( nModes < 2 )
+	{
+		ConMsg( " total %14.2f (block processing not available on this CPU/build)\n", flTotal[0] * 1000.0 );
+		return;
+	}
+
+	ConMsg( " total %14.2f %10.2f %7.2fx, %d preset(s) differ\n", flTotal[0] * 1000.0, flTotal[1] * 1000.0,
+		flTotal[1] > 0 ? flTotal[0] / flTotal[1] : 0.0, nMismatched );
+}
+
 // DSP helpers
 
 // free all dsp processors 
@@ -13,6 +13,9 @@
 #include "sys_dll.h"
 #include "video/ivideoservices.h"
 #include "engine/IEngineSound.h"
+#include "vstdlib/random.h"
+#include "tier1/kernelbenchmark.h"
+#include "snd_simd.h"
 
 #if defined( REPLAY_ENABLED )
 #include "demo.h"
@@ -134,6 +137,159 @@ bool DSP_CheckDspAutoEnabled( void );
 
 void MIX_ScalePaintBuffer( int bufferIndex, int count, float fgain );
 
+//===============================================================================
+// SIMD MIXING KERNELS
+//
+// SSE2 (or NEON through sse2neon) versions of the integer inner loops.  They
+// produce exactly the same results as the scalar loops they replace: volumes
+// are clamped to [0,255] before mixing, so the 16x16 bit products used here
+// never lose bits.  snd_mix_simd 0 forces the scalar paths for comparison.
+//===============================================================================
+
+ConVar snd_mix_simd( "snd_mix_simd", "1", FCVAR_ALLOWED_IN_COMPETITIVE, "Use SSE2/NEON kernels for paintbuffer mixing, scaling and upsampling." );
+
+#ifdef SND_SIMD
+
+// -1 follows snd_mix_simd, 0/1 forces scalar/SIMD (used by snd_mix_benchmark)
+static int s_nMixSIMDOverride = -1;
+
+static inline bool MIX_UseSIMD()
+{
+	return SND_UseSIMD( snd_mix_simd, s_nMixSIMDOverride );
+}
+
+// add (samples * vol) >> shift to 4 output sample pairs.
+// samples16: s0l,s0r,s1l,s1r,s2l,s2r,s3l,s3r; vol16: l,r,l,r,l,r,l,r
+static FORCEINLINE void MIX_AccumulateProducts4( portable_samplepair_t *pOutput, __m128i samples16, __m128i vol16, int shift )
+{
+	__m128i lo = _mm_mullo_epi16( samples16, vol16 );
+	__m128i hi = _mm_mulhi_epi16( samples16, vol16 );
+	__m128i count = _mm_cvtsi32_si128( shift );
+	__m128i p01 = _mm_sra_epi32( _mm_unpacklo_epi16( lo, hi ), count );
+	__m128i p23 = _mm_sra_epi32( _mm_unpackhi_epi16( lo, hi ), count );
+
+	__m128i *pOut = (__m128i *)pOutput;
+	_mm_storeu_si128( pOut,		_mm_add_epi32( _mm_loadu_si128( pOut ), p01 ) );
+	_mm_storeu_si128( pOut + 1, _mm_add_epi32( _mm_loadu_si128( pOut + 1 ), p23 ) );
+}
+
+static FORCEINLINE __m128i MIX_VolumePair16( int left, int right )
+{
+	return _mm_set_epi16( (short)right, (short)left, (short)right, (short)left, (short)right, (short)left, (short)right, (short)left );
+}
+
+// sign extend the low/high 8 bytes of a vector to 16 bits
+static FORCEINLINE __m128i MIX_Widen8Lo( __m128i v ) { return _mm_srai_epi16( _mm_unpacklo_epi8( v, v ), 8 ); }
+static FORCEINLINE __m128i MIX_Widen8Hi( __m128i v ) { return _mm_srai_epi16( _mm_unpackhi_epi8( v, v ), 8 ); }
+
+// 8 bit mono, no pitch shift.  Returns number of samples mixed (a multiple of 16).
+// snd_scaletable[vol>>1][j] == (signed char)j * ((vol>>1)<<1), computed directly here.
+static int MIX_PaintMono8_SIMD( portable_samplepair_t *pOutput, const int *volume, const byte *pData, int count )
+{
+	int lscale = ( volume[0] >> SND_SCALE_SHIFT ) << SND_SCALE_SHIFT;
+	int rscale = ( volume[1] >> SND_SCALE_SHIFT ) << SND_SCALE_SHIFT;
+	__m128i vol16 = MIX_VolumePair16( lscale, rscale );
+
+	int i = 0;
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		__m128i raw = _mm_loadu_si128( (const __m128i *)( pData + i ) );
+		__m128i s07 = MIX_Widen8Lo( raw );
+		__m128i s8f = MIX_Widen8Hi( raw );
+
+		MIX_AccumulateProducts4( pOutput + i,		_mm_unpacklo_epi16( s07, s07 ), vol16, 0 );
+		MIX_AccumulateProducts4( pOutput + i + 4,	_mm_unpackhi_epi16( s07, s07 ), vol16, 0 );
+		MIX_AccumulateProducts4( pOutput + i + 8,	_mm_unpacklo_epi16( s8f, s8f ), vol16, 0 );
+		MIX_AccumulateProducts4( pOutput + i + 12,	_mm_unpackhi_epi16( s8f, s8f ), vol16, 0 );
+	}
+	return i;
+}
+
+// 8 bit stereo (interleaved l/r), no pitch shift.  Returns number of sample pairs mixed.
+static int MIX_PaintStereo8_SIMD( portable_samplepair_t *pOutput, const int *volume, const byte *pData, int count )
+{
+	int lscale = ( volume[0] >> SND_SCALE_SHIFT ) << SND_SCALE_SHIFT;
+	int rscale = ( volume[1] >> SND_SCALE_SHIFT ) << SND_SCALE_SHIFT;
+	__m128i vol16 = MIX_VolumePair16( lscale, rscale );
+
+	int i = 0;
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i raw = _mm_loadu_si128( (const __m128i *)( pData + i * 2 ) );
+		MIX_AccumulateProducts4( pOutput + i,		MIX_Widen8Lo( raw ), vol16, 0 );
+		MIX_AccumulateProducts4( pOutput + i + 4,	MIX_Widen8Hi( raw ), vol16, 0 );
+	}
+	return i;
+}
+
+// 16 bit mono, no pitch shift.  Returns number of samples mixed.
+static int MIX_PaintMono16_SIMD( portable_samplepair_t *pOutput, const int *volume, const short *pData, int count )
+{
+	__m128i vol16 = MIX_VolumePair16( volume[0], volume[1] );
+
+	int i = 0;
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i s = _mm_loadu_si128( (const __m128i *)( pData + i ) );
+		MIX_AccumulateProducts4( pOutput + i,		_mm_unpacklo_epi16( s, s ), vol16, 8 );
+		MIX_AccumulateProducts4( pOutput + i + 4,	_mm_unpackhi_epi16( s, s ), vol16, 8 );
+	}
+	return i;
+}
+
+// 16 bit stereo (interleaved l/r), no pitch shift.  Returns number of sample pairs mixed.
+static int MIX_PaintStereo16_SIMD( portable_samplepair_t *pOutput, const int *volume, const short *pData, int count )
+{
+	__m128i vol16 = MIX_VolumePair16( volume[0], volume[1] );
+
+	int i = 0;
+	for ( ; i + 4 <= count; i += 4 )
+	{
+		__m128i s = _mm_loadu_si128( (const __m128i *)( pData + i * 2 ) );
+		MIX_AccumulateProducts4( pOutput + i, s, vol16, 8 );
+	}
+	return i;
+}
+
+// pbuf[i] = (pbuf[i] * gain) >> 8 for left and right.  Returns number of sample pairs scaled.
+static int MIX_ScaleSamplePairs_SIMD( portable_samplepair_t *pbuf, int count, int gain )
+{
+	__m128i vgain = _mm_set1_epi32( gain );
+	__m128i *p = (__m128i *)pbuf;
+
+	int i = 0;
+	for ( ; i + 4 <= count; i += 4, p += 2 )
+	{
+		__m128i a = _mm_loadu_si128( p );
+		__m128i b = _mm_loadu_si128( p + 1 );
+		_mm_storeu_si128( p,		_mm_srai_epi32( SND_MulLo32( a, vgain ), 8 ) );
+		_mm_storeu_si128( p + 1,	_mm_srai_epi32( SND_MulLo32( b, vgain ), 8 ) );
+	}
+	return i;
+}
+
+// in place 2x linear upsample of pbuffer[0..count-1], written back to front two
+// input samples at a time: out[2k+1] = in[k], out[2k] = (in[k-1] + in[k]) >> 1.
+// Returns the highest input index still to be processed (0 or 1).
+static int MIX_Interpolate2xLinear_SIMD( portable_samplepair_t *pbuffer, int count )
+{
+	int k = count - 1;
+	for ( ; k >= 2; k -= 2 )
+	{
+		// cur = in[k-1], in[k]; prev = in[k-2], in[k-1]
+		__m128i cur = _mm_loadu_si128( (const __m128i *)&pbuffer[k - 1] );
+		__m128i prev = _mm_loadu_si128( (const __m128i *)&pbuffer[k - 2] );
+		__m128i avg = _mm_srai_epi32( _mm_add_epi32( cur, prev ), 1 );
+
+		// out[2k-2..2k+1] = avg(k-1), in[k-1], avg(k), in[k]; never overlaps unread input for k >= 2
+		_mm_storeu_si128( (__m128i *)&pbuffer[2 * k],		_mm_unpackhi_epi64( avg, cur ) );
+		_mm_storeu_si128( (__m128i *)&pbuffer[2 * k - 2],	_mm_unpacklo_epi64( avg, cur ) );
+	}
+	return k;
+}
+
+#endif // SND_SIMD
+
 bool IsReplayRendering()
 {
 #if defined( REPLAY_ENABLED )
@@ -751,6 +907,25 @@ void S_Interpolate2xLinear_2( int count, portable_samplepair_t *pbuffer, portabl
 {
 	Assert (cfltmem >= 1);
 
+#ifdef SND_SIMD
+	if ( MIX_UseSIMD() )
+	{
+		int end = (count*2)-1;
+		int k = MIX_Interpolate2xLinear_SIMD( pbuffer, count );
+		for ( ; k >= 1; k-- )
+		{
+			pbuffer[2*k+1] = pbuffer[k];
+			pbuffer[2*k].left = (pbuffer[k-1].left + pbuffer[k].left) >> 1;
+			pbuffer[2*k].right = (pbuffer[k-1].right + pbuffer[k].right) >> 1;
+		}
+		pbuffer[1] = pbuffer[0];
+		pbuffer[0].left = (pfiltermem->left + pbuffer[1].left) >> 1;
+		pbuffer[0].right = (pfiltermem->right + pbuffer[1].right) >> 1;
+		*pfiltermem = pbuffer[end];
+		return;
+	}
+#endif
+
 	int sample = count-1;
 	int end = (count*2)-1;
 	portable_samplepair_t *pwrite = &pbuffer[end];
@@ -1605,6 +1780,24 @@ gain5ch:
 	return;
 }
 
+// scale left and right of count sample pairs by gain/256
+
+static void MIX_ScaleSamplePairs( portable_samplepair_t *pbuf, int count, int gain )
+{
+	int i = 0;
+#ifdef SND_SIMD
+	if ( MIX_UseSIMD() )
+	{
+		i = MIX_ScaleSamplePairs_SIMD( pbuf, count, gain );
+	}
+#endif
+	for ( ; i < count; i++ )
+	{
+		pbuf[i].left  = (pbuf[i].left * gain) >> 8;
+		pbuf[i].right = (pbuf[i].right * gain) >> 8;
+	}
+}
+
 // multiply all values in paintbuffer by fgain
 
 void MIX_ScalePaintBuffer( int bufferIndex, int count, float fgain )
@@ -1619,23 +1812,11 @@ void MIX_ScalePaintBuffer( int bufferIndex, int count, float fgain )
 	if (gain == 256)
 		return;
 
-	if ( !g_paintBuffers[bufferIndex].fsurround )
-	{
-		for (i = 0; i < count; i++)
-		{
-			pbuf[i].left  = (pbuf[i].left * gain) >> 8;
-			pbuf[i].right = (pbuf[i].right * gain) >> 8;
-		}
-	}
-	else
+	MIX_ScaleSamplePairs( pbuf, count, gain );
+
+	if ( g_paintBuffers[bufferIndex].fsurround )
 	{
-		for (i = 0; i < count; i++)
-		{
-			pbuf[i].left  = (pbuf[i].left * gain) >> 8;
-			pbuf[i].right = (pbuf[i].right * gain) >> 8;
-			pbufrear[i].left  = (pbufrear[i].left * gain) >> 8;
-			pbufrear[i].right = (pbufrear[i].right * gain) >> 8;
-		}
+		MIX_ScaleSamplePairs( pbufrear, count, gain );
 
 		if (g_paintBuffers[bufferIndex].fsurround_center)
 		{
@@ -2768,6 +2949,18 @@ void SND_InitScaletable (void)
 
 void SND_PaintChannelFrom8(portable_samplepair_t *pOutput, int *volume, byte *pData8, int count)
 {
+#ifdef SND_SIMD
+	if ( MIX_UseSIMD() )
+	{
+		int done = MIX_PaintMono8_SIMD( pOutput, volume, pData8, count );
+		pOutput += done;
+		pData8 += done;
+		count -= done;
+		if ( !count )
+			return;
+	}
+#endif
+
 #if	!id386
 	int 	data;
 	int		*lscale, *rscale;
@@ -3530,11 +3723,20 @@ void SW_Mix8Stereo( portable_samplepair_t *pOutput, int *volume, byte *pData, in
 	int sampleIndex = 0;
 	fixedint sampleFrac = inputOffset;
 	int		*lscale, *rscale;
+	int		i = 0;
 
 	lscale = snd_scaletable[volume[0] >> SND_SCALE_SHIFT];
 	rscale = snd_scaletable[volume[1] >> SND_SCALE_SHIFT];
 
-	for ( int i = 0; i < outCount; i++ )
+#ifdef SND_SIMD
+	if ( rateScaleFix == FIX(1) && MIX_UseSIMD() )
+	{
+		i = MIX_PaintStereo8_SIMD( pOutput, volume, pData, outCount );
+		sampleIndex = i << 1;
+	}
+#endif
+
+	for ( ; i < outCount; i++ )
 	{
 		pOutput[i].left  += lscale[pData[sampleIndex]];
 		pOutput[i].right += rscale[pData[sampleIndex+1]];
@@ -3677,6 +3879,19 @@ void SW_Mix16Mono_NoShift( portable_samplepair_t *pOutput, int *volume, short *p
 {
 	int vol0 = volume[0];
 	int vol1 = volume[1];
+
+#ifdef SND_SIMD
+	if ( MIX_UseSIMD() )
+	{
+		int done = MIX_PaintMono16_SIMD( pOutput, volume, pData, outCount );
+		pOutput += done;
+		pData += done;
+		outCount -= done;
+		if ( !outCount )
+			return;
+	}
+#endif
+
 #if !id386
 	for ( int i = 0; i < outCount; i++ )
 	{
@@ -3790,8 +4005,17 @@ void SW_Mix16Stereo( portable_samplepair_t *pOutput, int *volume, short *pData,
 {
 	int sampleIndex = 0;
 	fixedint sampleFrac = inputOffset;
+	int i = 0;
 
-	for ( int i = 0; i < outCount; i++ )
+#ifdef SND_SIMD
+	if ( rateScaleFix == FIX(1) && MIX_UseSIMD() )
+	{
+		i = MIX_PaintStereo16_SIMD( pOutput, volume, pData, outCount );
+		sampleIndex = i << 1;
+	}
+#endif
+
+	for ( ; i < outCount; i++ )
 	{
 		pOutput[i].left  += (volume[0] * (int)(pData[sampleIndex]))>>8;
 		pOutput[i].right += (volume[1] * (int)(pData[sampleIndex+1]))>>8;
@@ -3951,6 +4175,116 @@ void Mix16StereoWavtype( channel_t *pChannel, portable_samplepair_t *pOutput, in
 }
 
 
+//-----------------------------------------------------------------------------
+// Mixes synthetic 8/16 bit mono/stereo channels through the software mixers,
+// then scales and upsamples the result, with the scalar kernels (mode 0) and
+// the SIMD kernels (mode 1). One iteration mixes one frame.
+//-----------------------------------------------------------------------------
+class CMixBenchmark : public CKernelBenchmark< portable_samplepair_t >
+{
+public:
+	enum
+	{
+		SAMPLES = PAINTBUFFER_SIZE / 2	// leaves room for the 2x upsample
+	};
+
+	CMixBenchmark( int nChannels ) : CKernelBenchmark< portable_samplepair_t >( 1 ), m_nChannels( nChannels )
+	{
+		m_Data16.SetCount( nChannels * SAMPLES * 2 );
+		m_Data8.SetCount( nChannels * SAMPLES * 2 );
+		m_Volumes.SetCount( nChannels * 2 );
+		for ( int i = 0; i < m_Data16.Count(); i++ )
+		{
+			m_Data16[i] = (short)m_Random.RandomInt( -32768, 32767 );
+			m_Data8[i] = (byte)m_Random.RandomInt( 0, 255 );
+		}
+		for ( int i = 0; i < m_Volumes.Count(); i++ )
+		{
+			m_Volumes[i] = m_Random.RandomInt( 0, 255 );
+		}
+	}
+
+protected:
+	virtual bool BeginMode( int nMode )
+	{
+#ifdef SND_SIMD
+		s_nMixSIMDOverride = nMode;
+#endif
+		m_Output[nMode].SetCount( SAMPLES * 2 );
+		m_Filter.left = m_Filter.right = 0;
+		return true;
+	}
+
+	virtual void RunIteration( int nMode, int nFrame )
+	{
+		portable_samplepair_t *pOut = m_Output[nMode].Base();
+		V_memset( pOut, 0, SAMPLES * sizeof( portable_samplepair_t ) );
+		for ( int ch = 0; ch < m_nChannels; ch++ )
+		{
+			int *pVolume = &m_Volumes[ch * 2];
+			int nOffset = ch * SAMPLES * 2;
+			switch ( ch & 3 )
+			{
+			case 0: SW_Mix8Mono( pOut, pVolume, &m_Data8[nOffset], 0, FIX(1), SAMPLES ); break;
+			case 1: SW_Mix8Stereo( pOut, pVolume, &m_Data8[nOffset], 0, FIX(1), SAMPLES ); break;
+			case 2: SW_Mix16Mono( pOut, pVolume, &m_Data16[nOffset], 0, FIX(1), SAMPLES ); break;
+			case 3: SW_Mix16Stereo( pOut, pVolume, &m_Data16[nOffset], 0, FIX(1), SAMPLES ); break;
+			}
+		}
+		MIX_ScaleSamplePairs( pOut, SAMPLES, 181 );
+		S_Interpolate2xLinear_2( SAMPLES, pOut, &m_Filter, 1 );
+	}
+
+private:
+	int m_nChannels;
+	CUtlVector< short > m_Data16;
+	CUtlVector< byte > m_Data8;
+	CUtlVector< int > m_Volumes;
+	portable_samplepair_t m_Filter;
+};
+
+//-----------------------------------------------------------------------------
+// Times the software mixers with the scalar and SIMD kernels and checks the
+// two outputs match.  Uses scratch buffers only, so it also runs with -nosound
+// on the null device.
+//-----------------------------------------------------------------------------
+CON_COMMAND( snd_mix_benchmark, "Benchmark paintbuffer mixing: snd_mix_benchmark [channels] [frames]" )
+{
+	int nChannels = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1, 1024 ) : 32;
+	int nFrames = ( args.ArgC() > 2 ) ? clamp( atoi( args[2] ), 1, 100000 ) : 1000;
+
+	int nModes = 1;
+#ifdef SND_SIMD
+	if ( SND_CPUSupportsSIMD() )
+	{
+		nModes = 2;
+	}
+#endif
+
+	CMixBenchmark benchmark( nChannels );
+	{
+		// the mixer reads the kernel override while it holds the sound mutex
+		extern CThreadMutex g_SndMutex;
+		AUTO_LOCK( g_SndMutex );
+		benchmark.Run( nModes, nFrames );
+#ifdef SND_SIMD
+		s_nMixSIMDOverride = -1;
+#endif
+	}
+
+	ConMsg( "snd_mix_benchmark: %d channels, %d frames of %d samples\n", nChannels, nFrames, (int)CMixBenchmark::SAMPLES );
+	ConMsg( "  scalar: %.2f ms (%.2f us/frame)\n", benchmark.GetTime( 0 ) * 1000.0, benchmark.GetTime( 0 ) * 1e6 / nFrames );
+	if ( nModes < 2 )
+	{
+		ConMsg( "  SIMD kernels not available on this CPU/build\n" );
+		return;
+	}
+
+	ConMsg( "  SIMD:   %.2f ms (%.2f us/frame), %.2fx, output %s\n", benchmark.GetTime( 1 ) * 1000.0, benchmark.GetTime( 1 ) * 1e6 / nFrames,
+		benchmark.GetSpeedup(), benchmark.OutputMatches() ? "bit-exact" : "MISMATCH" );
+}
+
+
 //===============================================================================
 // Client entity mouth movement code.  Set entity mouthopen variable, based
 // on the sound envelope of the voice channel playing.
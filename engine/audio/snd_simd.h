@@ -0,0 +1,58 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: SSE2 (or NEON through sse2neon) support shared by the software
+//			mixer and the room dsp.
+//
+//=============================================================================//
+
+#ifndef SND_SIMD_H
+#define SND_SIMD_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "tier1/convar.h"
+
+#if defined(__arm__) || defined(__aarch64__)
+#include "sse2neon.h"
+#define SND_SIMD 1
+#elif !defined( _GAMECONSOLE ) && ( defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64) )
+#include <emmintrin.h>
+#define SND_SIMD 1
+#endif
+
+#ifdef SND_SIMD
+
+inline bool SND_CPUSupportsSIMD()
+{
+#if defined(__arm__) || defined(__aarch64__)
+	return true;
+#else
+	return GetCPUInformation()->m_bSSE2;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Whether a subsystem should run its SIMD kernels.
+// Input  : enable - the subsystem's convar (snd_mix_simd, dsp_simd)
+//			nOverride - -1 follows the convar, 0/1 forces scalar/SIMD (benchmarks)
+//-----------------------------------------------------------------------------
+inline bool SND_UseSIMD( const ConVar &enable, int nOverride )
+{
+	if ( nOverride >= 0 )
+		return nOverride != 0;
+	return enable.GetBool() && SND_CPUSupportsSIMD();
+}
+
+// low 32 bits of a 32x32 multiply, wrapping on overflow like the scalar code.  SSE2 has no pmulld.
+FORCEINLINE __m128i SND_MulLo32( __m128i a, __m128i b )
+{
+	__m128i even = _mm_mul_epu32( a, b );
+	__m128i odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), _mm_srli_epi64( b, 32 ) );
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+#endif // SND_SIMD
+
+#endif // SND_SIMD_H
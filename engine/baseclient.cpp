@@ -162,6 +162,84 @@ bool CBaseClient::SendNetMsg(INetMessage &msg, bool bForceReliable)
 	return bret;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Append a message that was already serialized for a broadcast
+//-----------------------------------------------------------------------------
+bool CBaseClient::SendEncodedNetMsg( INetMessage &msg, CEncodedNetMsg &encoded, bool bForceReliable )
+{
+	if ( !m_NetChannel )
+	{
+		return true;
+	}
+
+	// tracing wants the message itself
+	if ( !encoded.IsEncoded() || IsTracing() )
+	{
+		return SendNetMsg( msg, bForceReliable );
+	}
+
+	bool bReliable = msg.IsReliable() || bForceReliable;
+
+	// doesn't fit, let the stream overflow the same way SendNetMsg does
+	if ( encoded.GetBuffer().GetNumBitsWritten() > m_NetChannel->GetNumBitsLeft( bReliable ) )
+	{
+		return SendNetMsg( msg, bForceReliable );
+	}
+
+	return m_NetChannel->SendData( encoded.GetBuffer(), bReliable );
+}
+
+//-----------------------------------------------------------------------------
+// Buffers big enough for any message, recycled between broadcasts
+//-----------------------------------------------------------------------------
+static CUtlVector< byte * > s_EncodedNetMsgBuffers;
+
+CEncodedNetMsg::CEncodedNetMsg()
+{
+	m_pData = NULL;
+	m_bEncoded = false;
+}
+
+CEncodedNetMsg::~CEncodedNetMsg()
+{
+	if ( m_pData )
+	{
+		s_EncodedNetMsgBuffers.AddToTail( m_pData );
+	}
+}
+
+bool CEncodedNetMsg::Encode( INetMessage &msg )
+{
+	if ( !m_pData )
+	{
+		if ( s_EncodedNetMsgBuffers.Count() )
+		{
+			m_pData = s_EncodedNetMsgBuffers.Tail();
+			s_EncodedNetMsgBuffers.RemoveMultipleFromTail( 1 );
+		}
+		else
+		{
+			m_pData = new byte[ NET_MAX_PAYLOAD ];
+		}
+	}
+
+	m_Buffer.StartWriting( m_pData, NET_MAX_PAYLOAD );
+	m_Buffer.SetDebugName( "CEncodedNetMsg" );
+
+	m_bEncoded = msg.WriteToBuffer( m_Buffer ) && !m_Buffer.IsOverflowed();
+	return m_bEncoded;
+}
+
+void CEncodedNetMsg::PatchByte( int nBitOffset, int nValue )
+{
+	Assert( m_bEncoded && nBitOffset + 8 <= m_Buffer.GetNumBitsWritten() );
+
+	int nEndBit = m_Buffer.GetNumBitsWritten();
+	m_Buffer.SeekToBit( nBitOffset );
+	m_Buffer.WriteByte( nValue );
+	m_Buffer.SeekToBit( nEndBit );
+}
+
 char const *CBaseClient::GetUserSetting(char const *pchCvar) const 
 {
 	if ( !m_ConVars || !pchCvar || !pchCvar[0] )
@@ -648,6 +726,19 @@ void CBaseClient::FireGameEvent( IGameEvent *event )
 {
 	tmZoneFiltered( TELEMETRY_LEVEL0, 50, TMZF_NONE, "%s", __FUNCTION__ );
 
+	SVC_GameEvent *pEventMsg;
+	CEncodedNetMsg *pEncoded;
+	if ( g_GameEventManager.GetClientEventEncoding( event, pEventMsg, pEncoded ) )
+	{
+		if ( m_NetChannel )
+		{
+			bool bSent = SendEncodedNetMsg( *pEventMsg, *pEncoded );
+			if ( !bSent )
+				DevMsg("GameEventManager: failed to send event '%s'.\n", event->GetName() );
+		}
+		return;
+	}
+
 	char buffer_data[MAX_EVENT_BYTES];
 
 	SVC_GameEvent eventMsg;
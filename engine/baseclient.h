@@ -31,6 +31,29 @@ struct player_info_s;
 class CFrameSnapshot;
 class CEventInfo;
 
+//-----------------------------------------------------------------------------
+// Purpose: A net message serialized once so a broadcast can append the same
+//			bits to every recipient's stream instead of re-encoding it per client
+//-----------------------------------------------------------------------------
+class CEncodedNetMsg
+{
+public:
+	CEncodedNetMsg();
+	~CEncodedNetMsg();
+
+	bool		Encode( INetMessage &msg );		// false if the message failed to serialize
+	bool		IsEncoded() const { return m_bEncoded; }
+	bf_write	&GetBuffer() { return m_Buffer; }
+
+	// overwrite a byte sized field at a bit offset of the encoded message, for per-recipient values
+	void		PatchByte( int nBitOffset, int nValue );
+
+private:
+	byte		*m_pData;
+	bf_write	m_Buffer;
+	bool		m_bEncoded;
+};
+
 struct Spike_t
 {
 public:
@@ -106,6 +129,7 @@ public:
 
 	virtual bool	ExecuteStringCommand( const char *s );
 	virtual bool	SendNetMsg(INetMessage &msg, bool bForceReliable = false);
+	virtual bool	SendEncodedNetMsg( INetMessage &msg, CEncodedNetMsg &encoded, bool bForceReliable = false );
 	
 	virtual void	ClientPrintf (PRINTF_FORMAT_STRING const char *fmt, ...);
 
@@ -2167,6 +2167,9 @@ void CBaseServer::BroadcastPrintf (const char *fmt, ...)
 
 void CBaseServer::BroadcastMessage( INetMessage &msg, bool onlyActive, bool reliable )
 {
+	// serialized once on the first recipient, every other client gets a copy of the bits
+	CEncodedNetMsg encoded;
+
 	for ( int i = 0; i < m_Clients.Count(); i++ )
 	{
 		CBaseClient *cl = m_Clients[ i ];
@@ -2176,7 +2179,12 @@ void CBaseServer::BroadcastMessage( INetMessage &msg, bool onlyActive, bool reli
 			continue;
 		}
 
-		if ( !cl->SendNetMsg( msg, reliable ) )
+		if ( !encoded.IsEncoded() )
+		{
+			encoded.Encode( msg );
+		}
+
+		if ( !cl->SendEncodedNetMsg( msg, encoded, reliable ) )
 		{
 			if ( msg.IsReliable() || reliable )
 			{
@@ -2206,6 +2214,8 @@ void CBaseServer::BroadcastMessage( INetMessage &msg, IRecipientFilter &filter )
 	{
 		msg.SetReliable( filter.IsReliable() );
 
+		CEncodedNetMsg encoded;
+
 		int num = filter.GetRecipientCount();
 	
 		for ( int i = 0; i < num; i++ )
@@ -2233,7 +2243,12 @@ void CBaseServer::BroadcastMessage( INetMessage &msg, IRecipientFilter &filter )
 				continue;
 			}
 
-			if ( !cl->SendNetMsg( msg ) )
+			if ( !encoded.IsEncoded() )
+			{
+				encoded.Encode( msg );
+			}
+
+			if ( !cl->SendEncodedNetMsg( msg, encoded ) )
 			{
 				if ( msg.IsReliable() )
 				{
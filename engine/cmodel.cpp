@@ -28,6 +28,8 @@
 #include "collisionutils.h"
 #include "tier0/tslist.h"
 #include "tier0/vprof.h"
+#include "host.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -129,6 +131,8 @@ void EndTrace( TraceInfo_t *&pTraceInfo )
 static ConVar map_noareas( "map_noareas", "0", 0, "Disable area to area connection testing." );
 
 void	FloodAreaConnections (CCollisionBSPData *pBSPData);
+static void CM_InitVisCache( CCollisionBSPData *pBSPData );
+static void CM_ShutdownVisCache();
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -297,6 +301,8 @@ void CM_FreeMap(void)
 	// get the current collision bsp -- there is only one!
 	CCollisionBSPData *pBSPData = GetCollisionBSPData();
 
+	CM_ShutdownVisCache();
+
 	// free the collision bsp data
 	CollisionBSPData_Destroy( pBSPData );
 }
@@ -334,6 +340,13 @@ cmodel_t *CM_LoadMap( const char *name, bool allowReusePrevious, unsigned *check
 		return &pBSPData->map_cmodels[0];		// still have the right version
 	}
 
+	// Timed as a whole so the snapshot cache's numbers cover everything a restore still does
+	CFastTimer timer;
+	timer.Start();
+
+	// the cached rows belong to the map being replaced
+	CM_ShutdownVisCache();
+
 	// only pre-load if the map doesn't already exist
 	CollisionBSPData_PreLoad( pBSPData );
 
@@ -354,6 +367,11 @@ cmodel_t *CM_LoadMap( const char *name, bool allowReusePrevious, unsigned *check
 	CM_InitPortalOpenState( pBSPData );
 	FloodAreaConnections(pBSPData);
 
+	CM_InitVisCache( pBSPData );
+
+	timer.End();
+	CollisionBSPSnapshot_LoadMapDone( name, timer.GetDuration().GetMillisecondsF() );
+
 #ifdef COUNT_COLLISIONS
 	// initialize counters
 	CollisionCounts_Init( &g_CollisionCounts );
@@ -2380,6 +2398,281 @@ void CM_DecompressVis( CCollisionBSPData *pBSPData, int cluster, int visType, by
 	} while (out_p - out < numClusterBytes);
 }
 
+//-----------------------------------------------------------------------------
+// Decompressed PVS/PAS rows. Maps whose whole PVS and PAS fit in
+// cm_visflat_kb are decompressed into a flat bit matrix at load, otherwise
+// the most recently used rows are kept. Rows used during the current frame
+// are never evicted, so a row pointer stays valid until the end of the frame.
+//-----------------------------------------------------------------------------
+static ConVar cm_viscache( "cm_viscache", "1", 0, "Cache decompressed PVS/PAS rows." );
+static ConVar cm_viscache_kb( "cm_viscache_kb", "512", 0, "Memory for cached PVS/PAS rows in KB, applied at map load.", true, 16, false, 0 );
+static ConVar cm_visflat_kb( "cm_visflat_kb", "4096", 0, "Decompress the whole PVS and PAS at map load when they fit in this many KB (0 = never), applied at map load.", true, 0, false, 0 );
+
+class CClusterVisCache
+{
+public:
+	CClusterVisCache();
+
+	void Init( CCollisionBSPData *pBSPData );
+	void Shutdown();
+
+	// Returns NULL if the row isn't cacheable
+	const byte *GetRow( CCollisionBSPData *pBSPData, int cluster, int visType );
+
+	void PrintStats();
+	void ResetStats();
+
+private:
+	struct Row_t
+	{
+		int		m_nIndex;		// cluster * 2 + visType, -1 if unused
+		int		m_nLastFrame;
+		uint	m_nLastUse;
+	};
+
+	struct OverflowRow_t
+	{
+		byte	*m_pData;
+		int		m_nFrame;
+	};
+
+	const byte *CacheRow( CCollisionBSPData *pBSPData, int cluster, int visType );
+
+	int						m_nClusters;
+	int						m_nRowBytes;	// 0 when the cache isn't active
+
+	// Flat matrix, PVS rows followed by PAS rows
+	byte					*m_pFlat;
+
+	// Most recently used rows
+	CThreadFastMutex		m_Mutex;
+	byte					*m_pRowData;
+	CUtlVector<Row_t>		m_Rows;
+	CUtlVector<int>			m_RowForIndex;	// cluster * 2 + visType -> m_Rows index, -1 if not cached
+	CUtlVector<OverflowRow_t> m_Overflow;	// decompressed while every row was in use this frame
+	uint					m_nUseCounter;
+
+	CInterlockedInt			m_nHits;
+	CInterlockedInt			m_nMisses;
+	int						m_nOverflows;
+};
+
+static CClusterVisCache g_ClusterVisCache;
+
+static void CM_InitVisCache( CCollisionBSPData *pBSPData )
+{
+	g_ClusterVisCache.Init( pBSPData );
+}
+
+static void CM_ShutdownVisCache()
+{
+	g_ClusterVisCache.Shutdown();
+}
+
+CClusterVisCache::CClusterVisCache()
+{
+	m_nClusters = 0;
+	m_nRowBytes = 0;
+	m_pFlat = NULL;
+	m_pRowData = NULL;
+	m_nUseCounter = 0;
+	m_nOverflows = 0;
+}
+
+void CClusterVisCache::Init( CCollisionBSPData *pBSPData )
+{
+	Shutdown();
+	ResetStats();
+
+	if ( !cm_viscache.GetBool() || !pBSPData->numvisibility || !pBSPData->map_vis || pBSPData->numclusters <= 0 )
+		return;
+
+	m_nClusters = pBSPData->numclusters;
+	m_nRowBytes = ( m_nClusters + 7 ) >> 3;
+
+	int nFlatBytes = 2 * m_nClusters * m_nRowBytes;
+	if ( nFlatBytes <= cm_visflat_kb.GetInt() * 1024 )
+	{
+		m_pFlat = new byte[nFlatBytes];
+		for ( int i = 0; i < m_nClusters; ++i )
+		{
+			CM_DecompressVis( pBSPData, i, DVIS_PVS, m_pFlat + i * m_nRowBytes );
+			CM_DecompressVis( pBSPData, i, DVIS_PAS, m_pFlat + ( m_nClusters + i ) * m_nRowBytes );
+		}
+		return;
+	}
+
+	int nRows = clamp( cm_viscache_kb.GetInt() * 1024 / m_nRowBytes, 16, 2 * m_nClusters );
+	m_pRowData = new byte[nRows * m_nRowBytes];
+	m_Rows.SetCount( nRows );
+	for ( int i = 0; i < nRows; ++i )
+	{
+		m_Rows[i].m_nIndex = -1;
+		m_Rows[i].m_nLastFrame = -1;
+		m_Rows[i].m_nLastUse = 0;
+	}
+	m_RowForIndex.SetCount( 2 * m_nClusters );
+	for ( int i = 0; i < m_RowForIndex.Count(); ++i )
+	{
+		m_RowForIndex[i] = -1;
+	}
+}
+
+void CClusterVisCache::Shutdown()
+{
+	delete [] m_pFlat;
+	m_pFlat = NULL;
+	delete [] m_pRowData;
+	m_pRowData = NULL;
+	m_Rows.Purge();
+	m_RowForIndex.Purge();
+	for ( int i = 0; i < m_Overflow.Count(); ++i )
+	{
+		delete [] m_Overflow[i].m_pData;
+	}
+	m_Overflow.Purge();
+	m_nClusters = 0;
+	m_nRowBytes = 0;
+}
+
+void CClusterVisCache::ResetStats()
+{
+	m_nHits = 0;
+	m_nMisses = 0;
+	m_nOverflows = 0;
+}
+
+const byte *CClusterVisCache::GetRow( CCollisionBSPData *pBSPData, int cluster, int visType )
+{
+	if ( !m_nRowBytes || cluster < 0 || cluster >= m_nClusters || ( visType != DVIS_PVS && visType != DVIS_PAS ) )
+		return NULL;
+
+	if ( m_pFlat )
+	{
+		++m_nHits;
+		return m_pFlat + ( ( visType == DVIS_PAS ) ? m_nClusters + cluster : cluster ) * m_nRowBytes;
+	}
+
+	AUTO_LOCK( m_Mutex );
+	int iRow = m_RowForIndex[cluster * 2 + visType];
+	if ( iRow >= 0 )
+	{
+		++m_nHits;
+		m_Rows[iRow].m_nLastFrame = host_framecount;
+		m_Rows[iRow].m_nLastUse = ++m_nUseCounter;
+		return m_pRowData + iRow * m_nRowBytes;
+	}
+
+	++m_nMisses;
+	return CacheRow( pBSPData, cluster, visType );
+}
+
+// NOTE: m_Mutex must be held
+const byte *CClusterVisCache::CacheRow( CCollisionBSPData *pBSPData, int cluster, int visType )
+{
+	// Release overflow rows from earlier frames
+	for ( int i = m_Overflow.Count(); --i >= 0; )
+	{
+		if ( m_Overflow[i].m_nFrame != host_framecount )
+		{
+			delete [] m_Overflow[i].m_pData;
+			m_Overflow.FastRemove( i );
+		}
+	}
+
+	// Evict the least recently used row that hasn't been handed out this frame
+	int iRow = -1;
+	for ( int i = 0; i < m_Rows.Count(); ++i )
+	{
+		const Row_t &row = m_Rows[i];
+		if ( row.m_nLastFrame == host_framecount )
+			continue;
+
+		if ( iRow < 0 || row.m_nLastUse < m_Rows[iRow].m_nLastUse )
+		{
+			iRow = i;
+			if ( row.m_nIndex < 0 )
+				break;
+		}
+	}
+
+	if ( iRow < 0 )
+	{
+		// Every row is in use this frame
+		++m_nOverflows;
+		int i = m_Overflow.AddToTail();
+		m_Overflow[i].m_pData = new byte[m_nRowBytes];
+		m_Overflow[i].m_nFrame = host_framecount;
+		CM_DecompressVis( pBSPData, cluster, visType, m_Overflow[i].m_pData );
+		return m_Overflow[i].m_pData;
+	}
+
+	Row_t &row = m_Rows[iRow];
+	if ( row.m_nIndex >= 0 )
+	{
+		m_RowForIndex[row.m_nIndex] = -1;
+	}
+	row.m_nIndex = cluster * 2 + visType;
+	row.m_nLastFrame = host_framecount;
+	row.m_nLastUse = ++m_nUseCounter;
+	m_RowForIndex[row.m_nIndex] = iRow;
+
+	byte *pData = m_pRowData + iRow * m_nRowBytes;
+	CM_DecompressVis( pBSPData, cluster, visType, pData );
+	return pData;
+}
+
+void CClusterVisCache::PrintStats()
+{
+	if ( !m_nRowBytes )
+	{
+		ConMsg( "PVS/PAS cache inactive (disabled, no map loaded or map has no vis data)\n" );
+		return;
+	}
+
+	int nLookups = m_nHits + m_nMisses;
+	if ( m_pFlat )
+	{
+		ConMsg( "PVS/PAS flat matrix: %d clusters, %d bytes per row, %d KB\n", m_nClusters, m_nRowBytes, ( 2 * m_nClusters * m_nRowBytes + 1023 ) / 1024 );
+	}
+	else
+	{
+		ConMsg( "PVS/PAS row cache: %d clusters, %d of %d rows, %d bytes per row, %d KB\n", m_nClusters, m_Rows.Count(), 2 * m_nClusters,
+			m_nRowBytes, ( m_Rows.Count() * m_nRowBytes + 1023 ) / 1024 );
+		ConMsg( "  %d rows decompressed past the cache size (all rows in use in one frame)\n", m_nOverflows );
+	}
+	ConMsg( "  %d lookups, %d hits, %d misses, %.1f%% hit rate\n", nLookups, (int)m_nHits, (int)m_nMisses, nLookups ? 100.0f * m_nHits / nLookups : 0.0f );
+}
+
+CON_COMMAND( cm_viscache_stats, "Print PVS/PAS cache memory use and hit rate for the current map, \"reset\" clears the counters." )
+{
+	if ( args.ArgC() >= 2 && !Q_stricmp( args[1], "reset" ) )
+	{
+		g_ClusterVisCache.ResetStats();
+		return;
+	}
+	g_ClusterVisCache.PrintStats();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the decompressed PVS or PAS row for a cluster, without
+//			copying it when the cache has it. In that case the pointer is valid
+//			until the end of the frame. Otherwise the row is decompressed into
+//			dest, the same as CM_Vis.
+//-----------------------------------------------------------------------------
+const byte *CM_ClusterVisRow( byte *dest, int destlen, int cluster, int visType )
+{
+	if ( cluster != -1 )
+	{
+		const byte *pRow = g_ClusterVisCache.GetRow( GetCollisionBSPData(), cluster, visType );
+		if ( pRow )
+			return pRow;
+	}
+
+	return CM_Vis( dest, destlen, cluster, visType );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Decompress the RLE bitstring for PVS or PAS of one cluster
 // Input  : *dest - buffer to store the decompressed data
@@ -2410,7 +2703,15 @@ const byte *CM_Vis( byte *dest, int destlen, int cluster, int visType )
 	}
 	else
 	{
-		CM_DecompressVis( pBSPData, cluster, visType, dest );
+		const byte *pRow = g_ClusterVisCache.GetRow( pBSPData, cluster, visType );
+		if ( pRow )
+		{
+			memcpy( dest, pRow, (pBSPData->numclusters+7)>>3 );
+		}
+		else
+		{
+			CM_DecompressVis( pBSPData, cluster, visType, dest );
+		}
 	}
 
 	return dest;
@@ -2425,7 +2726,7 @@ int CM_ClusterPVSSize()
 
 const byte	*CM_ClusterPVS (int cluster)
 {
-	return CM_Vis( pvsrow, CM_ClusterPVSSize(), cluster, DVIS_PVS );
+	return CM_ClusterVisRow( pvsrow, CM_ClusterPVSSize(), cluster, DVIS_PVS );
 }
 
 /*
@@ -12,6 +12,7 @@
 #include "modelloader.h"
 #include "common.h"
 #include "zone.h"
+#include "tier1/convar.h"
 
 // UNDONE: Abstract the texture/material lookup stuff and all of this goes away
 #include "materialsystem/imaterialsystem.h"
@@ -231,6 +232,276 @@ void CollisionBSPData_PreLoad( CCollisionBSPData *pBSPData )
 }
 
 
+//-----------------------------------------------------------------------------
+// Collision BSP snapshots: everything decoded straight from the lumps (planes,
+// nodes, leafs, brushes, surfaces, areas, vis) lives in one contiguous run of
+// the hunk, so a copy of that run plus a pointer rebase restores it without
+// touching the lumps. Physics and displacement collision are still rebuilt.
+//-----------------------------------------------------------------------------
+static ConVar cm_snapshot_cache( "cm_snapshot_cache", "0", 0, "Number of maps whose decoded collision BSP is kept in memory to speed up changelevel back to them (0 = off)" );
+
+#define CM_SNAPSHOT_ALIGN 16
+
+struct CollisionBSPSnapshot_t
+{
+	char			m_szMapName[MAX_QPATH];
+	unsigned int	m_nHeaderChecksum;
+	unsigned int	m_nLastUsed;
+
+	// The decoded hunk run and the address it was decoded at
+	CUtlMemory<byte> m_Hunk;
+	intp			m_nOriginalBase;
+
+	// Copy of the decoded pBSPData state, pointers still in the original run
+	int				numbrushsides, numboxbrushes, numplanes, numnodes, numleafs, emptyleaf, solidleaf;
+	int				numleafbrushes, numcmodels, numbrushes, numvisibility, numareas, numareaportals;
+	int				numclusters, numtextures, numportalopen;
+	cbrushside_t	*map_brushsides;
+	cboxbrush_t		*map_boxbrushes;
+	cplane_t		*map_planes;
+	cnode_t			*map_nodes;
+	cleaf_t			*map_leafs;
+	unsigned short	*map_leafbrushes;
+	cmodel_t		*map_cmodels;
+	cbrush_t		*map_brushes;
+	dvis_t			*map_vis;
+	carea_t			*map_areas;
+	dareaportal_t	*map_areaportals;
+	char			*map_texturenames;
+	csurface_t		*map_surfaces;
+	bool			*portalopen;
+
+	// How long all of CM_LoadMap took when the map was decoded, and when it was last restored
+	float			m_flDecodeLoadMs;
+	float			m_flLastRestoreLoadMs;
+	int				m_nRestores;
+};
+
+static CUtlVector<CollisionBSPSnapshot_t *> s_CollisionBSPSnapshots;
+static unsigned int s_nCollisionBSPSnapshotUse = 0;
+
+// The snapshot the map being loaded was restored from or saved to, for CollisionBSPSnapshot_LoadMapDone
+static CollisionBSPSnapshot_t *s_pLoadingSnapshot = NULL;
+static bool s_bLoadingSnapshotRestored = false;
+
+template <class T>
+static inline T *RebasePointer( T *p, intp nOldBase, byte *pNewBase )
+{
+	return p ? (T *)( pNewBase + ( (intp)p - nOldBase ) ) : NULL;
+}
+
+static bool SnapshotContains( const CollisionBSPSnapshot_t *pSnapshot, const void *p, const byte *pStart )
+{
+	return !p || ( (const byte *)p >= pStart && (const byte *)p < pStart + pSnapshot->m_Hunk.Count() );
+}
+
+static void CollisionBSPSnapshot_Trim( int nMaxSnapshots )
+{
+	while ( s_CollisionBSPSnapshots.Count() > nMaxSnapshots )
+	{
+		int nOldest = 0;
+		for ( int i = 1; i < s_CollisionBSPSnapshots.Count(); ++i )
+		{
+			if ( s_CollisionBSPSnapshots[i]->m_nLastUsed < s_CollisionBSPSnapshots[nOldest]->m_nLastUsed )
+			{
+				nOldest = i;
+			}
+		}
+		if ( s_pLoadingSnapshot == s_CollisionBSPSnapshots[nOldest] )
+		{
+			s_pLoadingSnapshot = NULL;
+		}
+		delete s_CollisionBSPSnapshots[nOldest];
+		s_CollisionBSPSnapshots.FastRemove( nOldest );
+	}
+}
+
+static CollisionBSPSnapshot_t *CollisionBSPSnapshot_Find( const char *pName, unsigned int nHeaderChecksum )
+{
+	FOR_EACH_VEC( s_CollisionBSPSnapshots, i )
+	{
+		CollisionBSPSnapshot_t *pSnapshot = s_CollisionBSPSnapshots[i];
+		if ( pSnapshot->m_nHeaderChecksum == nHeaderChecksum && !V_stricmp( pSnapshot->m_szMapName, pName ) )
+			return pSnapshot;
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the hunk run decoded since nHunkMark into the snapshot cache
+//-----------------------------------------------------------------------------
+static CollisionBSPSnapshot_t *CollisionBSPSnapshot_Save( const char *pName, unsigned int nHeaderChecksum, CCollisionBSPData *pBSPData, int nHunkMark )
+{
+	byte *pStart = (byte *)AlignValue( (byte *)Hunk_LowMarkToPointer( nHunkMark ), CM_SNAPSHOT_ALIGN );
+	byte *pEnd = (byte *)Hunk_LowMarkToPointer( Hunk_LowMark() );
+	if ( pEnd <= pStart )
+		return NULL;
+
+	CollisionBSPSnapshot_t *pSnapshot = new CollisionBSPSnapshot_t;
+	pSnapshot->m_Hunk.EnsureCapacity( pEnd - pStart );
+	pSnapshot->m_nOriginalBase = (intp)pStart;
+
+	pSnapshot->map_brushsides = pBSPData->map_brushsides.Base();
+	pSnapshot->map_boxbrushes = pBSPData->map_boxbrushes.Base();
+	pSnapshot->map_planes = pBSPData->map_planes.Base();
+	pSnapshot->map_nodes = pBSPData->map_nodes.Base();
+	pSnapshot->map_leafs = pBSPData->map_leafs.Base();
+	pSnapshot->map_leafbrushes = pBSPData->map_leafbrushes.Base();
+	pSnapshot->map_cmodels = pBSPData->map_cmodels.Base();
+	pSnapshot->map_brushes = pBSPData->map_brushes.Base();
+	pSnapshot->map_vis = pBSPData->map_vis;
+	pSnapshot->map_areas = pBSPData->map_areas.Base();
+	pSnapshot->map_areaportals = pBSPData->map_areaportals.Base();
+	pSnapshot->map_texturenames = pBSPData->map_texturenames;
+	pSnapshot->map_surfaces = pBSPData->map_surfaces.Base();
+	pSnapshot->portalopen = pBSPData->portalopen.Base();
+
+	// Anything that spilled out of the main hunk page can't be captured this way
+	if ( !SnapshotContains( pSnapshot, pSnapshot->map_brushsides, pStart ) || !SnapshotContains( pSnapshot, pSnapshot->map_boxbrushes, pStart ) ||
+		 !SnapshotContains( pSnapshot, pSnapshot->map_planes, pStart ) || !SnapshotContains( pSnapshot, pSnapshot->map_nodes, pStart ) ||
+		 !SnapshotContains( pSnapshot, pSnapshot->map_leafs, pStart ) || !SnapshotContains( pSnapshot, pSnapshot->map_leafbrushes, pStart ) ||
+		 !SnapshotContains( pSnapshot, pSnapshot->map_cmodels, pStart ) || !SnapshotContains( pSnapshot, pSnapshot->map_brushes, pStart ) ||
+		 !SnapshotContains( pSnapshot, pSnapshot->map_vis, pStart ) || !SnapshotContains( pSnapshot, pSnapshot->map_areas, pStart ) ||
+		 !SnapshotContains( pSnapshot, pSnapshot->map_areaportals, pStart ) || !SnapshotContains( pSnapshot, pSnapshot->map_texturenames, pStart ) ||
+		 !SnapshotContains( pSnapshot, pSnapshot->map_surfaces, pStart ) || !SnapshotContains( pSnapshot, pSnapshot->portalopen, pStart ) )
+	{
+		DevMsg( "CM: %s collision data is not contiguous in the hunk, not caching it\n", pName );
+		delete pSnapshot;
+		return NULL;
+	}
+
+	memcpy( pSnapshot->m_Hunk.Base(), pStart, pEnd - pStart );
+
+	V_strncpy( pSnapshot->m_szMapName, pName, sizeof( pSnapshot->m_szMapName ) );
+	pSnapshot->m_nHeaderChecksum = nHeaderChecksum;
+	pSnapshot->m_nLastUsed = ++s_nCollisionBSPSnapshotUse;
+	pSnapshot->m_flDecodeLoadMs = 0.0f;
+	pSnapshot->m_flLastRestoreLoadMs = 0.0f;
+	pSnapshot->m_nRestores = 0;
+
+	pSnapshot->numbrushsides = pBSPData->numbrushsides;
+	pSnapshot->numboxbrushes = pBSPData->numboxbrushes;
+	pSnapshot->numplanes = pBSPData->numplanes;
+	pSnapshot->numnodes = pBSPData->numnodes;
+	pSnapshot->numleafs = pBSPData->numleafs;
+	pSnapshot->emptyleaf = pBSPData->emptyleaf;
+	pSnapshot->solidleaf = pBSPData->solidleaf;
+	pSnapshot->numleafbrushes = pBSPData->numleafbrushes;
+	pSnapshot->numcmodels = pBSPData->numcmodels;
+	pSnapshot->numbrushes = pBSPData->numbrushes;
+	pSnapshot->numvisibility = pBSPData->numvisibility;
+	pSnapshot->numareas = pBSPData->numareas;
+	pSnapshot->numareaportals = pBSPData->numareaportals;
+	pSnapshot->numclusters = pBSPData->numclusters;
+	pSnapshot->numtextures = pBSPData->numtextures;
+	pSnapshot->numportalopen = pBSPData->numportalopen;
+
+	CollisionBSPSnapshot_Trim( cm_snapshot_cache.GetInt() - 1 );
+	s_CollisionBSPSnapshots.AddToTail( pSnapshot );
+	return pSnapshot;
+}
+
+//-----------------------------------------------------------------------------
+// Copies a snapshot into a fresh hunk run and rebases every pointer into it
+//-----------------------------------------------------------------------------
+static void CollisionBSPSnapshot_Restore( CollisionBSPSnapshot_t *pSnapshot, CCollisionBSPData *pBSPData )
+{
+	byte *pBase = (byte *)Hunk_Alloc( pSnapshot->m_Hunk.Count() + CM_SNAPSHOT_ALIGN, false );
+	pBase = (byte *)AlignValue( pBase, CM_SNAPSHOT_ALIGN );
+	memcpy( pBase, pSnapshot->m_Hunk.Base(), pSnapshot->m_Hunk.Count() );
+	intp nOldBase = pSnapshot->m_nOriginalBase;
+
+	pBSPData->numbrushsides = pSnapshot->numbrushsides;
+	pBSPData->numboxbrushes = pSnapshot->numboxbrushes;
+	pBSPData->numplanes = pSnapshot->numplanes;
+	pBSPData->numnodes = pSnapshot->numnodes;
+	pBSPData->numleafs = pSnapshot->numleafs;
+	pBSPData->emptyleaf = pSnapshot->emptyleaf;
+	pBSPData->solidleaf = pSnapshot->solidleaf;
+	pBSPData->numleafbrushes = pSnapshot->numleafbrushes;
+	pBSPData->numcmodels = pSnapshot->numcmodels;
+	pBSPData->numbrushes = pSnapshot->numbrushes;
+	pBSPData->numvisibility = pSnapshot->numvisibility;
+	pBSPData->numareas = pSnapshot->numareas;
+	pBSPData->numareaportals = pSnapshot->numareaportals;
+	pBSPData->numclusters = pSnapshot->numclusters;
+	pBSPData->numtextures = pSnapshot->numtextures;
+	pBSPData->numportalopen = pSnapshot->numportalopen;
+
+	pBSPData->map_brushsides.Attach( pBSPData->numbrushsides, RebasePointer( pSnapshot->map_brushsides, nOldBase, pBase ) );
+	pBSPData->map_boxbrushes.Attach( pBSPData->numboxbrushes, RebasePointer( pSnapshot->map_boxbrushes, nOldBase, pBase ) );
+	pBSPData->map_planes.Attach( pBSPData->numplanes, RebasePointer( pSnapshot->map_planes, nOldBase, pBase ) );
+	pBSPData->map_nodes.Attach( pBSPData->numnodes + 6, RebasePointer( pSnapshot->map_nodes, nOldBase, pBase ) );
+	pBSPData->map_leafs.Attach( pBSPData->numleafs + 1, RebasePointer( pSnapshot->map_leafs, nOldBase, pBase ) );
+	pBSPData->map_leafbrushes.Attach( pBSPData->numleafbrushes, RebasePointer( pSnapshot->map_leafbrushes, nOldBase, pBase ) );
+	pBSPData->map_cmodels.Attach( pBSPData->numcmodels, RebasePointer( pSnapshot->map_cmodels, nOldBase, pBase ) );
+	pBSPData->map_brushes.Attach( pBSPData->numbrushes, RebasePointer( pSnapshot->map_brushes, nOldBase, pBase ) );
+	pBSPData->map_vis = RebasePointer( pSnapshot->map_vis, nOldBase, pBase );
+	pBSPData->map_areas.Attach( pBSPData->numareas, RebasePointer( pSnapshot->map_areas, nOldBase, pBase ) );
+	pBSPData->map_areaportals.Attach( pBSPData->numareaportals, RebasePointer( pSnapshot->map_areaportals, nOldBase, pBase ) );
+	pBSPData->map_texturenames = RebasePointer( pSnapshot->map_texturenames, nOldBase, pBase );
+	pBSPData->map_surfaces.Attach( pBSPData->numtextures, RebasePointer( pSnapshot->map_surfaces, nOldBase, pBase ) );
+	pBSPData->portalopen.Attach( pBSPData->numportalopen, RebasePointer( pSnapshot->portalopen, nOldBase, pBase ) );
+	pBSPData->map_rootnode = pBSPData->map_nodes.Base();
+
+	// Pointers stored inside the arrays
+	for ( int i = 0; i < pBSPData->numbrushsides; ++i )
+	{
+		pBSPData->map_brushsides[i].plane = RebasePointer( pBSPData->map_brushsides[i].plane, nOldBase, pBase );
+	}
+	for ( int i = 0; i < pBSPData->numnodes; ++i )
+	{
+		pBSPData->map_nodes[i].plane = RebasePointer( pBSPData->map_nodes[i].plane, nOldBase, pBase );
+	}
+	for ( int i = 0; i < pBSPData->numtextures; ++i )
+	{
+		pBSPData->map_surfaces[i].name = RebasePointer( pBSPData->map_surfaces[i].name, nOldBase, pBase );
+	}
+
+	pSnapshot->m_nLastUsed = ++s_nCollisionBSPSnapshotUse;
+}
+
+CON_COMMAND( cm_snapshot_cache_status, "Lists the maps in the collision BSP snapshot cache" )
+{
+	int nTotalBytes = 0;
+	FOR_EACH_VEC( s_CollisionBSPSnapshots, i )
+	{
+		const CollisionBSPSnapshot_t *pSnapshot = s_CollisionBSPSnapshots[i];
+		Msg( "%-48s %6d KB  load decoded %7.2f ms  load restored %7.2f ms  (%d restores)\n", pSnapshot->m_szMapName, pSnapshot->m_Hunk.Count() / 1024,
+			pSnapshot->m_flDecodeLoadMs, pSnapshot->m_flLastRestoreLoadMs, pSnapshot->m_nRestores );
+		nTotalBytes += pSnapshot->m_Hunk.Count();
+	}
+	Msg( "%d of %d snapshots, %d KB\n", s_CollisionBSPSnapshots.Count(), cm_snapshot_cache.GetInt(), nTotalBytes / 1024 );
+}
+
+CON_COMMAND( cm_snapshot_cache_flush, "Frees the collision BSP snapshot cache" )
+{
+	CollisionBSPSnapshot_Trim( 0 );
+}
+
+//-----------------------------------------------------------------------------
+// Records how long CM_LoadMap took against the snapshot the map was restored
+// from or saved to. Both are timed over the whole load, so the numbers include
+// the physics, displacement and vis work a restore doesn't skip.
+//-----------------------------------------------------------------------------
+void CollisionBSPSnapshot_LoadMapDone( const char *pName, float flLoadMs )
+{
+	CollisionBSPSnapshot_t *pSnapshot = s_pLoadingSnapshot;
+	s_pLoadingSnapshot = NULL;
+	if ( !pSnapshot )
+		return;
+
+	if ( s_bLoadingSnapshotRestored )
+	{
+		pSnapshot->m_flLastRestoreLoadMs = flLoadMs;
+		DevMsg( "CM: loaded %s from snapshot in %.2f ms (decoding it took %.2f ms)\n", pName, flLoadMs, pSnapshot->m_flDecodeLoadMs );
+	}
+	else
+	{
+		pSnapshot->m_flDecodeLoadMs = flLoadMs;
+	}
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 bool CollisionBSPData_Load( const char *pName, CCollisionBSPData *pBSPData )
@@ -242,45 +513,69 @@ bool CollisionBSPData_Load( const char *pName, CCollisionBSPData *pBSPData )
 	// copy map name
 	Q_strncpy( pBSPData->map_name, pName, sizeof( pBSPData->map_name ) );
 
-	//
-	// load bsp file data
-	//
-	COM_TimestampedLog( "  CollisionBSPData_LoadTextures" );
-	CollisionBSPData_LoadTextures( pBSPData );
+	CollisionBSPSnapshot_Trim( MAX( cm_snapshot_cache.GetInt(), 0 ) );
+	unsigned int nHeaderChecksum = CMapLoadHelper::GetHeaderChecksum();
+	CollisionBSPSnapshot_t *pSnapshot = cm_snapshot_cache.GetInt() > 0 ? CollisionBSPSnapshot_Find( pName, nHeaderChecksum ) : NULL;
+	if ( pSnapshot )
+	{
+		COM_TimestampedLog( "  CollisionBSPSnapshot_Restore" );
+		CollisionBSPSnapshot_Restore( pSnapshot, pBSPData );
+		pSnapshot->m_nRestores++;
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadTexinfo" );
-	CollisionBSPData_LoadTexinfo( pBSPData, map_texinfo );
+		s_pLoadingSnapshot = pSnapshot;
+		s_bLoadingSnapshotRestored = true;
+	}
+	else
+	{
+		int nHunkMark = Hunk_LowMark();
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadLeafs" );
-	CollisionBSPData_LoadLeafs( pBSPData );
+		//
+		// load bsp file data
+		//
+		COM_TimestampedLog( "  CollisionBSPData_LoadTextures" );
+		CollisionBSPData_LoadTextures( pBSPData );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadLeafBrushes" );
-	CollisionBSPData_LoadLeafBrushes( pBSPData );
+		COM_TimestampedLog( "  CollisionBSPData_LoadTexinfo" );
+		CollisionBSPData_LoadTexinfo( pBSPData, map_texinfo );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadPlanes" );
-	CollisionBSPData_LoadPlanes( pBSPData );
+		COM_TimestampedLog( "  CollisionBSPData_LoadLeafs" );
+		CollisionBSPData_LoadLeafs( pBSPData );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadBrushes" );
-	CollisionBSPData_LoadBrushes( pBSPData );
+		COM_TimestampedLog( "  CollisionBSPData_LoadLeafBrushes" );
+		CollisionBSPData_LoadLeafBrushes( pBSPData );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadBrushSides" );
-	CollisionBSPData_LoadBrushSides( pBSPData, map_texinfo );
+		COM_TimestampedLog( "  CollisionBSPData_LoadPlanes" );
+		CollisionBSPData_LoadPlanes( pBSPData );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadSubmodels" );
-	CollisionBSPData_LoadSubmodels( pBSPData );
+		COM_TimestampedLog( "  CollisionBSPData_LoadBrushes" );
+		CollisionBSPData_LoadBrushes( pBSPData );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadPlanes" );
-	CollisionBSPData_LoadNodes( pBSPData );
+		COM_TimestampedLog( "  CollisionBSPData_LoadBrushSides" );
+		CollisionBSPData_LoadBrushSides( pBSPData, map_texinfo );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadAreas" );
-	CollisionBSPData_LoadAreas( pBSPData );
+		COM_TimestampedLog( "  CollisionBSPData_LoadSubmodels" );
+		CollisionBSPData_LoadSubmodels( pBSPData );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadAreaPortals" );
-	CollisionBSPData_LoadAreaPortals( pBSPData );
+		COM_TimestampedLog( "  CollisionBSPData_LoadPlanes" );
+		CollisionBSPData_LoadNodes( pBSPData );
 
-	COM_TimestampedLog( "  CollisionBSPData_LoadVisibility" );
-	CollisionBSPData_LoadVisibility( pBSPData );
+		COM_TimestampedLog( "  CollisionBSPData_LoadAreas" );
+		CollisionBSPData_LoadAreas( pBSPData );
 
+		COM_TimestampedLog( "  CollisionBSPData_LoadAreaPortals" );
+		CollisionBSPData_LoadAreaPortals( pBSPData );
+
+		COM_TimestampedLog( "  CollisionBSPData_LoadVisibility" );
+		CollisionBSPData_LoadVisibility( pBSPData );
+
+		if ( cm_snapshot_cache.GetInt() > 0 )
+		{
+			s_pLoadingSnapshot = CollisionBSPSnapshot_Save( pName, nHeaderChecksum, pBSPData, nHunkMark );
+			s_bLoadingSnapshotRestored = false;
+		}
+	}
+
+	// The entity string is kept with its file offset, so it always comes from the map
 	COM_TimestampedLog( "  CollisionBSPData_LoadEntityString" );
 	CollisionBSPData_LoadEntityString( pBSPData );
 
@@ -334,7 +629,9 @@ void CollisionBSPData_LoadTextures( CCollisionBSPData *pBSPData )
 
 	pBSPData->map_texturenames = (char *)Hunk_Alloc( lhStringData.LumpSize() * sizeof(char), false );
 	memcpy( pBSPData->map_texturenames, pStringData, lhStringData.LumpSize() );
- 
+
+	CUtlVector<const char *> materialNames;
+	materialNames.SetCount( count );
 	for ( i=0 ; i<count ; i++, in++ )
 	{
 		Assert( in->nameStringTableID >= 0 );
@@ -347,8 +644,17 @@ void CollisionBSPData_LoadTextures( CCollisionBSPData *pBSPData )
 		out->name = &pBSPData->map_texturenames[index];
 		out->surfaceProps = 0;
 		out->flags = 0;
+		materialNames[i] = out->name;
+	}
 
-		material = materials->FindMaterial( pBSPData->map_surfaces[i].name, TEXTURE_GROUP_WORLD, true );
+	// Load every world material in one batch so the .vmt parsing runs in parallel
+	CUtlVector<IMaterial *> worldMaterials;
+	worldMaterials.SetCount( count );
+	materials->FindMaterials( materialNames.Base(), count, TEXTURE_GROUP_WORLD, worldMaterials.Base(), true );
+
+	for ( i=0 ; i<count ; i++ )
+	{
+		material = worldMaterials[i];
 		if ( !IsErrorMaterial( material ) )
 		{
 			IMaterialVar *var;
@@ -42,6 +42,9 @@ int			CM_ClusterPVSSize();
 
 const byte	*CM_Vis( byte *dest, int destlen, int cluster, int visType );
 
+// Like CM_Vis, but returns the cached row without a copy when there is one (valid until the end of the frame, see cm_viscache)
+const byte	*CM_ClusterVisRow( byte *dest, int destlen, int cluster, int visType );
+
 int			CM_PointLeafnum( const Vector& p );
 void		CM_SnapPointToReferenceLeaf(const Vector &referenceLeafPoint, float tolerance, Vector *pSnapPoint);
 
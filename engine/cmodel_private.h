@@ -381,6 +381,7 @@ void CollisionBSPData_LinkPhysics( void );
 void CollisionBSPData_PreLoad( CCollisionBSPData *pBSPData );
 bool CollisionBSPData_Load( const char *pName, CCollisionBSPData *pBSPData );
 void CollisionBSPData_PostLoad( void );
+void CollisionBSPSnapshot_LoadMapDone( const char *pName, float flLoadMs );
 
 //-----------------------------------------------------------------------------
 // Returns the collision tree associated with the ith displacement
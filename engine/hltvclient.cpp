@@ -535,3 +535,61 @@ void CHLTVClient::SendSnapshot( CClientFrame * pFrame )
 		Disconnect( "ERROR! Couldn't send snapshot." );
 	}
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: returns false if the client only needs its reliable data transmitted,
+//			either because it already got this snapshot or is waiting for a
+//			full update to be acknowledged
+//-----------------------------------------------------------------------------
+bool CHLTVClient::NeedsSnapshot( CClientFrame *pFrame )
+{
+	return !( m_pLastSnapshot == pFrame->GetSnapshot() ) && ( m_nForceWaitForTick <= 0 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: true if this client may get a snapshot encoded for another client.
+//			Full updates are sent as reliable data and depend on the client
+//			baselines, fake clients don't transmit and traced clients annotate
+//			their own stream.
+//-----------------------------------------------------------------------------
+bool CHLTVClient::CanShareSnapshot( CClientFrame *pFrame )
+{
+	if ( m_bFakePlayer || IsTracing() )
+		return false;
+
+	return GetDeltaFrame( m_nDeltaTick ) != NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: main thread part of SendSnapshot for a shared snapshot. Marks pFrame
+//			as sent and returns the first frame whose messages still have to
+//			be sent by SendSharedSnapshot.
+//-----------------------------------------------------------------------------
+CHLTVFrame *CHLTVClient::BeginSharedSnapshot( CClientFrame *pFrame )
+{
+	CHLTVFrame *pLastFrame = (CHLTVFrame*) GetDeltaFrame( m_nLastSendTick );
+
+	m_pLastSnapshot = pFrame->GetSnapshot();
+	m_nLastSendTick = pFrame->tick_count;
+
+	// start first frame after last send
+	return pLastFrame ? (CHLTVFrame*) pLastFrame->m_pNext : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: transmit part of SendSnapshot for a delta snapshot encoded once for
+//			all clients with the same delta tick. Only touches this client's
+//			net channel, so it can run on a worker thread. Returns false if
+//			the client should be disconnected.
+//-----------------------------------------------------------------------------
+bool CHLTVClient::SendSharedSnapshot( CHLTVFrame *pFirstFrame, CClientFrame *pFrame, bf_write &snapshot )
+{
+	// add all reliable & unreliable messages between ]lastframe,currentframe]
+	for ( CHLTVFrame *pLastFrame = pFirstFrame; pLastFrame && pLastFrame->tick_count <= pFrame->tick_count; pLastFrame = (CHLTVFrame*) pLastFrame->m_pNext )
+	{
+		m_NetChannel->SendData( pLastFrame->m_Messages[HLTV_BUFFER_RELIABLE], true );
+		m_NetChannel->SendData( pLastFrame->m_Messages[HLTV_BUFFER_UNRELIABLE], false );
+	}
+
+	return m_NetChannel->SendDatagram( &snapshot ) > 0;
+}
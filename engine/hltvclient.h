@@ -13,6 +13,7 @@
 #include "baseclient.h"
 
 class CHLTVServer;
+class CHLTVFrame;
 
 class CHLTVClient : public CBaseClient
 {
@@ -59,6 +60,12 @@ public: // IClientMessageHandlers
 
 public:
 	CClientFrame *GetDeltaFrame( int nTick );
+
+	// shared snapshot fan-out, see CHLTVServer::SendClientMessages
+	bool	NeedsSnapshot( CClientFrame *pFrame );
+	bool	CanShareSnapshot( CClientFrame *pFrame );
+	CHLTVFrame *BeginSharedSnapshot( CClientFrame *pFrame );
+	bool	SendSharedSnapshot( CHLTVFrame *pFirstFrame, CClientFrame *pFrame, bf_write &snapshot );
 	
 public:
 	int		m_nLastSendTick;	// last send tick, don't send ticks twice
@@ -39,6 +39,7 @@
 #include "sv_steamauth.h"
 #include "tier0/icommandline.h"
 #include "sys_dll.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -87,6 +88,10 @@ ConVar tv_debug( "tv_debug", "0", 0, "SourceTV debug info." );
 ConVar tv_title( "tv_title", "SourceTV", 0, "Set title for SourceTV spectator UI", tv_title_changed_f );
 static ConVar tv_deltacache( "tv_deltacache", "2", 0, "Enable delta entity bit stream cache" );
 static ConVar tv_relayvoice( "tv_relayvoice", "1", 0, "Relay voice data: 0=off, 1=on" );
+static ConVar tv_framecompress( "tv_framecompress", "0", 0, "Compress messages of frames waiting in the SourceTV delay buffer" );
+static ConVar tv_framecompress_ceiling( "tv_framecompress_ceiling", "16", 0, "Uncompressed SourceTV delay buffer messages (MB) kept before new frames are compressed", true, 0, false, 0 );
+static ConVar tv_framecompress_minbytes( "tv_framecompress_minbytes", "256", 0, "Don't compress SourceTV frames with fewer message bytes", true, 0, false, 0 );
+static ConVar tv_snapshot_fanout( "tv_snapshot_fanout", "0", 0, "Send snapshots to SourceTV clients: 0=encode per client, 1=encode delta snapshots once per delta tick, 2=also transmit in parallel" );
 
 CDeltaEntityCache::CDeltaEntityCache()
 {
@@ -361,7 +366,12 @@ void CHLTVServer::InitClientRecvTables()
 
 CHLTVFrame::CHLTVFrame()
 {
-	
+	m_pCompressJob = NULL;
+	Q_memset( m_pPackedMessages, 0, sizeof( m_pPackedMessages ) );
+	Q_memset( m_nPackedBytes, 0, sizeof( m_nPackedBytes ) );
+	Q_memset( m_nPackedBits, 0, sizeof( m_nPackedBits ) );
+	m_nCompressedSize = 0;
+	m_flCompressTime = 0.0f;
 }
 
 CHLTVFrame::~CHLTVFrame()
@@ -434,8 +444,20 @@ void CHLTVFrame::AllocBuffers( void )
 
 void CHLTVFrame::FreeBuffers( void )
 {
+	if ( m_pCompressJob )
+	{
+		m_pCompressJob->WaitForFinishAndRelease();
+		m_pCompressJob = NULL;
+	}
+
 	for ( int i=0; i<HLTV_BUFFER_MAX; i++ )
 	{
+		if ( m_pPackedMessages[i] )
+		{
+			free( m_pPackedMessages[i] );
+			m_pPackedMessages[i] = NULL;
+		}
+
 		bf_write &msg = m_Messages[i];
 
 		if ( msg.GetBasePointer() )
@@ -446,6 +468,88 @@ void CHLTVFrame::FreeBuffers( void )
 	}
 }
 
+int CHLTVFrame::GetMessageBytes( void )
+{
+	int nBytes = 0;
+
+	for ( int i=0; i<HLTV_BUFFER_MAX; i++ )
+	{
+		nBytes += m_Messages[i].GetNumBytesWritten();
+	}
+
+	return nBytes;
+}
+
+void CHLTVFrame::CompressMessages( void )
+{
+	CFastTimer timer;
+	timer.Start();
+
+	m_nCompressedSize = 0;
+
+	for ( int i=0; i<HLTV_BUFFER_MAX; i++ )
+	{
+		bf_write &msg = m_Messages[i];
+		int nBytes = msg.GetNumBytesWritten();
+
+		if ( nBytes <= 0 )
+			continue;
+
+		// keep buffers snappy can't shrink
+		unsigned int nPackedBytes = 0;
+		void *pPacked = COM_CompressBuffer_Snappy( msg.GetBasePointer(), nBytes, &nPackedBytes, nBytes );
+
+		if ( !pPacked )
+		{
+			m_nCompressedSize += nBytes;
+			continue;
+		}
+
+		m_pPackedMessages[i] = pPacked;
+		m_nPackedBytes[i] = nPackedBytes;
+		m_nPackedBits[i] = msg.GetNumBitsWritten();
+		m_nCompressedSize += nPackedBytes;
+
+		delete[] msg.GetBasePointer();
+		msg.StartWriting( NULL, 0 );
+	}
+
+	timer.End();
+	m_flCompressTime = timer.GetDuration().GetMillisecondsF();
+}
+
+void CHLTVFrame::UncompressMessages( void )
+{
+	if ( !m_pCompressJob )
+		return;
+
+	m_pCompressJob->WaitForFinishAndRelease();
+	m_pCompressJob = NULL;
+
+	for ( int i=0; i<HLTV_BUFFER_MAX; i++ )
+	{
+		if ( !m_pPackedMessages[i] )
+			continue;
+
+		int bits = m_nPackedBits[i];
+		int bytes = PAD_NUMBER( Bits2Bytes(bits), 4 );
+		unsigned int nUncompressedBytes = bytes;
+
+		char *pData = new char[ bytes ];
+
+		if ( !COM_BufferToBufferDecompress( pData, &nUncompressedBytes, m_pPackedMessages[i], m_nPackedBytes[i] ) )
+		{
+			ConMsg( "SourceTV failed to uncompress frame %i messages.\n", tick_count );
+			bits = 0;
+		}
+
+		m_Messages[i].StartWriting( pData, bytes, bits );
+
+		free( m_pPackedMessages[i] );
+		m_pPackedMessages[i] = NULL;
+	}
+}
+
 CHLTVServer::CHLTVServer()
 {
 	m_flTickInterval = 0.03;
@@ -475,6 +579,17 @@ CHLTVServer::CHLTVServer()
 	m_nGlobalSlots = 0;
 	m_nGlobalClients = 0;
 	m_nGlobalProxies = 0;
+	m_nSharedSnapshots = 0;
+	m_nFanoutFrames = 0;
+	m_nFanoutClients = 0;
+	m_nFanoutEncodes = 0;
+	m_FanoutTime.Init();
+	m_nDelayRawBytes = 0;
+	m_nCompressedFrames = 0;
+	m_flCompressedRawBytes = 0;
+	m_flCompressedBytes = 0;
+	m_flCompressTime = 0;
+	m_flUncompressTime = 0;
 }
 
 CHLTVServer::~CHLTVServer()
@@ -485,6 +600,8 @@ CHLTVServer::~CHLTVServer()
 		FreeClientRecvTables();
 	}
 
+	m_SharedSnapshots.PurgeAndDeleteElements();
+
 	// make sure everything was destroyed
 	Assert( m_CurrentFrame == NULL );
 	Assert( CountClientFrames() == 0 );
@@ -1358,6 +1475,11 @@ CClientFrame *CHLTVServer::AddNewFrame( CClientFrame *clientFrame )
 	// add frame to HLTV server
 	AddClientFrame( hltvFrame );
 
+	if ( IsMasterProxy() )
+	{
+		CompressFrame( hltvFrame );
+	}
+
 	if ( IsMasterProxy() && m_DemoRecorder.IsRecording() )
 	{
 		m_DemoRecorder.WriteFrame( &m_HLTVFrame );
@@ -1370,8 +1492,182 @@ CClientFrame *CHLTVServer::AddNewFrame( CClientFrame *clientFrame )
 	return hltvFrame;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: new frames wait tv_delay seconds before they are broadcast. Once the
+//			uncompressed messages of waiting frames exceed the ceiling, compress
+//			new frames on a worker thread until UncompressFrames needs them.
+//-----------------------------------------------------------------------------
+void CHLTVServer::CompressFrame( CHLTVFrame *pFrame )
+{
+	int nBytes = pFrame->GetMessageBytes();
+	int nCeiling = tv_framecompress_ceiling.GetFloat() * 1024 * 1024;
+
+	if ( tv_framecompress.GetBool() && g_pThreadPool &&
+		 nBytes >= tv_framecompress_minbytes.GetInt() &&
+		 m_nDelayRawBytes + nBytes > nCeiling )
+	{
+		pFrame->m_pCompressJob = g_pThreadPool->QueueCall( pFrame, &CHLTVFrame::CompressMessages );
+		return;
+	}
+
+	m_nDelayRawBytes += nBytes;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: restores all frames up to pNewFrame before it becomes current, so
+//			clients always read uncompressed messages
+//-----------------------------------------------------------------------------
+void CHLTVServer::UncompressFrames( CHLTVFrame *pNewFrame )
+{
+	VPROF_BUDGET( "CHLTVServer::UncompressFrames", "HLTV" );
+
+	if ( m_CurrentFrame && m_CurrentFrame->tick_count >= pNewFrame->tick_count )
+		return;	// older frames are uncompressed already
+
+	CHLTVFrame *pFrame = (CHLTVFrame*)( m_CurrentFrame ? m_CurrentFrame->m_pNext : GetClientFrame( 0, false ) );
+
+	while ( pFrame )
+	{
+		if ( pFrame->m_pCompressJob )
+		{
+			CFastTimer timer;
+			timer.Start();
+			pFrame->UncompressMessages();
+			timer.End();
+
+			m_nCompressedFrames++;
+			m_flCompressedRawBytes += pFrame->GetMessageBytes();
+			m_flCompressedBytes += pFrame->m_nCompressedSize;
+			m_flCompressTime += pFrame->m_flCompressTime;
+			m_flUncompressTime += timer.GetDuration().GetMillisecondsF();
+		}
+		else
+		{
+			m_nDelayRawBytes = max( 0, m_nDelayRawBytes - pFrame->GetMessageBytes() );
+		}
+
+		if ( pFrame == pNewFrame )
+			break;
+
+		pFrame = (CHLTVFrame*) pFrame->m_pNext;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: returns the encoded delta snapshot for this client, encoding it if
+//			no other client with the same delta state got one this frame
+//-----------------------------------------------------------------------------
+CHLTVSharedSnapshot *CHLTVServer::GetSharedSnapshot( CHLTVClient *client )
+{
+	int nDeltaTick = client->m_nDeltaTick;
+	int nStringTableTick = client->GetMaxAckTickCount();
+
+	for ( int i = 0; i < m_nSharedSnapshots; i++ )
+	{
+		CHLTVSharedSnapshot *pSnapshot = m_SharedSnapshots[i];
+
+		if ( !pSnapshot->m_bShared ||
+			 pSnapshot->m_nDeltaTick != nDeltaTick ||
+			 pSnapshot->m_nStringTableTick != nStringTableTick ||
+			 pSnapshot->m_nBaselineUsed != client->m_nBaselineUsed )
+			continue;
+
+		// WriteDeltaEntities would have prepared this frame as baseline update
+		if ( client->m_nBaselineUpdateTick == -1 )
+		{
+			client->m_BaselinesSent.ClearAll();
+			m_CurrentFrame->from_baseline = &client->m_BaselinesSent;
+		}
+
+		return pSnapshot;
+	}
+
+	VPROF_BUDGET( "CHLTVServer::GetSharedSnapshot", "HLTV" );
+
+	ALIGN4 byte		buf[NET_MAX_PAYLOAD] ALIGN4_POST;
+	bf_write	msg( "CHLTVServer::GetSharedSnapshot", buf, sizeof(buf) );
+
+	// send tick time
+	NET_Tick tickmsg( m_CurrentFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
+	tickmsg.WriteToBuffer( msg );
+
+	// Update shared client/server string tables. Must be done before sending entities
+	m_StringTables->WriteUpdateMessage( NULL, nStringTableTick, msg );
+
+	bool bClientSpecific = true;
+	WriteDeltaEntities( client, m_CurrentFrame, client->GetDeltaFrame( nDeltaTick ), msg, &bClientSpecific );
+
+	if ( msg.IsOverflowed() )
+	{
+		// unreliable snapshots may be dropped
+		ConMsg ("WARNING: msg overflowed for %s\n", client->GetClientName() );
+		msg.Reset();
+	}
+
+	if ( m_nSharedSnapshots == m_SharedSnapshots.Count() )
+	{
+		m_SharedSnapshots.AddToTail( new CHLTVSharedSnapshot );
+	}
+
+	CHLTVSharedSnapshot *pSnapshot = m_SharedSnapshots[m_nSharedSnapshots++];
+
+	pSnapshot->m_nDeltaTick = nDeltaTick;
+	pSnapshot->m_nStringTableTick = nStringTableTick;
+	pSnapshot->m_nBaselineUsed = client->m_nBaselineUsed;
+	pSnapshot->m_bShared = !bClientSpecific;
+	pSnapshot->m_nBits = msg.GetNumBitsWritten();
+
+	// bf_write needs dword aligned buffers
+	int nBytes = ( ( msg.GetNumBytesWritten() + 3 ) & ~3 ) + 4;
+	pSnapshot->m_Data.EnsureCapacity( nBytes );
+	Q_memcpy( pSnapshot->m_Data.Base(), buf, msg.GetNumBytesWritten() );
+
+	m_nFanoutEncodes++;
+
+	return pSnapshot;
+}
+
+struct HLTVSendJob_t
+{
+	CHLTVClient			*pClient;
+	CClientFrame		*pFrame;
+	CHLTVFrame			*pFirstFrame;
+	CHLTVSharedSnapshot	*pSnapshot;	// NULL = just send reliable data
+	bool				bSendOK;
+};
+
+static void HLTV_ParallelSendSnapshot( HLTVSendJob_t &job )
+{
+	CHLTVSharedSnapshot *pSnapshot = job.pSnapshot;
+
+	if ( !pSnapshot )
+	{
+		// Connected, but inactive or nothing new, just send reliable, sequenced info.
+		job.pClient->m_NetChannel->Transmit();
+		return;
+	}
+
+	bf_write snapshot( "HLTV_ParallelSendSnapshot", pSnapshot->m_Data.Base(), pSnapshot->m_Data.NumAllocated() & ~3 );
+	snapshot.SeekToBit( pSnapshot->m_nBits );
+
+	job.bSendOK = job.pClient->SendSharedSnapshot( job.pFirstFrame, job.pFrame, snapshot );
+}
+
 void CHLTVServer::SendClientMessages ( bool bSendSnapshots )
 {
+	VPROF_BUDGET( "CHLTVServer::SendClientMessages", "HLTV" );
+
+	CFastTimer timer;
+	timer.Start();
+
+	// all spectators see the same world, so with fan-out enabled delta snapshots
+	// are encoded once per delta state and only the net channel work is per client
+	int nFanout = m_CurrentFrame ? tv_snapshot_fanout.GetInt() : 0;
+	int nSnapshots = 0;
+
+	CUtlVector<HLTVSendJob_t> jobs;
+	m_nSharedSnapshots = 0;
+
 	// build individual updates
 	for ( int i=0; i< m_Clients.Count(); i++ )
 	{
@@ -1383,9 +1679,39 @@ void CHLTVServer::SendClientMessages ( bool bSendSnapshots )
 			continue;
 		}
 
+		if ( nFanout > 0 )
+		{
+			bool bSnapshot = client->IsActive() && client->NeedsSnapshot( m_CurrentFrame );
+
+			// full updates are still built per client below
+			if ( !bSnapshot || client->CanShareSnapshot( m_CurrentFrame ) )
+			{
+				HLTVSendJob_t &job = jobs[ jobs.AddToTail() ];
+				job.pClient = client;
+				job.pFrame = m_CurrentFrame;
+				job.pFirstFrame = NULL;
+				job.pSnapshot = NULL;
+				job.bSendOK = true;
+
+				if ( bSnapshot )
+				{
+					job.pSnapshot = GetSharedSnapshot( client );
+					job.pFirstFrame = client->BeginSharedSnapshot( m_CurrentFrame );
+					nSnapshots++;
+				}
+				continue;
+			}
+		}
+
 		// Append the unreliable data (player updates and packet entities)
 		if ( m_CurrentFrame && client->IsActive() )
 		{
+			if ( client->NeedsSnapshot( m_CurrentFrame ) )
+			{
+				nSnapshots++;
+				m_nFanoutEncodes++;
+			}
+
 			// don't send same snapshot twice
 			client->SendSnapshot( m_CurrentFrame );
 		}
@@ -1398,6 +1724,40 @@ void CHLTVServer::SendClientMessages ( bool bSendSnapshots )
 		client->UpdateSendState();
 		client->m_fLastSendTime = net_time;
 	}
+
+	if ( nFanout > 1 && jobs.Count() > 1 )
+	{
+		ParallelProcess( "HLTV_ParallelSendSnapshot", jobs.Base(), jobs.Count(), &HLTV_ParallelSendSnapshot );
+	}
+	else
+	{
+		FOR_EACH_VEC( jobs, i )
+		{
+			HLTV_ParallelSendSnapshot( jobs[i] );
+		}
+	}
+
+	FOR_EACH_VEC( jobs, i )
+	{
+		CHLTVClient *client = jobs[i].pClient;
+
+		if ( !jobs[i].bSendOK )
+		{
+			client->Disconnect( "ERROR! Couldn't send snapshot." );
+		}
+
+		client->UpdateSendState();
+		client->m_fLastSendTime = net_time;
+	}
+
+	timer.End();
+
+	if ( nSnapshots > 0 )
+	{
+		m_nFanoutFrames++;
+		m_nFanoutClients += nSnapshots;
+		m_FanoutTime += timer.GetDuration();
+	}
 }
 
 void CHLTVServer::UpdateStats( void )
@@ -1608,6 +1968,11 @@ void CHLTVServer::UpdateTick( void )
 	if ( m_CurrentFrame == newFrame )
 		return;	// current frame didn't change
 
+	if ( IsMasterProxy() )
+	{
+		UncompressFrames( newFrame );
+	}
+
 	m_CurrentFrame = newFrame;
 	m_nTickCount = m_CurrentFrame->tick_count;
 	
@@ -1677,6 +2042,7 @@ void CHLTVServer::Clear( void )
 
 	m_DeltaCache.Flush();
 	m_FrameCache.RemoveAll();
+	m_nDelayRawBytes = 0;
 }
 
 bool CHLTVServer::ProcessConnectionlessPacket( netpacket_t * packet )
@@ -2372,6 +2738,88 @@ CON_COMMAND( tv_clients, "Shows list of connected SourceTV clients." )
 	ConMsg("--- Total %i connected clients ---\n", nCount );
 }
 
+CON_COMMAND( tv_snapshot_stats, "Shows SourceTV snapshot fan-out costs, \"reset\" clears them." )
+{
+	if ( !hltv || !hltv->IsActive() )
+	{
+		ConMsg("SourceTV not active.\n" );
+		return;
+	}
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		hltv->m_nFanoutFrames = 0;
+		hltv->m_nFanoutClients = 0;
+		hltv->m_nFanoutEncodes = 0;
+		hltv->m_FanoutTime.Init();
+		return;
+	}
+
+	int nFrames = MAX( hltv->m_nFanoutFrames, 1 );
+	int nClients = MAX( hltv->m_nFanoutClients, 1 );
+	double flTotalUS = hltv->m_FanoutTime.GetMicrosecondsF();
+
+	ConMsg("Fan-out mode %i, %i frames, %.1f snapshots/frame, %.1f encodes/frame\n",
+		tv_snapshot_fanout.GetInt(), hltv->m_nFanoutFrames,
+		(float)hltv->m_nFanoutClients / nFrames, (float)hltv->m_nFanoutEncodes / nFrames );
+
+	ConMsg("SendClientMessages %.1f us/frame, %.2f us/snapshot\n",
+		flTotalUS / nFrames, flTotalUS / nClients );
+}
+
+CON_COMMAND( tv_framecompress_stats, "Shows SourceTV delay buffer memory and compression costs." )
+{
+	if ( !hltv || !hltv->IsActive() )
+	{
+		ConMsg("SourceTV not active.\n" );
+		return;
+	}
+
+	int nFrames = 0, nHistoryBytes = 0;
+	int nWaiting = 0, nRawBytes = 0, nPacked = 0, nPackedBytes = 0, nPending = 0;
+
+	for ( CHLTVFrame *pFrame = (CHLTVFrame*) hltv->GetClientFrame( 0, false ); pFrame; pFrame = (CHLTVFrame*) pFrame->m_pNext )
+	{
+		nFrames++;
+
+		if ( !hltv->m_CurrentFrame || pFrame->tick_count <= hltv->m_CurrentFrame->tick_count )
+		{
+			nHistoryBytes += pFrame->GetMessageBytes();
+			continue;
+		}
+
+		nWaiting++;
+
+		if ( !pFrame->m_pCompressJob )
+		{
+			nRawBytes += pFrame->GetMessageBytes();
+		}
+		else if ( pFrame->m_pCompressJob->IsFinished() )
+		{
+			nPacked++;
+			nPackedBytes += pFrame->m_nCompressedSize;
+		}
+		else
+		{
+			nPending++;
+		}
+	}
+
+	ConMsg("%i frames, %i broadcast (%.1f KB messages), %i waiting in delay buffer\n",
+		nFrames, nFrames - nWaiting, nHistoryBytes / 1024.0f, nWaiting );
+
+	ConMsg("Waiting: %i uncompressed (%.1f KB, ceiling %.1f MB), %i compressed (%.1f KB), %i compressing\n",
+		nWaiting - nPacked - nPending, nRawBytes / 1024.0f, tv_framecompress_ceiling.GetFloat(),
+		nPacked, nPackedBytes / 1024.0f, nPending );
+
+	int nCompressed = MAX( hltv->m_nCompressedFrames, 1 );
+
+	ConMsg("Broadcast %i compressed frames, ratio %.2f, compress %.3f ms/frame (worker), uncompress %.3f ms/frame (main)\n",
+		hltv->m_nCompressedFrames,
+		hltv->m_flCompressedBytes > 0 ? hltv->m_flCompressedRawBytes / hltv->m_flCompressedBytes : 1.0,
+		hltv->m_flCompressTime / nCompressed, hltv->m_flUncompressTime / nCompressed );
+}
+
 CON_COMMAND( tv_msg, "Send a screen message to all clients." )
 {
 	if ( !hltv || !hltv->IsActive() )
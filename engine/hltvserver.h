@@ -18,6 +18,7 @@
 #include "networkstringtable.h"
 #include <ihltv.h>
 #include <convar.h>
+#include "tier0/fasttimer.h"
 
 #define HLTV_BUFFER_DIRECTOR		0	// director commands
 #define	HLTV_BUFFER_RELIABLE		1	// reliable messages
@@ -34,6 +35,8 @@
 
 extern ConVar tv_debug;
 
+class CJob;
+
 class CHLTVFrame : public CClientFrame
 {
 public:
@@ -47,10 +50,23 @@ public:
 	void	CopyHLTVData( CHLTVFrame &frame );
 	virtual bool IsMemPoolAllocated() { return false; }
 
+	// delay buffer compression, see CHLTVServer::CompressFrame
+	int		GetMessageBytes();
+	void	CompressMessages();		// runs on a worker thread
+	void	UncompressMessages();	// waits for pending compression
+
 public:
 
 	// message buffers:
 	bf_write	m_Messages[HLTV_BUFFER_MAX];
+
+	// snappy compressed message buffers while waiting in the delay buffer
+	CJob		*m_pCompressJob;	// != NULL if messages are or will be compressed
+	void		*m_pPackedMessages[HLTV_BUFFER_MAX];
+	unsigned int m_nPackedBytes[HLTV_BUFFER_MAX];
+	int			m_nPackedBits[HLTV_BUFFER_MAX];
+	int			m_nCompressedSize;	// resident message bytes after compression
+	float		m_flCompressTime;	// ms spent in CompressMessages
 };
 
 struct CFrameCacheEntry_s
@@ -84,6 +100,17 @@ protected:
 	DeltaEntityEntry_s* m_Cache[MAX_EDICTS]; // array of pointers to delta entries
 };
 
+// delta snapshot body (tick, string tables & entities) encoded once and sent to
+// all clients with the same delta tick, string table ack tick and baseline flag
+struct CHLTVSharedSnapshot
+{
+	int		m_nDeltaTick;
+	int		m_nStringTableTick;
+	int		m_nBaselineUsed;
+	bool	m_bShared;		// false if encoded against the baselines of a single client
+	int		m_nBits;
+	CUtlMemory<byte> m_Data;
+};
 
 class CGameClient;
 class CGameServer;
@@ -205,6 +232,9 @@ private:
 	void		FreeClientRecvTables();
 	void		ReadCompleteDemoFile();
 	void		ResyncDemoClock();
+	CHLTVSharedSnapshot *GetSharedSnapshot( CHLTVClient *client );
+	void		CompressFrame( CHLTVFrame *pFrame );
+	void		UncompressFrames( CHLTVFrame *pNewFrame );
 
 #ifndef NO_STEAM
 	void		ReplyInfo( const netadr_t &adr );
@@ -247,6 +277,24 @@ public:
 	CDeltaEntityCache				m_DeltaCache;
 	CUtlVector<CFrameCacheEntry_s>	m_FrameCache;
 
+	// snapshots encoded by the last SendClientMessages, reused between calls
+	CUtlVector<CHLTVSharedSnapshot*> m_SharedSnapshots;
+	int				m_nSharedSnapshots;
+
+	// snapshot fan-out stats, see tv_snapshot_stats
+	int				m_nFanoutFrames;
+	int				m_nFanoutClients;	// snapshots sent
+	int				m_nFanoutEncodes;	// snapshots encoded
+	CCycleCount		m_FanoutTime;
+
+	// delay buffer compression, see tv_framecompress_stats
+	int				m_nDelayRawBytes;	// uncompressed message bytes of frames waiting for broadcast
+	int				m_nCompressedFrames;
+	double			m_flCompressedRawBytes;
+	double			m_flCompressedBytes;
+	double			m_flCompressTime;	// ms on worker threads
+	double			m_flUncompressTime;	// ms on main thread
+
 	// demoplayer stuff:
 	CDemoFile		m_DemoFile;		// for demo playback
 	int				m_nStartTick;
@@ -706,6 +706,14 @@ int CMapLoadHelper::LumpOffset( int lumpID  )
 	return pLump->fileofs;
 }
 
+//-----------------------------------------------------------------------------
+// Returns the CRC of the map header
+//-----------------------------------------------------------------------------
+unsigned int CMapLoadHelper::GetHeaderChecksum( void )
+{
+	return CRC32_ProcessSingleBuffer( &s_MapHeader, sizeof( s_MapHeader ) );
+}
+
 //-----------------------------------------------------------------------------
 // Loads one element in a lump.
 //-----------------------------------------------------------------------------
@@ -5018,6 +5026,15 @@ void CModelLoader::DumpVCollideStats()
 	physcollision->GetBBoxCacheSize( &bboxSize, &bboxCount );
 	Msg( "%8d bytes BBox physics: %d boxes\n", bboxSize, bboxCount );
 	totalVCollideMemory += bboxSize;
+
+	// identical solids are shared between models, so the per-model sizes above count them more than once
+	int savedBytes = physcollision->ReadStat( PHYSCOLLISION_STAT_VCOLLIDE_SAVED_BYTES );
+	Msg( "%8d bytes shared: %d unique solids, %d shared loads, %.1f ms load time (%.1f ms saved)\n", -savedBytes,
+		physcollision->ReadStat( PHYSCOLLISION_STAT_VCOLLIDE_UNIQUE_SOLIDS ),
+		physcollision->ReadStat( PHYSCOLLISION_STAT_VCOLLIDE_SHARED_REFS ),
+		physcollision->ReadStat( PHYSCOLLISION_STAT_VCOLLIDE_LOAD_USEC ) * 0.001f,
+		physcollision->ReadStat( PHYSCOLLISION_STAT_VCOLLIDE_SAVED_USEC ) * 0.001f );
+	totalVCollideMemory -= savedBytes;
 	Msg( "--------------\n%8d bytes total VCollide Memory\n", totalVCollideMemory );
 }
 
@@ -191,6 +191,9 @@ public:
 	static int			LumpSize( int lumpId );
 	static int			LumpOffset( int lumpId );
 
+	// CRC of the map header (version, revision and lump directory), identifies a particular compile of a map
+	static unsigned int	GetHeaderChecksum( void );
+
 	// Loads one element in a lump.
 	void				LoadLumpElement( int nElemIndex, int nElemSize, void *pData );
 	void				LoadLumpData( int offset, int size, void *pData );
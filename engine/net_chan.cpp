@@ -2518,6 +2518,16 @@ int CNetChan::GetNumBitsWritten( bool bReliable )
 	return pStream->GetNumBitsWritten();
 }
 
+int CNetChan::GetNumBitsLeft( bool bReliable )
+{
+	bf_write *pStream = &m_StreamUnreliable;
+	if ( bReliable )
+	{
+		pStream = &m_StreamReliable;
+	}
+	return pStream->GetNumBitsLeft();
+}
+
 bool CNetChan::SendNetMsg( INetMessage &msg, bool bForceReliable, bool bVoice )
 {
 	if ( remote_address.GetType() == NA_NULL )
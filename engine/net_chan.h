@@ -191,6 +191,7 @@ public:	// INetChannel interface
 	bool		HasPendingReliableData( void );
 	void		SetMaxBufferSize(bool bReliable, int nBytes, bool bVoice = false );
 	virtual int		GetNumBitsWritten( bool bReliable );
+	virtual int		GetNumBitsLeft( bool bReliable );
 	virtual void	SetInterpolationAmount( float flInterpolationAmount );
 	virtual void	SetRemoteFramerate( float flFrameTime, float flFrameTimeStdDeviation );
 
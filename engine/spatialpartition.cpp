@@ -32,6 +32,7 @@
 #include "bitvec.h"
 #include "host.h"
 #include "tier1/mempool.h"
+#include "vstdlib/random.h"
 
 #ifdef _PS3
 #include "tls_ps3.h"
@@ -51,12 +52,13 @@ class CIntersectSweptBox;
 #define SPHASH_VOXEL_LARGE	65536.0f
 
 #define SPHASH_HANDLELIST_BLOCK		256
-#define SPHASH_LEAFLIST_BLOCK		512
-#define SPHASH_ENTITYLIST_BLOCK		256
+#define SPHASH_VOXELLIST_BLOCK		256
 #define SPHASH_BUCKET_COUNT			512
 
 #define SPHASH_EPS					0.03125f
 
+#define SPHASH_VOXEL_SLOTS			8			// voxel list positions kept per entity, enough for the 2x2x2 voxels below the top level
+
 enum PartitionTrees_t
 {
 	CLIENT_TREE,
@@ -100,26 +102,17 @@ enum EntityInfoFlags_t
 struct EntityInfo_t
 {
 	Vector						m_vecMin;			// Min/Max of entity
-	Voxel_t						m_voxelMin;
+	Voxel_t						m_voxelMin[NUM_TREES];	// Voxel range it was inserted into, at m_nLevel
 	Vector						m_vecMax;
-	Voxel_t						m_voxelMax;
+	Voxel_t						m_voxelMax[NUM_TREES];
 	IHandleEntity *				m_pHandleEntity;	// Entity handle.
 	unsigned short				m_fList;			// Which lists is it in?
 	uint8						m_flags;
-	char						m_nLevel[NUM_TREES];	// Which level voxel tree is it in?
+	char						m_nLevel[NUM_TREES];	// Which level voxel tree is it in? -1 when it isn't in the tree
 	unsigned short				m_nVisitBit[NUM_TREES];
-	intp						m_iLeafList[NUM_TREES];	// Index into the leaf pool - leaf list for entity (m_aLeafList).
-};
-
-
-struct LeafListData_t
-{
-	UtlHashFixedHandle_t		m_hVoxel;	// Voxel handle the entity is in.
-	intp					m_iEntity;	// Entity list index for voxel
+	unsigned short				m_nVoxelSlot[NUM_TREES][SPHASH_VOXEL_SLOTS];	// Its index in each voxel list it's in, see CVoxelHash::VoxelSlot
 };
 
-typedef CUtlFixedLinkedList<LeafListData_t>	CLeafList;
-
 typedef CVarBitVec CPartitionVisits;
 
 //-----------------------------------------------------------------------------
@@ -155,12 +148,25 @@ inline Voxel_t ConvertToNextLevel( Voxel_t v )
 	return res;
 }
 
-class CSpatialEntry
+//-----------------------------------------------------------------------------
+// The entities in one voxel. Handles and list masks are kept in parallel
+// arrays so the list mask test walks contiguous memory. Entries are added at
+// the tail and removed by moving the tail into the hole, so the order is not
+// stable while a query's enumerator changes the tree.
+//-----------------------------------------------------------------------------
+struct CVoxelEntityList
 {
-public:
-	SpatialPartitionHandle_t m_handle;
-	uint16 m_nListMask;
+	CVoxelEntityList() : m_nRemoveCount( 0 ) {}
+
+	int Count() const	{ return m_Handles.Count(); }
+
+	CUtlVector<SpatialPartitionHandle_t>	m_Handles;
+	CUtlVector<uint16>						m_ListMasks;
+	unsigned int							m_nRemoveCount;		// Bumped on every removal, see EnumerateElementsInSingleVoxel
 };
+
+// Handles copied out of a voxel by the single voxel queries
+typedef CUtlVectorFixedGrowable<SpatialPartitionHandle_t, 128> CVoxelHandleSnapshot;
 //-----------------------------------------------------------------------------
 // A single voxel hash
 //-----------------------------------------------------------------------------
@@ -183,8 +189,11 @@ public:
 	
 	// Inserts/Removes a handle from the tree.
 	void InsertIntoTree( SpatialPartitionHandle_t hPartition, Voxel_t voxelMin, Voxel_t voxelMax );
-	void RemoveFromTree( SpatialPartitionHandle_t hPartition );
-	void UpdateListMask( SpatialPartitionHandle_t hPartition );
+	void RemoveFromTree( SpatialPartitionHandle_t hPartition, Voxel_t voxelMin, Voxel_t voxelMax, bool bDeferFree );
+	void UpdateListMask( SpatialPartitionHandle_t hPartition, Voxel_t voxelMin, Voxel_t voxelMax );
+
+	// Releases voxels emptied while a query was suspended
+	void FreeEmptyVoxels();
 
 	// Debug!
 	void RenderAllObjectsInTree( float flTime );
@@ -231,12 +240,27 @@ private:
 
 	inline void PackVoxel( int iX, int iY, int iZ, Voxel_t &voxel );
 
+	// Returns the index of the voxel's entity list, -1 if the voxel is empty
+	inline int FindVoxelList( Voxel_t voxel );
+
+	// Where in EntityInfo_t::m_nVoxelSlot an entity keeps its index in a voxel's list
+	static inline int VoxelSlot( Voxel_t voxel, Voxel_t voxelMin, Voxel_t voxelMax );
+	inline int FindInVoxelList( const CVoxelEntityList &list, Voxel_t voxel, SpatialPartitionHandle_t hPartition );
+	inline void SetVoxelListIndex( Voxel_t voxel, SpatialPartitionHandle_t hPartition, int iEntity );
+
+	// Single voxel queries enumerate from a copy of the voxel's handles
+	unsigned int SnapshotVoxelList( int iList, SpatialPartitionListMask_t listMask, CVoxelHandleSnapshot &handles );
+	inline bool IsInVoxelList( int iList, unsigned int nRemoveCount, SpatialPartitionHandle_t hPartition );
+	void FreeVoxel( UtlHashFixedHandle_t hHash );
+
     typedef CUtlHashFixed<intp, SPHASH_BUCKET_COUNT, CUtlHashFixedGenericHash<SPHASH_BUCKET_COUNT> > CHashTable;
 
 	Vector											m_vecVoxelOrigin;	// Voxel space (hash) origin.
-	CHashTable										m_aVoxelHash;		// Voxel tree (hash) - data = entity list head handle (m_aEntityList)
+	CHashTable										m_aVoxelHash;		// Voxel tree (hash) - data = entity list index (m_aVoxelLists)
 	int												m_nVoxelDelta[3];	// Voxel world - width(Dx), height(Dy), depth(Dz)
-	CUtlFixedLinkedList<CSpatialEntry>				m_aEntityList;	// Pool - Linked list(multilist) of entities per leaf.
+	CUtlVector<CVoxelEntityList>					m_aVoxelLists;		// Pool - entities per voxel.
+	CUtlVector<int>									m_aFreeVoxelLists;	// Unused entries in m_aVoxelLists.
+	CUtlVector<unsigned int>						m_aEmptyVoxels;		// Voxels emptied while a query was suspended, see CVoxelTree::BeginWrite.
 	CVoxelTree										*m_pTree;
 	int												m_nLevel;
 	float											m_flVoxelSize;
@@ -272,7 +296,6 @@ public:
 	virtual void DrawDebugOverlays();
 
 	EntityInfo_t &EntityInfo( SpatialPartitionHandle_t hPartition );
-	CLeafList &LeafList();
 
 	int GetTreeId() const;
 
@@ -296,6 +319,11 @@ public:
 	void LockForRead()		{ m_lock.LockForRead(); }
 	void UnlockRead()		{ m_lock.UnlockRead(); }
 
+	// Take the write lock, releasing this thread's read lock first if it is
+	// changing the tree from inside one of its own queries
+	bool BeginWrite();
+	void EndWrite( bool bWasReading );
+
 	// Ray casting
 	bool EnumerateElementsAlongRay_Ray( SpatialPartitionListMask_t listMask, const Ray_t &ray, const Vector &vecInvDelta, const Vector &vecEnd, IPartitionEnumerator *pIterator );
 	bool EnumerateElementsAlongRay_ExtrudedRay( SpatialPartitionListMask_t listMask, 
@@ -310,7 +338,6 @@ private:
 
 	int									m_nLevelCount;
 	CVoxelHash*							m_pVoxelHash;
-	CLeafList							m_aLeafList;								// Pool - Linked list(multilist) of leaves per entity.
 	int									m_TreeId;
 	CPartitionVisits *                  m_pVisits[MAX_THREADS_SUPPORTED];
 	CSpatialPartition *					m_pOwner;
@@ -318,6 +345,7 @@ private:
 	unsigned short						m_nNextVisitBit;
 	CTSPool<CPartitionVisits>			m_FreeVisits;
 	CThreadSpinRWLock					m_lock;
+	CInterlockedInt						m_nSuspendedQueries;	// Queries that released the read lock to write, voxels can't be freed under them
 };
 
 //-----------------------------------------------------------------------------
@@ -391,6 +419,9 @@ public:
 	CVoxelTree * VoxelTree( SpatialPartitionListMask_t listMask );
 	CVoxelTree * VoxelTreeForHandle( SpatialPartitionHandle_t handle );
 
+	// Times a mix of server queries built from the loaded map
+	void Benchmark( int nQueries );
+
 protected:
 	void UpdateListMask( SpatialPartitionHandle_t hPartition, uint16 nListMask );
 	// Invokes the pre-query callbacks.
@@ -425,11 +456,6 @@ inline EntityInfo_t &CVoxelTree::EntityInfo( SpatialPartitionHandle_t hPartition
 	return m_pOwner->EntityInfo( hPartition );
 }
 
-inline CLeafList &CVoxelTree::LeafList() 
-{ 
-	return m_aLeafList; 
-}
-
 inline int CVoxelTree::GetTreeId() const
 {
 	return m_TreeId;
@@ -673,14 +699,16 @@ void CVoxelHash::Init( CVoxelTree *pPartition, const Vector &worldmin, const Vec
 
 	m_aVoxelHash.RemoveAll();
 
-	// Setup the entity list pool.
-	int nGrowSize = SPHASH_ENTITYLIST_BLOCK >> nLevel;
+	// Setup the voxel list pool.
+	int nGrowSize = SPHASH_VOXELLIST_BLOCK >> nLevel;
 	if ( nGrowSize < 16 )
 	{
 		nGrowSize = 16;
 	}
-	m_aEntityList.Purge();
-	m_aEntityList.SetGrowSize( nGrowSize );
+	m_aVoxelLists.Purge();
+	m_aVoxelLists.SetGrowSize( nGrowSize );
+	m_aFreeVoxelLists.Purge();
+	m_aEmptyVoxels.Purge();
 }
 
 
@@ -689,24 +717,141 @@ void CVoxelHash::Init( CVoxelTree *pPartition, const Vector &worldmin, const Vec
 //-----------------------------------------------------------------------------
 void CVoxelHash::Shutdown( void )
 {
-	m_aEntityList.Purge();
+	m_aVoxelLists.Purge();
+	m_aFreeVoxelLists.Purge();
+	m_aEmptyVoxels.Purge();
 	m_aVoxelHash.Purge();
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Insert the object into the voxel hash.
+// Returns the index of the voxel's entity list, -1 if the voxel is empty
 //-----------------------------------------------------------------------------
-void CVoxelHash::InsertIntoTree( SpatialPartitionHandle_t hPartition, Voxel_t voxelMin, Voxel_t voxelMax )
+inline int CVoxelHash::FindVoxelList( Voxel_t voxel )
+{
+	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
+	if ( hHash == m_aVoxelHash.InvalidHandle() )
+		return -1;
+
+	return (int)m_aVoxelHash.Element( hHash );
+}
+
+
+//-----------------------------------------------------------------------------
+// Entities remember their index in the list of each voxel in their range, so
+// removal doesn't search the list. Returns the voxel's slot in that range, or
+// -1 for the rare top level entity spanning more voxels than there are slots.
+//-----------------------------------------------------------------------------
+inline int CVoxelHash::VoxelSlot( Voxel_t voxel, Voxel_t voxelMin, Voxel_t voxelMax )
+{
+	int nCountY = (int)voxelMax.bitsVoxel.y - (int)voxelMin.bitsVoxel.y + 1;
+	int nCountZ = (int)voxelMax.bitsVoxel.z - (int)voxelMin.bitsVoxel.z + 1;
+	if ( ( (int)voxelMax.bitsVoxel.x - (int)voxelMin.bitsVoxel.x + 1 ) * nCountY * nCountZ > SPHASH_VOXEL_SLOTS )
+		return -1;
+
+	int nX = (int)voxel.bitsVoxel.x - (int)voxelMin.bitsVoxel.x;
+	int nY = (int)voxel.bitsVoxel.y - (int)voxelMin.bitsVoxel.y;
+	int nZ = (int)voxel.bitsVoxel.z - (int)voxelMin.bitsVoxel.z;
+	return ( nX * nCountY + nY ) * nCountZ + nZ;
+}
+
+
+//-----------------------------------------------------------------------------
+// Index of an entity in one of the voxel lists of its current range
+//-----------------------------------------------------------------------------
+inline int CVoxelHash::FindInVoxelList( const CVoxelEntityList &list, Voxel_t voxel, SpatialPartitionHandle_t hPartition )
+{
+	const EntityInfo_t &info = m_pTree->EntityInfo( hPartition );
+	int nTree = m_pTree->GetTreeId();
+	int nSlot = VoxelSlot( voxel, info.m_voxelMin[nTree], info.m_voxelMax[nTree] );
+	if ( nSlot >= 0 )
+	{
+		int iEntity = info.m_nVoxelSlot[nTree][nSlot];
+		if ( iEntity < list.Count() && list.m_Handles[iEntity] == hPartition )
+			return iEntity;
+
+		Assert( 0 );
+	}
+	return list.m_Handles.Find( hPartition );
+}
+
+inline void CVoxelHash::SetVoxelListIndex( Voxel_t voxel, SpatialPartitionHandle_t hPartition, int iEntity )
 {
 	EntityInfo_t &info = m_pTree->EntityInfo( hPartition );
-	CLeafList &leafList = m_pTree->LeafList();
-	int treeId = m_pTree->GetTreeId();
+	int nTree = m_pTree->GetTreeId();
+	int nSlot = VoxelSlot( voxel, info.m_voxelMin[nTree], info.m_voxelMax[nTree] );
+	if ( nSlot >= 0 )
+	{
+		info.m_nVoxelSlot[nTree][nSlot] = (unsigned short)iEntity;
+	}
+}
 
-	uint16 nListMask = m_pTree->EntityInfo( hPartition ).m_fList;
 
-	// Set the voxel level
-	info.m_nLevel[m_pTree->GetTreeId()] = m_nLevel;
+//-----------------------------------------------------------------------------
+// Copies the handles in a voxel list that are in listMask, newest first.
+// Returns the list's removal count at the time of the copy.
+//-----------------------------------------------------------------------------
+unsigned int CVoxelHash::SnapshotVoxelList( int iList, SpatialPartitionListMask_t listMask, CVoxelHandleSnapshot &handles )
+{
+	const CVoxelEntityList &list = m_aVoxelLists[iList];
+	for ( int i = list.Count(); --i >= 0; )
+	{
+		if ( listMask & list.m_ListMasks[i] )
+		{
+			handles.AddToTail( list.m_Handles[i] );
+		}
+	}
+	return list.m_nRemoveCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Is a handle from a snapshot still in the voxel list? Only searches the list
+// if something was removed from it since the snapshot.
+//-----------------------------------------------------------------------------
+inline bool CVoxelHash::IsInVoxelList( int iList, unsigned int nRemoveCount, SpatialPartitionHandle_t hPartition )
+{
+	const CVoxelEntityList &list = m_aVoxelLists[iList];
+	return ( list.m_nRemoveCount == nRemoveCount ) || ( list.m_Handles.Find( hPartition ) >= 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Removes an empty voxel from the hash and recycles its entity list
+//-----------------------------------------------------------------------------
+void CVoxelHash::FreeVoxel( UtlHashFixedHandle_t hHash )
+{
+	int iList = (int)m_aVoxelHash.Element( hHash );
+	Assert( m_aVoxelLists[iList].Count() == 0 );
+	m_aFreeVoxelLists.AddToTail( iList );
+	m_aVoxelHash.Remove( hHash );
+}
+
+
+//-----------------------------------------------------------------------------
+// Releases voxels emptied while a query was suspended. They may have been
+// refilled (or freed already) since.
+//-----------------------------------------------------------------------------
+void CVoxelHash::FreeEmptyVoxels()
+{
+	for ( int i = 0; i < m_aEmptyVoxels.Count(); ++i )
+	{
+		UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( m_aEmptyVoxels[i] );
+		if ( hHash != m_aVoxelHash.InvalidHandle() && m_aVoxelLists[ m_aVoxelHash.Element( hHash ) ].Count() == 0 )
+		{
+			FreeVoxel( hHash );
+		}
+	}
+	m_aEmptyVoxels.RemoveAll();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Insert the object into the voxel hash.
+//-----------------------------------------------------------------------------
+void CVoxelHash::InsertIntoTree( SpatialPartitionHandle_t hPartition, Voxel_t voxelMin, Voxel_t voxelMax )
+{
+	uint16 nListMask = m_pTree->EntityInfo( hPartition ).m_fList;
 
 	Assert( (m_nLevel == 4) ||
 			(voxelMax.bitsVoxel.x - voxelMin.bitsVoxel.x <= 1) && 
@@ -731,39 +876,26 @@ void CVoxelHash::InsertIntoTree( SpatialPartitionHandle_t hPartition, Voxel_t vo
 				RenderVoxel( voxel );
 #endif
 
-				// Entity list.
-				intp iEntity = m_aEntityList.Alloc( true );
-				m_aEntityList[iEntity].m_handle = hPartition;
-				m_aEntityList[iEntity].m_nListMask = nListMask;
-				
-				UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
-				if ( hHash == m_aVoxelHash.InvalidHandle() )
+				int iList = FindVoxelList( voxel );
+				if ( iList < 0 )
 				{
 					// Add voxel(leaf) to hash.
-					hHash = m_aVoxelHash.FastInsert( voxel.uiVoxel, iEntity );
-				}
-				else
-				{
-					intp iHead = m_aVoxelHash.Element( hHash );
-					m_aEntityList.LinkBefore( iHead, iEntity );
-					m_aVoxelHash[hHash] = iEntity;
-				}
-				
-				// Leaf list.
-				intp iLeafList = leafList.Alloc( true );
-				leafList[iLeafList].m_hVoxel = hHash;
-				leafList[iLeafList].m_iEntity = iEntity;
-				
-				if ( info.m_iLeafList[treeId] == leafList.InvalidIndex() )
-				{
-					info.m_iLeafList[treeId] = iLeafList;
-				}
-				else
-				{
-					intp iHead = info.m_iLeafList[treeId];
-					leafList.LinkBefore( iHead, iLeafList );
-					info.m_iLeafList[treeId] = iLeafList;
+					if ( m_aFreeVoxelLists.Count() )
+					{
+						iList = m_aFreeVoxelLists.Tail();
+						m_aFreeVoxelLists.Remove( m_aFreeVoxelLists.Count() - 1 );
+					}
+					else
+					{
+						iList = m_aVoxelLists.AddToTail();
+					}
+					m_aVoxelHash.FastInsert( voxel.uiVoxel, iList );
 				}
+
+				CVoxelEntityList &list = m_aVoxelLists[iList];
+				list.m_Handles.AddToTail( hPartition );
+				list.m_ListMasks.AddToTail( nListMask );
+				SetVoxelListIndex( voxel, hPartition, list.Count() - 1 );
 			}
 		}
 	}
@@ -771,83 +903,69 @@ void CVoxelHash::InsertIntoTree( SpatialPartitionHandle_t hPartition, Voxel_t vo
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Removes the object into the voxel hash.
+// Purpose: Removes the object from the voxel hash. Voxels left empty are
+//			freed unless bDeferFree is set, when a suspended query may still be
+//			walking them.
 //-----------------------------------------------------------------------------
-void CVoxelHash::RemoveFromTree( SpatialPartitionHandle_t hPartition )
+void CVoxelHash::RemoveFromTree( SpatialPartitionHandle_t hPartition, Voxel_t voxelMin, Voxel_t voxelMax, bool bDeferFree )
 {
-	EntityInfo_t &data = m_pTree->EntityInfo( hPartition );
-	CLeafList &leafList = m_pTree->LeafList();
-	int treeId = m_pTree->GetTreeId();
-
-	intp iLeaf = data.m_iLeafList[treeId];
-	intp iNext;
-	while ( iLeaf != leafList.InvalidIndex() )
+	Voxel_t voxel;
+	unsigned int iX, iY, iZ;
+	for ( iX = voxelMin.bitsVoxel.x; iX <= voxelMax.bitsVoxel.x; ++iX )
 	{
-		// Get the next voxel - if any.
-		iNext = leafList.Next( iLeaf );
-
-		UtlHashFixedHandle_t hHash = leafList[iLeaf].m_hVoxel;
-		if ( hHash == m_aVoxelHash.InvalidHandle() )
+		voxel.bitsVoxel.x = iX;
+		for ( iY = voxelMin.bitsVoxel.y; iY <= voxelMax.bitsVoxel.y; ++iY )
 		{
-			iLeaf = iNext;
-			continue;
-		}
+			voxel.bitsVoxel.y = iY;
+			for ( iZ = voxelMin.bitsVoxel.z; iZ <= voxelMax.bitsVoxel.z; ++iZ )
+			{
+				voxel.bitsVoxel.z = iZ;
 
-		// Get the head of the entity list for the voxel.
-		intp iEntity = leafList[iLeaf].m_iEntity;
-		intp iEntityHead = m_aVoxelHash[hHash];
+				UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
+				if ( hHash == m_aVoxelHash.InvalidHandle() )
+				{
+					Assert( 0 );
+					continue;
+				}
 
-		if ( iEntityHead == iEntity )
-		{
-			intp iEntityNext = m_aEntityList.Next( iEntityHead );
-			if ( iEntityNext == m_aEntityList.InvalidIndex() )
-			{
-				m_aVoxelHash.Remove( hHash );
-			}
-			else
-			{
-				m_aVoxelHash[hHash] = iEntityNext;
+				// Suspended queries cope with the tail moving, see EnumerateElementsInVoxel
+				CVoxelEntityList &list = m_aVoxelLists[ m_aVoxelHash.Element( hHash ) ];
+				int iEntity = FindInVoxelList( list, voxel, hPartition );
+				Assert( iEntity >= 0 );
+				if ( iEntity < 0 )
+					continue;
+
+				list.m_Handles.FastRemove( iEntity );
+				list.m_ListMasks.FastRemove( iEntity );
+				++list.m_nRemoveCount;
+
+				// The tail entity moved into the hole
+				if ( iEntity < list.Count() )
+				{
+					SetVoxelListIndex( voxel, list.m_Handles[iEntity], iEntity );
+				}
+
+				if ( list.Count() == 0 )
+				{
+					if ( bDeferFree )
+					{
+						m_aEmptyVoxels.AddToTail( voxel.uiVoxel );
+					}
+					else
+					{
+						FreeVoxel( hHash );
+					}
+				}
 			}
 		}
-		
-		// Remove the entity from the entity list for the voxel.
-		m_aEntityList.Remove( iEntity );
-
-		// Remove from the leaf list.
-		leafList.Remove( iLeaf );		
-		iLeaf = iNext;
 	}
-	
-	data.m_iLeafList[treeId] = leafList.InvalidIndex();
 }
 
-void CVoxelHash::UpdateListMask( SpatialPartitionHandle_t hPartition )
+void CVoxelHash::UpdateListMask( SpatialPartitionHandle_t hPartition, Voxel_t vmin, Voxel_t vmax )
 {
 	EntityInfo_t &data = m_pTree->EntityInfo( hPartition );
 	uint16 nListMask = data.m_fList;
 
-	Voxel_t vmin = data.m_voxelMin;
-	Voxel_t vmax = data.m_voxelMax;
-	
-	// single voxel
-	if ( vmin.uiVoxel == vmax.uiVoxel )
-	{
-		UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( vmin.uiVoxel );
-		if ( hHash != m_aVoxelHash.InvalidHandle() )
-		{
-			for ( intp i = m_aVoxelHash.Element( hHash ); i != m_aEntityList.InvalidIndex(); i = m_aEntityList.Next(i) )
-			{
-				SpatialPartitionHandle_t handle = m_aEntityList[i].m_handle;
-				if ( handle != hPartition )
-					continue;
-
-				m_aEntityList[i].m_nListMask = nListMask;
-				break;
-			}
-		}
-	}
-
-	// spans voxels
 	Voxel_t vdelta;
 	vdelta.uiVoxel = vmax.uiVoxel - vmin.uiVoxel;
 	int cx = vdelta.bitsVoxel.x;
@@ -863,17 +981,15 @@ void CVoxelHash::UpdateListMask( SpatialPartitionHandle_t hPartition )
 			voxel.bitsVoxel.z = vmin.bitsVoxel.z;
 			for ( int iZ = 0; iZ <= cz; ++iZ, ++voxel.bitsVoxel.z )
 			{
-				UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
-				if ( hHash != m_aVoxelHash.InvalidHandle() )
-				{
-					for ( intp i = m_aVoxelHash.Element( hHash ); i != m_aEntityList.InvalidIndex(); i = m_aEntityList.Next(i) )
-					{
-						if ( m_aEntityList[i].m_handle != hPartition )
-							continue;
+				int iList = FindVoxelList( voxel );
+				if ( iList < 0 )
+					continue;
 
-						m_aEntityList[i].m_nListMask = nListMask;
-						break;
-					}
+				CVoxelEntityList &list = m_aVoxelLists[iList];
+				int iEntity = FindInVoxelList( list, voxel, hPartition );
+				if ( iEntity >= 0 )
+				{
+					list.m_ListMasks[iEntity] = nListMask;
 				}
 			}
 		}
@@ -1103,21 +1219,31 @@ template <class T>
 bool CVoxelHash::EnumerateElementsInVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator )
 {
 	// If the voxel doesn't exist, nothing to iterate over
-	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
-	if ( hHash == m_aVoxelHash.InvalidHandle() )
+	int iList = FindVoxelList( voxel );
+	if ( iList < 0 )
 		return true;
 
-	for ( intp i = m_aVoxelHash.Element( hHash ); i != m_aEntityList.InvalidIndex(); i = m_aEntityList.Next(i) )
+	// NOTE: The enumerator can move entities, which can reallocate the lists.
+	// Index them again each time around rather than holding on to pointers.
+	// A removal moves the tail into the hole, which only ever moves an entry
+	// we have already seen to a lower index. The visit bits below skip it
+	// the second time around.
+	for ( int i = m_aVoxelLists[iList].Count(); --i >= 0; )
 	{
-		SpatialPartitionHandle_t handle = m_aEntityList[i].m_handle;
-		SpatialPartitionListMask_t nListMask = m_aEntityList[i].m_nListMask;
-		if ( handle == PARTITION_INVALID_HANDLE )
+		const CVoxelEntityList &list = m_aVoxelLists[iList];
+		if ( i >= list.Count() )
+		{
+			// Entries were removed under us, carry on from the new tail
+			i = list.Count();
 			continue;
+		}
 
 		// Keep going if this dude isn't in the list
+		SpatialPartitionListMask_t nListMask = list.m_ListMasks[i];
 		if ( !( listMask & nListMask ) )
 			continue;
 
+		SpatialPartitionHandle_t handle = list.m_Handles[i];
 		EntityInfo_t &hInfo = m_pTree->EntityInfo( handle );
 		Assert( hInfo.m_fList == nListMask );
 
@@ -1149,26 +1275,21 @@ bool CVoxelHash::EnumerateElementsInSingleVoxel( Voxel_t voxel, const T &interse
 	SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator )
 {
 	// NOTE: We don't have to do the enum id checking, nor do we have to up the
-	// nesting level, since this only visits 1 voxel.
-	intp iEntityList;
-	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
-	if ( hHash != m_aVoxelHash.InvalidHandle() )
+	// nesting level, since this only visits 1 voxel. Walking a copy of the
+	// handles reports each entity once even if the enumerator changes the list.
+	int iList = FindVoxelList( voxel );
+	if ( iList >= 0 )
 	{
-		iEntityList = m_aVoxelHash.Element( hHash );
-		while ( iEntityList != m_aEntityList.InvalidIndex() )
+		CVoxelHandleSnapshot handles;
+		unsigned int nRemoveCount = SnapshotVoxelList( iList, listMask, handles );
+		for ( int i = 0; i < handles.Count(); ++i )
 		{
-			SpatialPartitionHandle_t handle = m_aEntityList[iEntityList].m_handle;
-			SpatialPartitionListMask_t nListMask = m_aEntityList[iEntityList].m_nListMask;
-			iEntityList = m_aEntityList.Next( iEntityList );
-			if ( handle == PARTITION_INVALID_HANDLE )
-				continue;
-
-			// Keep going if this dude isn't in the list
-			if ( !( listMask & nListMask ) )
+			// Skip entities the enumerator removed
+			if ( !IsInVoxelList( iList, nRemoveCount, handles[i] ) )
 				continue;
 
-			EntityInfo_t &hInfo = m_pTree->EntityInfo( handle );
-			if ( hInfo.m_flags & ENTITY_HIDDEN )
+			EntityInfo_t &hInfo = m_pTree->EntityInfo( handles[i] );
+			if ( ( hInfo.m_flags & ENTITY_HIDDEN ) || !( listMask & hInfo.m_fList ) )
 				continue;
 
 			// Keep going if there's no collision
@@ -1600,26 +1721,19 @@ bool CVoxelHash::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask,
 	Voxel_t v, const Vector& pt, IPartitionEnumerator* pIterator )
 {
 	// NOTE: We don't have to do the enum id checking, nor do we have to up the
-	// nesting level, since this only visits 1 voxel.
-	intp iEntityList;
-	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( v.uiVoxel );
-	if ( hHash != m_aVoxelHash.InvalidHandle() )
+	// nesting level, since this only visits 1 voxel. See EnumerateElementsInSingleVoxel.
+	int iList = FindVoxelList( v );
+	if ( iList >= 0 )
 	{
-		iEntityList = m_aVoxelHash.Element( hHash );
-		while ( iEntityList != m_aEntityList.InvalidIndex() )
+		CVoxelHandleSnapshot handles;
+		unsigned int nRemoveCount = SnapshotVoxelList( iList, listMask, handles );
+		for ( int i = 0; i < handles.Count(); ++i )
 		{
-			SpatialPartitionHandle_t handle = m_aEntityList[iEntityList].m_handle;
-			SpatialPartitionListMask_t nListMask = m_aEntityList[iEntityList].m_nListMask;
-			iEntityList = m_aEntityList.Next( iEntityList );
-			if ( handle == PARTITION_INVALID_HANDLE )
-				continue;
-
-			// Keep going if this dude isn't in the list
-			if ( !( listMask & nListMask ) )
+			if ( !IsInVoxelList( iList, nRemoveCount, handles[i] ) )
 				continue;
 
-			EntityInfo_t &hInfo = m_pTree->EntityInfo( handle );
-			if ( hInfo.m_flags & ENTITY_HIDDEN )
+			EntityInfo_t &hInfo = m_pTree->EntityInfo( handles[i] );
+			if ( ( hInfo.m_flags & ENTITY_HIDDEN ) || !( listMask & hInfo.m_fList ) )
 				continue;
 
 			// Keep going if there's no collision
@@ -1736,16 +1850,14 @@ void CVoxelHash::RenderObjectInVoxel( SpatialPartitionHandle_t hPartition, CPart
 //-----------------------------------------------------------------------------
 void CVoxelHash::RenderObjectsInVoxel( Voxel_t voxel, CPartitionVisitor *pVisitor, bool bRenderVoxel, float flTime )
 {
-	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
-	if ( hHash == m_aVoxelHash.InvalidHandle() )
+	int iList = FindVoxelList( voxel );
+	if ( iList < 0 )
 		return;
 
-	intp iEntityList = m_aVoxelHash.Element( hHash );
-	while ( iEntityList != m_aEntityList.InvalidIndex() )
+	const CVoxelEntityList &list = m_aVoxelLists[iList];
+	for ( int i = list.Count(); --i >= 0; )
 	{
-		SpatialPartitionHandle_t hPartition = m_aEntityList[iEntityList].m_handle;
-		RenderObjectInVoxel( hPartition, pVisitor, flTime );					
-		iEntityList = m_aEntityList.Next( iEntityList );
+		RenderObjectInVoxel( list.m_Handles[i], pVisitor, flTime );
 	}
 
 	if ( bRenderVoxel )
@@ -1760,26 +1872,11 @@ void CVoxelHash::RenderObjectsInVoxel( Voxel_t voxel, CPartitionVisitor *pVisito
 //-----------------------------------------------------------------------------
 int CVoxelHash::EntityCount()
 {
+	// Free and empty lists have no entries, no need to go through the hash
 	int nCount = 0;
-	int nBucketCount = SPHASH_BUCKET_COUNT;
-	for ( int iBucket = 0; iBucket < nBucketCount; ++iBucket )
+	for ( int i = 0; i < m_aVoxelLists.Count(); ++i )
 	{
-		if ( m_aVoxelHash.m_aBuckets[iBucket].Count() == 0 )
-			continue;
-
-		UtlPtrLinkedListIndex_t hHash = m_aVoxelHash.m_aBuckets[iBucket].Head();
-	
-		while ( hHash != m_aVoxelHash.m_aBuckets[iBucket].InvalidIndex() )
-		{
-			intp iEntity = m_aVoxelHash.m_aBuckets[iBucket][hHash].m_Data;
-			while ( iEntity!= m_aEntityList.InvalidIndex() )
-			{
-				++nCount;
-				iEntity = m_aEntityList.Next( iEntity );
-			}
-
-			hHash = m_aVoxelHash.m_aBuckets[iBucket].Next( hHash );
-		}
+		nCount += m_aVoxelLists[i].Count();
 	}
 	return nCount;
 }
@@ -1838,29 +1935,15 @@ void CVoxelHash::RenderGrid()
 //-----------------------------------------------------------------------------
 void CVoxelHash::RenderAllObjectsInTree( float flTime )
 {
-	int nBucketCount = SPHASH_BUCKET_COUNT;
-
 	CPartitionVisits *pPrevVisits = m_pTree->BeginVisit();
 	CPartitionVisitor visitor( m_pTree );
 
-	for ( int iBucket = 0; iBucket < nBucketCount; ++iBucket )
+	for ( int iList = 0; iList < m_aVoxelLists.Count(); ++iList )
 	{
-		if ( m_aVoxelHash.m_aBuckets[iBucket].Count() == 0 )
-			continue;
-
-		UtlPtrLinkedListIndex_t hHash = m_aVoxelHash.m_aBuckets[iBucket].Head();
-
-		while ( hHash != m_aVoxelHash.m_aBuckets[iBucket].InvalidIndex() )
+		const CVoxelEntityList &list = m_aVoxelLists[iList];
+		for ( int i = list.Count(); --i >= 0; )
 		{
-			intp iEntity = m_aVoxelHash.m_aBuckets[iBucket][hHash].m_Data;
-			while ( iEntity!= m_aEntityList.InvalidIndex() )
-			{
-				SpatialPartitionHandle_t hPartition = m_aEntityList[iEntity].m_handle;
-				RenderObjectInVoxel( hPartition, &visitor, flTime );
-				iEntity = m_aEntityList.Next( iEntity );
-			}
-
-			hHash = m_aVoxelHash.m_aBuckets[iBucket].Next( hHash );
+			RenderObjectInVoxel( list.m_Handles[i], &visitor, flTime );
 		}
 	}
 
@@ -1957,10 +2040,6 @@ void CVoxelTree::Init( CSpatialPartition *pOwner, int iTree, const Vector &world
 	{
 		m_pVoxelHash[i].Init( this, worldmin, worldmax, i );
 	}
-
-	// Setup the leaf list pool.
-	m_aLeafList.Purge();
-	m_aLeafList.SetGrowSize( SPHASH_LEAFLIST_BLOCK );
 }
 
 
@@ -1969,13 +2048,49 @@ void CVoxelTree::Init( CSpatialPartition *pOwner, int iTree, const Vector &world
 //-----------------------------------------------------------------------------
 void CVoxelTree::Shutdown( void )
 {
-	m_aLeafList.Purge();
 	for ( int i = 0; i < m_nLevelCount; ++i )
 	{
 		m_pVoxelHash[i].Shutdown();
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Takes the write lock. If this thread is changing the tree from inside one
+// of its own queries it has to give up its read lock first; the query is
+// suspended until EndWrite and voxels it may be walking can't be freed.
+//-----------------------------------------------------------------------------
+bool CVoxelTree::BeginWrite()
+{
+	bool bWasReading = ( m_pVisits[g_nThreadID] != NULL );
+	if ( bWasReading )
+	{
+		++m_nSuspendedQueries;
+		UnlockRead();
+	}
+
+	m_lock.LockForWrite();
+
+	if ( m_nSuspendedQueries == 0 )
+	{
+		for ( int i = 0; i < m_nLevelCount; ++i )
+		{
+			m_pVoxelHash[i].FreeEmptyVoxels();
+		}
+	}
+	return bWasReading;
+}
+
+void CVoxelTree::EndWrite( bool bWasReading )
+{
+	m_lock.UnlockWrite();
+	if ( bWasReading )
+	{
+		LockForRead();
+		--m_nSuspendedQueries;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Insert into the appropriate tree
 //-----------------------------------------------------------------------------
@@ -2007,54 +2122,43 @@ void CVoxelTree::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vect
 	voxelMin = m_pVoxelHash[nLevel].VoxelIndexFromPoint( vecMin );
 	voxelMax = m_pVoxelHash[nLevel].VoxelIndexFromPoint( vecMax );
 
-	bool bDoInsert = true;
-	if ( bReinsert )
-	{
-		// on reinsert we need to either remove/insert or not do anything
-		// if the entity spans the same bounding box of voxels no remove/insert is necessary
-		if ( info.m_voxelMin.uiVoxel == voxelMin.uiVoxel && info.m_voxelMax.uiVoxel == voxelMax.uiVoxel )
-		{
-			bDoInsert = false;
-		}
-		else
-		{
-			// Remove entity from voxel hash.
-			RemoveFromTree( hPartition );
-		}
-	}
+	int nOldLevel = info.m_nLevel[m_TreeId];
+	bool bInTree = bReinsert && ( nOldLevel >= 0 );
+
 	// Set/update the entity bounding box.
 	info.m_vecMin = vecMin;
 	info.m_vecMax = vecMax;
 
-	if ( bDoInsert )
-	{
-		bool bWasReading = ( m_pVisits[g_nThreadID] != NULL );
-		if ( bWasReading )
-		{
-			// If we're recursing in this thread, need to release our read lock to allow ourselves to write
-			UnlockRead();
-		}
-		m_lock.LockForWrite();
+	// on reinsert we need to either remove/insert or not do anything
+	// if the entity spans the same bounding box of voxels no remove/insert is necessary
+	if ( bInTree && nOldLevel == nLevel && info.m_voxelMin[m_TreeId].uiVoxel == voxelMin.uiVoxel && info.m_voxelMax[m_TreeId].uiVoxel == voxelMax.uiVoxel )
+		return;
 
-		// if these have changed we need to insert
-		info.m_voxelMin = voxelMin;
-		info.m_voxelMax = voxelMax;
-		if ( m_AvailableVisitBits.Count() )
-		{
-			info.m_nVisitBit[m_TreeId] = m_AvailableVisitBits.Tail();
-			m_AvailableVisitBits.Remove( m_AvailableVisitBits.Count() - 1 );
-		}
-		else
-		{
-			info.m_nVisitBit[m_TreeId] = m_nNextVisitBit++;
-		}
-		m_pVoxelHash[nLevel].InsertIntoTree( hPartition, voxelMin, voxelMax );
-		m_lock.UnlockWrite();
-		if ( bWasReading )
-		{
-			LockForRead();
-		}
+	// The remove and insert happen under one write lock so queries on other
+	// threads never see the entity missing
+	bool bWasReading = BeginWrite();
+
+	if ( bInTree )
+	{
+		// The visit bit carries over to the new voxels
+		m_pVoxelHash[nOldLevel].RemoveFromTree( hPartition, info.m_voxelMin[m_TreeId], info.m_voxelMax[m_TreeId], m_nSuspendedQueries > 0 );
+	}
+	else if ( m_AvailableVisitBits.Count() )
+	{
+		info.m_nVisitBit[m_TreeId] = m_AvailableVisitBits.Tail();
+		m_AvailableVisitBits.Remove( m_AvailableVisitBits.Count() - 1 );
 	}
+	else
+	{
+		info.m_nVisitBit[m_TreeId] = m_nNextVisitBit++;
+	}
+
+	info.m_nLevel[m_TreeId] = nLevel;
+	info.m_voxelMin[m_TreeId] = voxelMin;
+	info.m_voxelMax[m_TreeId] = voxelMax;
+	m_pVoxelHash[nLevel].InsertIntoTree( hPartition, voxelMin, voxelMax );
+
+	EndWrite( bWasReading );
 }
 
 
@@ -2065,26 +2169,15 @@ void CVoxelTree::RemoveFromTree( SpatialPartitionHandle_t hPartition )
 {
 	Assert( hPartition != PARTITION_INVALID_HANDLE );
 	EntityInfo_t &info = EntityInfo( hPartition );
-	int nLevel = info.m_nLevel[GetTreeId()];
+	int nLevel = info.m_nLevel[m_TreeId];
 	if ( nLevel >= 0 )
 	{
-		bool bWasReading = ( m_pVisits[g_nThreadID] != NULL );
-		if ( bWasReading )
-		{
-			// If we're recursing in this thread, need to release our read lock to allow ourselves to write
-			UnlockRead();
-		}
-
-		m_lock.LockForWrite();
-		m_pVoxelHash[nLevel].RemoveFromTree( hPartition );
+		bool bWasReading = BeginWrite();
+		m_pVoxelHash[nLevel].RemoveFromTree( hPartition, info.m_voxelMin[m_TreeId], info.m_voxelMax[m_TreeId], m_nSuspendedQueries > 0 );
 		m_AvailableVisitBits.AddToTail( info.m_nVisitBit[m_TreeId] );
 		info.m_nVisitBit[m_TreeId] = (unsigned short)-1;
-		m_lock.UnlockWrite();
-
-		if ( bWasReading )
-		{
-			LockForRead();
-		}
+		info.m_nLevel[m_TreeId] = -1;
+		EndWrite( bWasReading );
 	}
 }
 
@@ -2095,7 +2188,7 @@ void CVoxelTree::UpdateListMask( SpatialPartitionHandle_t hPartition )
 	if ( nLevel >= 0 )
 	{
 		m_lock.LockForRead();
-		m_pVoxelHash[nLevel].UpdateListMask( hPartition );
+		m_pVoxelHash[nLevel].UpdateListMask( hPartition, info.m_voxelMin[m_TreeId], info.m_voxelMax[m_TreeId] );
 		m_lock.UnlockRead();
 	}
 }
@@ -2108,16 +2201,10 @@ void CVoxelTree::ElementMoved( SpatialPartitionHandle_t hPartition, const Vector
 {
 	if ( hPartition != PARTITION_INVALID_HANDLE )
 	{
-		// If it doesn't already exist in the tree - add it.
+		// If it doesn't already exist in the tree - add it, otherwise re-insert
+		// entity into voxel hash.
 		EntityInfo_t &info = EntityInfo( hPartition );
-		if ( info.m_iLeafList[GetTreeId()] == CLeafList::InvalidIndex() )
-		{
-			InsertIntoTree( hPartition, mins, maxs, false );
-			return;
-		} 
-
-		// Re-insert entity into voxel hash.
-		InsertIntoTree( hPartition, mins, maxs, true );
+		InsertIntoTree( hPartition, mins, maxs, info.m_nLevel[GetTreeId()] >= 0 );
 	}
 }
 
@@ -2817,8 +2904,9 @@ SpatialPartitionHandle_t CSpatialPartition::CreateHandle( IHandleEntity *pHandle
 	for ( int i = 0; i < NUM_TREES; i++ )
 	{
 		m_aHandles[hPartition].m_nVisitBit[i] = 0xffff;
-		m_aHandles[hPartition].m_nLevel[i] = (uint8)-1;
-		m_aHandles[hPartition].m_iLeafList[i] = CLeafList::InvalidIndex();
+		m_aHandles[hPartition].m_nLevel[i] = -1;
+		m_aHandles[hPartition].m_voxelMin[i].uiVoxel = 0;
+		m_aHandles[hPartition].m_voxelMax[i].uiVoxel = 0;
 	}
 	
 	return hPartition;
@@ -3200,6 +3288,138 @@ void CSpatialPartition::DrawDebugOverlays()
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Benchmark: runs ray, swept hull and box queries against the server tree.
+// Queries start at the entities in the loaded map so the mix of voxel levels
+// and list lengths matches real play.
+//-----------------------------------------------------------------------------
+class CPartitionBenchmarkEnum : public IPartitionEnumerator
+{
+public:
+	CPartitionBenchmarkEnum() : m_nCount( 0 ) {}
+
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		++m_nCount;
+		return ITERATION_CONTINUE;
+	}
+
+	int m_nCount;
+};
+
+void CSpatialPartition::Benchmark( int nQueries )
+{
+	CUtlVector<Vector> centers;
+	m_HandlesMutex.Lock();
+	for ( SpatialPartitionHandle_t h = m_aHandles.Head(); h != m_aHandles.InvalidIndex(); h = m_aHandles.Next( h ) )
+	{
+		const EntityInfo_t &info = m_aHandles[h];
+		if ( info.m_flags & IN_SERVER_TREE )
+		{
+			centers.AddToTail( ( info.m_vecMin + info.m_vecMax ) * 0.5f );
+		}
+	}
+	m_HandlesMutex.Unlock();
+
+	if ( centers.Count() < 2 )
+	{
+		Msg( "No entities in the spatial partition, load a map first\n" );
+		return;
+	}
+
+	enum
+	{
+		QUERY_RAY,			// point traces between entities, line of sight and bullets
+		QUERY_HULL,			// short swept hulls, movement
+		QUERY_BOX,			// triggers, explosions, nearby entity searches
+
+		QUERY_TYPE_COUNT
+	};
+	static const char *s_pQueryNames[QUERY_TYPE_COUNT] = { "ray", "hull", "box" };
+	static const int s_nQueryPercent[QUERY_TYPE_COUNT] = { 50, 20, 30 };
+
+	CUniformRandomStream random;
+	random.SetSeed( 0x5a17 );
+
+	CVoxelTree *pTree = &m_VoxelTrees[SERVER_TREE];
+	SpatialPartitionListMask_t nRayMask = PARTITION_ENGINE_SOLID_EDICTS;
+	SpatialPartitionListMask_t nBoxMask = PARTITION_ENGINE_SOLID_EDICTS | PARTITION_ENGINE_TRIGGER_EDICTS;
+	Vector vecHullExtents( 16, 16, 36 );
+
+	double flTime[QUERY_TYPE_COUNT] = { 0 };
+	int nCount[QUERY_TYPE_COUNT] = { 0 };
+	int nFound[QUERY_TYPE_COUNT] = { 0 };
+
+	for ( int iQuery = 0; iQuery < nQueries; ++iQuery )
+	{
+		int nRoll = random.RandomInt( 0, 99 );
+		int nType = 0;
+		while ( nType < QUERY_TYPE_COUNT - 1 && nRoll >= s_nQueryPercent[nType] )
+		{
+			nRoll -= s_nQueryPercent[nType];
+			++nType;
+		}
+
+		const Vector &vecStart = centers[ random.RandomInt( 0, centers.Count() - 1 ) ];
+		CPartitionBenchmarkEnum enumerator;
+
+		double flStart = Plat_FloatTime();
+		switch ( nType )
+		{
+		case QUERY_RAY:
+			{
+				Ray_t ray;
+				ray.Init( vecStart, centers[ random.RandomInt( 0, centers.Count() - 1 ) ] );
+				pTree->EnumerateElementsAlongRay( nRayMask, ray, false, &enumerator );
+			}
+			break;
+
+		case QUERY_HULL:
+			{
+				Vector vecDir( random.RandomFloat( -1, 1 ), random.RandomFloat( -1, 1 ), random.RandomFloat( -0.25f, 0.25f ) );
+				Ray_t ray;
+				ray.Init( vecStart, vecStart + vecDir * 256.0f, -vecHullExtents, vecHullExtents );
+				pTree->EnumerateElementsAlongRay( nRayMask, ray, false, &enumerator );
+			}
+			break;
+
+		case QUERY_BOX:
+			{
+				float flSize = random.RandomFloat( 32.0f, 512.0f );
+				Vector vecSize( flSize, flSize, flSize );
+				pTree->EnumerateElementsInBox( nBoxMask, vecStart - vecSize, vecStart + vecSize, false, &enumerator );
+			}
+			break;
+		}
+		flTime[nType] += Plat_FloatTime() - flStart;
+		++nCount[nType];
+		nFound[nType] += enumerator.m_nCount;
+	}
+
+	Msg( "Spatial partition benchmark: %d queries from %d entities\n", nQueries, centers.Count() );
+	double flTotal = 0.0;
+	for ( int i = 0; i < QUERY_TYPE_COUNT; ++i )
+	{
+		flTotal += flTime[i];
+		if ( nCount[i] == 0 )
+			continue;
+
+		Msg( "  %-5s %7d queries %8.2fms %6.2fus/query %5.1f elements/query\n", s_pQueryNames[i], nCount[i], 
+			flTime[i] * 1000.0, flTime[i] * 1000000.0 / nCount[i], (float)nFound[i] / nCount[i] );
+	}
+	Msg( "  total %8.2fms %6.2fus/query\n", flTotal * 1000.0, nQueries ? flTotal * 1000000.0 / nQueries : 0.0 );
+}
+
+CON_COMMAND( spatialpartition_benchmark, "Times a mix of ray, hull and box queries against the spatial partition of the loaded map: spatialpartition_benchmark [queries]" )
+{
+	int nQueries = 100000;
+	if ( args.ArgC() >= 2 )
+	{
+		nQueries = MAX( Q_atoi( args[1] ), 1 );
+	}
+	g_SpatialPartition.Benchmark( nQueries );
+}
+
 //=============================================================================
 ISpatialPartition *CreateSpatialPartition( const Vector& worldmin, const Vector& worldmax )
 {
@@ -46,6 +46,8 @@
 #include "generichash.h"
 #include "tier2/renderutils.h"
 #include "ipooledvballocator.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -58,6 +60,7 @@ static ConVar r_drawstaticprops( "r_drawstaticprops", "1", FCVAR_CHEAT, "0=Off,
 static ConVar r_colorstaticprops( "r_colorstaticprops", "0", FCVAR_CHEAT );
 ConVar r_staticpropinfo( "r_staticpropinfo", "0" );
 ConVar  r_drawmodeldecals( "r_drawmodeldecals", "1" );
+static ConVar r_threaded_staticprop_init( "r_threaded_staticprop_init", "1", 0, "Set up static props on the thread pool at level load" );
 extern ConVar mat_fullbright;
 static bool g_MakingDevShots = false;
 extern int s_MapVersion;
@@ -112,6 +115,21 @@ inline bool IsUsingStaticPropDebugModes()
 	return false;
 }
 
+//-----------------------------------------------------------------------------
+// Unique static prop models. Everything a prop needs from its model is
+// resolved here once, serially, so the props themselves can be set up in parallel
+//-----------------------------------------------------------------------------
+struct StaticPropDict_t
+{
+	model_t* m_pModel;
+	MDLHandle_t m_hMDL;
+	studiohdr_t* m_pStudioHdr;
+	vcollide_t* m_pVCollide;
+	Vector m_RenderBBoxMin;
+	Vector m_RenderBBoxMax;
+};
+
+
 //-----------------------------------------------------------------------------
 // A static prop
 //-----------------------------------------------------------------------------
@@ -245,9 +263,10 @@ public:
 	}
 
 public:
-	bool Init( int index, StaticPropLump_t &lump, model_t *pModel );
+	bool Init( int index, StaticPropLump_t &lump, const StaticPropDict_t &dict );
 	// KD Tree
-	void InsertPropIntoKDTree();
+	bool ComputeKDTreeBounds( vcollide_t *pCollide, Vector &mins, Vector &maxs );
+	void InsertPropIntoKDTree( const Vector &mins, const Vector &maxs );
 	void RemovePropFromKDTree();
 
 	void PrecacheLighting();
@@ -405,12 +424,7 @@ private:
 	void ChangeRenderGroup( CStaticProp &prop );
 
 private:
-	// Unique static prop models
-	struct StaticPropDict_t
-	{
-		model_t* m_pModel;
-		MDLHandle_t m_hMDL;
-	};
+	void PrepareModelDict( StaticPropDict_t &dict, bool bNeedsCollide );
 
 	// Static props that fade use this data to fade
 	struct StaticPropFade_t
@@ -478,32 +492,31 @@ CStaticProp::~CStaticProp()
 //-----------------------------------------------------------------------------
 // Initialization
 //-----------------------------------------------------------------------------
-bool CStaticProp::Init( int index, StaticPropLump_t &lump, model_t *pModel )
+static CInterlockedInt s_nBitchCount;
+
+bool CStaticProp::Init( int index, StaticPropLump_t &lump, const StaticPropDict_t &dict )
 {
 	m_EntHandle.Init(index, STATICPROP_EHANDLE_MASK >> NUM_ENT_ENTRY_BITS);
 	m_Partition = PARTITION_INVALID_HANDLE;
 	m_flForcedFadeScale = lump.m_flForcedFadeScale;
 	VectorCopy( lump.m_Origin, m_Origin );
 	VectorCopy( lump.m_Angles, m_Angles );
-	m_pModel = pModel;
+	m_pModel = dict.m_pModel;
 	m_FirstLeaf = lump.m_FirstLeaf;
 	m_LeafCount = lump.m_LeafCount;
 	m_nSolidType = lump.m_Solid;
 	m_FadeIndex = INVALID_FADE_INDEX;
 
-	MDLCACHE_CRITICAL_SECTION_( g_pMDLCache );
-
-	studiohdr_t *pStudioHdr = modelinfo->GetStudiomodel( m_pModel );
+	// May run on a job thread; dict was filled in by CStaticPropMgr::PrepareModelDict
+	studiohdr_t *pStudioHdr = dict.m_pStudioHdr;
 
 	if ( pStudioHdr )
 	{
 		if ( !( pStudioHdr->flags & STUDIOHDR_FLAGS_STATIC_PROP ) )
 		{
-			static int nBitchCount = 0;
-			if( nBitchCount < 100 )
+			if( s_nBitchCount++ < 100 )
 			{
 				Warning( "model %s used as a static prop, but not compiled as a static prop\n", pStudioHdr->pszName() );
-				nBitchCount++;
 			}
 		}
 
@@ -547,7 +560,8 @@ bool CStaticProp::Init( int index, StaticPropLump_t &lump, model_t *pModel )
 	AngleMatrix( lump.m_Angles, lump.m_Origin, m_ModelToWorld );
 
 	// Cache the collision bounding box since it'll never change.
-	modelinfo->GetModelRenderBounds( m_pModel, m_RenderBBoxMin, m_RenderBBoxMax );
+	m_RenderBBoxMin = dict.m_RenderBBoxMin;
+	m_RenderBBoxMax = dict.m_RenderBBoxMax;
 	m_flRadius = m_RenderBBoxMin.DistTo( m_RenderBBoxMax ) * 0.5f;
 	TransformAABB( m_ModelToWorld, m_RenderBBoxMin, m_RenderBBoxMax, m_WorldRenderBBoxMin, m_WorldRenderBBoxMax );
 
@@ -557,17 +571,13 @@ bool CStaticProp::Init( int index, StaticPropLump_t &lump, model_t *pModel )
 	{
 		m_LightingOrigin = lump.m_LightingOrigin;
 	}
-	else
+	else if ( pStudioHdr )
 	{
-		modelinfo->GetIlluminationPoint( m_pModel, this, m_Origin, m_Angles, &m_LightingOrigin );
+		R_ComputeLightingOrigin( this, pStudioHdr, m_ModelToWorld, m_LightingOrigin );
 	}
-	g_MakingDevShots = CommandLine()->FindParm( "-makedevshots" ) ? true : false;
-
-	// If we do Mod_SetMaterialVarFlag() while running with the dedicated server, we crash.
-	//  RJ said he'd save my butt and look into this. (Hip hip horray! We love RJ!)
-	if ( !sv.IsDedicated() && m_pModel )
+	else
 	{
-		Mod_SetMaterialVarFlag( pModel, MATERIAL_VAR_IGNORE_ALPHA_MODULATION, true );
+		m_LightingOrigin = m_Origin;
 	}
 
 	return true;
@@ -1098,14 +1108,12 @@ int CStaticProp::DrawModel( int flags )
 //-----------------------------------------------------------------------------
 // KD Tree
 //-----------------------------------------------------------------------------
-void CStaticProp::InsertPropIntoKDTree()
+bool CStaticProp::ComputeKDTreeBounds( vcollide_t *pCollide, Vector &mins, Vector &maxs )
 {
-	Assert( m_Partition == PARTITION_INVALID_HANDLE );
 	if ( m_nSolidType == SOLID_NONE )
-		return;
+		return false;
 
 	// Compute the bbox of the prop
-	Vector mins, maxs;
 	matrix3x4_t propToWorld;
 	AngleMatrix( m_Angles, m_Origin, propToWorld );
 	TransformAABB( propToWorld, m_pModel->mins, m_pModel->maxs, mins, maxs ); 
@@ -1113,7 +1121,6 @@ void CStaticProp::InsertPropIntoKDTree()
 	// If it's using vphysics, get a good AABB
 	if ( m_nSolidType == SOLID_VPHYSICS )
 	{
-		vcollide_t *pCollide = CM_VCollideForModel( -1, m_pModel );
 		if ( pCollide && pCollide->solidCount )
 		{
 			physcollision->CollideGetAABB( &mins, &maxs, pCollide->solids[0], m_Origin, m_Angles );
@@ -1124,10 +1131,17 @@ void CStaticProp::InsertPropIntoKDTree()
 			Q_strncpy( szModel, m_pModel ? modelloader->GetName( m_pModel ) : "unknown model", sizeof( szModel ) );
 			Warning( "SOLID_VPHYSICS static prop with no vphysics model! (%s)\n", szModel );
 			m_nSolidType = SOLID_NONE;
-			return;
+			return false;
 		}
 	}
 
+	return true;
+}
+
+void CStaticProp::InsertPropIntoKDTree( const Vector &mins, const Vector &maxs )
+{
+	Assert( m_Partition == PARTITION_INVALID_HANDLE );
+
 	// add the entity to the KD tree so we will collide against it
 	m_Partition = SpatialPartition()->CreateHandle( this, 
 		PARTITION_CLIENT_SOLID_EDICTS | PARTITION_CLIENT_STATIC_PROPS | 
@@ -1281,6 +1295,33 @@ void CStaticPropMgr::UnserializeModelDict( CUtlBuffer& buf )
 			lump.m_Name, IModelLoader::FMODELLOADER_STATICPROP );
 		dict.m_hMDL = modelinfo->GetCacheHandle( dict.m_pModel );
 		g_pMDLCache->LockStudioHdr( dict.m_hMDL );
+		dict.m_pStudioHdr = NULL;
+		dict.m_pVCollide = NULL;
+		dict.m_RenderBBoxMin.Init();
+		dict.m_RenderBBoxMax.Init();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Resolves the per-model data static props share. Must run on the main thread
+//-----------------------------------------------------------------------------
+void CStaticPropMgr::PrepareModelDict( StaticPropDict_t &dict, bool bNeedsCollide )
+{
+	if ( !dict.m_pModel )
+		return;
+
+	dict.m_pStudioHdr = modelinfo->GetStudiomodel( dict.m_pModel );
+	modelinfo->GetModelRenderBounds( dict.m_pModel, dict.m_RenderBBoxMin, dict.m_RenderBBoxMax );
+	if ( bNeedsCollide )
+	{
+		dict.m_pVCollide = CM_VCollideForModel( -1, dict.m_pModel );
+	}
+
+	// If we do Mod_SetMaterialVarFlag() while running with the dedicated server, we crash.
+	//  RJ said he'd save my butt and look into this. (Hip hip horray! We love RJ!)
+	if ( !sv.IsDedicated() )
+	{
+		Mod_SetMaterialVarFlag( dict.m_pModel, MATERIAL_VAR_IGNORE_ALPHA_MODULATION, true );
 	}
 }
 
@@ -1315,6 +1356,26 @@ void UnserializeLump<StaticPropLump_t>(StaticPropLump_t* _output, CUtlBuffer& bu
 	buf.Get(_output, sizeof(StaticPropLump_t));
 }
 
+//-----------------------------------------------------------------------------
+// Per-prop setup job: Init plus the collision bounds used for the partition
+//-----------------------------------------------------------------------------
+struct StaticPropSetup_t
+{
+	CStaticProp				*m_pProp;
+	StaticPropLump_t		*m_pLump;
+	const StaticPropDict_t	*m_pDict;
+	int						m_nIndex;
+	Vector					m_vecMins;
+	Vector					m_vecMaxs;
+	bool					m_bInsert;
+
+	static void Process( StaticPropSetup_t &item )
+	{
+		item.m_pProp->Init( item.m_nIndex, *item.m_pLump, *item.m_pDict );
+		item.m_bInsert = item.m_pProp->ComputeKDTreeBounds( item.m_pDict->m_pVCollide, item.m_vecMins, item.m_vecMaxs );
+	}
+};
+
 void CStaticPropMgr::UnserializeModels( CUtlBuffer& buf )
 {
 	// Version check
@@ -1326,13 +1387,18 @@ void CStaticPropMgr::UnserializeModels( CUtlBuffer& buf )
 	}
 
 	int count = buf.GetInt();
+	if ( count <= 0 )
+		return;
 
-	// Gotta preallocate the static props here so no rellocations take place
-	// the leaf list stores pointers to these tricky little guys.
-	m_StaticProps.AddMultipleToTail(count);
+	CFastTimer timer;
+
+	// Decode every lump up front
+	timer.Start();
+	CUtlVector<StaticPropLump_t> lumps;
+	lumps.SetCount( count );
 	for ( int i = 0; i < count; ++i )
 	{
-		StaticPropLump_t lump;
+		StaticPropLump_t &lump = lumps[i];
 		switch ( nLumpVersion )
 		{
 			case 4: UnserializeLump<StaticPropLumpV4_t>(&lump, buf); break;
@@ -1352,8 +1418,82 @@ void CStaticPropMgr::UnserializeModels( CUtlBuffer& buf )
 			default:
 				Assert("Unexpected version while deserializing lumps.");
 		}
+	}
+	timer.End();
+	float flDecodeMs = timer.GetDuration().GetMillisecondsF();
+
+	// Resolve model data once per referenced model rather than once per prop
+	timer.Start();
+	enum
+	{
+		DICT_USED = 0x1,
+		DICT_NEEDS_COLLIDE = 0x2,
+	};
+	CUtlVector<unsigned char> dictFlags;
+	dictFlags.SetCount( m_StaticPropDict.Count() );
+	dictFlags.FillWithValue( 0 );
+	for ( int i = 0; i < count; ++i )
+	{
+		unsigned char &flags = dictFlags[ lumps[i].m_PropType ];
+		flags |= DICT_USED;
+		if ( lumps[i].m_Solid == SOLID_VPHYSICS )
+		{
+			flags |= DICT_NEEDS_COLLIDE;
+		}
+	}
+
+	int nModelsUsed = 0;
+	{
+		MDLCACHE_CRITICAL_SECTION_( g_pMDLCache );
+		for ( int i = 0; i < m_StaticPropDict.Count(); ++i )
+		{
+			if ( dictFlags[i] & DICT_USED )
+			{
+				PrepareModelDict( m_StaticPropDict[i], ( dictFlags[i] & DICT_NEEDS_COLLIDE ) != 0 );
+				++nModelsUsed;
+			}
+		}
+	}
+	g_MakingDevShots = CommandLine()->FindParm( "-makedevshots" ) ? true : false;
+	timer.End();
+	float flModelMs = timer.GetDuration().GetMillisecondsF();
+
+	// Gotta preallocate the static props here so no rellocations take place
+	// the leaf list stores pointers to these tricky little guys.
+	m_StaticProps.AddMultipleToTail(count);
+
+	// Per-prop setup touches only the prop itself and the shared read-only dict data
+	timer.Start();
+	CUtlVector<StaticPropSetup_t> setup;
+	setup.SetCount( count );
+	for ( int i = 0; i < count; ++i )
+	{
+		setup[i].m_pProp = &m_StaticProps[i];
+		setup[i].m_pLump = &lumps[i];
+		setup[i].m_pDict = &m_StaticPropDict[ lumps[i].m_PropType ];
+		setup[i].m_nIndex = i;
+		setup[i].m_bInsert = false;
+	}
+
+	bool bThreaded = r_threaded_staticprop_init.GetBool() && count > 1 && g_pThreadPool && g_pThreadPool->NumIdleThreads() && ThreadInMainThread();
+	if ( bThreaded )
+	{
+		ParallelProcess( "StaticPropSetup", setup.Base(), count, &StaticPropSetup_t::Process );
+	}
+	else
+	{
+		for ( int i = 0; i < count; ++i )
+		{
+			StaticPropSetup_t::Process( setup[i] );
+		}
+	}
+	timer.End();
+	float flSetupMs = timer.GetDuration().GetMillisecondsF();
 
-		m_StaticProps[i].Init( i, lump, m_StaticPropDict[lump.m_PropType].m_pModel );
+	timer.Start();
+	for ( int i = 0; i < count; ++i )
+	{
+		const StaticPropLump_t &lump = lumps[i];
 
 		// For distance-based fading, keep a list of the things that need
 		// to be faded out. Not sure if this is the optimal way of doing it
@@ -1390,10 +1530,26 @@ void CStaticPropMgr::UnserializeModels( CUtlBuffer& buf )
 				fade.m_FalloffFactor = 255.0f;
 			}
 		}
+	}
+	timer.End();
+	float flFadeMs = timer.GetDuration().GetMillisecondsF();
 
-		// Add the prop to the K-D tree for collision
-		m_StaticProps[i].InsertPropIntoKDTree( );
+	// Add the props to the K-D tree for collision in one pass
+	timer.Start();
+	int nInserted = 0;
+	for ( int i = 0; i < count; ++i )
+	{
+		if ( setup[i].m_bInsert )
+		{
+			m_StaticProps[i].InsertPropIntoKDTree( setup[i].m_vecMins, setup[i].m_vecMaxs );
+			++nInserted;
+		}
 	}
+	timer.End();
+	float flPartitionMs = timer.GetDuration().GetMillisecondsF();
+
+	DevMsg( "Static props: %d props, %d models: decode %.2f ms, models %.2f ms, setup %.2f ms%s, fade %.2f ms, partition %.2f ms (%d inserted)\n",
+		count, nModelsUsed, flDecodeMs, flModelMs, flSetupMs, bThreaded ? " (threaded)" : "", flFadeMs, flPartitionMs, nInserted );
 }
 
 void CStaticPropMgr::OutputLevelStats( void )
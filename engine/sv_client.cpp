@@ -1113,6 +1113,22 @@ bool CGameClient::SendNetMsg(INetMessage &msg, bool bForceReliable)
 	return CBaseClient::SendNetMsg( msg, bForceReliable);
 }
 
+bool CGameClient::SendEncodedNetMsg( INetMessage &msg, CEncodedNetMsg &encoded, bool bForceReliable )
+{
+#ifndef _XBOX
+	// HLTV and replay take the message itself
+	if ( m_bIsHLTV
+#if defined( REPLAY_ENABLED )
+		|| m_bIsReplay
+#endif
+		)
+	{
+		return SendNetMsg( msg, bForceReliable );
+	}
+#endif
+	return CBaseClient::SendEncodedNetMsg( msg, encoded, bForceReliable );
+}
+
 bool CGameClient::ExecuteStringCommand( const char *pCommandString )
 {
 	// first let the baseclass handle it
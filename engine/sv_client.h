@@ -79,6 +79,7 @@ public:
 	void	Clear( void );
 
 	bool	SendNetMsg(INetMessage &msg, bool bForceReliable = false);
+	bool	SendEncodedNetMsg( INetMessage &msg, CEncodedNetMsg &encoded, bool bForceReliable = false );
 	bool	ExecuteStringCommand( const char *s );
 
 public: // IClientMessageHandlers
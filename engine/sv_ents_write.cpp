@@ -77,6 +77,7 @@ public:
 
 	int				m_nFullProps;	// number of properties send as full update (Enter PVS)
 	bool			m_bCullProps;	// filter props by clients in recipient lists
+	bool			m_bEnteredPVS;	// at least one entity was written against the client baselines
 	
 	/* Some profiling data
 	int				m_nTotalGap;
@@ -638,6 +639,8 @@ static inline void SV_WriteEnterPVS( CEntityWriteInfo &u )
 
 	Assert( u.m_nNewEntity < u.m_pToSnapshot->m_nNumEntities );
 
+	u.m_bEnteredPVS = true;
+
 	CFrameSnapshotEntry *entry = &u.m_pToSnapshot->m_pEntities[u.m_nNewEntity];
 
 	ServerClass *pClass = entry->m_pClass;
@@ -864,10 +867,13 @@ WritePacketEntities
 
 Computes either a compressed, or uncompressed delta buffer for the client.
 Returns the size IN BITS of the message buffer created.
+If pbClientSpecific is given, it's set to true if the update depends on the
+client baselines (entities entered the PVS), otherwise the written bits only
+depend on the client's baseline flag and the from/to frames.
 =============
 */
 
-void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from, bf_write &pBuf )
+void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CClientFrame *from, bf_write &pBuf, bool *pbClientSpecific )
 {
 	VPROF_BUDGET( "CBaseServer::WriteDeltaEntities", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 	// Setup the CEntityWriteInfo structure.
@@ -877,6 +883,7 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 	u.m_pToSnapshot = to->GetSnapshot();
 	u.m_pBaseline = client->m_pBaseline;
 	u.m_nFullProps = 0;
+	u.m_bEnteredPVS = false;
 	u.m_pServer = this;
 	u.m_nClientEntity = client->m_nEntityIndex;
 #ifndef _XBOX
@@ -1031,6 +1038,11 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 		savepos.WriteOneBit( 0 ); 
 	}
 
+	if ( pbClientSpecific )
+	{
+		*pbClientSpecific = u.m_bEnteredPVS || !u.m_bAsDelta;
+	}
+
 	if ( bIsTracing )
 	{
 		client->TraceNetworkData( pBuf, "Delta Finish" );
@@ -19,6 +19,8 @@
 #include "GameEventManager.h"
 #include "netadr.h"
 #include "zlib/zlib.h"
+#include "tier0/threadtools.h"
+#include "tier1/KeyValues.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -30,12 +32,243 @@ static ConVar sv_logecho( "sv_logecho", "1", FCVAR_ARCHIVE, "Echo log informatio
 static ConVar sv_log_onefile( "sv_log_onefile", "0", FCVAR_ARCHIVE, "Log server information to only one file." );
 static ConVar sv_logbans( "sv_logbans", "0", FCVAR_ARCHIVE, "Log server bans in the server logs." ); // should sv_banid() calls be logged in the server logs?
 static ConVar sv_logsecret( "sv_logsecret", "0", 0, "If set then include this secret when doing UDP logging (will use 0x53 as packet type, not usual 0x52)" ); 
+static ConVar sv_logasync( "sv_logasync", "0", FCVAR_ARCHIVE, "Write the log file on a background thread." );
+static ConVar sv_logjson( "sv_logjson", "0", FCVAR_ARCHIVE, "Also log server events as JSON lines to a .jsonl file next to the log file." );
 
 static ConVar sv_logfilename_format( "sv_logfilename_format", "", FCVAR_ARCHIVE, "Log filename format. See strftime for formatting codes." );
 static ConVar sv_logfilecompress( "sv_logfilecompress", "0", FCVAR_ARCHIVE, "Gzip compress logfile and rename to logfilename.log.gz on close." );
 
+#define LOG_RING_LINES		512		// must be a power of 2
+#define LOG_BATCH_SIZE		(64*1024)
+
+//-----------------------------------------------------------------------------
+// Purpose: single producer, single consumer ring of log lines. The main thread
+//			queues finished lines, the writer thread batches them into one file
+//			write per target. UDP sends stay on the main thread, the net
+//			sockets aren't thread safe.
+//-----------------------------------------------------------------------------
+class CLogWriter : public CThread
+{
+public:
+	CLogWriter();
+
+	void	Queue( FileHandle_t hFile, const char *pszText );	// main thread
+	void	Drain();		// main thread, returns once all queued lines are written
+	bool	IsEmpty() { return m_nRead == m_nQueued; }
+	void	Stop();
+
+	void	PrintStats();
+	void	ResetStats();
+
+protected:
+	virtual int Run();
+
+private:
+	struct LogLine_t
+	{
+		FileHandle_t		hFile;
+		int					nLength;
+		CUtlMemory< char >	text;	// grown by the main thread as needed, never shrunk
+	};
+
+	void	WriteLines( int nFirst, int nLast );
+	void	WriteBatch( FileHandle_t hFile, const char *pBatch, int nBytes );
+
+	LogLine_t			m_Lines[LOG_RING_LINES];
+	CInterlockedInt		m_nQueued;	// lines queued by the main thread
+	CInterlockedInt		m_nRead;	// lines written by the writer thread
+	CThreadEvent		m_WakeEvent;
+	volatile bool		m_bExit;
+
+	char				m_Batch[LOG_BATCH_SIZE];
+	double				m_flLastFlush;
+
+	// backpressure stats, main thread
+	int					m_nMaxDepth;
+	int					m_nStalls;
+	double				m_flStallTime;
+
+	// writer stats, writer thread
+	int					m_nBatches;
+	int					m_nBatchedLines;
+	double				m_flWriteTime;
+};
+
+static CLogWriter g_LogWriter;	// must be constructed before g_Log
+
 CLog g_Log;	// global Log object
 
+CLogWriter::CLogWriter()
+{
+	SetName( "LogWriter" );
+	m_bExit = false;
+	m_flLastFlush = 0;
+	ResetStats();
+}
+
+void CLogWriter::ResetStats()
+{
+	m_nMaxDepth = 0;
+	m_nStalls = 0;
+	m_flStallTime = 0;
+	m_nBatches = 0;
+	m_nBatchedLines = 0;
+	m_flWriteTime = 0;
+}
+
+void CLogWriter::Queue( FileHandle_t hFile, const char *pszText )
+{
+	if ( !IsAlive() )
+	{
+		m_bExit = false;
+		Start();
+	}
+
+	int nDepth = m_nQueued - m_nRead;
+
+	if ( nDepth >= LOG_RING_LINES )
+	{
+		// ring is full, wait for the writer instead of dropping lines
+		double flStart = Plat_FloatTime();
+
+		while ( m_nQueued - m_nRead >= LOG_RING_LINES )
+		{
+			m_WakeEvent.Set();
+			ThreadSleep( 0 );
+		}
+
+		m_nStalls++;
+		m_flStallTime += Plat_FloatTime() - flStart;
+	}
+
+	m_nMaxDepth = max( m_nMaxDepth, nDepth + 1 );
+
+	LogLine_t &line = m_Lines[ m_nQueued & (LOG_RING_LINES-1) ];
+	line.hFile = hFile;
+	line.nLength = V_strlen( pszText );
+	line.text.EnsureCapacity( line.nLength );
+	Q_memcpy( line.text.Base(), pszText, line.nLength );
+
+	// publish the line, the interlocked increment orders the writes above
+	++m_nQueued;
+	m_WakeEvent.Set();
+}
+
+void CLogWriter::Drain()
+{
+	while ( !IsEmpty() && IsAlive() )
+	{
+		m_WakeEvent.Set();
+		ThreadSleep( 1 );
+	}
+}
+
+void CLogWriter::Stop()
+{
+	if ( !IsAlive() )
+		return;
+
+	Drain();
+
+	m_bExit = true;
+	m_WakeEvent.Set();
+	Join();
+}
+
+int CLogWriter::Run()
+{
+	while ( !m_bExit )
+	{
+		m_WakeEvent.Wait( 100 );
+
+		int nRead = m_nRead;
+		int nQueued = m_nQueued;
+
+		if ( nRead != nQueued )
+		{
+			WriteLines( nRead, nQueued );
+
+			// release the slots only after they are written, Drain() relies on that
+			m_nRead += nQueued - nRead;
+		}
+	}
+
+	return 0;
+}
+
+void CLogWriter::WriteBatch( FileHandle_t hFile, const char *pBatch, int nBytes )
+{
+	if ( hFile == FILESYSTEM_INVALID_HANDLE || nBytes <= 0 )
+		return;
+
+	g_pFileSystem->Write( pBatch, nBytes, hFile );
+
+	if ( sv_logflush.GetBool() || ( Plat_FloatTime() - m_flLastFlush ) > 1.0 )
+	{
+		m_flLastFlush = Plat_FloatTime();
+		g_pFileSystem->Flush( hFile );
+	}
+}
+
+void CLogWriter::WriteLines( int nFirst, int nLast )
+{
+	double flStart = Plat_FloatTime();
+
+	FileHandle_t hBatchFile = FILESYSTEM_INVALID_HANDLE;
+	int nBatchBytes = 0;
+
+	for ( int i = nFirst; i != nLast; i++ )
+	{
+		const LogLine_t &line = m_Lines[ i & (LOG_RING_LINES-1) ];
+
+		// consecutive lines for the same file go out as one write
+		if ( line.hFile != hBatchFile || nBatchBytes + line.nLength > LOG_BATCH_SIZE )
+		{
+			WriteBatch( hBatchFile, m_Batch, nBatchBytes );
+			hBatchFile = line.hFile;
+			nBatchBytes = 0;
+		}
+
+		if ( line.nLength > LOG_BATCH_SIZE )
+		{
+			// too big to batch, write it on its own
+			WriteBatch( line.hFile, line.text.Base(), line.nLength );
+			continue;
+		}
+
+		Q_memcpy( m_Batch + nBatchBytes, line.text.Base(), line.nLength );
+		nBatchBytes += line.nLength;
+	}
+
+	WriteBatch( hBatchFile, m_Batch, nBatchBytes );
+
+	m_nBatches++;
+	m_nBatchedLines += nLast - nFirst;
+	m_flWriteTime += Plat_FloatTime() - flStart;
+}
+
+void CLogWriter::PrintStats()
+{
+	int nBatches = max( m_nBatches, 1 );
+
+	ConMsg( "Log writer %s, %i/%i lines queued, max depth %i\n",
+		IsAlive() ? "running" : "stopped", m_nQueued - m_nRead, LOG_RING_LINES, m_nMaxDepth );
+	ConMsg( "%i lines in %i batches (%.1f lines/batch), %.3f ms/batch on writer thread\n",
+		m_nBatchedLines, m_nBatches, (float)m_nBatchedLines / nBatches, m_flWriteTime * 1000.0 / nBatches );
+	ConMsg( "%i stalls on full ring, %.1f ms stalled\n", m_nStalls, m_flStallTime * 1000.0 );
+}
+
+CON_COMMAND( log_writer_stats, "Shows asynchronous log writer backpressure, \"reset\" clears it." )
+{
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		g_LogWriter.ResetStats();
+		return;
+	}
+
+	g_LogWriter.PrintStats();
+}
+
 CON_COMMAND( log, "Enables logging to file, console, and udp < on | off >." )
 {
 	if ( args.ArgC() != 2 )
@@ -274,6 +507,7 @@ void CLog::Reset( void )	// reset all logging streams
 	m_LogAddresses.RemoveAll();
 
 	m_hLogFile = FILESYSTEM_INVALID_HANDLE;
+	m_hJSONFile = FILESYSTEM_INVALID_HANDLE;
 	m_LogFilename = NULL;
 
 	m_bActive = false;
@@ -303,6 +537,7 @@ void CLog::Init( void )
 void CLog::Shutdown()
 {
 	Close();
+	g_LogWriter.Stop();
 	Reset();
 	g_GameEventManager.RemoveListener( this );
 }
@@ -314,6 +549,10 @@ void CLog::SetLoggingState( bool state )
 
 void CLog::RunFrame() 
 {
+	// the log writer flushes its own writes
+	if ( !g_LogWriter.IsEmpty() )
+		return;
+
 	if ( m_bFlushLog && m_hLogFile != FILESYSTEM_INVALID_HANDLE && ( realtime - m_flLastLogFlush ) > 1.0f )
 	{
 		m_flLastLogFlush = realtime;
@@ -502,18 +741,42 @@ void CLog::Print( const char * text )
 		ConMsg( "%s", string );
 	}
 
-	// Echo to log file
-	if ( sv_logfile.GetInt() && ( m_hLogFile != FILESYSTEM_INVALID_HANDLE ) )
+	FileHandle_t hFile = sv_logfile.GetInt() ? m_hLogFile : FILESYSTEM_INVALID_HANDLE;
+
+	WriteLine( hFile, string, true );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: sends a finished line to the log file and/or the log addresses.
+//			The file write goes through the log writer thread if sv_logasync
+//			is set.
+//-----------------------------------------------------------------------------
+void CLog::WriteLine( FileHandle_t hFile, const char *string, bool bUDP )
+{
+	bUDP = bUDP && m_LogAddresses.Count() > 0;
+
+	if ( hFile == FILESYSTEM_INVALID_HANDLE && !bUDP )
+		return;
+
+	if ( hFile != FILESYSTEM_INVALID_HANDLE && sv_logasync.GetBool() )
+	{
+		g_LogWriter.Queue( hFile, string );
+	}
+	else if ( hFile != FILESYSTEM_INVALID_HANDLE )
 	{
-		g_pFileSystem->FPrintf( m_hLogFile, "%s", string );
+		// keep lines in order when switching back from async logging
+		g_LogWriter.Drain();
+
+		// Echo to log file, JSON lines can be longer than FPrintf's buffer
+		g_pFileSystem->Write( string, V_strlen( string ), hFile );
 		if ( sv_logflush.GetBool() )
 		{
-			g_pFileSystem->Flush( m_hLogFile );
+			g_pFileSystem->Flush( hFile );
 		}
 	}
 
 	// Echo to UDP port
-	if ( m_LogAddresses.Count() > 0 )
+	if ( bUDP )
 	{
 		// out of band sending
 		for ( int i = 0 ; i < m_LogAddresses.Count() ; i++ )
@@ -527,6 +790,83 @@ void CLog::Print( const char * text )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: appends a JSON string literal to buf
+//-----------------------------------------------------------------------------
+static void JSON_AppendString( CUtlBuffer &buf, const char *pszText )
+{
+	buf.PutChar( '"' );
+
+	for ( const char *p = pszText; p && *p; p++ )
+	{
+		unsigned char c = *p;
+
+		if ( c == '"' || c == '\\' )
+		{
+			buf.PutChar( '\\' );
+			buf.PutChar( c );
+		}
+		else if ( c < 0x20 )
+		{
+			buf.Printf( "\\u%04x", c );
+		}
+		else
+		{
+			buf.PutChar( c );
+		}
+	}
+
+	buf.PutChar( '"' );
+}
+
+void CLog::PrintEventJSON( IGameEvent *event )
+{
+	KeyValues *pKeys = static_cast< CGameEvent* >( event )->m_pDataKeys;
+
+	tm today;
+	VCRHook_LocalTime( &today );
+
+	char szTime[32];
+	V_sprintf_safe( szTime, "%04i-%02i-%02iT%02i:%02i:%02i",
+		1900 + today.tm_year, today.tm_mon+1, today.tm_mday,
+		today.tm_hour, today.tm_min, today.tm_sec );
+
+	CUtlBuffer buf( 0, 512, CUtlBuffer::TEXT_BUFFER );
+
+	buf.PutString( "{\"time\":" );
+	JSON_AppendString( buf, szTime );
+	buf.PutString( ",\"event\":" );
+	JSON_AppendString( buf, event->GetName() );
+
+	for ( KeyValues *pKey = pKeys ? pKeys->GetFirstSubKey() : NULL; pKey; pKey = pKey->GetNextKey() )
+	{
+		buf.PutChar( ',' );
+		JSON_AppendString( buf, pKey->GetName() );
+		buf.PutChar( ':' );
+
+		switch ( pKey->GetDataType() )
+		{
+		case KeyValues::TYPE_INT:
+			buf.Printf( "%d", pKey->GetInt() );
+			break;
+		case KeyValues::TYPE_FLOAT:
+			// JSON has no nan or inf
+			if ( IsFinite( pKey->GetFloat() ) )
+				buf.Printf( "%g", pKey->GetFloat() );
+			else
+				buf.PutString( "null" );
+			break;
+		default:
+			JSON_AppendString( buf, pKey->GetString() );
+			break;
+		}
+	}
+
+	buf.PutString( "}\n" );
+
+	WriteLine( m_hJSONFile, (const char *)buf.Base(), false );
+}
+
 void CLog::FireGameEvent( IGameEvent *event )
 {
 	if ( !IsActive() )
@@ -538,6 +878,11 @@ void CLog::FireGameEvent( IGameEvent *event )
 	if ( !name || !name[0])
 		return;
 
+	if ( m_hJSONFile != FILESYSTEM_INVALID_HANDLE )
+	{
+		PrintEventJSON( event );
+	}
+
 	if ( Q_strcmp(name, "server_spawn") == 0 )
 	{
 		Printf( "Started map \"%s\" (CRC \"%s\")\n", sv.GetMapName(), MD5_Print( sv.worldmapMD5.bits, MD5_DIGEST_LENGTH ) );
@@ -797,9 +1142,19 @@ Close logging file
 */
 void CLog::Close( void )
 {
+	if ( m_hJSONFile != FILESYSTEM_INVALID_HANDLE )
+	{
+		g_LogWriter.Drain();
+		g_pFileSystem->Close( m_hJSONFile );
+		m_hJSONFile = FILESYSTEM_INVALID_HANDLE;
+	}
+
 	if ( m_hLogFile != FILESYSTEM_INVALID_HANDLE )
 	{
 		Printf( "Log file closed.\n" );
+
+		// the log writer may still hold lines for this file
+		g_LogWriter.Drain();
 		g_pFileSystem->Close( m_hLogFile );
 
 		if ( sv_logfilecompress.GetBool() )
@@ -898,6 +1253,17 @@ void CLog::Open( void )
 	m_hLogFile = info.fh.file;
 	m_LogFilename = info.Filename;
 
+	if ( sv_logjson.GetBool() )
+	{
+		CUtlString jsonFilename = m_LogFilename.StripExtension() + ".jsonl";
+
+		m_hJSONFile = g_pFileSystem->Open( jsonFilename, "wt", "LOGDIR" );
+		if ( m_hJSONFile == FILESYSTEM_INVALID_HANDLE )
+		{
+			ConMsg( "Unable to open JSON log file %s\n", jsonFilename.Get() );
+		}
+	}
+
 	ConMsg( "Server logging data to file %s\n", m_LogFilename.Get() );
 	Printf( "Log file started (file \"%s\") (game \"%s\") (version \"%i\")\n", m_LogFilename.Get(), com_gamedir, build_number() );
 }
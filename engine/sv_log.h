@@ -54,11 +54,15 @@ public:
 
 private:
 
+	void WriteLine( FileHandle_t hFile, const char *string, bool bUDP );
+	void PrintEventJSON( IGameEvent *event ); // log event fields as JSON line
+
 	bool m_bActive;		// true if we're currently logging
 
 	CUtlVector< netadr_t >	m_LogAddresses;		// Server frag log stream is sent to the address(es) in this list
 	FileHandle_t			m_hLogFile;			// File where frag log is put.
 	CUtlString				m_LogFilename;		// Name of our logfile.
+	FileHandle_t			m_hJSONFile;		// JSON lines event log next to the log file, see sv_logjson
 	double					m_flLastLogFlush;
 	bool					m_bFlushLog;
 };
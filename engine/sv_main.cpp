@@ -37,6 +37,7 @@
 #include "PlayerState.h"
 #include "saverestoretypes.h"
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
 #include "proto_oob.h"
 #include "staticpropmgr.h"
 #include "checksum_crc.h"
@@ -1196,7 +1197,7 @@ void SV_DetermineMulticastRecipients( bool usepas, const Vector& origin, CBitVec
 	int cluster = CM_LeafCluster( CM_PointLeafnum( origin ) );
 	byte pvs[MAX_MAP_LEAFS/8];
 	int visType = usepas ? DVIS_PAS : DVIS_PVS;
-	const byte *pMask = CM_Vis( pvs, sizeof(pvs), cluster, visType );
+	const byte *pMask = CM_ClusterVisRow( pvs, sizeof(pvs), cluster, visType );
 
 	playerbits.ClearAll();
 
@@ -1450,9 +1451,9 @@ CUtlVector<int> g_AreasNetworked;
 static void SV_AddToFatPVS( const Vector& org )
 {
 	int		i;
-	byte	pvs[MAX_MAP_LEAFS/8];
+	byte	pvsBuffer[MAX_MAP_LEAFS/8];
 
-	CM_Vis( pvs, sizeof(pvs), CM_LeafCluster( CM_PointLeafnum( org ) ), DVIS_PVS );
+	const byte *pvs = CM_ClusterVisRow( pvsBuffer, sizeof(pvsBuffer), CM_LeafCluster( CM_PointLeafnum( org ) ), DVIS_PVS );
 	for (i=0 ; i<s_FatBytes ; i++)
 	{
 		s_pFatPVS[i] |= pvs[i];
@@ -1975,6 +1976,9 @@ void SV_WriteVoiceCodec(bf_write &pBuf)
 // Gets voice data from a client and forwards it to anyone who can hear this client.
 ConVar voice_debugfeedbackfrom( "voice_debugfeedbackfrom", "0" );
 
+// m_bProximity follows the message type and m_nFromClient, see SVC_VoiceData::WriteToBuffer
+#define SVC_VOICEDATA_PROXIMITY_BIT		( NETMSG_TYPE_BITS + 8 )
+
 void SV_BroadcastVoiceData(IClient * pClient, int nBytes, char * data, int64 xuid )
 {
 	// Disable voice?
@@ -1993,9 +1997,13 @@ void SV_BroadcastVoiceData(IClient * pClient, int nBytes, char * data, int64 xui
 		Msg( "Sending voice from: %s - playerslot: %d\n", pClient->GetClientName(), pClient->GetPlayerSlot() + 1 );
 	}
 
+	// Serialized at most once with data and once without, m_bProximity is patched per recipient
+	CEncodedNetMsg encodedVoice;
+	CEncodedNetMsg encodedLoopback;
+
 	for(int i=0; i < sv.GetClientCount(); i++)
 	{
-		IClient *pDestClient = sv.GetClient(i);
+		CGameClient *pDestClient = sv.Client(i);
 
 		bool bSelf = (pDestClient == pClient);
 
@@ -2024,8 +2032,127 @@ void SV_BroadcastVoiceData(IClient * pClient, int nBytes, char * data, int64 xui
 			voiceData.m_nLength = 0;	
 		}
 
-		pDestClient->SendNetMsg( voiceData );
+		CEncodedNetMsg &encoded = bHearsPlayer ? encodedVoice : encodedLoopback;
+		if ( !encoded.IsEncoded() )
+		{
+			encoded.Encode( voiceData );
+		}
+		else
+		{
+			encoded.PatchByte( SVC_VOICEDATA_PROXIMITY_BIT, voiceData.m_bProximity );
+		}
+
+		pDestClient->SendEncodedNetMsg( voiceData, encoded );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compare encoding a broadcast per recipient against encoding it once
+//			and copying the bits into every recipient's stream
+//-----------------------------------------------------------------------------
+static void SV_BenchmarkBroadcast( const char *pszName, INetMessage &msg, int nRecipients, int nIterations, byte *pStreamData, int nStreamBytes )
+{
+	CUtlVector< bf_write > perClient;
+	CUtlVector< bf_write > encodeOnce;
+	perClient.SetCount( nRecipients );
+	encodeOnce.SetCount( nRecipients );
+
+	CCycleCount perClientTime;
+	CCycleCount encodeOnceTime;
+	int nBits = 0;
+	bool bMatch = true;
+
+	for ( int iter = 0; iter < nIterations; iter++ )
+	{
+		// streams already hold a few bits, like a real channel mid-tick
+		for ( int i = 0; i < nRecipients; i++ )
+		{
+			perClient[i].StartWriting( pStreamData + i * nStreamBytes, nStreamBytes );
+			perClient[i].WriteUBitLong( 0, 1 + ( i % 31 ) );
+			encodeOnce[i].StartWriting( pStreamData + ( nRecipients + i ) * nStreamBytes, nStreamBytes );
+			encodeOnce[i].WriteUBitLong( 0, 1 + ( i % 31 ) );
+		}
+
+		CFastTimer timer;
+		timer.Start();
+		for ( int i = 0; i < nRecipients; i++ )
+		{
+			msg.WriteToBuffer( perClient[i] );
+		}
+		timer.End();
+		perClientTime += timer.GetDuration();
+
+		timer.Start();
+		{
+			CEncodedNetMsg encoded;
+			encoded.Encode( msg );
+			bf_write &buf = encoded.GetBuffer();
+			for ( int i = 0; i < nRecipients; i++ )
+			{
+				encodeOnce[i].WriteBits( buf.GetData(), buf.GetNumBitsWritten() );
+			}
+			nBits = buf.GetNumBitsWritten();
+		}
+		timer.End();
+		encodeOnceTime += timer.GetDuration();
+
+		for ( int i = 0; i < nRecipients && bMatch; i++ )
+		{
+			bMatch = perClient[i].GetNumBitsWritten() == encodeOnce[i].GetNumBitsWritten() &&
+				!V_memcmp( perClient[i].GetData(), encodeOnce[i].GetData(), perClient[i].GetNumBytesWritten() );
+		}
+	}
+
+	double flBytes = (double)Bits2Bytes( nBits ) * nRecipients * nIterations;
+	double flPerClientSec = perClientTime.GetSeconds();
+	double flEncodeOnceSec = encodeOnceTime.GetSeconds();
+
+	ConMsg( "%-10s %3d recipients, %5d bits: per-client %8.2f us (%7.1f MB/s), encode-once %8.2f us (%7.1f MB/s)%s\n",
+		pszName, nRecipients, nBits,
+		perClientTime.GetMicrosecondsF() / nIterations, flPerClientSec > 0.0 ? flBytes / flPerClientSec / ( 1024.0 * 1024.0 ) : 0.0,
+		encodeOnceTime.GetMicrosecondsF() / nIterations, flEncodeOnceSec > 0.0 ? flBytes / flEncodeOnceSec / ( 1024.0 * 1024.0 ) : 0.0,
+		bMatch ? "" : "  OUTPUT MISMATCH" );
+}
+
+CON_COMMAND( sv_broadcast_benchmark, "Measure per-client versus encode-once serialization of broadcast messages. Usage: sv_broadcast_benchmark [iterations]" )
+{
+	int nIterations = ( args.ArgC() >= 2 ) ? MAX( atoi( args[1] ), 1 ) : 1000;
+
+	const int nStreamBytes = 4096;
+	const int nMaxRecipients = 255;
+	byte *pStreamData = new byte[ 2 * nMaxRecipients * nStreamBytes ];
+
+	// a typical voice packet
+	byte voiceBytes[ 400 ];
+	for ( int i = 0; i < sizeof( voiceBytes ); i++ )
+	{
+		voiceBytes[i] = RandomInt( 0, 255 );
+	}
+
+	SVC_VoiceData voiceData;
+	voiceData.m_nFromClient = 1;
+	voiceData.m_bProximity = true;
+	voiceData.m_nLength = sizeof( voiceBytes ) * 8;
+	voiceData.m_DataOut = voiceBytes;
+	voiceData.m_xuid = 0;
+
+	// a killfeed sized game event
+	byte eventBytes[ 48 ];
+	SVC_GameEvent eventMsg;
+	eventMsg.m_DataOut.StartWriting( eventBytes, sizeof( eventBytes ) );
+	while ( eventMsg.m_DataOut.GetNumBitsLeft() >= 32 )
+	{
+		eventMsg.m_DataOut.WriteUBitLong( RandomInt( 0, 0x7fffffff ), 32 );
+	}
+
+	int recipientCounts[] = { 64, nMaxRecipients };
+	for ( int i = 0; i < ARRAYSIZE( recipientCounts ); i++ )
+	{
+		SV_BenchmarkBroadcast( "voice", voiceData, recipientCounts[i], nIterations, pStreamData, nStreamBytes );
+		SV_BenchmarkBroadcast( "game event", eventMsg, recipientCounts[i], nIterations, pStreamData, nStreamBytes );
 	}
+
+	delete [] pStreamData;
 }
 
 
@@ -19,6 +19,9 @@
 #include <netinet/tcp.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#ifdef LINUX
+#include <sys/epoll.h>
+#endif
 #define closesocket close
 #define WSAGetLastError() errno
 #define ioctlsocket ioctl
@@ -96,6 +99,7 @@ ConVar sv_rcon_minfailuretime( "sv_rcon_minfailuretime", "30", 0, "Number of sec
 ConVar sv_rcon_whitelist_address( "sv_rcon_whitelist_address", "", 0, "When set, rcon failed authentications will never ban this address, e.g. '127.0.0.1'" );
 
 ConVar sv_rcon_maxpacketsize( "sv_rcon_maxpacketsize", "1024", 0, "The maximum number of bytes to allow in a command packet", true, 0, false, 0 );
+ConVar sv_rcon_maxrequestsperframe( "sv_rcon_maxrequestsperframe", "64", 0, "The maximum number of RCON requests to run per frame across all connections, the rest wait for the next frame (0 = no limit)", true, 0, false, 0 );
 ConVar sv_rcon_maxpacketbans( "sv_rcon_maxpacketbans", "1", 0, "Ban IPs for sending RCON packets exceeding the value specified in sv_rcon_maxpacketsize", true, 0, true, 1 );
 
 //-----------------------------------------------------------------------------
@@ -105,10 +109,20 @@ ConVar sv_rcon_maxpacketbans( "sv_rcon_maxpacketbans", "1", 0, "Ban IPs for send
 
 CRConServer::CRConServer() : m_Socket( this )
 {
+	m_bSocketDeleted = false;
+	m_bBatchSends = false;
+#ifdef LINUX
+	m_hEpoll = -1;
+#endif
 }
 
 CRConServer::CRConServer( const char *pNetAddress ) : m_Socket( this )
 {
+	m_bSocketDeleted = false;
+	m_bBatchSends = false;
+#ifdef LINUX
+	m_hEpoll = -1;
+#endif
 	SetAddress( pNetAddress );
 }
 
@@ -120,6 +134,12 @@ CRConServer::CRConServer( const char *pNetAddress ) : m_Socket( this )
 //-----------------------------------------------------------------------------
 CRConServer::~CRConServer()
 {
+#ifdef LINUX
+	if ( m_hEpoll != -1 )
+	{
+		close( m_hEpoll );
+	}
+#endif
 }
 
 
@@ -181,6 +201,17 @@ void CRConServer::SetAddress( const char *pNetAddress )
 
 bool CRConServer::CreateSocket()
 {
+#ifdef LINUX
+	// accepted sockets are registered with this so RunFrame only reads the ones with data waiting
+	if ( m_hEpoll == -1 && m_Socket.GetAcceptedSocketCount() == 0 )
+	{
+		m_hEpoll = epoll_create( 16 );
+		if ( m_hEpoll == -1 )
+		{
+			Warning( "RCON: epoll_create failed (%s), polling sockets\n", NET_ErrorString( WSAGetLastError() ) );
+		}
+	}
+#endif
 	return m_Socket.CreateListenSocket( m_Address );
 }
 
@@ -199,18 +230,257 @@ void CRConServer::OnSocketAccepted( SocketHandle_t hSocket, const netadr_t &netA
 	pNewSocket->lastRequestID = 0;
 	pNewSocket->authed = false;
 	pNewSocket->listenerID = g_ServerRemoteAccess.GetNextListenerID( true, &netAdr );
+	pNewSocket->recvstart = 0;
+	pNewSocket->recvend = 0;
+	pNewSocket->readable = true; // data may have arrived before the socket was registered
 	*ppData = pNewSocket;
+
+#ifdef LINUX
+	if ( m_hEpoll == -1 )
+		return;
+
+	epoll_event event;
+	event.events = EPOLLIN | EPOLLRDHUP;
+	event.data.ptr = pNewSocket;
+	if ( epoll_ctl( m_hEpoll, EPOLL_CTL_ADD, hSocket, &event ) != 0 )
+	{
+		// fall back to polling every socket rather than missing this one
+		Warning( "RCON: epoll_ctl failed (%s), polling sockets\n", NET_ErrorString( WSAGetLastError() ) );
+		close( m_hEpoll );
+		m_hEpoll = -1;
+	}
+#endif
 }
 
 void CRConServer::OnSocketClosed( SocketHandle_t hSocket, const netadr_t &netAdr, void* pData )
 {
 	m_bSocketDeleted = true;
+#ifdef LINUX
+	if ( m_hEpoll != -1 )
+	{
+		epoll_event event; // pre 2.6.9 kernels want a non-NULL event
+		epoll_ctl( m_hEpoll, EPOLL_CTL_DEL, hSocket, &event );
+	}
+#endif
 	ConnectedRConSocket_t *pOldSocket = (ConnectedRConSocket_t*)( pData );
 	delete pOldSocket;
 }
 
 
 
+//-----------------------------------------------------------------------------
+// Purpose: mark the accepted sockets that have incoming data waiting
+//-----------------------------------------------------------------------------
+void CRConServer::PollSockets()
+{
+#ifdef LINUX
+	if ( m_hEpoll != -1 )
+	{
+		epoll_event events[64];
+		int nEvents;
+		do 
+		{
+			nEvents = epoll_wait( m_hEpoll, events, ARRAYSIZE(events), 0 );
+			for ( int i = 0; i < nEvents; ++i )
+			{
+				( (ConnectedRConSocket_t *)events[i].data.ptr )->readable = true;
+			}
+		} while ( nEvents == ARRAYSIZE(events) );
+		return;
+	}
+#endif
+
+	// no readiness notification on this platform, try every socket
+	int nCount = m_Socket.GetAcceptedSocketCount();
+	for ( int i = 0; i < nCount; ++i )
+	{
+		GetSocketData( i )->readable = true;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: how much unprocessed data to buffer for a connection. A request bigger
+//			than RCON_MAX_PENDING_RECV at the front of the buffer can never complete
+//			otherwise, so the limit grows to fit it. Requests over sv_rcon_maxpacketsize
+//			drop the connection in ProcessRequest.
+//-----------------------------------------------------------------------------
+int CRConServer::GetRecvLimit( ConnectedRConSocket_t *pData )
+{
+	if ( pData->recvend - pData->recvstart < (int)sizeof(int) )
+		return RCON_MAX_PENDING_RECV;
+
+	int size;
+	memcpy( &size, pData->recvbuffer.Base() + pData->recvstart, sizeof(size) );
+	if ( size <= 0 || size > INT_MAX - pData->recvstart - (int)sizeof(int) )
+		return RCON_MAX_PENDING_RECV;
+
+	if ( sv_rcon_maxpacketsize.GetInt() > 0 && size > sv_rcon_maxpacketsize.GetInt() )
+		return RCON_MAX_PENDING_RECV;
+
+	return MAX( RCON_MAX_PENDING_RECV, pData->recvstart + (int)sizeof(int) + size );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: read everything available on a socket straight into its receive buffer,
+//			returns false if the socket was closed
+//-----------------------------------------------------------------------------
+bool CRConServer::ReadSocket( int nIndex )
+{
+	ConnectedRConSocket_t *pData = GetSocketData( nIndex );
+	SocketHandle_t hSocket = m_Socket.GetAcceptedSocketHandle( nIndex );
+	pData->readable = false;
+
+	// move the partial request left over from last time to the front
+	if ( pData->recvstart > 0 )
+	{
+		if ( pData->recvend > pData->recvstart )
+		{
+			memmove( pData->recvbuffer.Base(), pData->recvbuffer.Base() + pData->recvstart, pData->recvend - pData->recvstart );
+		}
+		pData->recvend -= pData->recvstart;
+		pData->recvstart = 0;
+	}
+
+	// leave anything past RCON_MAX_PENDING_RECV in the socket until the queued requests have run
+	while ( pData->recvend < GetRecvLimit( pData ) )
+	{
+		if ( pData->recvbuffer.NumAllocated() - pData->recvend < 1024 )
+		{
+			pData->recvbuffer.Grow( MAX( 4096, pData->recvbuffer.NumAllocated() ) );
+		}
+
+		int nSpace = pData->recvbuffer.NumAllocated() - pData->recvend;
+		int recvLen = recv( hSocket, pData->recvbuffer.Base() + pData->recvend, nSpace, 0 );
+		if ( recvLen == 0 ) // socket was closed
+		{
+			m_Socket.CloseAcceptedSocket( nIndex );
+			return false;
+		}
+
+		if ( recvLen < 0 )
+		{
+			if ( SocketWouldBlock() )
+				break;
+
+			Warning( "RCON Cmd: recv error (%s)\n", NET_ErrorString( WSAGetLastError() ) );
+			m_Socket.CloseAcceptedSocket( nIndex );
+			return false;
+		}
+
+		pData->recvend += recvLen;
+		if ( recvLen < nSpace ) // drained the socket
+			break;
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: run the next complete request queued on a connection. Returns 1 if a
+//			request was run, 0 if there is none ready and -1 if running it closed
+//			sockets, in which case the socket indices are no longer valid.
+//-----------------------------------------------------------------------------
+int CRConServer::ProcessRequest( int nIndex )
+{
+	ConnectedRConSocket_t *pData = GetSocketData( nIndex );
+	int nPending = pData->recvend - pData->recvstart;
+	if ( nPending < (int)sizeof(int) )
+		return 0;
+
+	const char *pRequest = pData->recvbuffer.Base() + pData->recvstart;
+	int size;
+	memcpy( &size, pRequest, sizeof(size) );
+
+	if ( size <= 0 || ( sv_rcon_maxpacketsize.GetInt() > 0 && size > sv_rcon_maxpacketsize.GetInt() ) )
+	{
+		if ( size > 0 && sv_rcon_maxpacketbans.GetBool() )
+		{
+			HandleFailedRconAuth( m_Socket.GetAcceptedSocketAddress( nIndex ) );
+		}
+
+		m_Socket.CloseAcceptedSocket( nIndex );
+		return 0;
+	}
+
+	if ( nPending - (int)sizeof(int) < size )
+		return 0; // wait for the rest of it
+
+	// the request stays in place in recvbuffer, nothing reads into it until the next frame
+	pData->recvstart += sizeof(int) + size;
+
+	netadr_t socketAdr = m_Socket.GetAcceptedSocketAddress( nIndex );
+	m_bSocketDeleted = false;
+	SV_RedirectStart( RD_SOCKET, &socketAdr );
+	g_ServerRemoteAccess.WriteDataRequest( this, pData->listenerID, pRequest + sizeof(int), size );
+	SV_RedirectEnd();
+
+	// Check and see if socket was closed as a result of processing - this can happen if the user has entered too many passwords
+	if ( m_bSocketDeleted )
+		return -1;
+
+	if ( pData->recvstart == pData->recvend )
+	{
+		pData->recvstart = pData->recvend = 0;
+	}
+
+	QueueDataResponses( nIndex );
+	return 1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: send everything the remote access interface has queued for a connection
+//-----------------------------------------------------------------------------
+void CRConServer::QueueDataResponses( int nIndex )
+{
+	ConnectedRConSocket_t *pData = GetSocketData( nIndex );
+
+	int sendLen;
+	while ( ( sendLen = g_ServerRemoteAccess.GetDataResponseSize( pData->listenerID ) ) > 0 )
+	{
+		char sendBuf[4096];
+		char *pBuf = sendBuf;
+		bool bAllocate = ( sendLen + sizeof(int) > sizeof(sendBuf) );
+		if ( bAllocate )
+		{
+			pBuf = new char[sendLen + sizeof(int)];
+		}
+		memcpy( pBuf, &sendLen, sizeof(sendLen) ); // copy the size of the packet in
+		g_ServerRemoteAccess.ReadDataResponse( pData->listenerID, pBuf + sizeof(int), sendLen );
+		SendRCONResponse( nIndex, pBuf, sendLen + sizeof(int) );
+		if ( bAllocate )
+		{
+			delete [] pBuf;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: write the responses batched up while running requests, one send per connection
+//-----------------------------------------------------------------------------
+void CRConServer::FlushPendingSends()
+{
+	m_bBatchSends = false;
+
+	// NOTE: Has to iterate in reverse; SendRCONResponse can close sockets
+	int nCount = m_Socket.GetAcceptedSocketCount();
+	for ( int i = nCount - 1; i >= 0; --i )
+	{
+		ConnectedRConSocket_t *pData = GetSocketData( i );
+		if ( pData->pendingsend.TellPut() == 0 )
+			continue;
+
+		CUtlBuffer pending;
+		pending.Swap( pData->pendingsend );
+		SendRCONResponse( i, pending.Base(), pending.TellPut() );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: accept new connections and walk open sockets and handle any incoming data
 //-----------------------------------------------------------------------------
@@ -219,15 +489,16 @@ void CRConServer::RunFrame()
 	m_Socket.RunFrame();
 	m_bSocketDeleted = false;
 
-	// handle incoming data
+	PollSockets();
+
+	// process any outgoing data and read any incoming data
 	// NOTE: Have to iterate in reverse since we may be killing sockets
+	bool bHaveRequests = false;
+	m_bBatchSends = true;
 	int nCount = m_Socket.GetAcceptedSocketCount();
 	for ( int i = nCount - 1; i >= 0; --i )
 	{
-		// process any outgoing data for this socket
 		ConnectedRConSocket_t *pData = GetSocketData( i );
-		SocketHandle_t hSocket = m_Socket.GetAcceptedSocketHandle( i );
-		const netadr_t& socketAdr = m_Socket.GetAcceptedSocketAddress( i );
 		while ( pData->m_OutstandingSends.Count() > 0 )
 		{
 			CUtlBuffer &packet = pData->m_OutstandingSends[ pData->m_OutstandingSends.Head()];
@@ -242,143 +513,51 @@ void CRConServer::RunFrame()
 				break;
 			}
 		}
-		
-		int sendLen = g_ServerRemoteAccess.GetDataResponseSize( pData->listenerID );
-		if ( sendLen > 0 )
-		{
-			char sendBuf[4096];
-			char *pBuf = sendBuf;
-			bool bAllocate = ( sendLen + sizeof(int) > sizeof(sendBuf) );
-			if ( bAllocate )
-			{
-				pBuf = new char[sendLen + sizeof(int)];
-			}
-			memcpy( pBuf, &sendLen, sizeof(sendLen) ); // copy the size of the packet in
-			g_ServerRemoteAccess.ReadDataResponse( pData->listenerID, pBuf + sizeof(int), sendLen );
-			SendRCONResponse( i, pBuf, sendLen + sizeof(int) );
-			if ( bAllocate )
-			{
-				delete [] pBuf;
-			}
-		}
 
-		// check for incoming data
-		int pendingLen = 0;
-		unsigned long readLen = 0;
-		char ch;
-		pendingLen = recv( hSocket, &ch, sizeof(ch), MSG_PEEK );
-		if ( pendingLen == -1 && SocketWouldBlock() )
-			continue;
+		if ( i >= m_Socket.GetAcceptedSocketCount() || GetSocketData( i ) != pData )
+			continue; // closed while sending
 
-		if ( pendingLen == 0 )
-		{
-			m_Socket.CloseAcceptedSocket( i );
+		if ( pData->readable && !ReadSocket( i ) )
 			continue;
-		}
 
-		if ( pendingLen < 0 )
-		{
-			//DevMsg( "RCON Cmd: peek error %s\n", NET_ErrorString(WSAGetLastError()));
-			m_Socket.CloseAcceptedSocket( i );
-			continue;
-		}
+		QueueDataResponses( i );
 
-		// find out how much we have to read
-		ioctlsocket( hSocket, FIONREAD, &readLen );
-		if ( readLen > sizeof(int) ) // we have a command to process
+		if ( pData->recvend - pData->recvstart >= (int)sizeof(int) )
 		{
-			CUtlBuffer & response = pData->packetbuffer;
-			response.EnsureCapacity( response.TellPut() + readLen );
-			char *recvBuf = (char *)_alloca( min( 1024ul, readLen ) ); // a buffer used for recv()
-			unsigned int len = 0;
-			while ( len < readLen )
-			{
-				int recvLen = recv( hSocket, recvBuf , min(1024ul, readLen - len) , 0 );
-				if ( recvLen == 0 ) // socket was closed
-				{
-					m_Socket.CloseAcceptedSocket( i );
-					break;
-				}
-				
-				if ( recvLen < 0 && !SocketWouldBlock() )
-				{
-					Warning( "RCON Cmd: recv error (%s)\n", NET_ErrorString( WSAGetLastError() ) );
-					break;
-				}
-
-				response.Put( recvBuf, recvLen );
-				len += recvLen;
-			}
-			
-			response.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
-
-			int size = response.GetInt();
-		
-			if ( sv_rcon_maxpacketsize.GetInt() > 0 && size > sv_rcon_maxpacketsize.GetInt() )
-			{
-				if ( sv_rcon_maxpacketbans.GetBool() )
-				{
-					HandleFailedRconAuth( socketAdr );
-				}
+			bHaveRequests = true;
+		}
+	}
 
-				m_Socket.CloseAcceptedSocket( i );
-				continue;
-			}
-			
-			while ( size > 0 && size <= response.TellPut() - response.TellGet() )
-			{
-				SV_RedirectStart( RD_SOCKET, &socketAdr );
-				g_ServerRemoteAccess.WriteDataRequest( this, pData->listenerID, response.PeekGet(), size );
-				SV_RedirectEnd();
-				if ( m_bSocketDeleted )
-					return;
-				response.SeekGet( CUtlBuffer::SEEK_CURRENT, size ); // eat up the buffer we just sent
-
-				if ( response.TellPut() - response.TellGet() >= sizeof(int) )
-				{
-					size = response.GetInt(); // read how much is in this packet
-				}
-				else
-				{
-					size = 0; // finished the packet
-				}
-			}
+	// Run the queued requests a connection at a time so one client pipelining
+	// lots of requests can't starve the others. Whatever doesn't fit in the
+	// budget stays in the receive buffers for next frame.
+	int nCommandBudget = sv_rcon_maxrequestsperframe.GetInt();
+	if ( nCommandBudget <= 0 )
+	{
+		nCommandBudget = INT_MAX;
+	}
 
-			// Check and see if socket was closed as a result of processing - this can happen if the user has entered too many passwords
-			int nNewCount = m_Socket.GetAcceptedSocketCount();
-			if ( 0 == nNewCount || i > nNewCount || pData != GetSocketData( i )  ) 
+	while ( bHaveRequests && nCommandBudget > 0 )
+	{
+		bHaveRequests = false;
+		for ( int i = m_Socket.GetAcceptedSocketCount() - 1; i >= 0 && nCommandBudget > 0; --i )
+		{
+			int nResult = ProcessRequest( i );
+			if ( nResult < 0 )
 			{
-				response.Purge();
-				break;
+				FlushPendingSends();
+				return;
 			}
 
-			if ( size > 0 || (response.TellPut() - response.TellGet() > 0))
-			{
-				// trim the bytes that were just processed
-				CUtlBuffer tmpBuf;
-				if ( response.TellPut() - response.TellGet() > 0 )
-				{
-					tmpBuf.Put( response.PeekGet(), response.TellPut() - response.TellGet() );
-				}
-
-				response.Purge();
-
-				if ( size > 0 )
-				{
-					response.Put( &size, sizeof(size));
-				}
-
-				if ( tmpBuf.TellPut() > 0 )
-				{
-					response.Put( tmpBuf.Base(), tmpBuf.TellPut() );
-				}
-			}
-			else
+			if ( nResult > 0 )
 			{
-				response.Purge();
+				--nCommandBudget;
+				bHaveRequests = true;
 			}
 		}
-	} // for each socket
+	}
+
+	FlushPendingSends();
 }
 
 
@@ -445,6 +624,14 @@ bool CRConServer::SendRCONResponse( int nIndex, const void *data, int len, bool
 
 	ConnectedRConSocket_t *pSocketData = GetSocketData( nIndex );
 
+	// while RunFrame is running requests collect the responses, FlushPendingSends
+	// writes them out together once the batch is done
+	if ( m_bBatchSends && !fromQueue )
+	{
+		pSocketData->pendingsend.Put( data, len );
+		return true;
+	}
+
 	// if we already have queued data pending then just add this to the end
 	// of the queue
 	if ( !fromQueue && pSocketData->m_OutstandingSends.Count() > 0 )
@@ -634,3 +821,244 @@ bool CRConServer::BCloseAcceptedSocket( ra_listener_id listener )
 	}
 	return false;
 }
+
+
+//-----------------------------------------------------------------------------
+// Load test client: opens a number of connections to an rcon server and pipelines
+// requests down each one from worker threads. The threads don't touch the engine
+// so this can be pointed at the local server, run "rcon_loadtest" without
+// arguments to see the results.
+//-----------------------------------------------------------------------------
+struct RConLoadTest_t
+{
+	netadr_t		adr;
+	char			password[128];
+	char			command[256];
+	int				nConnections;
+	int				nRequests;		// per connection
+	int				nPipeline;		// requests in flight per connection
+	double			flStartTime;
+	double			flEndTime;
+	CInterlockedInt	nRunning;
+	CInterlockedInt	nCompleted;
+	CInterlockedInt	nFailedConnections;
+	CThreadFastMutex latencyMutex;
+	double			flTotalLatency;
+	double			flMaxLatency;
+};
+
+static RConLoadTest_t g_RConLoadTest;
+
+static bool RConLoadTest_Send( SocketHandle_t hSocket, const CUtlBuffer &buf )
+{
+	int sendLen = 0;
+	while ( sendLen < buf.TellPut() )
+	{
+		int ret = send( hSocket, (const char *)buf.Base() + sendLen, buf.TellPut() - sendLen, MSG_NOSIGNAL );
+		if ( ret <= 0 )
+			return false;
+		sendLen += ret;
+	}
+	return true;
+}
+
+static bool RConLoadTest_Recv( SocketHandle_t hSocket, void *pDest, int len )
+{
+	int recvLen = 0;
+	while ( recvLen < len )
+	{
+		int ret = recv( hSocket, (char *)pDest + recvLen, len - recvLen, 0 );
+		if ( ret <= 0 )
+			return false;
+		recvLen += ret;
+	}
+	return true;
+}
+
+// reads one response packet and returns its id and type
+static bool RConLoadTest_RecvPacket( SocketHandle_t hSocket, CUtlMemory<char> &body, int &id, int &type )
+{
+	int size;
+	if ( !RConLoadTest_Recv( hSocket, &size, sizeof(size) ) || size < 2 * (int)sizeof(int) )
+		return false;
+
+	body.EnsureCapacity( size );
+	if ( !RConLoadTest_Recv( hSocket, body.Base(), size ) )
+		return false;
+
+	memcpy( &id, body.Base(), sizeof(id) );
+	memcpy( &type, body.Base() + sizeof(int), sizeof(type) );
+	return true;
+}
+
+static void RConLoadTest_PutPacket( CUtlBuffer &buf, int id, int type, const char *pString )
+{
+	buf.PutInt( 2 * sizeof(int) + V_strlen( pString ) + 2 );
+	buf.PutInt( id );
+	buf.PutInt( type );
+	buf.PutString( pString );
+	buf.PutString( "" );
+}
+
+static uintp RConLoadTest_Thread( void *pParam )
+{
+	RConLoadTest_t &test = g_RConLoadTest;
+	bool bOk = false;
+
+	SocketHandle_t hSocket = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP );
+	if ( hSocket != -1 )
+	{
+		int opt = 1;
+		setsockopt( hSocket, IPPROTO_TCP, TCP_NODELAY, (char *)&opt, sizeof(opt) );
+
+		struct sockaddr s;
+		test.adr.ToSockadr( &s );
+		bOk = ( connect( hSocket, &s, sizeof(s) ) == 0 );
+	}
+
+	CUtlBuffer buf;
+	CUtlMemory<char> body;
+	int id, type;
+
+	if ( bOk )
+	{
+		RConLoadTest_PutPacket( buf, 1, SERVERDATA_AUTH, test.password );
+		bOk = RConLoadTest_Send( hSocket, buf );
+		while ( bOk )
+		{
+			bOk = RConLoadTest_RecvPacket( hSocket, body, id, type );
+			if ( bOk && type == SERVERDATA_AUTH_RESPONSE )
+			{
+				bOk = ( id != -1 ); // -1 is a bad password
+				break;
+			}
+		}
+	}
+
+	// Each request is the command followed by a value request for "hostname";
+	// the value response to the second one (odd id) marks the request complete
+	// since commands with no output send nothing back.
+	double *pSendTimes = (double *)stackalloc( test.nPipeline * sizeof(double) );
+	int nSent = 0;
+	int nDone = 0;
+	while ( bOk && nDone < test.nRequests )
+	{
+		buf.Clear();
+		while ( nSent < test.nRequests && nSent - nDone < test.nPipeline )
+		{
+			RConLoadTest_PutPacket( buf, 2 * nSent + 2, SERVERDATA_EXECCOMMAND, test.command );
+			RConLoadTest_PutPacket( buf, 2 * nSent + 3, SERVERDATA_REQUESTVALUE, "hostname" );
+			pSendTimes[ nSent % test.nPipeline ] = Plat_FloatTime();
+			++nSent;
+		}
+
+		if ( buf.TellPut() > 0 && !RConLoadTest_Send( hSocket, buf ) )
+		{
+			bOk = false;
+			break;
+		}
+
+		bOk = RConLoadTest_RecvPacket( hSocket, body, id, type );
+		if ( bOk && type == SERVERDATA_RESPONSE_VALUE && ( id & 1 ) && id > 2 )
+		{
+			int nRequest = ( id - 3 ) / 2;
+			double flLatency = Plat_FloatTime() - pSendTimes[ nRequest % test.nPipeline ];
+			++nDone;
+			++test.nCompleted;
+
+			AUTO_LOCK( test.latencyMutex );
+			test.flTotalLatency += flLatency;
+			test.flMaxLatency = MAX( test.flMaxLatency, flLatency );
+		}
+	}
+
+	if ( hSocket != -1 )
+	{
+		closesocket( hSocket );
+	}
+
+	if ( !bOk )
+	{
+		++test.nFailedConnections;
+	}
+
+	if ( --test.nRunning == 0 )
+	{
+		test.flEndTime = Plat_FloatTime();
+	}
+	return 0;
+}
+
+CON_COMMAND( rcon_loadtest, "Load test an rcon server: rcon_loadtest <address> <password> [connections] [requests per connection] [pipeline depth] [command]" )
+{
+	RConLoadTest_t &test = g_RConLoadTest;
+
+	if ( args.ArgC() < 3 )
+	{
+		if ( test.nConnections == 0 )
+		{
+			ConMsg( "Usage: %s\n", rcon_loadtest_command.GetHelpText() );
+			return;
+		}
+
+		int nCompleted = test.nCompleted;
+		double flElapsed = ( test.nRunning > 0 ? Plat_FloatTime() : test.flEndTime ) - test.flStartTime;
+		ConMsg( "rcon load test %s: %s, %d connections, %d/%d requests, pipeline %d\n", test.nRunning > 0 ? "running" : "finished",
+			test.adr.ToString(), test.nConnections, nCompleted, test.nConnections * test.nRequests, test.nPipeline );
+		ConMsg( "  %.2f seconds, %.1f requests/sec, %d failed connections\n", flElapsed, flElapsed > 0 ? nCompleted / flElapsed : 0.0, (int)test.nFailedConnections );
+
+		AUTO_LOCK( test.latencyMutex );
+		if ( nCompleted > 0 )
+		{
+			ConMsg( "  latency avg %.2fms max %.2fms\n", 1000.0 * test.flTotalLatency / nCompleted, 1000.0 * test.flMaxLatency );
+		}
+		return;
+	}
+
+	if ( test.nRunning > 0 )
+	{
+		ConMsg( "An rcon load test is already running\n" );
+		return;
+	}
+
+	netadr_t adr;
+	if ( !NET_StringToAdr( args[1], &adr ) )
+	{
+		ConMsg( "Unable to resolve rcon address %s\n", args[1] );
+		return;
+	}
+	if ( adr.GetPort() == 0 )
+	{
+		adr.SetPort( PORT_RCON );
+	}
+
+	test.adr = adr;
+	V_strncpy( test.password, args[2], sizeof(test.password) );
+	test.nConnections = clamp( args.ArgC() > 3 ? atoi( args[3] ) : 8, 1, 256 );
+	test.nRequests = MAX( args.ArgC() > 4 ? atoi( args[4] ) : 1000, 1 );
+	test.nPipeline = clamp( args.ArgC() > 5 ? atoi( args[5] ) : 8, 1, 256 );
+	V_strncpy( test.command, args.ArgC() > 6 ? args[6] : "status", sizeof(test.command) );
+	test.nCompleted = 0;
+	test.nFailedConnections = 0;
+	test.flTotalLatency = 0;
+	test.flMaxLatency = 0;
+	test.flStartTime = test.flEndTime = Plat_FloatTime();
+	test.nRunning = test.nConnections;
+
+	for ( int i = 0; i < test.nConnections; ++i )
+	{
+		ThreadHandle_t hThread = CreateSimpleThread( RConLoadTest_Thread, NULL );
+		if ( !hThread )
+		{
+			++test.nFailedConnections;
+			if ( --test.nRunning == 0 )
+			{
+				test.flEndTime = Plat_FloatTime();
+			}
+			continue;
+		}
+		ReleaseThreadHandle( hThread );
+	}
+
+	ConMsg( "Started rcon load test against %s, run \"rcon_loadtest\" for results\n", adr.ToString() );
+}
@@ -25,6 +25,7 @@
 #include "tier0/memdbgon.h"
 
 #define RCON_MAX_OUTSTANDING_SENDS 100 // max packets to queue before dropping connection
+#define RCON_MAX_PENDING_RECV	(64*1024) // stop reading from a connection with this much unprocessed data, unless one request needs more
 
 //-----------------------------------------------------------------------------
 // container class to handle network streams
@@ -62,7 +63,11 @@ private:
 		bool			authed;
 		int				lastRequestID;
 		ra_listener_id	listenerID;
-		CUtlBuffer		packetbuffer; // data buffer containing pending incoming data for this connection
+		CUtlMemory< char > recvbuffer; // pending incoming data for this connection, requests are parsed in place
+		int				recvstart;	// first unprocessed byte in recvbuffer
+		int				recvend;	// end of received data in recvbuffer
+		bool			readable;	// socket reported incoming data since the last read
+		CUtlBuffer		pendingsend; // responses batched while running this frame's requests
 		CUtlLinkedList< CUtlBuffer > m_OutstandingSends; // packets pending to be send (queued because of WSAEWOULDBLOCK )
 	};
 
@@ -77,6 +82,12 @@ private:
 
 	ConnectedRConSocket_t* GetSocketData( int nIndex );
 	void ProcessAccept();
+	void PollSockets();
+	bool ReadSocket( int nIndex );
+	int GetRecvLimit( ConnectedRConSocket_t *pData );
+	int ProcessRequest( int nIndex );
+	void QueueDataResponses( int nIndex );
+	void FlushPendingSends();
 
 	// NOTE: This function can remove elements. If calling it from a loop,
 	// always iterate over accepted sockets backwards to avoid problems.
@@ -87,6 +98,10 @@ private:
 	CUtlString m_Password;
 	netadr_t m_Address;
 	bool m_bSocketDeleted;
+	bool m_bBatchSends;		// SendRCONResponse appends to pendingsend, see FlushPendingSends
+#ifdef LINUX
+	int m_hEpoll;			// readiness of accepted sockets, -1 if not created
+#endif
 };
 
 
@@ -87,6 +87,12 @@ int	Hunk_LowMark(void)
 	return (int)( g_HunkMemoryStack.GetCurrentAllocPoint() );
 }
 
+// Address of a low mark in the main hunk, so callers can find what was allocated since taking it
+void *Hunk_LowMarkToPointer( int mark )
+{
+	return (byte *)g_HunkMemoryStack.GetBase() + mark;
+}
+
 void Hunk_FreeToLowMark(int mark)
 {
 	Assert( mark < g_HunkMemoryStack.GetSize() );
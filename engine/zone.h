@@ -19,6 +19,7 @@ void *Hunk_AllocName (int size, const char *name, bool bClear = true );
 
 int	Hunk_LowMark (void);
 void Hunk_FreeToLowMark (int mark);
+void *Hunk_LowMarkToPointer( int mark );
 
 void Hunk_Check (void);
 
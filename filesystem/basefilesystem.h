@@ -721,6 +721,9 @@ protected:
 	virtual bool FS_FindNextFile(HANDLE handle, WIN32_FIND_DATA *dat) = 0;
 	virtual bool FS_FindClose(HANDLE handle) = 0;
 	virtual int FS_GetSectorSize( FILE * ) { return 1; }
+	// Positional read that doesn't touch the file pointer, so callers can share a file without a lock.
+	// Returns false if the file can't do that, and the caller has to seek + read instead.
+	virtual bool FS_fpread( void *dest, size_t destSize, size_t size, int64 pos, FILE *fp, size_t *pBytesRead ) { return false; }
 
 #if defined( TRACK_BLOCKING_IO )
 	void BlockingFileAccess_EnterCriticalSection();
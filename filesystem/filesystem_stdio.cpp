@@ -85,6 +85,7 @@ protected:
 	virtual bool FS_FindNextFile(HANDLE handle, WIN32_FIND_DATA *dat);
 	virtual bool FS_FindClose(HANDLE handle);
 	virtual int FS_GetSectorSize( FILE * );
+	virtual bool FS_fpread( void *dest, size_t destSize, size_t size, int64 pos, FILE *fp, size_t *pBytesRead );
 
 private:
 	bool CanAsync() const
@@ -117,6 +118,7 @@ public:
 	virtual int FS_fflush() = 0;
 	virtual char *FS_fgets( char *dest, int destSize ) = 0;
 	virtual int FS_GetSectorSize() { return 1; }
+	virtual bool FS_fpread( void *dest, size_t destSize, size_t size, int64 pos, size_t *pBytesRead ) { return false; }
 };
 
 //---------------------------------------------------------
@@ -138,6 +140,9 @@ public:
 	virtual int FS_ferror();
 	virtual int FS_fflush();
 	virtual char *FS_fgets( char *dest, int destSize );
+#ifdef POSIX
+	virtual bool FS_fpread( void *dest, size_t destSize, size_t size, int64 pos, size_t *pBytesRead );
+#endif
 
 #ifdef POSIX
 	static CUtlMap< ino_t, CThreadMutex * > m_LockedFDMap;
@@ -180,8 +185,11 @@ public:
 	virtual int FS_fflush() { return 0; }
 	virtual char *FS_fgets( char *dest, int destSize );
 	virtual int FS_GetSectorSize() { return m_SectorSize; }
+	virtual bool FS_fpread( void *dest, size_t destSize, size_t size, int64 pos, size_t *pBytesRead );
 
 private:
+	size_t ReadAt( void *dest, size_t destSize, size_t size, int64 nReadPos );
+
 	CWin32ReadOnlyFile( HANDLE hFileUnbuffered, HANDLE hFileBuffered, int sectorSize, int64 fileSize, bool bOverlapped )
 	 :	m_hFileUnbuffered( hFileUnbuffered ),
 		m_hFileBuffered( hFileBuffered ),
@@ -764,6 +772,21 @@ int CFileSystem_Stdio::FS_GetSectorSize( FILE *fp )
 	return pFile->FS_GetSectorSize();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: low-level filesystem wrapper
+//-----------------------------------------------------------------------------
+bool CFileSystem_Stdio::FS_fpread( void *dest, size_t destSize, size_t size, int64 pos, FILE *fp, size_t *pBytesRead )
+{
+	CStdFilesystemFile *pFile = ((CStdFilesystemFile *)fp);
+	if ( !pFile->FS_fpread( dest, destSize, size, pos, pBytesRead ) )
+	{
+		return false;
+	}
+
+	Trace_FRead( *pBytesRead, fp );
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: files are always immediately available on disk
 //-----------------------------------------------------------------------------
@@ -1031,6 +1054,35 @@ size_t CStdioFile::FS_fread( void *dest, size_t destSize, size_t size )
 	return fread( dest, 1, size, m_pFile );
 }
 
+#ifdef POSIX
+//-----------------------------------------------------------------------------
+// Purpose: low-level filesystem wrapper, reads straight from the descriptor
+// so it must not be mixed with buffered writes
+//-----------------------------------------------------------------------------
+bool CStdioFile::FS_fpread( void *dest, size_t destSize, size_t size, int64 pos, size_t *pBytesRead )
+{
+	if ( m_bWriteable )
+	{
+		return false;
+	}
+
+	int fd = fileno( m_pFile );
+	size_t nBytesRead = 0;
+	while ( nBytesRead < size )
+	{
+		ssize_t nResult = pread( fd, (byte *)dest + nBytesRead, size - nBytesRead, pos + nBytesRead );
+		if ( nResult < 0 && errno == EINTR )
+			continue;
+		if ( nResult <= 0 )
+			break;
+		nBytesRead += nResult;
+	}
+
+	*pBytesRead = nBytesRead;
+	return true;
+}
+#endif
+
 
 #define WRITE_CHUNK		(256 * 1024)
 
@@ -1386,6 +1438,25 @@ int CWin32ReadOnlyFile::FS_feof()
 // Purpose: low-level filesystem wrapper
 //-----------------------------------------------------------------------------
 size_t CWin32ReadOnlyFile::FS_fread( void *dest, size_t destSize, size_t size )
+{
+	size_t result = ReadAt( dest, destSize, size, m_ReadPos );
+	m_ReadPos += result;
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: low-level filesystem wrapper, every ReadFile carries its own offset
+//-----------------------------------------------------------------------------
+bool CWin32ReadOnlyFile::FS_fpread( void *dest, size_t destSize, size_t size, int64 pos, size_t *pBytesRead )
+{
+	*pBytesRead = ReadAt( dest, destSize, size, pos );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: reads at the given offset without touching the read position
+//-----------------------------------------------------------------------------
+size_t CWin32ReadOnlyFile::ReadAt( void *dest, size_t destSize, size_t size, int64 nReadPos )
 {
 	VPROF_BUDGET( "CWin32ReadOnlyFile::FS_fread", VPROF_BUDGETGROUP_OTHER_FILESYSTEM );
 	tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "%s %t", __FUNCTION__, tmSendCallStack( TELEMETRY_LEVEL0, 0 ) );
@@ -1410,13 +1481,13 @@ size_t CWin32ReadOnlyFile::FS_fread( void *dest, size_t destSize, size_t size )
 	HANDLE hReadFile = m_hFileBuffered;
 	int nBytesToRead = size;
 	byte *pDest = (byte *)dest;
-	int64 offset = m_ReadPos;
+	int64 offset = nReadPos;
 
 	if ( m_hFileUnbuffered != INVALID_HANDLE_VALUE )
 	{
 		const int destBaseAlign = ( IsX360() ) ? 4 : m_SectorSize;
 		bool bDestBaseIsAligned = ( (DWORD_PTR)dest % destBaseAlign == 0 );
-		bool bCanReadUnbufferedDirect = ( bDestBaseIsAligned && ( destSize % m_SectorSize == 0 ) && ( m_ReadPos % m_SectorSize == 0 ) );
+		bool bCanReadUnbufferedDirect = ( bDestBaseIsAligned && ( destSize % m_SectorSize == 0 ) && ( nReadPos % m_SectorSize == 0 ) );
 
 		if ( bCanReadUnbufferedDirect )
 		{
@@ -1428,8 +1499,8 @@ size_t CWin32ReadOnlyFile::FS_fread( void *dest, size_t destSize, size_t size )
 		{
 			// not properly aligned, snap to alignments
 			// attempt to perform single unbuffered operation using stack buffer
-			int64 alignedOffset = AlignValue( ( m_ReadPos - m_SectorSize ) + 1, m_SectorSize );
-			unsigned int alignedBytesToRead = AlignValue( ( m_ReadPos - alignedOffset ) + size, m_SectorSize );
+			int64 alignedOffset = AlignValue( ( nReadPos - m_SectorSize ) + 1, m_SectorSize );
+			unsigned int alignedBytesToRead = AlignValue( ( nReadPos - alignedOffset ) + size, m_SectorSize );
 			if ( alignedBytesToRead <= sizeof( tempBuffer ) - destBaseAlign )
 			{
 				// read operation can be performed as unbuffered follwed by a post fixup
@@ -1553,7 +1624,7 @@ size_t CWin32ReadOnlyFile::FS_fread( void *dest, size_t destSize, size_t size )
 	{
 		if ( nBytesRead && hReadFile == m_hFileUnbuffered && pDest != dest )
 		{
-			int nBytesExtra = ( m_ReadPos - offset );
+			int nBytesExtra = ( nReadPos - offset );
 			nBytesRead -= nBytesExtra;
 			if ( nBytesRead )
 			{
@@ -1570,8 +1641,6 @@ size_t CWin32ReadOnlyFile::FS_fread( void *dest, size_t destSize, size_t size )
 		g_ThreadIOEvents.ReleaseEvent( pEvent );
 	}
 
-	m_ReadPos += result;
-
 	return result;
 }
 
@@ -12,8 +12,10 @@
 #include "tier1/lzmaDecoder.h"
 #include "tier1/utlbuffer.h"
 #include "tier1/generichash.h"
+#include "tier0/fasttimer.h"
 
 ConVar fs_monitor_read_from_pack( "fs_monitor_read_from_pack", "0", 0, "0:Off, 1:Any, 2:Sync only" );
+ConVar fs_pack_positional_reads( "fs_pack_positional_reads", "1", 0, "Read from zip pack files with positional reads instead of seek + read under the pack lock" );
 
 // How many bytes we should decode at a time when doing pseudo-reads to seek forward in a compressed file handle,
 // (affects maximum stack allocation by a forward seek)
@@ -268,9 +270,6 @@ int CZipPackFile::ReadFromPack( int nEntryIndex, void* pBuffer, int nDestBytes,
 	}
 #endif
 
-	// Otherwise, do the read from the pack
-	m_mutex.Lock();
-
 	if ( fs_monitor_read_from_pack.GetInt() == 1 || ( fs_monitor_read_from_pack.GetInt() == 2 && ThreadInMainThread() ) )
 	{
 		// spew info about real i/o request
@@ -279,6 +278,17 @@ int CZipPackFile::ReadFromPack( int nEntryIndex, void* pBuffer, int nDestBytes,
 		Msg( "Read From Pack: Sync I/O: Requested:%7d, Offset:0x%16.16llx, %s\n", nBytes, m_nBaseOffset + nOffset, szName );
 	}
 
+	// The handle stays open while any file in the pack is open, so a positional read needs no lock
+	size_t nPositionalBytesRead = 0;
+	if ( m_hPackFileHandleFS && fs_pack_positional_reads.GetBool() &&
+		m_fs->FS_fpread( pBuffer, nDestBytes, nBytes, m_nBaseOffset + nOffset, m_hPackFileHandleFS, &nPositionalBytesRead ) )
+	{
+		return (int)nPositionalBytesRead;
+	}
+
+	// Otherwise, do the read from the pack
+	m_mutex.Lock();
+
 	int nBytesRead = 0;
 	// Seek to the start of the read area and perform the read: TODO: CHANGE THIS INTO A CFileHandle
 	if ( m_hPackFileHandleFS )
@@ -325,9 +335,10 @@ bool CZipPackFile::GetFileInfo( const char *pFileName, int &nBaseIndex, int64 &n
 
 	lookup.m_HashName = HashStringCaselessConventional( szFixedName );
 
-	int idx = m_PackFiles.Find( lookup );
-	if ( -1 != idx  )
+	UtlHashHandle_t hIndex = m_PackFileIndex.Find( lookup.m_HashName );
+	if ( hIndex != m_PackFileIndex.InvalidHandle() )
 	{
+		int idx = m_PackFileIndex.Element( hIndex );
 		nFileOffset = m_PackFiles[idx].m_nPosition;
 		nOriginalSize = m_PackFiles[idx].m_nOriginalSize;
 		nCompressedSize = m_PackFiles[idx].m_nCompressedSize;
@@ -792,10 +803,139 @@ bool CZipPackFile::Prepare( int64 fileLen, int64 nFileOfs )
 
 	m_PackFiles.RedoSort();
 
+	// Hash the sorted directory; as with the old binary search, only one of two colliding names is reachable
+	m_PackFileIndex.RemoveAll();
+	m_PackFileIndex.Reserve( m_PackFiles.Count() );
+	for ( int i = 0; i < m_PackFiles.Count(); ++i )
+	{
+		m_PackFileIndex.Insert( m_PackFiles[i].m_HashName, i );
+	}
+
 	return bSuccess;
 }
 
 
+//-----------------------------------------------------------------------------
+// Pack file extraction benchmark: opens and reads every file in a mounted pack
+// from N threads at once, the way parallel loaders hit a map's pakfile
+//-----------------------------------------------------------------------------
+struct PackBenchContext_t
+{
+	CZipPackFile *m_pPackFile;
+	CUtlStringList m_FileNames;
+	CInterlockedInt m_nNextFile;
+	CInterlockedInt m_nFilesRead;
+	CInterlockedInt m_nFailures;
+	CInterlockedInt m_nKBRead;
+};
+
+static uintp PackBenchThread( void *pParam )
+{
+	PackBenchContext_t *pContext = (PackBenchContext_t *)pParam;
+	CUtlMemory< byte > buffer;
+	int64 nBytesRead = 0;
+
+	for ( ;; )
+	{
+		int nFile = pContext->m_nNextFile++;
+		if ( nFile >= pContext->m_FileNames.Count() )
+			break;
+
+		CFileHandle *fh = pContext->m_pPackFile->OpenFile( pContext->m_FileNames[nFile] );
+		if ( !fh )
+		{
+			++pContext->m_nFailures;
+			continue;
+		}
+
+		int nSize = fh->Size();
+		buffer.EnsureCapacity( MAX( nSize, 1 ) );
+		if ( fh->Read( buffer.Base(), nSize, nSize ) != nSize )
+		{
+			++pContext->m_nFailures;
+		}
+		nBytesRead += nSize;
+		++pContext->m_nFilesRead;
+		delete fh;
+	}
+
+	pContext->m_nKBRead += (int)( nBytesRead / 1024 );
+	return 0;
+}
+
+CON_COMMAND( fs_pack_bench, "Extract every file of a mounted pack file with N threads. Usage: fs_pack_bench [threads] [pack name substring]" )
+{
+	CBaseFileSystem *pFileSystem = BaseFileSystem();
+	int nThreads = clamp( ( args.ArgC() > 1 ) ? atoi( args[1] ) : 1, 1, 64 );
+	const char *pSubString = ( args.ArgC() > 2 ) ? args[2] : NULL;
+
+	// Default to the map's pakfile, otherwise the pack with the most files
+	CZipPackFile *pPackFile = NULL;
+	FOR_EACH_VEC( pFileSystem->m_ZipFiles, i )
+	{
+		CZipPackFile *pCandidate = static_cast< CZipPackFile * >( pFileSystem->m_ZipFiles[i] );
+		if ( pSubString )
+		{
+			if ( V_stristr( pCandidate->m_ZipName.Get(), pSubString ) )
+			{
+				pPackFile = pCandidate;
+				break;
+			}
+		}
+		else if ( !pPackFile || ( pCandidate->m_bIsMapPath && !pPackFile->m_bIsMapPath ) ||
+			( pCandidate->m_bIsMapPath == pPackFile->m_bIsMapPath && pCandidate->GetFileCount() > pPackFile->GetFileCount() ) )
+		{
+			pPackFile = pCandidate;
+		}
+	}
+
+	if ( !pPackFile )
+	{
+		Msg( "fs_pack_bench: no matching pack file is mounted\n" );
+		return;
+	}
+
+	PackBenchContext_t context;
+	context.m_pPackFile = pPackFile;
+	for ( int i = 0; i < pPackFile->GetFileCount(); ++i )
+	{
+		char szName[MAX_PATH];
+		pPackFile->IndexToFilename( i, szName, sizeof( szName ) );
+		context.m_FileNames.CopyAndAddToTail( szName );
+	}
+	context.m_nNextFile = 0;
+	context.m_nFilesRead = 0;
+	context.m_nFailures = 0;
+	context.m_nKBRead = 0;
+
+	pPackFile->AddRef();
+
+	CFastTimer timer;
+	timer.Start();
+
+	CUtlVector< ThreadHandle_t > threads;
+	for ( int i = 1; i < nThreads; ++i )
+	{
+		threads.AddToTail( CreateSimpleThread( PackBenchThread, &context ) );
+	}
+	PackBenchThread( &context );
+	for ( int i = 0; i < threads.Count(); ++i )
+	{
+		ThreadJoin( threads[i] );
+		ReleaseThreadHandle( threads[i] );
+	}
+
+	timer.End();
+	pPackFile->Release();
+
+	float flSeconds = MAX( timer.GetDuration().GetSeconds(), 0.000001f );
+	Msg( "fs_pack_bench: %s\n", pPackFile->m_ZipName.Get() );
+	Msg( "  %d threads, %s reads: %d files (%d failed), %.2f MB in %.2f ms, %.0f files/s, %.1f MB/s\n",
+		nThreads, fs_pack_positional_reads.GetBool() ? "positional" : "locked",
+		(int)context.m_nFilesRead, (int)context.m_nFailures, context.m_nKBRead / 1024.0f, flSeconds * 1000.0f,
+		context.m_nFilesRead / flSeconds, context.m_nKBRead / 1024.0f / flSeconds );
+}
+
 //-----------------------------------------------------------------------------
 //
 //-----------------------------------------------------------------------------
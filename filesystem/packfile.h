@@ -199,6 +199,7 @@ public:
 	virtual int64 GetPackFileBaseOffset() OVERRIDE { return m_nBaseOffset; }
 
 	virtual bool IndexToFilename( int nIndex, char *pBuffer, int nBufferSize ) OVERRIDE;
+	int GetFileCount() const { return m_PackFiles.Count(); }
 
 protected:
 	virtual int  ReadFromPack( int nIndex, void* buffer, int nDestBytes, int nBytes, int64 nOffset  ) OVERRIDE;
@@ -254,6 +255,9 @@ protected:
 	// Entries to the individual files stored inside the pack file.
 	CUtlSortVector< CPackFileEntry, CPackFileLessFunc > m_PackFiles;
 
+	// Name hash -> index into m_PackFiles, built once the directory is parsed
+	CUtlHashtable< unsigned int, int > m_PackFileIndex;
+
 	bool						GetFileInfo( const char *pFileName, int &nBaseIndex, int64 &nFileOffset, int &nOriginalSize, int &nCompressedSize, unsigned short &nCompressionMethod );
 
 	// Preload Support
@@ -2699,6 +2699,19 @@ void C_BaseAnimating::ThreadedBoneSetup()
 	g_PreviousBoneSetups.RemoveAll();
 }
 
+void C_BaseAnimating::SetupBonesOnThreadPool( const char *pszDescription, C_BaseAnimating **ppEntities, int nCount )
+{
+	if ( nCount <= 0 )
+		return;
+
+	bool bWasInThreadedBoneSetup = g_bInThreadedBoneSetup;
+	g_bInThreadedBoneSetup = true;
+
+	ParallelProcess( pszDescription, ppEntities, nCount, &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+
+	g_bInThreadedBoneSetup = bWasInThreadedBoneSetup;
+}
+
 bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, int boneMask, float currentTime )
 {
 	VPROF_BUDGET( "C_BaseAnimating::SetupBones", VPROF_BUDGETGROUP_CLIENT_ANIMATION );
@@ -400,6 +400,9 @@ public:
 	static void						PushAllowBoneAccess( bool bAllowForNormalModels, bool bAllowForViewModels, char const *tagPush );
 	static void						PopBoneAccess( char const *tagPop );
 	static void						ThreadedBoneSetup();
+	// Sets up bones for a list of entities on the thread pool with the same protection
+	// ThreadedBoneSetup() uses. Entities with a move parent are left for the main thread.
+	static void						SetupBonesOnThreadPool( const char *pszDescription, C_BaseAnimating **ppEntities, int nCount );
 	static void						InitBoneSetupThreadPool();
 	static void						ShutdownBoneSetupThreadPool();
 
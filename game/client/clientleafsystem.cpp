@@ -32,7 +32,10 @@ class VMatrix;  // forward decl
 static ConVar cl_drawleaf("cl_drawleaf", "-1", FCVAR_CHEAT );
 static ConVar r_PortalTestEnts( "r_PortalTestEnts", "1", FCVAR_CHEAT, "Clip entities against portal frustums." );
 static ConVar r_portalsopenall( "r_portalsopenall", "0", FCVAR_CHEAT, "Open all portals" );
-static ConVar cl_threaded_client_leaf_system("cl_threaded_client_leaf_system", "0"  );
+static ConVar cl_threaded_client_leaf_system("cl_threaded_client_leaf_system", "0", 0, "Re-leaf moved renderables on the thread pool" );
+
+// -1 follows cl_threaded_client_leaf_system, 0/1 force the serial/threaded insertion path
+static int s_nThreadedInsertOverride = -1;
 
 
 DEFINE_FIXEDSIZE_ALLOCATOR( CClientRenderablesList, 1, CUtlMemoryPool::GROW_SLOW );
@@ -56,6 +59,31 @@ static void CallComputeFXBlend( IClientRenderable *&pRenderable )
 	pRenderable->ComputeFxBlend();
 }
 
+//-----------------------------------------------------------------------------
+// Collects the leaves a box touches without touching the leaf system itself,
+// so the tree walks for moved renderables can run on worker threads
+//-----------------------------------------------------------------------------
+class CLeafListEnumerator : public ISpatialLeafEnumerator
+{
+public:
+	bool EnumerateLeaf( int leaf, intp context )
+	{
+		CUtlVector< unsigned short > *pLeaves = (CUtlVector< unsigned short > *)context;
+		pLeaves->AddToTail( leaf );
+		return true;
+	}
+};
+
+static CLeafListEnumerator s_LeafListEnumerator;
+
+struct InsertStaging_t
+{
+	ClientRenderHandle_t m_Handle;
+	Vector m_vecAbsMins;
+	Vector m_vecAbsMaxs;
+	CUtlVector< unsigned short > m_Leaves;
+};
+
 //-----------------------------------------------------------------------------
 // The client leaf system
 //-----------------------------------------------------------------------------
@@ -134,6 +162,9 @@ public:
 
 	bool EnumerateLeaf( int leaf, intp context );
 
+	// Compares the leaf lists produced by the threaded and serial insertion paths
+	void VerifyThreadedInsertion();
+
 	// Adds a shadow to a leaf
 	void AddShadowToLeaf( int leaf, ClientLeafShadowHandle_t handle );
 
@@ -163,6 +194,12 @@ private:
 	void InsertIntoTree( ClientRenderHandle_t &handle );
 	void RemoveFromTree( ClientRenderHandle_t handle );
 
+	// Threaded version of InsertIntoTree for the current dirty renderables
+	void InsertDirtyIntoTreeThreaded( int nDirty );
+	void EnumerateStagedLeaves( InsertStaging_t &staging );
+
+	void SnapshotLeafLists( CUtlVector< unsigned int > &snapshot );
+
 	// Returns if it's a view model render group
 	inline bool IsViewModelRenderGroup( RenderGroup_t group ) const;
 
@@ -219,16 +256,6 @@ private:
 		return s_ClientLeafSystem.m_Shadows[shadow].m_FirstRenderable;
 	}
 
-	void FrameLock()
-	{
-		mdlcache->BeginLock();
-	}
-
-	void FrameUnlock()
-	{
-		mdlcache->EndLock();
-	}
-
 private:
 	enum
 	{
@@ -280,18 +307,6 @@ private:
 		unsigned short	m_Flags;
 	};
 
-	struct EnumResult_t
-	{
-		int leaf;
-		EnumResult_t *pNext;
-	};
-
-	struct EnumResultList_t
-	{
-		EnumResult_t *pHead;
-		ClientRenderHandle_t handle;
-	};
-
 	// Stores data associated with each leaf.
 	CUtlVector< ClientLeaf_t >	m_Leaf;
 
@@ -323,7 +338,9 @@ private:
 	// A little enumerator to help us when adding shadows to renderables
 	int	m_ShadowEnum;
 
-	CTSList<EnumResultList_t> m_DeferredInserts;
+	// Staging for the threaded re-leafing, one per dirty renderable. Worker threads
+	// only fill in the leaf lists; the main thread merges them in serial order.
+	CUtlVector< InsertStaging_t > m_InsertStaging;
 };
 
 
@@ -549,7 +566,15 @@ void CClientLeafSystem::PreRender()
 			RemoveFromTree( handle );
 		}
 
-		bool bThreaded = false;//( nDirty > 5 && cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() );
+		bool bThreaded;
+		if ( s_nThreadedInsertOverride >= 0 )
+		{
+			bThreaded = ( s_nThreadedInsertOverride != 0 );
+		}
+		else
+		{
+			bThreaded = ( nDirty > 5 && cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() );
+		}
 
 		if ( !bThreaded )
 		{
@@ -560,26 +585,7 @@ void CClientLeafSystem::PreRender()
 		}
 		else
 		{
-			// InsertIntoTree can result in new renderables being added, so copy:
-			ClientRenderHandle_t *pDirtyRenderables = (ClientRenderHandle_t *)alloca( sizeof(ClientRenderHandle_t) * nDirty );
-			memcpy( pDirtyRenderables, m_DirtyRenderables.Base(), sizeof(ClientRenderHandle_t) * nDirty );
-			ParallelProcess( "CClientLeafSystem::PreRender", pDirtyRenderables, nDirty, this, &CClientLeafSystem::InsertIntoTree, &CClientLeafSystem::FrameLock, &CClientLeafSystem::FrameUnlock );
-		}
-
-		if ( m_DeferredInserts.Count() )
-		{
-			EnumResultList_t enumResultList;
-			while ( m_DeferredInserts.PopItem( &enumResultList ) )
-			{
-				m_ShadowEnum++;
-				while ( enumResultList.pHead )
-				{
-					EnumResult_t *p = enumResultList.pHead;
-					enumResultList.pHead = p->pNext;
-					AddRenderableToLeaf( p->leaf, enumResultList.handle );
-					delete p;
-				}
-			}
+			InsertDirtyIntoTreeThreaded( nDirty );
 		}
 
 		for ( i = nDirty; --i >= 0; )
@@ -1134,31 +1140,15 @@ void CClientLeafSystem::AddRenderableToLeaves( ClientRenderHandle_t handle, int
 //-----------------------------------------------------------------------------
 bool CClientLeafSystem::EnumerateLeaf( int leaf, intp context )
 {
-	EnumResultList_t *pList = (EnumResultList_t *)context;
-	if ( ThreadInMainThread() )
-	{
-		AddRenderableToLeaf( leaf, pList->handle );
-	}
-	else
-	{
-		EnumResult_t *p = new EnumResult_t;
-		p->leaf = leaf;
-		p->pNext = pList->pHead;
-		pList->pHead = p;
-	}
+	AddRenderableToLeaf( leaf, (ClientRenderHandle_t)context );
 	return true;
 }
 
 void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t &handle )
 {
-	if ( ThreadInMainThread() )
-	{
-		// When we insert into the tree, increase the shadow enumerator
-		// to make sure each shadow is added exactly once to each renderable
-		m_ShadowEnum++;
-	}
-
-	EnumResultList_t list = { NULL, handle };
+	// When we insert into the tree, increase the shadow enumerator
+	// to make sure each shadow is added exactly once to each renderable
+	m_ShadowEnum++;
 
 	// NOTE: The render bounds here are relative to the renderable's coordinate system
 	IClientRenderable* pRenderable = m_Renderables[handle].m_pRenderable;
@@ -1168,12 +1158,114 @@ void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t &handle )
 	Assert( absMins.IsValid() && absMaxs.IsValid() );
 
 	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
-	pQuery->EnumerateLeavesInBox( absMins, absMaxs, this, (intp)&list );
+	pQuery->EnumerateLeavesInBox( absMins, absMaxs, this, handle );
+}
 
-	if ( list.pHead )
+void CClientLeafSystem::EnumerateStagedLeaves( InsertStaging_t &staging )
+{
+	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
+	pQuery->EnumerateLeavesInBox( staging.m_vecAbsMins, staging.m_vecAbsMaxs, &s_LeafListEnumerator, (intp)&staging.m_Leaves );
+}
+
+//-----------------------------------------------------------------------------
+// Re-leafs the first nDirty dirty renderables. Bounds come from entity code, which
+// isn't thread safe, so they're computed here; only the tree walks run on the
+// thread pool, each into its own staging list. The lists are then merged in the
+// order the serial path inserts, so the leaf and shadow lists come out identical.
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::InsertDirtyIntoTreeThreaded( int nDirty )
+{
+	MEM_ALLOC_CREDIT();
+	m_InsertStaging.EnsureCount( nDirty );
+	for ( int i = 0; i < nDirty; ++i )
 	{
-		m_DeferredInserts.PushItem( list );
+		InsertStaging_t &staging = m_InsertStaging[i];
+		staging.m_Handle = m_DirtyRenderables[i];
+		staging.m_Leaves.RemoveAll();
+
+		// NOTE: The render bounds here are relative to the renderable's coordinate system
+		CalcRenderableWorldSpaceAABB_Fast( m_Renderables[staging.m_Handle].m_pRenderable, staging.m_vecAbsMins, staging.m_vecAbsMaxs );
+		Assert( staging.m_vecAbsMins.IsValid() && staging.m_vecAbsMaxs.IsValid() );
 	}
+
+	ParallelProcess( "CClientLeafSystem::PreRender", m_InsertStaging.Base(), nDirty, this, &CClientLeafSystem::EnumerateStagedLeaves );
+
+	for ( int i = nDirty; --i >= 0; )
+	{
+		InsertStaging_t &staging = m_InsertStaging[i];
+		m_ShadowEnum++;
+		for ( int j = 0; j < staging.m_Leaves.Count(); ++j )
+		{
+			AddRenderableToLeaf( staging.m_Leaves[j], staging.m_Handle );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Determinism check for the threaded insertion: re-leafs every movable renderable
+// through both paths and compares the resulting leaf and shadow lists
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::SnapshotLeafLists( CUtlVector< unsigned int > &snapshot )
+{
+	snapshot.RemoveAll();
+	for ( int leaf = 0; leaf < m_Leaf.Count(); ++leaf )
+	{
+		for ( unsigned short idx = m_RenderablesInLeaf.FirstElement( leaf ); idx != m_RenderablesInLeaf.InvalidIndex(); idx = m_RenderablesInLeaf.NextElement( idx ) )
+		{
+			snapshot.AddToTail( m_RenderablesInLeaf.Element( idx ) );
+		}
+		snapshot.AddToTail( 0xFFFFFFFF );
+	}
+	for ( ClientRenderHandle_t h = m_Renderables.Head(); h != m_Renderables.InvalidIndex(); h = m_Renderables.Next( h ) )
+	{
+		for ( unsigned short idx = m_ShadowsOnRenderable.FirstElement( h ); idx != m_ShadowsOnRenderable.InvalidIndex(); idx = m_ShadowsOnRenderable.NextElement( idx ) )
+		{
+			snapshot.AddToTail( m_ShadowsOnRenderable.Element( idx ) );
+		}
+		snapshot.AddToTail( 0xFFFFFFFF );
+	}
+}
+
+void CClientLeafSystem::VerifyThreadedInsertion()
+{
+	if ( !g_pThreadPool->NumThreads() )
+	{
+		Msg( "No worker threads, the threaded insertion path can't run\n" );
+		return;
+	}
+
+	// Settle anything pending so both passes start from the same tree
+	PreRender();
+
+	int nRenderables = 0;
+	CUtlVector< unsigned int > snapshots[2];
+	for ( int nPass = 0; nPass < 2; ++nPass )
+	{
+		nRenderables = 0;
+		for ( ClientRenderHandle_t h = m_Renderables.Head(); h != m_Renderables.InvalidIndex(); h = m_Renderables.Next( h ) )
+		{
+			// Static props are put in their leaves by the engine, not by InsertIntoTree
+			if ( m_Renderables[h].m_Flags & RENDER_FLAGS_STATIC_PROP )
+				continue;
+			RenderableChanged( h );
+			++nRenderables;
+		}
+
+		s_nThreadedInsertOverride = nPass;
+		PreRender();
+		s_nThreadedInsertOverride = -1;
+
+		SnapshotLeafLists( snapshots[nPass] );
+	}
+
+	bool bMatch = ( snapshots[0].Count() == snapshots[1].Count() ) &&
+		!V_memcmp( snapshots[0].Base(), snapshots[1].Base(), snapshots[0].Count() * sizeof( unsigned int ) );
+	Msg( "Re-leafed %d renderables serially and threaded: leaf lists %s\n", nRenderables, bMatch ? "match" : "DIFFER" );
+}
+
+CON_COMMAND_F( cl_leafsystem_verify_threaded, "Re-leafs all renderables through the serial and threaded paths and compares the leaf lists", FCVAR_CHEAT )
+{
+	CClientLeafSystem::s_ClientLeafSystem.VerifyThreadedInsertion();
 }
 
 //-----------------------------------------------------------------------------
@@ -1331,7 +1423,9 @@ void CClientLeafSystem::ComputeTranslucentRenderLeaf( int count, const LeafIndex
 
 	// For better sorting, we're gonna choose the leaf that is closest to the camera.
 	// The leaf list passed in here is sorted front to back
-	bool bThreaded = false;//( cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() );
+	// ComputeFxBlend changes render groups, shadow falloff and the abs origin cache,
+	// none of which is thread safe, so translucency stays on this thread.
+	bool bThreaded = false;
 	int globalFrameCount = gpGlobals->framecount;
 	int i;
 
@@ -1539,12 +1539,10 @@ static ConVar r_threaded_particles( "r_threaded_particles", "1" );
 
 static float s_flThreadedPSystemTimeStep;
 
-static void ProcessPSystem( CNewParticleEffect *&pNewEffect )
+// Everything ProcessPSystem does before simulating. Returns the timestep to
+// simulate with, or a negative one if the effect shouldn't simulate this frame.
+static float BeginProcessPSystem( CNewParticleEffect *pNewEffect )
 {
-	// Enable FP exceptions here when FP_EXCEPTIONS_ENABLED is defined,
-	// to help track down bad math.
-	FPExceptionEnabler enableExceptions;
-
 	// If this is a new effect, then update its bbox so it goes in the
 	// right leaves (if it has particles).
 	int bFirstUpdate = pNewEffect->GetNeedsBBoxUpdate();
@@ -1563,20 +1561,56 @@ static void ProcessPSystem( CNewParticleEffect *&pNewEffect )
 
 	if ( pNewEffect->GetFirstFrameFlag() )
 	{
-		pNewEffect->Simulate( 0.0f );
 		pNewEffect->SetFirstFrameFlag( false );
+		return 0.0f;
 	}
-	else if ( pNewEffect->ShouldSimulate() )
-	{
-		pNewEffect->Simulate( s_flThreadedPSystemTimeStep );
-	}
+	return pNewEffect->ShouldSimulate() ? s_flThreadedPSystemTimeStep : -1.0f;
+}
 
+static void EndProcessPSystem( CNewParticleEffect *pNewEffect )
+{
 	if ( pNewEffect->IsFinished() )
 	{
 		pNewEffect->SetRemoveFlag();
 	}
 }
 
+static void ProcessPSystem( CNewParticleEffect *&pNewEffect )
+{
+	// Enable FP exceptions here when FP_EXCEPTIONS_ENABLED is defined,
+	// to help track down bad math.
+	FPExceptionEnabler enableExceptions;
+
+	float flTimeStep = BeginProcessPSystem( pNewEffect );
+	if ( flTimeStep >= 0.0f )
+	{
+		pNewEffect->Simulate( flTimeStep );
+	}
+	EndProcessPSystem( pNewEffect );
+}
+
+// Hands the simulation itself to the particle system manager, which also spreads
+// the child systems of each effect across the thread pool a level at a time
+static void ProcessPSystemHierarchies( CNewParticleEffect **ppEffects, int nCount )
+{
+	CUtlVector< CParticleCollection * > collections;
+	CUtlVector< float > timeSteps;
+	collections.SetCount( nCount );
+	timeSteps.SetCount( nCount );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		collections[i] = ppEffects[i];
+		timeSteps[i] = BeginProcessPSystem( ppEffects[i] );
+	}
+
+	g_pParticleSystemMgr->SimulateCollections( collections.Base(), timeSteps.Base(), nCount );
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		EndProcessPSystem( ppEffects[i] );
+	}
+}
+
 
 int CParticleMgr::ComputeParticleDefScreenArea( int nInfoCount, RetireInfo_t *pInfo, float *pTotalArea, CParticleSystemDefinition* pDef, 
 	const CViewSetup& view, const VMatrix &worldToPixels, float flFocalDist )
@@ -1754,6 +1788,7 @@ bool CParticleMgr::EarlyRetireParticleSystems( int nCount, CNewParticleEffect **
 }
 
 static ConVar particle_sim_alt_cores( "particle_sim_alt_cores", "2" );
+static ConVar r_threaded_particle_children( "r_threaded_particle_children", "1", 0, "Also simulate the child systems of particle effects on the thread pool" );
 
 void CParticleMgr::BuildParticleSimList( CUtlVector< CNewParticleEffect* > &list )
 {
@@ -1795,6 +1830,33 @@ static int CountParticleSystemActiveParticles( CParticleCollection *p )
 	return nCount;
 }
 
+// Appends every per-particle attribute of a system and its children to values,
+// so two simulations of the same system can be compared
+static void GetParticleSystemAttributes( CParticleCollection *p, CUtlVector< float > &values )
+{
+	for ( int nAttribute = 0; nAttribute < MAX_PARTICLE_ATTRIBUTES; nAttribute++ )
+	{
+		// the stride is 0 for attributes that aren't stored per particle, otherwise the
+		// number of components (vectors are stored as 4 x's, 4 y's, 4 z's)
+		size_t nComponents;
+		p->GetM128AttributePtr( nAttribute, &nComponents );
+		bool bInt = ( ATTRIBUTES_WHICH_ARE_INTS & ( 1 << nAttribute ) ) != 0;
+		for ( int i = 0; i < p->m_nActiveParticles; i++ )
+		{
+			const float *pValue = p->GetFloatAttributePtr( nAttribute, i );
+			for ( size_t c = 0; c < nComponents; c++ )
+			{
+				values.AddToTail( bInt ? (float)*(const int *)pValue : pValue[c * 4] );
+			}
+		}
+	}
+
+	for ( CParticleCollection *pChild = p->m_Children.m_pHead; pChild; pChild = pChild->m_pNext )
+	{
+		GetParticleSystemAttributes( pChild, values );
+	}
+}
+
 
 void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 {
@@ -1850,7 +1912,11 @@ void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 		else
 		{
 			int nAltCore = IsX360() && particle_sim_alt_cores.GetInt();
-			if ( !m_pThreadPool[1] || nAltCore == 0 )
+			if ( ( !m_pThreadPool[1] || nAltCore == 0 ) && r_threaded_particle_children.GetBool() )
+			{
+				ProcessPSystemHierarchies( particlesToSimulate.Base(), nCount );
+			}
+			else if ( !m_pThreadPool[1] || nAltCore == 0 )
 			{
 				ParallelProcess( "CParticleMgr::UpdateNewEffects", particlesToSimulate.Base(), nCount, ProcessPSystem );
 			}
@@ -1906,6 +1972,116 @@ void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Headless benchmark: simulates copies of a particle system (optionally loaded
+// from a .pcf first) one at a time and then through the threaded frame update
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( cl_particle_sim_benchmark, "Times serial vs. threaded simulation: <system> [copies] [frames] [pcf file]", FCVAR_CHEAT )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: cl_particle_sim_benchmark <system> [copies] [frames] [pcf file]\n" );
+		return;
+	}
+
+	const char *pSystemName = args[1];
+	int nCopies = ( args.ArgC() > 2 ) ? clamp( atoi( args[2] ), 1, 4096 ) : 64;
+	int nFrames = ( args.ArgC() > 3 ) ? clamp( atoi( args[3] ), 1, 10000 ) : 300;
+	if ( args.ArgC() > 4 && !g_pParticleSystemMgr->ReadParticleConfigFile( args[4], true ) )
+	{
+		Warning( "cl_particle_sim_benchmark: couldn't load %s\n", args[4] );
+		return;
+	}
+	if ( !g_pParticleSystemMgr->IsParticleSystemDefined( pSystemName ) )
+	{
+		Warning( "cl_particle_sim_benchmark: unknown particle system %s\n", pSystemName );
+		return;
+	}
+
+	const float flTimeStep = 1.0f / 60.0f;
+	double flPassTime[2];
+	int nPassParticles[2];
+	CUtlVector< float > passAttributes[2];
+	int nSystems = 0;
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		CUtlVector< CParticleCollection * > collections;
+		CUtlVector< float > timeSteps;
+		for ( int i = 0; i < nCopies; i++ )
+		{
+			// same seeds in both passes so they simulate the same particles
+			CParticleCollection *pCollection = g_pParticleSystemMgr->CreateParticleCollection( pSystemName, 0.0f, i + 1 );
+			if ( !pCollection )
+				break;
+			pCollection->SetControlPoint( 0, Vector( 64.0f * ( i % 16 ), 64.0f * ( i / 16 ), 0.0f ) );
+			collections.AddToTail( pCollection );
+			timeSteps.AddToTail( flTimeStep );
+		}
+
+		double flStart = Plat_FloatTime();
+		for ( int nFrame = 0; nFrame < nFrames; nFrame++ )
+		{
+			if ( nPass == 0 )
+			{
+				for ( int i = 0; i < collections.Count(); i++ )
+				{
+					collections[i]->Simulate( flTimeStep );
+				}
+			}
+			else
+			{
+				g_pParticleSystemMgr->SimulateCollections( collections.Base(), timeSteps.Base(), collections.Count() );
+			}
+		}
+		flPassTime[nPass] = Plat_FloatTime() - flStart;
+
+		nSystems = 0;
+		nPassParticles[nPass] = 0;
+		for ( int i = 0; i < collections.Count(); i++ )
+		{
+			nSystems += CountChildParticleSystems( collections[i] );
+			nPassParticles[nPass] += CountParticleSystemActiveParticles( collections[i] );
+			GetParticleSystemAttributes( collections[i], passAttributes[nPass] );
+			delete collections[i];
+		}
+	}
+
+	Msg( "%s: %d copies (%d systems), %d frames\n", pSystemName, nCopies, nSystems, nFrames );
+	Msg( "  serial   %8.2f ms/frame\n", 1000.0 * flPassTime[0] / nFrames );
+	Msg( "  threaded %8.2f ms/frame (%.2fx)\n", 1000.0 * flPassTime[1] / nFrames, flPassTime[1] > 0.0 ? flPassTime[0] / flPassTime[1] : 0.0 );
+
+	// the threaded pass runs the same operators on the same seeds, so anything beyond
+	// float noise means the systems didn't simulate the same particles
+	const float flTolerance = 0.001f;
+	int nDiffering = -1;
+	float flMaxDiff = 0.0f;
+	if ( nPassParticles[0] == nPassParticles[1] && passAttributes[0].Count() == passAttributes[1].Count() )
+	{
+		nDiffering = 0;
+		for ( int i = 0; i < passAttributes[0].Count(); i++ )
+		{
+			float a = passAttributes[0][i];
+			float b = passAttributes[1][i];
+			float flDiff = fabs( a - b ) / MAX( 1.0f, MAX( fabs( a ), fabs( b ) ) );
+			flMaxDiff = MAX( flMaxDiff, flDiff );
+			if ( !( flDiff <= flTolerance ) )
+			{
+				nDiffering++;
+			}
+		}
+	}
+
+	if ( nDiffering < 0 )
+	{
+		Msg( "  %d particles at the end, passes differ (%d threaded)\n", nPassParticles[0], nPassParticles[1] );
+	}
+	else
+	{
+		Msg( "  %d particles at the end, %d attribute values, %s (max relative difference %g, %d over %g)\n", nPassParticles[0], passAttributes[0].Count(),
+			nDiffering ? "passes differ" : "passes match", flMaxDiff, nDiffering, flTolerance );
+	}
+}
+
 void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 {
 	// These reflect the convars so we don't parse the strings every particle.
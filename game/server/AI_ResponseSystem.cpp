@@ -22,6 +22,8 @@
 #include "stringpool.h"
 #include "fmtstr.h"
 #include "multiplay_gamerules.h"
+#include "utlmap.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -29,6 +31,18 @@
 ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose matching output (1 for simple, 2 for rule scoring). If set to 3, it will only show response success/failure for npc_selected NPCs." );
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
+ConVar rr_ruleindex( "rr_ruleindex", "1", FCVAR_CHEAT, "Only score rules whose concept/classname/map requirements can match the query." );
+
+// Queries captured by rr_record_queries for rr_benchmark_queries
+static KeyValues *g_pRecordedQueries = NULL;
+
+// Required exact-match criteria that rules are bucketed by, most selective first
+static const char *g_pszIndexedCriteria[] =
+{
+	"concept",
+	"classname",
+	"map",
+};
 
 static CUtlSymbolTable g_RS;
 
@@ -681,6 +695,11 @@ public:
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	void		FindBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool bUseIndex, CUtlVector< int > &bestrules );
+
+	void		BuildRuleIndex();
+	int			GetRuleIndexKey( int irule, CUtlSymbol &value );
+	void		GetCandidateRules( const AI_CriteriaSet& set, CUtlVector< int > &candidates );
 
 	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false );
 	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ );
@@ -708,6 +727,13 @@ public:
 	CUtlDict< Rule, short >	m_Rules;
 	CUtlDict< Enumeration, short > m_Enumerations;
 
+	// Rules bucketed by ( g_pszIndexedCriteria slot, required value ), rebuilt when m_Rules changes
+	CUtlSymbolTable	m_RuleIndexSymbols;
+	CUtlMap< unsigned int, int > m_RuleIndexBuckets;
+	CUtlVector< CUtlVector< int > > m_RuleIndexBucketRules;
+	CUtlVector< int >	m_UnindexedRules;
+	bool		m_bRuleIndexDirty;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -754,9 +780,12 @@ END_DATADESC()
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
-CResponseSystem::CResponseSystem()
+CResponseSystem::CResponseSystem() :
+	m_RuleIndexSymbols( 0, 32, true ),
+	m_RuleIndexBuckets( DefLessFunc( unsigned int ) )
 {
 	token[0] = 0;
+	m_bRuleIndexDirty = true;
 	m_bUnget = false;
 	m_bPrecache = true;
 	m_bCustomManagable = false;
@@ -815,6 +844,7 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+	m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -1675,21 +1705,146 @@ bool CResponseSystem::GetBestResponse( ResponseSearchResult& searchResult, Rule
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: 
+// Purpose: Finds the required, exact string match criterion a rule can be
+//  bucketed by. Such a criterion excludes the rule unless the query carries
+//  exactly that value, so only that bucket needs to be scored.
+// Output : slot in g_pszIndexedCriteria, or -1 if the rule must always be scored
+//-----------------------------------------------------------------------------
+int CResponseSystem::GetRuleIndexKey( int irule, CUtlSymbol &value )
+{
+	Rule *rule = &m_Rules[ irule ];
+
+	int bestKey = -1;
+	for ( int i = 0; i < rule->m_Criteria.Count(); i++ )
+	{
+		Criteria *c = &m_Criteria[ rule->m_Criteria[ i ] ];
+		if ( c->IsSubCriteriaType() || !c->required )
+			continue;
+
+		const Matcher &m = c->matcher;
+		if ( !m.valid || m.isnumeric || m.notequal || m.usemin || m.usemax )
+			continue;
+
+		for ( int k = 0; k < ARRAYSIZE( g_pszIndexedCriteria ); k++ )
+		{
+			if ( bestKey != -1 && k >= bestKey )
+				break;
+
+			if ( !Q_stricmp( c->name, g_pszIndexedCriteria[ k ] ) )
+			{
+				bestKey = k;
+				value = m_RuleIndexSymbols.AddString( m.GetToken() );
+				break;
+			}
+		}
+	}
+
+	return bestKey;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Rebuilds the rule buckets used by GetCandidateRules
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_RuleIndexSymbols.RemoveAll();
+	m_RuleIndexBuckets.RemoveAll();
+	m_RuleIndexBucketRules.RemoveAll();
+	m_UnindexedRules.RemoveAll();
+
+	int c = m_Rules.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		CUtlSymbol value;
+		int key = GetRuleIndexKey( i, value );
+		if ( key == -1 )
+		{
+			m_UnindexedRules.AddToTail( i );
+			continue;
+		}
+
+		unsigned int bucketKey = ( (unsigned int)key << 16 ) | (UtlSymId_t)value;
+		unsigned short it = m_RuleIndexBuckets.Find( bucketKey );
+		if ( it == m_RuleIndexBuckets.InvalidIndex() )
+		{
+			it = m_RuleIndexBuckets.Insert( bucketKey, m_RuleIndexBucketRules.AddToTail() );
+		}
+		m_RuleIndexBucketRules[ m_RuleIndexBuckets[ it ] ].AddToTail( i );
+	}
+
+	m_bRuleIndexDirty = false;
+}
+
+static int __cdecl RuleIndexCompare( const int *a, const int *b )
+{
+	return *a - *b;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects every rule that could score against the set, in rule order
+//-----------------------------------------------------------------------------
+void CResponseSystem::GetCandidateRules( const AI_CriteriaSet& set, CUtlVector< int > &candidates )
+{
+	if ( m_bRuleIndexDirty )
+	{
+		BuildRuleIndex();
+	}
+
+	candidates.AddVectorToTail( m_UnindexedRules );
+
+	for ( int k = 0; k < ARRAYSIZE( g_pszIndexedCriteria ); k++ )
+	{
+		// A missing criterion compares as ""
+		const char *pszValue = "";
+		int found = set.FindCriterionIndex( g_pszIndexedCriteria[ k ] );
+		if ( found != -1 && set.GetValue( found ) )
+		{
+			pszValue = set.GetValue( found );
+		}
+
+		CUtlSymbol value = m_RuleIndexSymbols.Find( pszValue );
+		if ( !value.IsValid() )
+			continue;
+
+		unsigned short it = m_RuleIndexBuckets.Find( ( (unsigned int)k << 16 ) | (UtlSymId_t)value );
+		if ( it != m_RuleIndexBuckets.InvalidIndex() )
+		{
+			candidates.AddVectorToTail( m_RuleIndexBucketRules[ m_RuleIndexBuckets[ it ] ] );
+		}
+	}
+
+	// Ties are broken by position in the bucket, so keep the full scan's order
+	candidates.Sort( RuleIndexCompare );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects all rules tied for the best score, in rule order
 // Input  : set - 
 //			verbose - 
-// Output : int
+//			bUseIndex - only score rules returned by GetCandidateRules
+//			bestrules - 
 //-----------------------------------------------------------------------------
-int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+void CResponseSystem::FindBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool bUseIndex, CUtlVector< int > &bestrules )
 {
-	CUtlVector< int >	bestrules;
 	float bestscore = 0.001f;
 
-	int c = m_Rules.Count();
+	// Debug output describes every rule, so it always takes the full scan
+	const char *pszDebugRule = rr_debugrule.GetString();
+	bUseIndex = bUseIndex && !verbose && !( pszDebugRule && pszDebugRule[0] );
+
+	CUtlVector< int > candidates;
+	if ( bUseIndex )
+	{
+		GetCandidateRules( set, candidates );
+	}
+
+	int c = bUseIndex ? candidates.Count() : m_Rules.Count();
 	int i;
 	for ( i = 0; i < c; i++ )
 	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
+		int irule = bUseIndex ? candidates[ i ] : i;
+
+		float score = ScoreCriteriaAgainstRule( set, irule, verbose );
 		// Check equals so that we keep track of all matching rules
 		if ( score >= bestscore )
 		{
@@ -1701,9 +1856,21 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 			}
 
 			// Add to bucket
-			bestrules.AddToTail( i );
+			bestrules.AddToTail( irule );
 		}
 	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : set - 
+//			verbose - 
+// Output : int
+//-----------------------------------------------------------------------------
+int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+{
+	CUtlVector< int >	bestrules;
+	FindBestMatchingRules( set, verbose, rr_ruleindex.GetBool(), bestrules );
 
 	int bestCount = bestrules.Count();
 	if ( bestCount <= 0 )
@@ -1730,6 +1897,18 @@ bool CResponseSystem::FindBestResponse( const AI_CriteriaSet& set, AI_Response&
 {
 	bool valid = false;
 
+	if ( g_pRecordedQueries )
+	{
+		KeyValues *pQuery = g_pRecordedQueries->CreateNewKey();
+		for ( int i = 0; i < set.GetCount(); i++ )
+		{
+			KeyValues *pCriterion = pQuery->CreateNewKey();
+			pCriterion->SetString( "name", set.GetName( i ) );
+			pCriterion->SetString( "value", set.GetValue( i ) );
+			pCriterion->SetFloat( "weight", set.GetWeight( i ) );
+		}
+	}
+
 	int iDbgResponse = rr_debugresponses.GetInt();
 	bool showRules = ( iDbgResponse == 2 );
 	bool showResult = ( iDbgResponse == 1 || iDbgResponse == 2 );
@@ -2605,6 +2784,7 @@ void CResponseSystem::ParseRule( void )
 	if ( validRule )
 	{
 		m_Rules.Insert( ruleName, newRule );
+		m_bRuleIndexDirty = true;
 	}
 	else
 	{
@@ -2802,6 +2982,7 @@ void CResponseSystem::CopyRuleFrom( Rule *pSrcRule, int iRule, CResponseSystem *
 
 	// Add rule.
 	pCustomSystem->m_Rules.Insert( m_Rules.GetElementName( iRule ), dstRule );
+	pCustomSystem->m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -3049,6 +3230,118 @@ CON_COMMAND( rr_reloadresponsesystems, "Reload all response system scripts." )
 #endif
 }
 
+CON_COMMAND_F( rr_record_queries, "Record response rule queries to a file. Run without a file name to stop recording and save.", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	static char s_szRecordFile[ MAX_PATH ];
+
+	if ( g_pRecordedQueries )
+	{
+		if ( g_pRecordedQueries->SaveToFile( filesystem, s_szRecordFile, "MOD" ) )
+		{
+			Msg( "Saved response rule queries to %s\n", s_szRecordFile );
+		}
+		else
+		{
+			Warning( "Unable to save response rule queries to %s\n", s_szRecordFile );
+		}
+
+		g_pRecordedQueries->deleteThis();
+		g_pRecordedQueries = NULL;
+		return;
+	}
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: rr_record_queries <file>\n" );
+		return;
+	}
+
+	Q_strncpy( s_szRecordFile, args[ 1 ], sizeof( s_szRecordFile ) );
+	g_pRecordedQueries = new KeyValues( "ResponseQueries" );
+	Msg( "Recording response rule queries, run rr_record_queries again to save them to %s\n", s_szRecordFile );
+}
+
+CON_COMMAND_F( rr_benchmark_queries, "Replay recorded response rule queries with and without the rule index.", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: rr_benchmark_queries <file> [iterations]\n" );
+		return;
+	}
+
+	KeyValues *pQueries = new KeyValues( "ResponseQueries" );
+	if ( !pQueries->LoadFromFile( filesystem, args[ 1 ], "MOD" ) )
+	{
+		Warning( "Unable to load response rule queries from %s\n", args[ 1 ] );
+		pQueries->deleteThis();
+		return;
+	}
+
+	CUtlVector< AI_CriteriaSet * > sets;
+	for ( KeyValues *pQuery = pQueries->GetFirstTrueSubKey(); pQuery; pQuery = pQuery->GetNextTrueSubKey() )
+	{
+		AI_CriteriaSet *pSet = new AI_CriteriaSet;
+		for ( KeyValues *pCriterion = pQuery->GetFirstTrueSubKey(); pCriterion; pCriterion = pCriterion->GetNextTrueSubKey() )
+		{
+			pSet->AppendCriteria( pCriterion->GetString( "name" ), pCriterion->GetString( "value" ), pCriterion->GetFloat( "weight", 1.0f ) );
+		}
+		sets.AddToTail( pSet );
+	}
+	pQueries->deleteThis();
+
+	int nIterations = ( args.ArgC() >= 3 ) ? MAX( atoi( args[ 2 ] ), 1 ) : 1;
+
+	CDefaultResponseSystem& rs = defaultresponsesytem;
+	CUtlVector< int > scanRules;
+	CUtlVector< int > indexRules;
+	CCycleCount scanTime;
+	CCycleCount indexTime;
+	int nMismatches = 0;
+
+	for ( int iter = 0; iter < nIterations; iter++ )
+	{
+		for ( int i = 0; i < sets.Count(); i++ )
+		{
+			CFastTimer timer;
+
+			scanRules.RemoveAll();
+			timer.Start();
+			rs.FindBestMatchingRules( *sets[ i ], false, false, scanRules );
+			timer.End();
+			scanTime += timer.GetDuration();
+
+			indexRules.RemoveAll();
+			timer.Start();
+			rs.FindBestMatchingRules( *sets[ i ], false, true, indexRules );
+			timer.End();
+			indexTime += timer.GetDuration();
+
+			if ( scanRules.Count() != indexRules.Count() ||
+				( scanRules.Count() && V_memcmp( scanRules.Base(), indexRules.Base(), scanRules.Count() * sizeof( int ) ) ) )
+			{
+				++nMismatches;
+			}
+		}
+	}
+
+	int nQueries = sets.Count() * nIterations;
+	if ( nQueries > 0 )
+	{
+		Msg( "%d queries against %d rules (%d unindexed)\n", sets.Count(), rs.m_Rules.Count(), rs.m_UnindexedRules.Count() );
+		Msg( "  full scan:  %.3f us/query\n", scanTime.GetMicrosecondsF() / nQueries );
+		Msg( "  rule index: %.3f us/query\n", indexTime.GetMicrosecondsF() / nQueries );
+		Msg( "  %d queries matched a different set of rules\n", nMismatches );
+	}
+
+	sets.PurgeAndDeleteElements();
+}
+
 static short RESPONSESYSTEM_SAVE_RESTORE_VERSION = 1;
 
 // note:  this won't save/restore settings from instanced response systems.  Could add that with a CDefSaveRestoreOps implementation if needed
@@ -14,6 +14,7 @@
 #endif
 
 #include "SharedFunctorUtils.h"
+#include "vstdlib/jobthread.h"
 //#include "../../common/blackbox_helper.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -25,6 +26,8 @@ ConVar nb_update_frequency( "nb_update_frequency", ".1", FCVAR_CHEAT );
 ConVar nb_update_framelimit( "nb_update_framelimit", ( IsDebug() ) ? "30" : "15", FCVAR_CHEAT );
 ConVar nb_update_maxslide( "nb_update_maxslide", "2", FCVAR_CHEAT );
 ConVar nb_update_debug( "nb_update_debug", "0", FCVAR_CHEAT );
+ConVar nb_update_budget_us( "nb_update_budget_us", "0", FCVAR_CHEAT, "Microseconds of full NextBot updates allowed per tick. Overrides nb_update_framelimit when non-zero." );
+ConVar nb_update_parallel_sense( "nb_update_parallel_sense", "0", FCVAR_CHEAT, "Gather vision for the NextBots updating this tick in parallel before entity think." );
 
 //---------------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
@@ -234,6 +237,21 @@ void CC_WarpSelectedHere( const CCommand &args )
 static ConCommand WarpSelectedHere( "nb_warp_selected_here", CC_WarpSelectedHere, "Teleport the selected bot to your cursor position", FCVAR_CHEAT );
 
 
+//---------------------------------------------------------------------------------------------
+static void CC_UpdateHistogram( const CCommand &args )
+{
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		TheNextBots().ResetUpdateCost();
+		Msg( "NextBot update cost histograms cleared.\n" );
+		return;
+	}
+
+	TheNextBots().DumpUpdateCost();
+}
+static ConCommand UpdateHistogram( "nb_update_histogram", CC_UpdateHistogram, "Show per-bot sense and update cost histograms. Use 'nb_update_histogram reset' to clear them.", FCVAR_CHEAT );
+
+
 //---------------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
 NextBotManager::NextBotManager( void )
@@ -391,6 +409,11 @@ void NextBotManager::Update( void )
 			nScheduled = m_botList.Count();
 		}
 
+		if ( nb_update_parallel_sense.GetBool() )
+		{
+			SenseScheduledBots();
+		}
+
 		if ( nb_update_debug.GetBool() )
 		{
 			int nIntentionalSliders = 0;
@@ -420,7 +443,7 @@ bool NextBotManager::ShouldUpdate( INextBot *bot )
 		return true;
 	}
 
-	float frameLimit = nb_update_framelimit.GetFloat();
+	float frameLimit = GetUpdateBudget();
 	float sumFrameTime = 0;
 	if ( bot->IsFlaggedForUpdate() )
 	{
@@ -443,7 +466,7 @@ bool NextBotManager::ShouldUpdate( INextBot *bot )
 
 	if ( nTicksSlid >= nb_update_maxslide.GetInt() )
 	{
-		if ( frameLimit == 0.0 || sumFrameTime < nb_update_framelimit.GetFloat() * 2.0 )
+		if ( frameLimit == 0.0 || sumFrameTime < frameLimit * 2.0 )
 		{
 			g_nBlockedSlides++;
 			return true;
@@ -480,7 +503,214 @@ void NextBotManager::NotifyBeginUpdate( INextBot *bot )
 void NextBotManager::NotifyEndUpdate( INextBot *bot )
 {
 	// This might be a good place to detect a particular bot had spiked [3/14/2008 tom]
-	m_SumFrameTime += Plat_FloatTime() - m_CurUpdateStartTime;
+	double duration = Plat_FloatTime() - m_CurUpdateStartTime;
+	m_SumFrameTime += duration;
+
+	if ( m_updateCost.IsValidIndex( bot->GetBotId() ) )
+	{
+		m_updateCost[ bot->GetBotId() ].m_act.AddSample( duration * 1000000.0 );
+	}
+}
+
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Milliseconds of full bot updates allowed per tick, zero for no limit
+ */
+float NextBotManager::GetUpdateBudget( void ) const
+{
+	if ( nb_update_budget_us.GetFloat() > 0.0f )
+	{
+		return nb_update_budget_us.GetFloat() / 1000.0f;
+	}
+
+	return nb_update_framelimit.GetFloat();
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::ProcessSenseJob( SenseJob &job )
+{
+	CFastTimer timer;
+	timer.Start();
+	job.bot->GetVisionInterface()->SenseVisibleEntities();
+	timer.End();
+	job.duration = timer.GetDuration();
+}
+
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Sense phase of the bots flagged to update this tick. Vision only reads the world, so it
+ * is gathered for all of them at once before any entity thinks, and each bot's serial
+ * update in think consumes the result. Bots are admitted in update order until their
+ * average update cost would exceed the tick budget, since the rest won't run this tick.
+ */
+void NextBotManager::SenseScheduledBots( void )
+{
+	VPROF_BUDGET( "NextBotManager::SenseScheduledBots", "NextBot" );
+
+	float budget = GetUpdateBudget() * 1000.0f;
+	float predicted = 0.0f;
+
+	m_senseJobs.RemoveAll();
+	for( int i = m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
+	{
+		INextBot *bot = m_botList[i];
+		if ( m_iUpdateTickrate > 0 && !bot->IsFlaggedForUpdate() )
+			continue;
+
+		if ( IsDead( bot ) || !bot->GetVisionInterface() || !bot->GetVisionInterface()->IsSenseThreadSafe() )
+			continue;
+
+		if ( m_iUpdateTickrate > 0 && budget > 0.0f )
+		{
+			if ( predicted >= budget )
+				break;
+
+			if ( m_updateCost.IsValidIndex( i ) )
+			{
+				predicted += m_updateCost[i].m_act.GetAverage();
+			}
+		}
+
+		SenseJob &job = m_senseJobs[ m_senseJobs.AddToTail() ];
+		job.bot = bot;
+	}
+
+	if ( !m_senseJobs.Count() )
+		return;
+
+	// Resolve transforms the vision queries read, computing them can touch other entities
+	for( int i = m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
+	{
+		CBaseCombatCharacter *entity = m_botList[i]->GetEntity();
+		if ( entity )
+		{
+			entity->GetAbsOrigin();
+			entity->WorldSpaceCenter();
+			entity->EyePosition();
+		}
+	}
+
+	for( int i = 1; i <= gpGlobals->maxClients; ++i )
+	{
+		CBasePlayer *player = UTIL_PlayerByIndex( i );
+		if ( player )
+		{
+			player->GetAbsOrigin();
+			player->WorldSpaceCenter();
+			player->EyePosition();
+		}
+	}
+
+	double startTime = Plat_FloatTime();
+	ParallelProcess( "NextBotManager::SenseScheduledBots", m_senseJobs.Base(), m_senseJobs.Count(), &NextBotManager::ProcessSenseJob );
+
+	// the sense phase runs on the main thread's time, so it counts against this tick's budget
+	m_SumFrameTime += Plat_FloatTime() - startTime;
+
+	FOR_EACH_VEC( m_senseJobs, it )
+	{
+		int id = m_senseJobs[ it ].bot->GetBotId();
+		if ( m_updateCost.IsValidIndex( id ) )
+		{
+			m_updateCost[ id ].m_sense.AddSample( m_senseJobs[ it ].duration.GetMicrosecondsF() );
+		}
+	}
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::CostHistogram::Reset( void )
+{
+	V_memset( m_bucket, 0, sizeof( m_bucket ) );
+	m_count = 0;
+	m_max = 0.0f;
+	m_total = 0.0;
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::CostHistogram::AddSample( float microseconds )
+{
+	int bucket = 0;
+	for( float limit = 25.0f; bucket < NUM_BUCKETS-1 && microseconds >= limit; limit *= 2.0f )
+	{
+		++bucket;
+	}
+
+	++m_bucket[ bucket ];
+	++m_count;
+	m_max = MAX( m_max, microseconds );
+	m_total += microseconds;
+}
+
+
+//---------------------------------------------------------------------------------------------
+float NextBotManager::CostHistogram::GetAverage( void ) const
+{
+	return m_count ? m_total / m_count : 0.0f;
+}
+
+
+//---------------------------------------------------------------------------------------------
+static void PrintCostHistogram( const char *label, const char *phase, int count, float average, float max, const unsigned int *bucket, int numBuckets )
+{
+	char line[ 256 ];
+	Q_snprintf( line, sizeof( line ), "%-24s %-5s %7d %9.1f %9.1f ", label, phase, count, average, max );
+
+	for( int b=0; b<numBuckets; ++b )
+	{
+		char entry[ 16 ];
+		Q_snprintf( entry, sizeof( entry ), " %6u", bucket[b] );
+		Q_strncat( line, entry, sizeof( line ), COPY_ALL_CHARACTERS );
+	}
+
+	Msg( "%s\n", line );
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::DumpUpdateCost( void ) const
+{
+	char header[ 256 ];
+	Q_snprintf( header, sizeof( header ), "%-24s %-5s %7s %9s %9s ", "bot", "phase", "samples", "avg(us)", "max(us)" );
+
+	float limit = 25.0f;
+	for( int b=0; b<CostHistogram::NUM_BUCKETS; ++b, limit *= 2.0f )
+	{
+		char entry[ 16 ];
+		if ( b < CostHistogram::NUM_BUCKETS-1 )
+			Q_snprintf( entry, sizeof( entry ), " <%5.0f", limit );
+		else
+			Q_snprintf( entry, sizeof( entry ), " >=%4.0f", limit * 0.5f );
+		Q_strncat( header, entry, sizeof( header ), COPY_ALL_CHARACTERS );
+	}
+	Msg( "%s\n", header );
+
+	for( int i = m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
+	{
+		if ( !m_updateCost.IsValidIndex( i ) )
+			continue;
+
+		const UpdateCost &cost = m_updateCost[i];
+		const char *name = m_botList[i]->GetDebugIdentifier();
+
+		PrintCostHistogram( name, "sense", cost.m_sense.m_count, cost.m_sense.GetAverage(), cost.m_sense.m_max, cost.m_sense.m_bucket, CostHistogram::NUM_BUCKETS );
+		PrintCostHistogram( name, "act", cost.m_act.m_count, cost.m_act.GetAverage(), cost.m_act.m_max, cost.m_act.m_bucket, CostHistogram::NUM_BUCKETS );
+	}
+}
+
+
+//---------------------------------------------------------------------------------------------
+void NextBotManager::ResetUpdateCost( void )
+{
+	FOR_EACH_VEC( m_updateCost, it )
+	{
+		m_updateCost[ it ].m_sense.Reset();
+		m_updateCost[ it ].m_act.Reset();
+	}
 }
 
 //---------------------------------------------------------------------------------------------
@@ -506,7 +736,13 @@ void NextBotManager::OnRoundRestart( void )
 //---------------------------------------------------------------------------------------------
 int NextBotManager::Register( INextBot *bot )
 {
-	return m_botList.AddToHead( bot );
+	int id = m_botList.AddToHead( bot );
+
+	m_updateCost.EnsureCount( id + 1 );
+	m_updateCost[ id ].m_sense.Reset();
+	m_updateCost[ id ].m_act.Reset();
+
+	return id;
 }
 
 
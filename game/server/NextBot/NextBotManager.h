@@ -6,6 +6,7 @@
 #define _NEXT_BOT_MANAGER_H_
 
 #include "NextBotInterface.h"
+#include "tier0/fasttimer.h"
 
 class CTerrorPlayer;
 
@@ -26,6 +27,9 @@ public:
 	void NotifyBeginUpdate( INextBot *bot );
 	void NotifyEndUpdate( INextBot *bot );
 
+	void DumpUpdateCost( void ) const;				// print per-bot sense/update cost histograms
+	void ResetUpdateCost( void );
+
 	int GetNextBotCount( void ) const;				// How many nextbots are alive right now?
 
 
@@ -151,6 +155,41 @@ protected:
 	double m_CurUpdateStartTime;
 	double m_SumFrameTime;
 
+	float GetUpdateBudget( void ) const;			// milliseconds of full bot updates allowed per tick
+	void SenseScheduledBots( void );				// run the vision sense phase of this tick's updates in parallel
+
+	struct SenseJob
+	{
+		INextBot *bot;
+		CCycleCount duration;
+	};
+	static void ProcessSenseJob( SenseJob &job );
+	CUtlVector< SenseJob > m_senseJobs;
+
+	/**
+	 * Histogram of update costs in microseconds, buckets double from 25us up
+	 */
+	struct CostHistogram
+	{
+		enum { NUM_BUCKETS = 8 };
+
+		void Reset( void );
+		void AddSample( float microseconds );
+		float GetAverage( void ) const;
+
+		unsigned int m_bucket[ NUM_BUCKETS ];
+		unsigned int m_count;
+		float m_max;
+		double m_total;
+	};
+
+	struct UpdateCost
+	{
+		CostHistogram m_sense;						// parallel sense phase
+		CostHistogram m_act;						// serial update in entity think
+	};
+	CUtlVector< UpdateCost > m_updateCost;			// indexed by bot id
+
 	unsigned int m_debugType;						// debug flags
 
 	struct DebugFilter
@@ -46,6 +46,9 @@ void IVision::Reset( void )
 	m_lastVisionUpdateTimestamp = 0.0f;
 	m_primaryThreat = NULL;
 
+	m_sensedVisible.RemoveAll();
+	m_sensedTick = -1;
+
 	m_FOV = GetDefaultFieldOfView();
 	m_cosHalfFOV = cos( 0.5f * m_FOV * M_PI / 180.0f );
 	
@@ -364,10 +367,11 @@ public:
 
 
 //------------------------------------------------------------------------------------------
-void IVision::UpdateKnownEntities( void )
+/**
+ * Populate "visible" with the entities we can see and recognize at this moment
+ */
+void IVision::CollectVisibleEntities( CUtlVector< CBaseEntity * > *visible )
 {
-	VPROF_BUDGET( "IVision::UpdateKnownEntities", "NextBot" );
-
 	// construct set of potentially visible objects
 	CUtlVector< CBaseEntity * > potentiallyVisible;
 	CollectPotentiallyVisibleEntities( &potentiallyVisible );
@@ -381,6 +385,62 @@ void IVision::UpdateKnownEntities( void )
 		if ( visibleNow( potentiallyVisible[ pit ] ) == false )
 			break;
 	}
+
+	visible->Swap( visibleNow.m_recognized );
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Sense phase of a scheduled update. Only reads the world and writes m_sensedVisible,
+ * so it is safe to run for different bots at the same time.
+ */
+void IVision::SenseVisibleEntities( void )
+{
+	m_sensedVisible.RemoveAll();
+	m_sensedTick = -1;
+
+	if ( nb_blind.GetBool() )
+		return;
+
+	CUtlVector< CBaseEntity * > visible;
+	CollectVisibleEntities( &visible );
+
+	m_sensedVisible.EnsureCapacity( visible.Count() );
+	FOR_EACH_VEC( visible, it )
+	{
+		m_sensedVisible.AddToTail( visible[ it ] );
+	}
+
+	m_sensedTick = gpGlobals->tickcount;
+}
+
+
+//------------------------------------------------------------------------------------------
+void IVision::UpdateKnownEntities( void )
+{
+	VPROF_BUDGET( "IVision::UpdateKnownEntities", "NextBot" );
+
+	CollectVisible visibleNow( this );
+	if ( m_sensedTick == gpGlobals->tickcount )
+	{
+		// use the visible set gathered during this tick's sense phase
+		FOR_EACH_VEC( m_sensedVisible, it )
+		{
+			CBaseEntity *entity = m_sensedVisible[ it ];
+			if ( entity )
+			{
+				visibleNow.m_recognized.AddToTail( entity );
+			}
+		}
+	}
+	else
+	{
+		CollectVisibleEntities( &visibleNow.m_recognized );
+	}
+
+	m_sensedVisible.RemoveAll();
+	m_sensedTick = -1;
 	
 	// update known set with new data
 	{	VPROF_BUDGET( "IVision::UpdateKnownEntities( update status )", "NextBot" );
@@ -72,6 +72,14 @@ public:
 	 */
 	virtual void CollectPotentiallyVisibleEntities( CUtlVector< CBaseEntity * > *potentiallyVisible );
 
+	/**
+	 * Gather the entities visible right now without touching the known set.
+	 * NextBotManager may call this for many bots in parallel before entity think,
+	 * in which case this tick's Update() consumes the result instead of tracing again.
+	 */
+	void SenseVisibleEntities( void );
+	virtual bool IsSenseThreadSafe( void ) const;				// return true only if collecting visible entities has been audited to have no side effects
+
 	virtual float GetMaxVisionRange( void ) const;				// return maximum distance vision can reach
 	virtual float GetMinRecognizeTime( void ) const;			// return VISUAL reaction time
 
@@ -116,6 +124,10 @@ private:
 	
 	CUtlVector< CKnownEntity > m_knownEntityVector;		// the set of enemies/friends we are aware of
 	void UpdateKnownEntities( void );
+	void CollectVisibleEntities( CUtlVector< CBaseEntity * > *visible );
+
+	CUtlVector< CHandle< CBaseEntity > > m_sensedVisible;	// result of SenseVisibleEntities()
+	int m_sensedTick;									// tick m_sensedVisible was gathered on
 	bool IsAwareOf( const CKnownEntity &known ) const;	// return true if our reaction time has passed for this entity
 	mutable CHandle< CBaseEntity > m_primaryThreat;
 
@@ -139,6 +151,26 @@ inline void IVision::CollectKnownEntities( CUtlVector< CKnownEntity > *knownVect
 	}
 }
 
+inline bool IVision::IsSenseThreadSafe( void ) const
+{
+	// derived visions may override any of the queries the sense phase uses, so they must opt in
+	return false;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * The vision INextBot creates for bots that don't provide their own. It uses the stock
+ * IVision queries unmodified, which only read the world, so it can sense in parallel.
+ */
+class NextBotDefaultVision : public IVision
+{
+public:
+	NextBotDefaultVision( INextBot *bot ) : IVision( bot ) { }
+
+	virtual bool IsSenseThreadSafe( void ) const	{ return true; }
+};
+
 inline float IVision::GetDefaultFieldOfView( void ) const
 {
 	return 90.0f;
@@ -27,6 +27,7 @@
 #include "datacache/idatacache.h"
 #include "smoke_trail.h"
 #include "props.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -288,6 +289,8 @@ CBaseAnimating::CBaseAnimating()
 	m_fadeMaxDist = 0;
 	m_flFadeScale = 0.0f;
 	m_fBoneCacheFlags = 0;
+	m_nBoneSetupRequestTick = -1;
+	m_flBoneSetupBatchTime = -1.0f;
 }
 
 CBaseAnimating::~CBaseAnimating()
@@ -2578,6 +2581,243 @@ void CBaseAnimating::UnlockStudioHdr()
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: the bones kept in the shared bone cache
+//-----------------------------------------------------------------------------
+static int GetBoneCacheMask( void )
+{
+	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
+
+	// TF queries these bones to position weapons when players are killed
+#if defined( TF_DLL )
+	boneMask |= BONE_USED_BY_BONE_MERGE;
+#endif
+	return boneMask;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets up the bone caches of the animating entities that asked for
+// them this tick, in parallel, once every entity has thought and animated.
+// The bones serve queries made before each entity animates next tick.
+// Only caches that would have to be rebuilt for those queries are set up, and
+// entities whose batched bones go unused drop out of the next batch.
+//-----------------------------------------------------------------------------
+ConVar sv_setupbones_batch( "sv_setupbones_batch", "0", 0, "Set up the bone caches of animating entities that used them this tick in parallel after entities think" );
+
+extern ConVar sv_unlag;
+extern ConVar sv_lagflushbonecache;
+
+class CBoneSetupBatch : public CAutoGameSystemPerFrame
+{
+public:
+	CBoneSetupBatch( char const *name ) : CAutoGameSystemPerFrame( name )
+	{
+	}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		m_Requests.Purge();
+		m_Jobs.Purge();
+		m_BoneToWorld.Purge();
+	}
+
+	virtual void FrameUpdatePostEntityThink();
+
+	void AddRequest( CBaseAnimating *pAnimating );
+
+	// Compares batched bone setup against serial SetupBones for every entity that can be batched
+	void RunTest();
+
+private:
+	struct BoneSetupJob_t
+	{
+		CBaseAnimating	*m_pAnimating;
+		matrix3x4_t		*m_pBoneToWorld;
+		int				m_nBoneMask;
+	};
+
+	static void ProcessJob( BoneSetupJob_t &job );
+	static bool CanBatch( CBaseAnimating *pAnimating );
+	void AddJob( CBaseAnimating *pAnimating, int boneMask );
+	void AllocateBoneToWorld();
+
+	CUtlVector< EHANDLE >			m_Requests;
+	CUtlVector< BoneSetupJob_t >	m_Jobs;
+	CUtlVector< matrix3x4_t >		m_BoneToWorld;
+};
+
+static CBoneSetupBatch g_BoneSetupBatch( "CBoneSetupBatch" );
+
+void CBoneSetupBatch::AddRequest( CBaseAnimating *pAnimating )
+{
+	if ( !sv_setupbones_batch.GetBool() || pAnimating->m_nBoneSetupRequestTick == gpGlobals->tickcount )
+		return;
+
+	pAnimating->m_nBoneSetupRequestTick = gpGlobals->tickcount;
+	m_Requests.AddToTail( pAnimating );
+}
+
+void CBoneSetupBatch::ProcessJob( BoneSetupJob_t &job )
+{
+	job.m_pAnimating->SetupBones( job.m_pBoneToWorld, job.m_nBoneMask );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Lag compensation flushes the bone cache of every player it moves,
+// so batching those would only throw the work away.
+//-----------------------------------------------------------------------------
+bool CBoneSetupBatch::CanBatch( CBaseAnimating *pAnimating )
+{
+	if ( !pAnimating || !pAnimating->CanBatchBoneSetup() )
+		return false;
+
+	if ( pAnimating->IsPlayer() && gpGlobals->maxClients > 1 && sv_unlag.GetBool() && sv_lagflushbonecache.GetBool() )
+		return false;
+
+	return true;
+}
+
+void CBoneSetupBatch::AddJob( CBaseAnimating *pAnimating, int boneMask )
+{
+	// Resolve the absolute transform here, computing it can touch other entities
+	pAnimating->GetAbsOrigin();
+	pAnimating->GetAbsAngles();
+
+	BoneSetupJob_t &job = m_Jobs[ m_Jobs.AddToTail() ];
+	job.m_pAnimating = pAnimating;
+	job.m_nBoneMask = boneMask;
+}
+
+void CBoneSetupBatch::AllocateBoneToWorld()
+{
+	m_BoneToWorld.SetCount( m_Jobs.Count() * MAXSTUDIOBONES );
+	FOR_EACH_VEC( m_Jobs, i )
+	{
+		m_Jobs[i].m_pBoneToWorld = &m_BoneToWorld[ i * MAXSTUDIOBONES ];
+	}
+}
+
+void CBoneSetupBatch::FrameUpdatePostEntityThink()
+{
+	if ( !sv_setupbones_batch.GetBool() || ai_setupbones_debug.GetBool() )
+	{
+		m_Requests.RemoveAll();
+		return;
+	}
+
+	if ( !m_Requests.Count() )
+		return;
+
+	VPROF_BUDGET( "CBoneSetupBatch", VPROF_BUDGETGROUP_SERVER_ANIM );
+
+	int boneMask = GetBoneCacheMask();
+	float flNextTime = gpGlobals->curtime + gpGlobals->interval_per_tick;
+
+	// Gather the entities whose bones can be set up off the main thread
+	m_Jobs.RemoveAll();
+	FOR_EACH_VEC( m_Requests, i )
+	{
+		CBaseAnimating *pAnimating = static_cast< CBaseAnimating * >( m_Requests[i].Get() );
+		if ( !CanBatch( pAnimating ) )
+			continue;
+
+		// GetBoneCache would still use this cache next tick, nothing to do
+		CBoneCache *pcache = Studio_GetBoneCache( pAnimating->m_boneCacheHandle );
+		if ( pcache && pcache->IsValid( flNextTime ) && ( pcache->m_boneMask & boneMask ) == boneMask && pcache->m_timeValid <= flNextTime )
+			continue;
+
+		AddJob( pAnimating, boneMask );
+	}
+	m_Requests.RemoveAll();
+
+	if ( !m_Jobs.Count() )
+		return;
+
+	AllocateBoneToWorld();
+	ParallelProcess( "CBoneSetupBatch", m_Jobs.Base(), m_Jobs.Count(), &CBoneSetupBatch::ProcessJob );
+
+	// The bone cache is only ever written from the main thread
+	FOR_EACH_VEC( m_Jobs, i )
+	{
+		BoneSetupJob_t &job = m_Jobs[i];
+		job.m_pAnimating->UpdateBoneCache( job.m_pBoneToWorld, job.m_nBoneMask );
+		job.m_pAnimating->m_flBoneSetupBatchTime = gpGlobals->curtime;
+	}
+
+	// Batched bones only save work once GetBoneCache uses them, see "SetupBones batch used"
+	VPROF_INCREMENT_COUNTER( "SetupBones batched", m_Jobs.Count() );
+}
+
+void CBoneSetupBatch::RunTest()
+{
+	int boneMask = GetBoneCacheMask();
+
+	m_Jobs.RemoveAll();
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		if ( CanBatch( pAnimating ) )
+		{
+			AddJob( pAnimating, boneMask );
+		}
+	}
+
+	if ( !m_Jobs.Count() )
+	{
+		Msg( "No animating entities can be batched\n" );
+		return;
+	}
+
+	AllocateBoneToWorld();
+	ParallelProcess( "CBoneSetupBatch", m_Jobs.Base(), m_Jobs.Count(), &CBoneSetupBatch::ProcessJob );
+
+	int nMismatched = 0;
+	matrix3x4_t bonetoworld[MAXSTUDIOBONES];
+	FOR_EACH_VEC( m_Jobs, i )
+	{
+		BoneSetupJob_t &job = m_Jobs[i];
+		job.m_pAnimating->SetupBones( bonetoworld, job.m_nBoneMask );
+
+		// Only the bones in the mask are written
+		CStudioHdr *pStudioHdr = job.m_pAnimating->GetModelPtr();
+		for ( int j = 0; j < pStudioHdr->numbones(); j++ )
+		{
+			if ( !( pStudioHdr->boneFlags( j ) & job.m_nBoneMask ) )
+				continue;
+
+			if ( !MatricesAreEqual( bonetoworld[j], job.m_pBoneToWorld[j], 1e-3f ) )
+			{
+				Warning( "%s (%s): bone %d differs from serial SetupBones\n", job.m_pAnimating->GetClassname(), STRING( job.m_pAnimating->GetModelName() ), j );
+				nMismatched++;
+				break;
+			}
+		}
+	}
+
+	Msg( "SetupBones batch test: %d entities, %d mismatched\n", m_Jobs.Count(), nMismatched );
+	m_Jobs.RemoveAll();
+}
+
+CON_COMMAND_F( sv_setupbones_batch_test, "Sets up bones for every animating entity in a parallel batch and compares them against serial SetupBones", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_BoneSetupBatch.RunTest();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bone merging and IK read other entities and the world while
+// setting up bones, so those are left to be set up on demand.
+//-----------------------------------------------------------------------------
+bool CBaseAnimating::CanBatchBoneSetup( void )
+{
+	if ( IsMarkedForDeletion() || IsEffectActive( EF_NODRAW ) || m_pIk || GetMoveParent() )
+		return false;
+
+	return GetModelPtr() != NULL;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: return the index to the shared bone cache
 // Output :
@@ -2588,17 +2828,22 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 	Assert(pStudioHdr);
 
 	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
-	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
+	int boneMask = GetBoneCacheMask();
 
-	// TF queries these bones to position weapons when players are killed
-#if defined( TF_DLL )
-	boneMask |= BONE_USED_BY_BONE_MERGE;
-#endif
 	if ( pcache )
 	{
 		if ( pcache->IsValid( gpGlobals->curtime ) && (pcache->m_boneMask & boneMask) == boneMask && pcache->m_timeValid <= gpGlobals->curtime)
 		{
 			// Msg("%s:%s:%s (%x:%x:%8.4f) cache\n", GetClassname(), GetDebugName(), STRING(GetModelName()), boneMask, pcache->m_boneMask, pcache->m_timeValid );
+			// first use of bones from the last batch, a SetupBones the serial path would have
+			// had to do.  Keep the entity in the batch, which skips it while its cache holds up.
+			if ( pcache->m_timeValid == m_flBoneSetupBatchTime )
+			{
+				m_flBoneSetupBatchTime = -1.0f;
+				VPROF_INCREMENT_COUNTER( "SetupBones batch used", 1 );
+				g_BoneSetupBatch.AddRequest( this );
+			}
+
 			// in memory and still valid, use it!
 			return pcache;
 		}
@@ -2611,19 +2856,43 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 		}
 	}
 
+	// set these up in this tick's batch
+	g_BoneSetupBatch.AddRequest( this );
+
 	matrix3x4_t bonetoworld[MAXSTUDIOBONES];
 	SetupBones( bonetoworld, boneMask );
 
+	return UpdateBoneCache( bonetoworld, boneMask );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: store bones set up for the current time in the shared bone cache
+//-----------------------------------------------------------------------------
+CBoneCache *CBaseAnimating::UpdateBoneCache( matrix3x4_t *pBoneToWorld, int boneMask )
+{
+	CStudioHdr *pStudioHdr = GetModelPtr( );
+	Assert(pStudioHdr);
+
+	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
+
+	// in memory, but missing some of the bone masks
+	if ( pcache && (pcache->m_boneMask & boneMask) != boneMask )
+	{
+		Studio_DestroyBoneCache( m_boneCacheHandle );
+		m_boneCacheHandle = 0;
+		pcache = NULL;
+	}
+
 	if ( pcache )
 	{
 		// still in memory but out of date, refresh the bones.
-		pcache->UpdateBones( bonetoworld, pStudioHdr->numbones(), gpGlobals->curtime );
+		pcache->UpdateBones( pBoneToWorld, pStudioHdr->numbones(), gpGlobals->curtime );
 	}
 	else
 	{
 		bonecacheparams_t params;
 		params.pStudioHdr = pStudioHdr;
-		params.pBoneToWorld = bonetoworld;
+		params.pBoneToWorld = pBoneToWorld;
 		params.curtime = gpGlobals->curtime;
 		params.boneMask = boneMask;
 
@@ -256,6 +256,8 @@ public:
 	virtual bool TestCollision( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	virtual bool TestHitboxes( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	class CBoneCache *GetBoneCache( void );
+	class CBoneCache *UpdateBoneCache( matrix3x4_t *pBoneToWorld, int boneMask );	// store freshly set up bones in the bone cache
+	bool CanBatchBoneSetup( void );		// can SetupBones run on a worker thread alongside other entities?
 	void InvalidateBoneCache();
 	void InvalidateBoneCacheIfOlderThan( float deltaTime );
 	virtual int DrawDebugTextOverlays( void );
@@ -407,6 +409,8 @@ private:
 
 	memhandle_t		m_boneCacheHandle;
 	unsigned short	m_fBoneCacheFlags;		// Used for bone cache state on model
+	int				m_nBoneSetupRequestTick;	// last tick the bone cache was requested for the bone setup batch
+	float			m_flBoneSetupBatchTime;		// curtime the bone setup batch last filled in the bone cache
 
 protected:
 	CNetworkVar( float, m_fadeMinDist );	// Point at which fading is absolute
@@ -423,6 +427,7 @@ private:
 
 // FIXME: necessary so that cyclers can hack m_bSequenceFinished
 friend class CFlexCycler;
+friend class CBoneSetupBatch;
 friend class CCycler;
 friend class CBlendingCycler;
 };
@@ -17,6 +17,7 @@
 #include "viewport_panel_names.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef TERROR
 #include "func_simpleladder.h"
@@ -42,6 +43,8 @@ ConVar nav_generate_fixup_jump_areas( "nav_generate_fixup_jump_areas", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_threaded( "nav_generate_threaded", "0", FCVAR_CHEAT, "Sample walkable space in parallel waves instead of one step at a time" );
+ConVar nav_generate_region_size( "nav_generate_region_size", "1024", FCVAR_CHEAT, "Size of the spatial regions that threaded sampling batches traces by" );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -3461,8 +3464,13 @@ void CNavMesh::BeginGeneration( bool incremental )
 	// initialize seed list index
 	m_seedIdx = 0;
 
+	// the threaded sampler starts its first wave from the first seed
+	m_sampleFrontier.RemoveAll();
+	m_sampleNewNodes.RemoveAll();
+
 	Msg( "Generating Navigation Mesh...\n" );
 	m_generationStartTime = Plat_FloatTime();
+	m_generationPhaseStartTime = m_generationStartTime;
 }
 
 
@@ -3530,6 +3538,7 @@ void CNavMesh::BeginAnalysis( bool quitWhenFinished )
 	m_bQuitWhenFinished = quitWhenFinished;
 	lastMsgTime = 0.0f;
 	m_generationStartTime = Plat_FloatTime();
+	m_generationPhaseStartTime = m_generationStartTime;
 }
 
 
@@ -3631,7 +3640,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			AnalysisProgress( "Sampling walkable space...", 100, m_sampleTick / 10, false );
 			m_sampleTick = ( m_sampleTick + 1 ) % 1000;
 
-			while ( SampleStep() )
+			while ( nav_generate_threaded.GetBool() ? SampleWave() : SampleStep() )
 			{
 				if ( Plat_FloatTime() - startTime > maxTime )
 				{
@@ -3640,6 +3649,8 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			}
 
 			// sampling is complete, now build nav areas
+			Msg( "Sampled %d nodes.\n", CNavNode::GetListLength() );
+			EndGenerationPhase( "Sampling walkable space" );
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
 
 			return true;
@@ -3688,6 +3699,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+			EndGenerationPhase( "Creating navigation areas" );
 			m_generationState = FIND_HIDING_SPOTS;
 			m_generationIndex = 0;
 			return true;
@@ -3712,6 +3724,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			}
 
 			Msg( "Finding hiding spots...DONE\n" );
+			EndGenerationPhase( "Finding hiding spots" );
 
 			m_generationState = FIND_ENCOUNTER_SPOTS;
 			m_generationIndex = 0;
@@ -3737,6 +3750,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			}
 
 			Msg( "Finding encounter spots...DONE\n" );
+			EndGenerationPhase( "Finding encounter spots" );
 
 			m_generationState = FIND_SNIPER_SPOTS;
 			m_generationIndex = 0;
@@ -3762,6 +3776,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			}
 
 			Msg( "Finding sniper spots...DONE\n" );
+			EndGenerationPhase( "Finding sniper spots" );
 
 			m_generationState = COMPUTE_MESH_VISIBILITY;
 			m_generationIndex = 0;
@@ -3794,6 +3809,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			EndVisibilityComputations();
 
 			Msg( "Computing mesh visibility...DONE\n" );
+			EndGenerationPhase( "Computing mesh visibility" );
 
 			m_generationState = FIND_EARLIEST_OCCUPY_TIMES;
 			m_generationIndex = 0;
@@ -3819,6 +3835,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			}
 
 			Msg( "Finding earliest occupy times...DONE\n" );
+			EndGenerationPhase( "Finding earliest occupy times" );
 
 #ifdef NAV_ANALYZE_LIGHT_INTENSITY
 			bool shouldSkipLightComputation = ( m_generationMode == GENERATE_INCREMENTAL || engine->IsDedicatedServer() );
@@ -3962,6 +3979,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 			EndCustomAnalysis();
 			Msg( "Custom game-specific analysis...DONE\n" );
+			EndGenerationPhase( "Custom game-specific analysis" );
 
 			m_generationState = SAVE_NAV_MESH;
 			m_generationIndex = 0;
@@ -4071,7 +4089,7 @@ const char *CNavMesh::GetPlayerSpawnName( void ) const
  * Node Z positions are ground level.
  */
 CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDirType dir, CNavNode *source, bool isOnDisplacement, 
-							float obstacleHeight, float obstacleStartDist, float obstacleEndDist )
+							float obstacleHeight, float obstacleStartDist, float obstacleEndDist, bool deferFinish )
 {
 	// check if a node exists at this location
 	CNavNode *node = CNavNode::GetNode( destPos );
@@ -4108,6 +4126,23 @@ CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDir
 		m_currentNode = node;
 	}
 
+	// the caller will run FinishNode() itself, typically for a whole batch of nodes at once
+	if ( !deferFinish )
+	{
+		FinishNode( node );
+	}
+
+	return node;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Compute the crouch and cliff attributes of a node.
+ * Only modifies the given node, so batches of nodes may be finished in parallel.
+ */
+void CNavMesh::FinishNode( CNavNode *&node )
+{
 	node->CheckCrouch();
 
 	// determine if there's a cliff nearby and set an attribute on this node
@@ -4120,8 +4155,6 @@ CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDir
 			break;
 		}
 	}
-
-	return node;
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -4413,208 +4446,405 @@ bool CNavMesh::SampleStep( void )
 				// mark direction as visited
 				m_currentNode->MarkAsVisited( m_generationDir );
 
-				// sanity check to not generate across the world for incremental generation
-				const float incrementalRange = nav_generate_incremental_range.GetFloat();
-				if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
+				if ( !IsSampleStepInRange( pos ) )
 				{
-					bool inRange = false;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
-						{
-							inRange = true;
-							break;
-						}
-					}
-
-					if ( !inRange )
-					{
-						return true;
-					}
-				}
-
-				if ( m_generationMode == GENERATE_SIMPLIFY )
-				{
-					if ( !m_simplifyGenerationExtent.Contains( pos ) )
-					{
-						return true;
-					}
+					return true;
 				}
 
 				// test if we can move to new position
-				trace_t result;
-				Vector from( *m_currentNode->GetPosition() );
-				CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
-				Vector to, toNormal;
-				float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
-				if ( TraceAdjacentNode( 0, from, pos, &result ) )
+				SampleProbe probe;
+				if ( !ComputeSampleStep( *m_currentNode->GetPosition(), pos, &probe ) )
 				{
-					to = result.endpos;
-					toNormal = result.plane.normal;
+					return true;
 				}
-				else
-				{
-					// test going up ClimbUpHeight
-					bool success = false;
-					for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
-					{						
-						trace_t tr;
-						Vector start( from );
-						Vector end( pos );
-						start.z += height;
-						end.z += height;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-						if ( !tr.startsolid && tr.fraction == 1.0f )
-						{
-							if ( !StayOnFloor( &tr ) )
-							{
-								break;
-							}
 
-							to = tr.endpos;
-							toNormal = tr.plane.normal;
+				// we can move here
+				// create a new navigation node, and update current node pointer
+				AddNode( probe.to, probe.toNormal, m_generationDir, m_currentNode, probe.isOnDisplacement, probe.obstacleHeight, probe.obstacleStartDist, probe.obstacleEndDist );
 
-							start = end = from;
-							end.z += height;
-							UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-							if ( tr.fraction < 1.0f )
-							{
-								break;
-							}
+				return true;
+			}
+		}
 
-							// keep track of far up we had to go to find a path to the next node
-							obstacleHeight = height;
-							success = true;
-							break;
-						}
-						else
-						{
-							// Could not trace from node to node at this height, something is in the way.
-							// Trace in the other direction to see if we hit something
-							Vector vecToObstacleStart = tr.endpos - start;
-							Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
-							if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
-							{
-								UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-								if ( !tr.startsolid && tr.fraction < 1.0 )
-								{
-									// We hit something going the other direction.  There is some obstacle between the two nodes.
-									Vector vecToObstacleEnd = tr.endpos - start;
-									Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
-									if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
-									{
-										// Remember the distances to start and end of the obstacle (with respect to the "from" node).
-										// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
-										// If we do eventually clear the obstacle, these values will be the start and end distance to the
-										// very tip of the obstacle.
-										obstacleStartDist = vecToObstacleStart.Length();
-										obstacleEndDist = vecToObstacleEnd.Length();
-										if ( obstacleEndDist == 0 )
-										{
-											obstacleEndDist = GenerationStepSize;
-										}
-									}								
-								}
-							}
-						}
-					}
+		// all directions have been searched from this node - pop back to its parent and continue
+		m_currentNode = m_currentNode->GetParent();
+	}
+}
 
-					if ( !success )
-					{
-						return true;
-					}
-				}
 
-				// Don't generate nodes if we spill off the end of the world onto skybox
-				if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
-				{
-					return true;
-				}
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return false if a sample step to 'pos' falls outside of the extent being generated
+ */
+bool CNavMesh::IsSampleStepInRange( const Vector &pos ) const
+{
+	// sanity check to not generate across the world for incremental generation
+	const float incrementalRange = nav_generate_incremental_range.GetFloat();
+	if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
+	{
+		bool inRange = false;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
+			{
+				inRange = true;
+				break;
+			}
+		}
 
-				// If we're incrementally generating, don't overlap existing nav areas.
-				Vector testPos( to );
-				bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
-				bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
-				bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
-				bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
-				if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
-				{
-					return true;
-				}
+		if ( !inRange )
+		{
+			return false;
+		}
+	}
 
-				int nTolerance = nav_generate_incremental_tolerance.GetInt();
-				if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
-				{
-					bool bValid = false;
-					int zPos = to.z;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						int zMin = seedPos.z - nTolerance;
-						int zMax = seedPos.z + nTolerance;
+	if ( m_generationMode == GENERATE_SIMPLIFY )
+	{
+		if ( !m_simplifyGenerationExtent.Contains( pos ) )
+		{
+			return false;
+		}
+	}
 
-						if ( zPos >= zMin && zPos <= zMax )
-						{
-							bValid = true;
-							break;
-						}
-					}
+	return true;
+}
 
-					if ( !bValid )
-						return true;
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Trace a single sample step from 'from' toward the grid position 'pos'.
+ * Only reads the world and the existing mesh, so it is safe to run on worker threads.
+ * Returns true and fills in the probe's destination if the step is walkable.
+ */
+bool CNavMesh::ComputeSampleStep( const Vector &from, const Vector &pos, SampleProbe *probe )
+{
+	trace_t result;
+	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
+	Vector to, toNormal;
+	float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
+	if ( TraceAdjacentNode( 0, from, pos, &result ) )
+	{
+		to = result.endpos;
+		toNormal = result.plane.normal;
+	}
+	else
+	{
+		// test going up ClimbUpHeight
+		bool success = false;
+		for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
+		{						
+			trace_t tr;
+			Vector start( from );
+			Vector end( pos );
+			start.z += height;
+			end.z += height;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+			if ( !tr.startsolid && tr.fraction == 1.0f )
+			{
+				if ( !StayOnFloor( &tr ) )
+				{
+					break;
 				}
 
+				to = tr.endpos;
+				toNormal = tr.plane.normal;
 
-				bool isOnDisplacement = result.IsDispSurface();
+				start = end = from;
+				end.z += height;
+				UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+				if ( tr.fraction < 1.0f )
+				{
+					break;
+				}
 
-				if ( nav_displacement_test.GetInt() > 0 )
+				// keep track of far up we had to go to find a path to the next node
+				obstacleHeight = height;
+				success = true;
+				break;
+			}
+			else
+			{
+				// Could not trace from node to node at this height, something is in the way.
+				// Trace in the other direction to see if we hit something
+				Vector vecToObstacleStart = tr.endpos - start;
+				Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
+				if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
 				{
-					// Test for nodes under displacement surfaces.
-					// This happens during development, and is a pain because the space underneath a displacement
-					// is not 'solid'.
-					Vector start = to + Vector( 0, 0, 0 );
-					Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
-					UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-
-					if ( result.fraction > 0 )
+					UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+					if ( !tr.startsolid && tr.fraction < 1.0 )
 					{
-						end = start;
-						start = result.endpos;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-						if ( result.fraction < 1 )
+						// We hit something going the other direction.  There is some obstacle between the two nodes.
+						Vector vecToObstacleEnd = tr.endpos - start;
+						Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
+						if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
 						{
-							// if we made it down to within StepHeight, maybe we're on a static prop
-							if ( result.endpos.z > to.z + StepHeight )
+							// Remember the distances to start and end of the obstacle (with respect to the "from" node).
+							// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
+							// If we do eventually clear the obstacle, these values will be the start and end distance to the
+							// very tip of the obstacle.
+							obstacleStartDist = vecToObstacleStart.Length();
+							obstacleEndDist = vecToObstacleEnd.Length();
+							if ( obstacleEndDist == 0 )
 							{
-								return true;
+								obstacleEndDist = GenerationStepSize;
 							}
-						}
+						}								
 					}
 				}
+			}
+		}
+
+		if ( !success )
+		{
+			return false;
+		}
+	}
+
+	// Don't generate nodes if we spill off the end of the world onto skybox
+	if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+	{
+		return false;
+	}
+
+	// If we're incrementally generating, don't overlap existing nav areas.
+	Vector testPos( to );
+	bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
+	bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
+	bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
+	bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
+	if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+	{
+		return false;
+	}
+
+	int nTolerance = nav_generate_incremental_tolerance.GetInt();
+	if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
+	{
+		bool bValid = false;
+		int zPos = to.z;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			int zMin = seedPos.z - nTolerance;
+			int zMax = seedPos.z + nTolerance;
+
+			if ( zPos >= zMin && zPos <= zMax )
+			{
+				bValid = true;
+				break;
+			}
+		}
 
-				float deltaZ = to.z - m_currentNode->GetPosition()->z;
-				// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
-				// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
-				// and distances
-				if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+		if ( !bValid )
+			return false;
+	}
+
+
+	bool isOnDisplacement = result.IsDispSurface();
+
+	if ( nav_displacement_test.GetInt() > 0 )
+	{
+		// Test for nodes under displacement surfaces.
+		// This happens during development, and is a pain because the space underneath a displacement
+		// is not 'solid'.
+		Vector start = to + Vector( 0, 0, 0 );
+		Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
+		UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+
+		if ( result.fraction > 0 )
+		{
+			end = start;
+			start = result.endpos;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+			if ( result.fraction < 1 )
+			{
+				// if we made it down to within StepHeight, maybe we're on a static prop
+				if ( result.endpos.z > to.z + StepHeight )
 				{
-					obstacleHeight = 0;
-					obstacleStartDist = 0;
-					obstacleEndDist = GenerationStepSize;
+					return false;
 				}
+			}
+		}
+	}
 
-				// we can move here
-				// create a new navigation node, and update current node pointer
-				AddNode( to, toNormal, m_generationDir, m_currentNode, isOnDisplacement, obstacleHeight, obstacleStartDist, obstacleEndDist );
+	float deltaZ = to.z - from.z;
+	// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
+	// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
+	// and distances
+	if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+	{
+		obstacleHeight = 0;
+		obstacleStartDist = 0;
+		obstacleEndDist = GenerationStepSize;
+	}
 
-				return true;
+	probe->to = to;
+	probe->toNormal = toNormal;
+	probe->isOnDisplacement = isOnDisplacement;
+	probe->obstacleHeight = obstacleHeight;
+	probe->obstacleStartDist = obstacleStartDist;
+	probe->obstacleEndDist = obstacleEndDist;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int CNavMesh::SampleProbeCompare( const SampleProbe *a, const SampleProbe *b )
+{
+	if ( a->regionKey != b->regionKey )
+		return ( a->regionKey < b->regionKey ) ? -1 : 1;
+
+	return a->order - b->order;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::ProcessSampleProbe( SampleProbe &probe )
+{
+	probe.success = ComputeSampleStep( *probe.from->GetPosition(), probe.pos, &probe );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Threaded version of SampleStep().
+ * Rather than a depth-first walk one step at a time, every unvisited direction of the current
+ * frontier of nodes is traced at once on the thread pool, grouped by spatial region. The results
+ * are then merged into the node graph on the main thread in (region, creation) order, so the
+ * resulting graph does not depend on thread scheduling. The nodes created by the merge become
+ * the frontier of the next wave.
+ *
+ * Returns true if sampling needs to continue, or false if done.
+ */
+bool CNavMesh::SampleWave( void )
+{
+	if ( m_sampleFrontier.Count() == 0 )
+	{
+		// sampling is complete from current seed, try next one
+		CNavNode *seedNode = GetNextWalkableSeedNode();
+
+		if ( seedNode == NULL )
+		{
+			if ( m_generationMode == GENERATE_INCREMENTAL || m_generationMode == GENERATE_SIMPLIFY )
+			{
+				return false;
+			}
+
+			// search is exhausted - continue search from ends of ladders
+			for ( int i=0; i<m_ladders.Count(); ++i )
+			{
+				CNavLadder *ladder = m_ladders[i];
+
+				// check ladder bottom
+				if ((seedNode = LadderEndSearch( &ladder->m_bottom, ladder->GetDir() )) != 0)
+					break;
+
+				// check ladder top
+				if ((seedNode = LadderEndSearch( &ladder->m_top, ladder->GetDir() )) != 0)
+					break;
+			}
+
+			if ( seedNode == NULL )
+			{
+				// all seeds exhausted, sampling complete
+				return false;
 			}
 		}
 
-		// all directions have been searched from this node - pop back to its parent and continue
-		m_currentNode = m_currentNode->GetParent();
+		m_sampleFrontier.AddToTail( seedNode );
+	}
+
+	// gather a probe for every direction of the frontier that has not been searched yet
+	const float regionSize = nav_generate_region_size.GetFloat() > GenerationStepSize ? nav_generate_region_size.GetFloat() : GenerationStepSize;
+
+	CUtlVector< SampleProbe > probes;
+	FOR_EACH_VEC( m_sampleFrontier, fit )
+	{
+		CNavNode *node = m_sampleFrontier[ fit ];
+
+		for( int dir = NORTH; dir < NUM_DIRECTIONS; dir++ )
+		{
+			if ( node->HasVisited( (NavDirType)dir ) )
+				continue;
+
+			node->MarkAsVisited( (NavDirType)dir );
+
+			// snap to grid and step to the adjacent node
+			Vector pos = *node->GetPosition();
+			int cx = SnapToGrid( pos.x );
+			int cy = SnapToGrid( pos.y );
+
+			switch( dir )
+			{
+				case NORTH:		cy -= GenerationStepSize; break;
+				case SOUTH:		cy += GenerationStepSize; break;
+				case EAST:		cx += GenerationStepSize; break;
+				case WEST:		cx -= GenerationStepSize; break;
+			}
+
+			pos.x = cx;
+			pos.y = cy;
+
+			if ( !IsSampleStepInRange( pos ) )
+				continue;
+
+			int rx = (int)floor( pos.x / regionSize );
+			int ry = (int)floor( pos.y / regionSize );
+
+			SampleProbe &probe = probes[ probes.AddToTail() ];
+			probe.from = node;
+			probe.dir = (NavDirType)dir;
+			probe.pos = pos;
+			probe.regionKey = ( ( (unsigned int)rx & 0xffff ) << 16 ) | ( (unsigned int)ry & 0xffff );
+			probe.order = probes.Count() - 1;
+			probe.success = false;
+		}
+	}
+	m_sampleFrontier.RemoveAll();
+
+	// trace all of the steps in parallel, nearby probes are handed out together
+	probes.Sort( SampleProbeCompare );
+	ParallelProcess( "CNavMesh::SampleWave", probes.Base(), probes.Count(), this, &CNavMesh::ProcessSampleProbe );
+
+	// merge the results serially, in a deterministic order
+	FOR_EACH_VEC( probes, pit )
+	{
+		const SampleProbe &probe = probes[ pit ];
+		if ( !probe.success )
+			continue;
+
+		// an earlier probe in this wave already made a commutative connection for this step
+		if ( probe.from->GetConnectedNode( probe.dir ) )
+			continue;
+
+		bool isNew = ( CNavNode::GetNode( probe.to ) == NULL );
+
+		CNavNode *node = AddNode( probe.to, probe.toNormal, probe.dir, probe.from, probe.isOnDisplacement, probe.obstacleHeight, probe.obstacleStartDist, probe.obstacleEndDist, true );
+		if ( isNew )
+		{
+			m_sampleFrontier.AddToTail( node );
+			m_sampleNewNodes.AddToTail( node );
+		}
 	}
+
+	// crouch and cliff checks only touch the node being checked
+	ParallelProcess( "CNavMesh::FinishNode", m_sampleNewNodes.Base(), m_sampleNewNodes.Count(), this, &CNavMesh::FinishNode );
+	m_sampleNewNodes.RemoveAll();
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Report the time spent in the generation phase that just completed, and start timing the next one
+ */
+void CNavMesh::EndGenerationPhase( const char *phaseName )
+{
+	double now = Plat_FloatTime();
+	Msg( "%s took %0.2f seconds.\n", phaseName, now - m_generationPhaseStartTime );
+	m_generationPhaseStartTime = now;
 }
 
 
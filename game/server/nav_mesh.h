@@ -1162,13 +1162,40 @@ private:
 
 	CNavNode *m_currentNode;									// the current node we are sampling from
 	NavDirType m_generationDir;
-	CNavNode *AddNode( const Vector &destPos, const Vector &destNormal, NavDirType dir, CNavNode *source, bool isOnDisplacement, float obstacleHeight, float flObstacleStartDist, float flObstacleEndDist );		// add a nav node and connect it, update current node
+	CNavNode *AddNode( const Vector &destPos, const Vector &destNormal, NavDirType dir, CNavNode *source, bool isOnDisplacement, float obstacleHeight, float flObstacleStartDist, float flObstacleEndDist, bool deferFinish = false );		// add a nav node and connect it, update current node
 
 	NavLadderVector m_ladders;									// list of ladder navigation representations
 	void BuildLadders( void );
 	void DestroyLadders( void );
 
 	bool SampleStep( void );									// sample the walkable areas of the map
+
+	struct SampleProbe
+	{
+		CNavNode *from;											// node we are stepping away from
+		NavDirType dir;											// direction of the step
+		Vector pos;												// grid position we are trying to reach
+		unsigned int regionKey;									// spatial region of 'pos', used to batch nearby probes together
+		int order;												// creation order, keeps the merge deterministic
+		bool success;
+		Vector to;
+		Vector toNormal;
+		bool isOnDisplacement;
+		float obstacleHeight;
+		float obstacleStartDist;
+		float obstacleEndDist;
+	};
+	bool ComputeSampleStep( const Vector &from, const Vector &pos, SampleProbe *probe );	// trace from 'from' toward 'pos', filling in the probe's result. does not modify the mesh.
+	bool IsSampleStepInRange( const Vector &pos ) const;		// incremental/simplify generation extent test for a sample step
+	bool SampleWave( void );									// sample one wavefront of the walkable areas in parallel
+	void ProcessSampleProbe( SampleProbe &probe );
+	static int SampleProbeCompare( const SampleProbe *a, const SampleProbe *b );
+	void FinishNode( CNavNode *&node );							// crouch and cliff checks for a newly added node
+	CUtlVector< CNavNode * > m_sampleFrontier;					// nodes whose unvisited directions are sampled by the next wave
+	CUtlVector< CNavNode * > m_sampleNewNodes;					// nodes created by the current wave, awaiting FinishNode()
+
+	void EndGenerationPhase( const char *phaseName );			// report the time spent in the current generation phase
+	double m_generationPhaseStartTime;
 	void CreateNavAreasFromNodes( void );						// cover all of the sampled nodes with nav areas
 
 	bool TestArea( CNavNode *node, int width, int height );		// check if an area of size (width, height) can fit, starting from node as upper left corner
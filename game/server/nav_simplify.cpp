@@ -18,6 +18,7 @@ extern ConVar nav_snap_to_grid;
 extern ConVar nav_split_place_on_ground;
 extern ConVar nav_coplanar_slope_limit;
 extern ConVar nav_coplanar_slope_limit_displacement;
+extern ConVar nav_generate_threaded;
 
 //--------------------------------------------------------------------------------------------------------
 static bool ReduceToComponentAreas( CNavArea *area, bool addToSelectedSet )
@@ -127,9 +128,10 @@ void CNavMesh::GenerateNodes( const Extent &bounds )
 {
 	m_simplifyGenerationExtent = bounds;
 	m_seedIdx = 0;
+	m_sampleFrontier.RemoveAll();
 
 	Assert( m_generationMode == GENERATE_SIMPLIFY );
-	while ( SampleStep() )
+	while ( nav_generate_threaded.GetBool() ? SampleWave() : SampleStep() )
 	{
 		// do nothing
 	}
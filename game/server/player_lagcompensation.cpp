@@ -13,6 +13,7 @@
 #include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
 #include "tier0/vprof.h"
+#include "mathlib/ssemath.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -37,6 +38,13 @@ ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show
 
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_DEVELOPMENTONLY, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
 
+ConVar sv_unlag_prefilter( "sv_unlag_prefilter", "0", FCVAR_DEVELOPMENTONLY, "Skip lag compensating players whose backtracked bounds are outside the shooter's fire cone" );
+ConVar sv_unlag_prefilter_cone( "sv_unlag_prefilter_cone", "45", FCVAR_DEVELOPMENTONLY, "Half angle in degrees of the fire cone used by sv_unlag_prefilter", true, 0.0f, true, 90.0f );
+ConVar sv_unlag_prefilter_range( "sv_unlag_prefilter_range", "8192", FCVAR_DEVELOPMENTONLY, "Range of the fire cone used by sv_unlag_prefilter" );
+
+// Hitboxes can stick out of the collision bounds, so pad the bounds tested by the prefilter
+#define LAG_COMPENSATION_PREFILTER_PAD 16.0f
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -114,6 +122,111 @@ public:
 	float					m_masterCycle;
 };
 
+struct LagAnimationRecord
+{
+	LayerRecord				m_layerRecords[MAX_LAYER_RECORDS];
+	int						m_masterSequence;
+	float					m_masterCycle;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: A player's lag record history, kept in a fixed size ring buffer
+// with the newest record at index 0. The fields used to find the backtrack
+// target and its bounds are stored as separate arrays, so searching the
+// history doesn't drag the animation layers through the cache.
+//-----------------------------------------------------------------------------
+class CLagRecordTrack
+{
+public:
+	CLagRecordTrack() : m_nHead( 0 ), m_nCount( 0 ) {}
+
+	// Capacity must be a power of two, existing records are discarded
+	void SetCapacity( int nCapacity )
+	{
+		Assert( IsPowerOfTwo( nCapacity ) );
+		m_flSimulationTime.SetCount( nCapacity );
+		m_fFlags.SetCount( nCapacity );
+		m_vecOrigin.SetCount( nCapacity );
+		m_vecMinsPreScaled.SetCount( nCapacity );
+		m_vecMaxsPreScaled.SetCount( nCapacity );
+		m_vecAngles.SetCount( nCapacity );
+		m_Animation.SetCount( nCapacity );
+		RemoveAll();
+	}
+
+	void Purge()
+	{
+		m_flSimulationTime.Purge();
+		m_fFlags.Purge();
+		m_vecOrigin.Purge();
+		m_vecMinsPreScaled.Purge();
+		m_vecMaxsPreScaled.Purge();
+		m_vecAngles.Purge();
+		m_Animation.Purge();
+		RemoveAll();
+	}
+
+	int Capacity() const	{ return m_flSimulationTime.Count(); }
+	int Count() const		{ return m_nCount; }
+	void RemoveAll()		{ m_nHead = 0; m_nCount = 0; }
+
+	// Storage slot of the i'th newest record
+	int Slot( int i ) const
+	{
+		Assert( i >= 0 && i < m_nCount );
+		return ( m_nHead - i ) & ( Capacity() - 1 );
+	}
+
+	// Drops the oldest record
+	void RemoveTail()
+	{
+		Assert( m_nCount > 0 );
+		--m_nCount;
+	}
+
+	// Returns the slot for a new newest record, overwriting the oldest record if the track is full
+	int AddToHead()
+	{
+		Assert( Capacity() > 0 );
+		m_nHead = ( m_nHead + 1 ) & ( Capacity() - 1 );
+		m_nCount = MIN( m_nCount + 1, Capacity() );
+		return m_nHead;
+	}
+
+	// Index of the newest record at or before flTargetTime, or of the oldest record if there is none.
+	// Simulation times strictly decrease with the index, so this is a binary search.
+	int FindRecord( float flTargetTime ) const
+	{
+		int nLow = 0;
+		int nHigh = m_nCount - 1;
+		while ( nLow < nHigh )
+		{
+			int nMid = ( nLow + nHigh ) >> 1;
+			if ( m_flSimulationTime[ Slot( nMid ) ] <= flTargetTime )
+			{
+				nHigh = nMid;
+			}
+			else
+			{
+				nLow = nMid + 1;
+			}
+		}
+		return nLow;
+	}
+
+	CUtlVector< float >					m_flSimulationTime;
+	CUtlVector< int >					m_fFlags;
+	CUtlVector< Vector >				m_vecOrigin;
+	CUtlVector< Vector >				m_vecMinsPreScaled;
+	CUtlVector< Vector >				m_vecMaxsPreScaled;
+	CUtlVector< QAngle >				m_vecAngles;
+	CUtlVector< LagAnimationRecord >	m_Animation;
+
+private:
+	int		m_nHead;
+	int		m_nCount;
+};
+
 
 //
 // Try to take the player from his current origin to vWantedPos.
@@ -194,7 +307,12 @@ public:
 	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd );
 	void			FinishLagCompensation( CBasePlayer *player );
 
+	// Times lag compensating every player against every other player
+	void			RunBenchmark( int nIterations, float flLatency );
+
 private:
+	int				BacktrackPlayers( CBasePlayer *player, CUserCmd *cmd, float flTargetTime, bool bPrefilter );
+	int				PrefilterPlayers( CBasePlayer *player, const CUserCmd *cmd, float flTargetTime, CBasePlayer **ppPlayers, int nPlayers );
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
 
 	void ClearHistory()
@@ -203,8 +321,14 @@ private:
 			m_PlayerTrack[i].Purge();
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a history of lag records for each player
+	CLagRecordTrack			m_PlayerTrack[ MAX_PLAYERS ];
+
+	// Bounding spheres of the players being prefiltered, four per fltx4
+	fltx4					m_PrefilterCenterX[ ( MAX_PLAYERS + 3 ) / 4 ];
+	fltx4					m_PrefilterCenterY[ ( MAX_PLAYERS + 3 ) / 4 ];
+	fltx4					m_PrefilterCenterZ[ ( MAX_PLAYERS + 3 ) / 4 ];
+	fltx4					m_PrefilterRadius[ ( MAX_PLAYERS + 3 ) / 4 ];
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -240,12 +364,17 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	// remove all records before that time:
 	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
 
+	// every track holds enough records to cover the largest sv_maxunlag at this tickrate
+	float flMaxUnlag = 1.0f;
+	sv_maxunlag.GetMax( flMaxUnlag );
+	int nCapacity = SmallestPowerOfTwoGreaterOrEqual( TIME_TO_TICKS( flMaxUnlag ) + 2 );
+
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CLagRecordTrack *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
@@ -257,62 +386,60 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
+		if ( track->Capacity() != nCapacity )
+		{
+			track->SetCapacity( nCapacity );
+		}
 
 		// remove tail records that are too old
-		intp tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+		while ( track->Count() > 0 )
 		{
-			LagRecord &tail = track->Element( tailIndex );
-
 			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
+			if ( track->m_flSimulationTime[ track->Slot( track->Count() - 1 ) ] >= flDeadtime )
 				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+
+			track->RemoveTail();
 		}
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
 			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
+			if ( track->m_flSimulationTime[ track->Slot( 0 ) ] >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
 		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		int slot = track->AddToHead();
 
-		record.m_fFlags = 0;
+		int fFlags = 0;
 		if ( pPlayer->IsAlive() )
 		{
-			record.m_fFlags |= LC_ALIVE;
+			fFlags |= LC_ALIVE;
 		}
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMinsPreScaled	= pPlayer->CollisionProp()->OBBMinsPreScaled();
-		record.m_vecMaxsPreScaled	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		track->m_fFlags[slot]			= fFlags;
+		track->m_flSimulationTime[slot]	= pPlayer->GetSimulationTime();
+		track->m_vecAngles[slot]		= pPlayer->GetLocalAngles();
+		track->m_vecOrigin[slot]		= pPlayer->GetLocalOrigin();
+		track->m_vecMinsPreScaled[slot]	= pPlayer->CollisionProp()->OBBMinsPreScaled();
+		track->m_vecMaxsPreScaled[slot]	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
 
+		LagAnimationRecord &animation = track->m_Animation[slot];
 		int layerCount = pPlayer->GetNumAnimOverlays();
 		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 		{
 			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
 			if( currentLayer )
 			{
-				record.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-				record.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-				record.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-				record.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+				animation.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+				animation.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+				animation.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+				animation.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
 			}
 		}
-		record.m_masterSequence = pPlayer->GetSequence();
-		record.m_masterCycle = pPlayer->GetCycle();
+		animation.m_masterSequence = pPlayer->GetSequence();
+		animation.m_masterCycle = pPlayer->GetCycle();
 	}
 
 	//Clear the current player.
@@ -385,8 +512,19 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
 	
+	BacktrackPlayers( player, cmd, TICKS_TO_TIME( targettick ), sv_unlag_prefilter.GetBool() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves every player the shooter wants lag compensated back to
+// flTargetTime. Returns the number of players considered for backtracking.
+//-----------------------------------------------------------------------------
+int CLagCompensationManager::BacktrackPlayers( CBasePlayer *player, CUserCmd *cmd, float flTargetTime, bool bPrefilter )
+{
+	CBasePlayer *pPlayers[ MAX_PLAYERS ];
+	int nPlayers = 0;
+
 	// Iterate all active players
-	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
@@ -402,13 +540,120 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 			continue;
 		}
 
+		pPlayers[ nPlayers++ ] = pPlayer;
+	}
+
+	if ( bPrefilter )
+	{
+		nPlayers = PrefilterPlayers( player, cmd, flTargetTime, pPlayers, nPlayers );
+	}
+
+	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
+	for ( int i = 0; i < nPlayers; i++ )
+	{
+		CBasePlayer *pPlayer = pPlayers[i];
+
 		// Custom checks for if things should lag compensate (based on things like what team the player is on).
 		if ( !player->WantsLagCompensationOnEntity( pPlayer, cmd, pEntityTransmitBits ) )
 			continue;
 
 		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		BacktrackPlayer( pPlayer, flTargetTime );
+	}
+
+	return nPlayers;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Removes the players whose bounds around flTargetTime cannot
+// intersect the shooter's fire cone, testing four players at a time.
+// Returns the number of players left in ppPlayers, in their original order.
+//-----------------------------------------------------------------------------
+int CLagCompensationManager::PrefilterPlayers( CBasePlayer *player, const CUserCmd *cmd, float flTargetTime, CBasePlayer **ppPlayers, int nPlayers )
+{
+	VPROF_BUDGET( "PrefilterPlayers", "CLagCompensationManager" );
+
+	// Gather a bounding sphere for each player, covering the two records
+	// BacktrackPlayer may interpolate between and the current position,
+	// since sv_unlag_fixstuck can leave the player anywhere in between.
+	for ( int i = 0; i < nPlayers; i++ )
+	{
+		CBasePlayer *pPlayer = ppPlayers[i];
+		CLagRecordTrack *track = &m_PlayerTrack[ pPlayer->entindex() - 1 ];
+
+		Vector vecMins, vecMaxs;
+		pPlayer->CollisionProp()->WorldSpaceAABB( &vecMins, &vecMaxs );
+
+		if ( track->Count() > 0 )
+		{
+			float flScale = MAX( pPlayer->GetModelScale(), 1.0f );
+			int nRecord = track->FindRecord( flTargetTime );
+			for ( int j = MAX( nRecord - 1, 0 ); j <= nRecord; j++ )
+			{
+				int slot = track->Slot( j );
+				VectorMin( vecMins, track->m_vecOrigin[slot] + track->m_vecMinsPreScaled[slot] * flScale, vecMins );
+				VectorMax( vecMaxs, track->m_vecOrigin[slot] + track->m_vecMaxsPreScaled[slot] * flScale, vecMaxs );
+			}
+		}
+
+		Vector vecCenter = ( vecMins + vecMaxs ) * 0.5f;
+		SubFloat( m_PrefilterCenterX[ i >> 2 ], i & 3 ) = vecCenter.x;
+		SubFloat( m_PrefilterCenterY[ i >> 2 ], i & 3 ) = vecCenter.y;
+		SubFloat( m_PrefilterCenterZ[ i >> 2 ], i & 3 ) = vecCenter.z;
+		SubFloat( m_PrefilterRadius[ i >> 2 ], i & 3 ) = ( vecMaxs - vecCenter ).Length() + LAG_COMPENSATION_PREFILTER_PAD;
+	}
+
+	Vector vecEye = player->EyePosition();
+	Vector vecForward;
+	AngleVectors( cmd->viewangles, &vecForward );
+
+	float flSin, flCos;
+	SinCos( DEG2RAD( sv_unlag_prefilter_cone.GetFloat() ), &flSin, &flCos );
+
+	fltx4 eyeX = ReplicateX4( vecEye.x );
+	fltx4 eyeY = ReplicateX4( vecEye.y );
+	fltx4 eyeZ = ReplicateX4( vecEye.z );
+	fltx4 forwardX = ReplicateX4( vecForward.x );
+	fltx4 forwardY = ReplicateX4( vecForward.y );
+	fltx4 forwardZ = ReplicateX4( vecForward.z );
+	fltx4 coneSin = ReplicateX4( flSin );
+	fltx4 coneCos = ReplicateX4( flCos );
+	fltx4 coneRange = ReplicateX4( sv_unlag_prefilter_range.GetFloat() );
+
+	int nSurvivors = 0;
+	for ( int i = 0; i < nPlayers; i += 4 )
+	{
+		fltx4 dx = SubSIMD( m_PrefilterCenterX[ i >> 2 ], eyeX );
+		fltx4 dy = SubSIMD( m_PrefilterCenterY[ i >> 2 ], eyeY );
+		fltx4 dz = SubSIMD( m_PrefilterCenterZ[ i >> 2 ], eyeZ );
+		fltx4 radius = m_PrefilterRadius[ i >> 2 ];
+
+		fltx4 distSqr = AddSIMD( AddSIMD( MulSIMD( dx, dx ), MulSIMD( dy, dy ) ), MulSIMD( dz, dz ) );
+		fltx4 radiusSqr = MulSIMD( radius, radius );
+		fltx4 dot = AddSIMD( AddSIMD( MulSIMD( dx, forwardX ), MulSIMD( dy, forwardY ) ), MulSIMD( dz, forwardZ ) );
+
+		// The shooter is inside the sphere
+		fltx4 inside = CmpLeSIMD( distSqr, radiusSqr );
+
+		// The angle to the center is at most the cone angle plus the angle the sphere subtends:
+		// dot >= cos(cone) * tangentLength - sin(cone) * radius
+		fltx4 tangentLength = SqrtSIMD( MaxSIMD( SubSIMD( distSqr, radiusSqr ), Four_Zeros ) );
+		fltx4 inCone = CmpGeSIMD( dot, SubSIMD( MulSIMD( coneCos, tangentLength ), MulSIMD( coneSin, radius ) ) );
+
+		fltx4 reach = AddSIMD( coneRange, radius );
+		fltx4 inRange = CmpLeSIMD( distSqr, MulSIMD( reach, reach ) );
+
+		int nMask = TestSignSIMD( OrSIMD( inside, AndSIMD( inCone, inRange ) ) );
+		for ( int j = 0; j < 4 && i + j < nPlayers; j++ )
+		{
+			if ( nMask & ( 1 << j ) )
+			{
+				ppPlayers[ nSurvivors++ ] = ppPlayers[ i + j ];
+			}
+		}
 	}
+
+	return nSurvivors;
 }
 
 void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
@@ -422,35 +667,33 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	int pl_index = pPlayer->entindex() - 1;
 
 	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	CLagRecordTrack *track = &m_PlayerTrack[ pl_index ];
 
 	// check if we have at leat one entry
 	if ( track->Count() <= 0 )
 		return;
 
-    intp curr = track->Head();
-
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+	int prevSlot = -1;
+	int slot = -1;
 
 	Vector prevOrg = pPlayer->GetLocalOrigin();
 	
 	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	for ( int i = 0; i < track->Count(); i++ )
 	{
 		// remember last record
-		prevRecord = record;
+		prevSlot = slot;
 
 		// get next record
-		record = &track->Element( curr );
+		slot = track->Slot( i );
 
-		if ( !(record->m_fFlags & LC_ALIVE) )
+		if ( !(track->m_fFlags[slot] & LC_ALIVE) )
 		{
 			// player most be alive, lost track
 			return;
 		}
 
-		Vector delta = record->m_vecOrigin - prevOrg;
+		Vector delta = track->m_vecOrigin[slot] - prevOrg;
 		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
 		{
 			// lost track, too much difference
@@ -458,57 +701,48 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 		}
 
 		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
+		if ( track->m_flSimulationTime[slot] <= flTargetTime )
 			break; // hurra, stop
 
-		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
+		prevOrg = track->m_vecOrigin[slot];
 	}
 
-	Assert( record );
+	Assert( slot >= 0 );
 
-	if ( !record )
-	{
-		if ( sv_unlag_debug.GetBool() )
-		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
-		}
-
-		return; // that should never happen
-	}
+	float flRecordTime = track->m_flSimulationTime[slot];
+	const LagAnimationRecord *record = &track->m_Animation[slot];
+	const LagAnimationRecord *prevRecord = ( prevSlot >= 0 ) ? &track->m_Animation[prevSlot] : NULL;
 
 	float frac = 0.0f;
 	if ( prevRecord && 
-		 (record->m_flSimulationTime < flTargetTime) &&
-		 (record->m_flSimulationTime < prevRecord->m_flSimulationTime) )
+		 (flRecordTime < flTargetTime) &&
+		 (flRecordTime < track->m_flSimulationTime[prevSlot]) )
 	{
 		// we didn't find the exact time but have a valid previous record
 		// so interpolate between these two records;
 
-		Assert( prevRecord->m_flSimulationTime > record->m_flSimulationTime );
-		Assert( flTargetTime < prevRecord->m_flSimulationTime );
+		Assert( track->m_flSimulationTime[prevSlot] > flRecordTime );
+		Assert( flTargetTime < track->m_flSimulationTime[prevSlot] );
 
 		// calc fraction between both records
-		frac = ( flTargetTime - record->m_flSimulationTime ) / 
-			( prevRecord->m_flSimulationTime - record->m_flSimulationTime );
+		frac = ( flTargetTime - flRecordTime ) / 
+			( track->m_flSimulationTime[prevSlot] - flRecordTime );
 
 		Assert( frac > 0 && frac < 1 ); // should never extrapolate
 
-		ang				= Lerp( frac, record->m_vecAngles, prevRecord->m_vecAngles );
-		org				= Lerp( frac, record->m_vecOrigin, prevRecord->m_vecOrigin );
-		minsPreScaled	= Lerp( frac, record->m_vecMinsPreScaled, prevRecord->m_vecMinsPreScaled );
-		maxsPreScaled	= Lerp( frac, record->m_vecMaxsPreScaled, prevRecord->m_vecMaxsPreScaled );
+		ang				= Lerp( frac, track->m_vecAngles[slot], track->m_vecAngles[prevSlot] );
+		org				= Lerp( frac, track->m_vecOrigin[slot], track->m_vecOrigin[prevSlot] );
+		minsPreScaled	= Lerp( frac, track->m_vecMinsPreScaled[slot], track->m_vecMinsPreScaled[prevSlot] );
+		maxsPreScaled	= Lerp( frac, track->m_vecMaxsPreScaled[slot], track->m_vecMaxsPreScaled[prevSlot] );
 	}
 	else
 	{
 		// we found the exact record or no other record to interpolate with
 		// just copy these values since they are the best we have
-		org				= record->m_vecOrigin;
-		ang				= record->m_vecAngles;
-		minsPreScaled	= record->m_vecMinsPreScaled;
-		maxsPreScaled	= record->m_vecMaxsPreScaled;
+		org				= track->m_vecOrigin[slot];
+		ang				= track->m_vecAngles[slot];
+		minsPreScaled	= track->m_vecMinsPreScaled[slot];
+		maxsPreScaled	= track->m_vecMaxsPreScaled[slot];
 	}
 
 	// See if this is still a valid position for us to teleport to
@@ -669,8 +903,8 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			bool interpolated = false;
 			if( (frac > 0.0f)  &&  interpolationAllowed )
 			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
+				const LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
+				const LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
 				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
 					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
 					)
@@ -831,3 +1065,80 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 }
 
 
+
+//-----------------------------------------------------------------------------
+// Purpose: Lag compensates every player against every other player, as if
+// they had all sent a usercmd this tick, with and without the prefilter.
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::RunBenchmark( int nIterations, float flLatency )
+{
+	if ( m_pCurrentPlayer )
+	{
+		Warning( "Can't benchmark lag compensation while a session is active\n" );
+		return;
+	}
+
+	float flTargetTime = TICKS_TO_TIME( gpGlobals->tickcount - TIME_TO_TICKS( flLatency ) );
+
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		bool bPrefilter = ( nPass != 0 );
+		int nUserCmds = 0;
+		int nConsidered = 0;
+		int nBacktracked = 0;
+
+		double flStartTime = Plat_FloatTime();
+		for ( int nIteration = 0; nIteration < nIterations; nIteration++ )
+		{
+			for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+			{
+				CBasePlayer *player = UTIL_PlayerByIndex( i );
+				if ( !player || !player->IsAlive() )
+					continue;
+
+				CUserCmd cmd;
+				cmd.tick_count = TIME_TO_TICKS( flTargetTime );
+				cmd.viewangles = player->EyeAngles();
+
+				m_RestorePlayer.ClearAll();
+				m_bNeedToRestore = false;
+				m_pCurrentPlayer = player;
+
+				nConsidered += BacktrackPlayers( player, &cmd, flTargetTime, bPrefilter );
+
+				// Only players whose state was actually changed are flagged for restore
+				for ( int j = 0; j < gpGlobals->maxClients; j++ )
+				{
+					if ( m_RestorePlayer.Get( j ) )
+					{
+						nBacktracked++;
+					}
+				}
+
+				FinishLagCompensation( player );
+				nUserCmds++;
+			}
+		}
+		double flElapsed = Plat_FloatTime() - flStartTime;
+
+		if ( !nUserCmds )
+		{
+			Msg( "No live players to lag compensate\n" );
+			return;
+		}
+
+		Msg( "%s: %d usercmds, %.2f us per usercmd, %.1f players considered and %.1f players backtracked per usercmd\n",
+			bPrefilter ? "prefilter" : "no prefilter", nUserCmds, 1000000.0 * flElapsed / nUserCmds,
+			(float)nConsidered / nUserCmds, (float)nBacktracked / nUserCmds );
+	}
+}
+
+CON_COMMAND_F( sv_unlag_benchmark, "Times lag compensation of every player against every other player. Arguments: [iterations] [latency in ms]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nIterations = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100;
+	float flLatency = ( args.ArgC() > 2 ) ? atof( args[2] ) / 1000.0f : 0.1f;
+	g_LagCompensationManager.RunBenchmark( nIterations, clamp( flLatency, 0.0f, sv_maxunlag.GetFloat() ) );
+}
@@ -3523,23 +3523,32 @@ void ExpandPatchFile( KeyValues& keyValues, KeyValues &patchKeyValues, const cha
 	}
 }
 
-bool LoadVMTFile( KeyValues &vmtKeyValues, KeyValues &patchKeyValues, const char *pMaterialName, bool bAbsolutePath, CUtlVector<FileNameHandle_t> *pIncludes )
+//-----------------------------------------------------------------------------
+// Builds the file name of a material's .vmt, returns the path ID to read it from
+//-----------------------------------------------------------------------------
+static const char *GetVMTFileName( const char *pMaterialName, bool bAbsolutePath, char *pFileName, int nMaxLen )
 {
-	char pFileName[MAX_PATH];
 	const char *pPathID = "GAME";
 	if ( !bAbsolutePath )
 	{
-		Q_snprintf( pFileName, sizeof( pFileName ), "materials/%s.vmt", pMaterialName );
+		Q_snprintf( pFileName, nMaxLen, "materials/%s.vmt", pMaterialName );
 	}
 	else
 	{
-		Q_snprintf( pFileName, sizeof( pFileName ), "%s.vmt", pMaterialName );
+		Q_snprintf( pFileName, nMaxLen, "%s.vmt", pMaterialName );
 		if ( pMaterialName[0] == '/' && pMaterialName[1] == '/' && pMaterialName[2] != '/' )
 		{
 			// UNC, do full search
 			pPathID = NULL;
 		}
 	}
+	return pPathID;
+}
+
+bool LoadVMTFile( KeyValues &vmtKeyValues, KeyValues &patchKeyValues, const char *pMaterialName, bool bAbsolutePath, CUtlVector<FileNameHandle_t> *pIncludes )
+{
+	char pFileName[MAX_PATH];
+	const char *pPathID = GetVMTFileName( pMaterialName, bAbsolutePath, pFileName, sizeof( pFileName ) );
 
 	if ( !vmtKeyValues.LoadFromFile( g_pFullFileSystem, pFileName, pPathID ) )
 	{
@@ -3550,6 +3559,36 @@ bool LoadVMTFile( KeyValues &vmtKeyValues, KeyValues &patchKeyValues, const char
 	return true;
 }
 
+bool ReadVMTFile( CUtlBuffer &buf, const char *pMaterialName, bool bAbsolutePath )
+{
+	char pFileName[MAX_PATH];
+	const char *pPathID = GetVMTFileName( pMaterialName, bAbsolutePath, pFileName, sizeof( pFileName ) );
+
+	if ( !g_pFullFileSystem->ReadFile( pFileName, pPathID, buf ) )
+	{
+		return false;
+	}
+
+	// double NULL terminated in case this is a unicode file, like KeyValues::LoadFromFile
+	buf.PutChar( 0 );
+	buf.PutChar( 0 );
+	return true;
+}
+
+bool LoadVMTFileFromBuffer( KeyValues &vmtKeyValues, KeyValues &patchKeyValues, const char *pMaterialName, bool bAbsolutePath, CUtlBuffer &buf, CUtlVector<FileNameHandle_t> *pIncludes )
+{
+	char pFileName[MAX_PATH];
+	const char *pPathID = GetVMTFileName( pMaterialName, bAbsolutePath, pFileName, sizeof( pFileName ) );
+
+	if ( !vmtKeyValues.LoadFromBuffer( pFileName, (const char *)buf.Base(), g_pFullFileSystem ) )
+	{
+		return false;
+	}
+	ExpandPatchFile( vmtKeyValues, patchKeyValues, pPathID, pIncludes );
+
+	return true;
+}
+
 int CMaterial::GetNumPasses( void )
 {
 	Precache();
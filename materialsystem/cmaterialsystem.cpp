@@ -2776,14 +2776,11 @@ IMaterial* CMaterialSystem::FindMaterial( char const *pMaterialName, const char
 }
 
 //-----------------------------------------------------------------------------
-// Search by name
+// FindMaterial's dictionary key: lower case, no extension, forward slashes
 //-----------------------------------------------------------------------------
-IMaterial* CMaterialSystem::FindMaterialEx( char const* pMaterialName, const char *pTextureGroupName, int nContext, bool bComplain, const char *pComplainPrefix )
+static void GetMaterialLookupName( const char *pMaterialName, char *pTemp, int nLen )
 {
-	// We need lower-case symbols for this to work
-	int nLen = Q_strlen( pMaterialName ) + 1;
 	char *pFixedNameTemp = (char*)stackalloc( nLen );
-	char *pTemp = (char*)stackalloc( nLen );
 	Q_strncpy( pFixedNameTemp, pMaterialName, nLen );
 	Q_strlower( pFixedNameTemp );
 #ifdef POSIX
@@ -2796,16 +2793,13 @@ IMaterial* CMaterialSystem::FindMaterialEx( char const* pMaterialName, const cha
 #endif
 	
 	Assert( nLen >= Q_strlen( pTemp ) + 1 );
+}
 
-	IMaterialInternal *pExistingMaterial = m_MaterialDict.FindMaterial( pTemp, false );	// 'false' causes the search to find only file-created materials
-
-	if ( pExistingMaterial )
-		return pExistingMaterial->GetQueueFriendlyVersion();
-
-	// It hasn't been seen yet, so let's check to see if it's in the filesystem.
-	nLen = Q_strlen( "materials/" ) + Q_strlen( pTemp ) + Q_strlen( ".vmt" ) + 1;
-	char *vmtName = (char *)stackalloc( nLen );
-
+//-----------------------------------------------------------------------------
+// Builds the path LoadVMTFile wants for a lookup name, returns true for UNC names
+//-----------------------------------------------------------------------------
+static bool GetMaterialVMTName( const char *pTemp, char *vmtName, int nLen )
+{
 	// Check to see if this is a UNC-specified material name
 	bool bIsUNC = pTemp[0] == '/' && pTemp[1] == '/' && pTemp[2] != '/';
 	if ( !bIsUNC )
@@ -2822,6 +2816,28 @@ IMaterial* CMaterialSystem::FindMaterialEx( char const* pMaterialName, const cha
 
 	//Q_strncat( vmtName, ".vmt", nLen, COPY_ALL_CHARACTERS );
 	Assert( nLen >= (int)Q_strlen( vmtName ) + 1 );
+	return bIsUNC;
+}
+
+//-----------------------------------------------------------------------------
+// Search by name
+//-----------------------------------------------------------------------------
+IMaterial* CMaterialSystem::FindMaterialEx( char const* pMaterialName, const char *pTextureGroupName, int nContext, bool bComplain, const char *pComplainPrefix )
+{
+	// We need lower-case symbols for this to work
+	int nLen = Q_strlen( pMaterialName ) + 1;
+	char *pTemp = (char*)stackalloc( nLen );
+	GetMaterialLookupName( pMaterialName, pTemp, nLen );
+
+	IMaterialInternal *pExistingMaterial = m_MaterialDict.FindMaterial( pTemp, false );	// 'false' causes the search to find only file-created materials
+
+	if ( pExistingMaterial )
+		return pExistingMaterial->GetQueueFriendlyVersion();
+
+	// It hasn't been seen yet, so let's check to see if it's in the filesystem.
+	nLen = Q_strlen( "materials/" ) + Q_strlen( pTemp ) + Q_strlen( ".vmt" ) + 1;
+	char *vmtName = (char *)stackalloc( nLen );
+	bool bIsUNC = GetMaterialVMTName( pTemp, vmtName, nLen );
 
 	CUtlVector<FileNameHandle_t> includes;
 	KeyValues *pKeyValues = new KeyValues("vmt");
@@ -2829,48 +2845,59 @@ IMaterial* CMaterialSystem::FindMaterialEx( char const* pMaterialName, const cha
 	if ( !LoadVMTFile( *pKeyValues, *pPatchKeyValues, vmtName, true, &includes ) )
 	{
 		pKeyValues->deleteThis();
-		pKeyValues = NULL;
 		pPatchKeyValues->deleteThis();
-		pPatchKeyValues = NULL;
+		return MaterialNotFound( pTemp, bComplain, pComplainPrefix );
+	}
+
+	return AddMaterialFromVMT( pTemp, pTextureGroupName, pKeyValues, pPatchKeyValues, includes, bIsUNC, nContext );
+}
+
+//-----------------------------------------------------------------------------
+// Creates + precaches a material from its loaded .vmt; takes ownership of the key values
+//-----------------------------------------------------------------------------
+IMaterial *CMaterialSystem::AddMaterialFromVMT( const char *pTemp, const char *pTextureGroupName, KeyValues *pKeyValues, KeyValues *pPatchKeyValues, CUtlVector<FileNameHandle_t> &includes, bool bIsUNC, int nContext )
+{
+	char *matNameWithExtension;
+	int nLen = Q_strlen( pTemp ) + Q_strlen( ".vmt" ) + 1;
+	matNameWithExtension = (char *)stackalloc( nLen );
+	Q_strncpy( matNameWithExtension, pTemp, nLen );
+	Q_strncat( matNameWithExtension, ".vmt", nLen, COPY_ALL_CHARACTERS );
+
+	IMaterialInternal *pMat = NULL;
+	if ( !Q_stricmp( pKeyValues->GetName(), "subrect" ) )
+	{
+		pMat = m_MaterialDict.AddMaterialSubRect( matNameWithExtension, pTextureGroupName, pKeyValues, pPatchKeyValues );
 	}
 	else
 	{
-		char *matNameWithExtension;
-		nLen = Q_strlen( pTemp ) + Q_strlen( ".vmt" ) + 1;
-		matNameWithExtension = (char *)stackalloc( nLen );
-		Q_strncpy( matNameWithExtension, pTemp, nLen );
-		Q_strncat( matNameWithExtension, ".vmt", nLen, COPY_ALL_CHARACTERS );
-
-		IMaterialInternal *pMat = NULL;
-		if ( !Q_stricmp( pKeyValues->GetName(), "subrect" ) )
-		{
-			pMat = m_MaterialDict.AddMaterialSubRect( matNameWithExtension, pTextureGroupName, pKeyValues, pPatchKeyValues );
-		}
-		else
+		pMat = m_MaterialDict.AddMaterial( matNameWithExtension, pTextureGroupName );
+		if ( g_pShaderDevice->IsUsingGraphics() )
 		{
-			pMat = m_MaterialDict.AddMaterial( matNameWithExtension, pTextureGroupName );
-			if ( g_pShaderDevice->IsUsingGraphics() )
+			if ( !bIsUNC )
 			{
-				if ( !bIsUNC )
-				{
-					m_pForcedTextureLoadPathID = "GAME";
-				}
-				pMat->PrecacheVars( pKeyValues, pPatchKeyValues, &includes, nContext );
-				m_pForcedTextureLoadPathID = NULL;
+				m_pForcedTextureLoadPathID = "GAME";
 			}
+			pMat->PrecacheVars( pKeyValues, pPatchKeyValues, &includes, nContext );
+			m_pForcedTextureLoadPathID = NULL;
 		}
-		pKeyValues->deleteThis();
-		pPatchKeyValues->deleteThis();
-
-		return pMat->GetQueueFriendlyVersion();
 	}
+	pKeyValues->deleteThis();
+	pPatchKeyValues->deleteThis();
+
+	return pMat->GetQueueFriendlyVersion();
+}
 
+//-----------------------------------------------------------------------------
+// Returns the error material, complaining once per missing name
+//-----------------------------------------------------------------------------
+IMaterial *CMaterialSystem::MaterialNotFound( const char *pTemp, bool bComplain, const char *pComplainPrefix )
+{
 	if ( bComplain )
 	{
 		Assert( pTemp );
 
 		// convert to lowercase
-		nLen = Q_strlen(pTemp) + 1 ;
+		int nLen = Q_strlen(pTemp) + 1 ;
 		char *name = (char*)stackalloc( nLen );
 		Q_strncpy( name, pTemp, nLen );
 		Q_strlower( name );
@@ -2888,6 +2915,165 @@ IMaterial* CMaterialSystem::FindMaterialEx( char const* pMaterialName, const cha
 	return g_pErrorMaterial->GetRealTimeVersion();
 }
 
+//-----------------------------------------------------------------------------
+// Batch search: .vmt files are read on the thread pool, then parsed and the
+// materials created + precached in list order on this thread. The KeyValues
+// parser isn't reentrant, so only the file reads go wide.
+//-----------------------------------------------------------------------------
+static ConVar mat_findmaterials_threaded( "mat_findmaterials_threaded", "1", 0, "Read .vmt files for FindMaterials batches on the thread pool" );
+static ConVar mat_findmaterials_spew( "mat_findmaterials_spew", "0", 0, "Print per-phase timing for FindMaterials batches" );
+
+struct MaterialBatchLoad_t
+{
+	CUtlString m_LookupName;
+	CUtlString m_VMTName;
+	bool m_bIsUNC;
+	bool m_bRead;
+	CUtlBuffer m_VMTBuffer;
+	KeyValues *m_pKeyValues;
+	KeyValues *m_pPatchKeyValues;
+	CUtlVector<FileNameHandle_t> m_Includes;
+	IMaterial *m_pMaterial;
+};
+
+static void ReadBatchMaterialVMT( MaterialBatchLoad_t *&pLoad )
+{
+	pLoad->m_bRead = ReadVMTFile( pLoad->m_VMTBuffer, pLoad->m_VMTName.Get(), true );
+}
+
+static void ParseBatchMaterialVMT( MaterialBatchLoad_t *pLoad )
+{
+	if ( !pLoad->m_bRead )
+		return;
+
+	pLoad->m_pKeyValues = new KeyValues( "vmt" );
+	pLoad->m_pPatchKeyValues = new KeyValues( "vmt_patches" );
+	if ( !LoadVMTFileFromBuffer( *pLoad->m_pKeyValues, *pLoad->m_pPatchKeyValues, pLoad->m_VMTName.Get(), true, pLoad->m_VMTBuffer, &pLoad->m_Includes ) )
+	{
+		pLoad->m_pKeyValues->deleteThis();
+		pLoad->m_pKeyValues = NULL;
+		pLoad->m_pPatchKeyValues->deleteThis();
+		pLoad->m_pPatchKeyValues = NULL;
+	}
+}
+
+void CMaterialSystem::FindMaterials( const char * const *ppMaterialNames, int nCount, const char *pTextureGroupName, IMaterial **ppMaterialsOut, bool bComplain )
+{
+	CFastTimer timer;
+	timer.Start();
+
+	// Resolve what's already loaded and collapse duplicates
+	CUtlVector<MaterialBatchLoad_t *> loads;
+	CUtlVector<int> loadForName;
+	loadForName.SetCount( nCount );
+	CUtlDict<int, int> loadIndex( k_eDictCompareTypeCaseSensitive );
+	int nAlreadyLoaded = 0;
+	for ( int i = 0; i < nCount; ++i )
+	{
+		loadForName[i] = -1;
+
+		char pTemp[MAX_PATH];
+		GetMaterialLookupName( ppMaterialNames[i], pTemp, sizeof( pTemp ) );
+
+		IMaterialInternal *pExistingMaterial = m_MaterialDict.FindMaterial( pTemp, false );
+		if ( pExistingMaterial )
+		{
+			if ( ppMaterialsOut )
+			{
+				ppMaterialsOut[i] = pExistingMaterial->GetQueueFriendlyVersion();
+			}
+			++nAlreadyLoaded;
+			continue;
+		}
+
+		int idx = loadIndex.Find( pTemp );
+		if ( idx == loadIndex.InvalidIndex() )
+		{
+			MaterialBatchLoad_t *pLoad = new MaterialBatchLoad_t;
+			pLoad->m_LookupName = pTemp;
+
+			char vmtName[MAX_PATH + 16];
+			pLoad->m_bIsUNC = GetMaterialVMTName( pTemp, vmtName, sizeof( vmtName ) );
+			pLoad->m_VMTName = vmtName;
+			pLoad->m_pKeyValues = pLoad->m_pPatchKeyValues = NULL;
+			pLoad->m_bRead = false;
+			pLoad->m_pMaterial = NULL;
+
+			idx = loadIndex.Insert( pTemp, loads.AddToTail( pLoad ) );
+		}
+		loadForName[i] = loadIndex[idx];
+	}
+
+	timer.End();
+	float flResolveMs = timer.GetDuration().GetMillisecondsF();
+	timer.Start();
+
+	// Read every .vmt
+	if ( mat_findmaterials_threaded.GetBool() && loads.Count() > 1 && g_pThreadPool && g_pThreadPool->NumIdleThreads() )
+	{
+		ParallelProcess( "FindMaterials", loads.Base(), loads.Count(), &ReadBatchMaterialVMT );
+	}
+	else
+	{
+		for ( int i = 0; i < loads.Count(); ++i )
+		{
+			ReadBatchMaterialVMT( loads[i] );
+		}
+	}
+
+	timer.End();
+	float flReadMs = timer.GetDuration().GetMillisecondsF();
+	timer.Start();
+
+	// Parse them (and read + parse their patch includes) here
+	for ( int i = 0; i < loads.Count(); ++i )
+	{
+		ParseBatchMaterialVMT( loads[i] );
+	}
+
+	timer.End();
+	float flParseMs = timer.GetDuration().GetMillisecondsF();
+	timer.Start();
+
+	// Create the materials and precache their textures in the order the caller asked for them,
+	// so everything downstream sees the same sequence as individual FindMaterial calls
+	for ( int i = 0; i < nCount; ++i )
+	{
+		if ( loadForName[i] < 0 )
+			continue;
+
+		MaterialBatchLoad_t *pLoad = loads[ loadForName[i] ];
+		if ( !pLoad->m_pMaterial )
+		{
+			if ( pLoad->m_pKeyValues )
+			{
+				pLoad->m_pMaterial = AddMaterialFromVMT( pLoad->m_LookupName.Get(), pTextureGroupName, pLoad->m_pKeyValues, pLoad->m_pPatchKeyValues, pLoad->m_Includes, pLoad->m_bIsUNC, MATERIAL_FINDCONTEXT_NONE );
+				pLoad->m_pKeyValues = pLoad->m_pPatchKeyValues = NULL;
+			}
+			else
+			{
+				pLoad->m_pMaterial = MaterialNotFound( pLoad->m_LookupName.Get(), bComplain, NULL );
+			}
+		}
+
+		if ( ppMaterialsOut )
+		{
+			ppMaterialsOut[i] = pLoad->m_pMaterial;
+		}
+	}
+
+	timer.End();
+	float flCommitMs = timer.GetDuration().GetMillisecondsF();
+
+	if ( mat_findmaterials_spew.GetBool() )
+	{
+		Msg( "FindMaterials: %d names, %d already loaded, %d .vmt loads: resolve %.2f ms, read %.2f ms%s, parse %.2f ms, create+precache %.2f ms\n",
+			nCount, nAlreadyLoaded, loads.Count(), flResolveMs, flReadMs, mat_findmaterials_threaded.GetBool() ? " (threaded)" : "", flParseMs, flCommitMs );
+	}
+
+	loads.PurgeAndDeleteElements();
+}
+
 void CMaterialSystem::SetAsyncTextureLoadCache( void* h )
 {
 	Assert( !h || !m_hAsyncLoadFileCache );
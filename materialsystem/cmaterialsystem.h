@@ -486,6 +486,8 @@ public:
 	virtual bool				AddTextureCompositorTemplate( const char* pName, KeyValues* pTmplDesc, int nTexCompositeTemplateFlags = 0 ) OVERRIDE;
 	virtual bool				VerifyTextureCompositorTemplates() OVERRIDE;
 
+	virtual void				FindMaterials( const char * const *ppMaterialNames, int nCount, const char *pTextureGroupName, IMaterial **ppMaterialsOut, bool bComplain = true ) OVERRIDE;
+
 
 
 
@@ -588,6 +590,9 @@ public:
 private:
 	void									OnRenderingAsyncComplete();
 
+	IMaterial *								AddMaterialFromVMT( const char *pTemp, const char *pTextureGroupName, KeyValues *pKeyValues, KeyValues *pPatchKeyValues, CUtlVector<FileNameHandle_t> &includes, bool bIsUNC, int nContext );
+	IMaterial *								MaterialNotFound( const char *pTemp, bool bComplain, const char *pComplainPrefix );
+
 	// -----------------------------------------------------------
 private:
 	CON_COMMAND_MEMBER_F( CMaterialSystem, "mat_showmaterials", DebugPrintUsedMaterials, "Show materials.", 0 );
@@ -78,6 +78,7 @@ static void ConVarChanged_mat_managedtextures( IConVar *var, const char *pOldVal
 static ConVar mat_spew_on_texture_size( "mat_spew_on_texture_size", "0", 0, "Print warnings about vtf content that isn't of the expected size" );
 static ConVar mat_lodin_time( "mat_lodin_time", "5.0", FCVAR_DEVELOPMENTONLY );
 static ConVar mat_lodin_hidden_pop( "mat_lodin_hidden_pop", "1", FCVAR_DEVELOPMENTONLY );
+static ConVar mat_texture_stream_vtf( "mat_texture_stream_vtf", "1", 0, "Read only the header, resources and needed mip levels of a .vtf, straight into the texture" );
 
 #define TEXTURE_FNAME_EXTENSION			".vtf"
 #define TEXTURE_FNAME_EXTENSION_LEN		4
@@ -4167,6 +4168,84 @@ int GetThreadId()
 	return retVal;
 }
 
+//-----------------------------------------------------------------------------
+// Reads ranges of a .vtf for IVTFTexture::UnserializeFromReader
+//-----------------------------------------------------------------------------
+class CVTFFileRangeReader : public IVTFRangeReader
+{
+public:
+	CVTFFileRangeReader( FileHandle_t hFile ) : m_hFile( hFile ), m_nBytesRead( 0 ) {}
+
+	virtual int ReadRange( void *pDest, int nOffset, int nSize )
+	{
+		g_pFullFileSystem->Seek( m_hFile, nOffset, FILESYSTEM_SEEK_HEAD );
+		int nBytesRead = g_pFullFileSystem->Read( pDest, nSize, m_hFile );
+		m_nBytesRead += MAX( nBytesRead, 0 );
+		return nBytesRead;
+	}
+
+	int BytesRead() const { return m_nBytesRead; }
+
+private:
+	FileHandle_t m_hFile;
+	int m_nBytesRead;
+};
+
+//-----------------------------------------------------------------------------
+// I/O totals for SLoadTextureBitsFromFile, buffered [0] vs. streamed [1] reads
+//-----------------------------------------------------------------------------
+struct VTFLoadStats_t
+{
+	CThreadFastMutex m_Mutex;
+	int m_nFiles;
+	int64 m_nFileBytes;
+	int64 m_nBytesRead;
+	int64 m_nMicroseconds;
+
+	void Add( int nFileBytes, int nBytesRead, int64 nMicroseconds )
+	{
+		AUTO_LOCK( m_Mutex );
+		++m_nFiles;
+		m_nFileBytes += nFileBytes;
+		m_nBytesRead += nBytesRead;
+		m_nMicroseconds += nMicroseconds;
+	}
+
+	void Reset()
+	{
+		AUTO_LOCK( m_Mutex );
+		m_nFiles = 0;
+		m_nFileBytes = m_nBytesRead = m_nMicroseconds = 0;
+	}
+};
+static VTFLoadStats_t g_VTFLoadStats[2];
+
+CON_COMMAND( mat_texture_load_stats, "Bytes read and time spent loading .vtf files, split by mat_texture_stream_vtf. 'reset' clears the totals" )
+{
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		g_VTFLoadStats[0].Reset();
+		g_VTFLoadStats[1].Reset();
+		return;
+	}
+
+	static const char *s_pPathNames[2] = { "buffered", "streamed" };
+	for ( int i = 0; i < 2; ++i )
+	{
+		VTFLoadStats_t &stats = g_VTFLoadStats[i];
+		AUTO_LOCK( stats.m_Mutex );
+		if ( !stats.m_nFiles )
+			continue;
+
+		Msg( "%s: %d files, %.1f MB on disk, %.1f MB read (%.1f MB skipped, %.1f%%), %.1f ms (%.3f ms/file)\n",
+			s_pPathNames[i], stats.m_nFiles,
+			stats.m_nFileBytes / ( 1024.0 * 1024.0 ), stats.m_nBytesRead / ( 1024.0 * 1024.0 ),
+			( stats.m_nFileBytes - stats.m_nBytesRead ) / ( 1024.0 * 1024.0 ),
+			stats.m_nFileBytes ? 100.0 * ( stats.m_nFileBytes - stats.m_nBytesRead ) / stats.m_nFileBytes : 0.0,
+			stats.m_nMicroseconds / 1000.0, stats.m_nMicroseconds / ( 1000.0 * stats.m_nFiles ) );
+	}
+}
+
 // ------------------------------------------------------------------------------------------------
 bool SLoadTextureBitsFromFile( IVTFTexture **ppOutVtfTexture, FileHandle_t hFile, unsigned int nFlags, 
 							   TextureLODControlSettings_t* pInOutCachedFileLodSettings, 
@@ -4182,6 +4261,9 @@ bool SLoadTextureBitsFromFile( IVTFTexture **ppOutVtfTexture, FileHandle_t hFile
 	// NOTE! NOTE! NOTE! or by the streaming texture code!
 	Assert( ppOutVtfTexture != NULL && *ppOutVtfTexture != NULL );
 
+	CFastTimer loadTimer;
+	loadTimer.Start();
+
 	CUtlBuffer buf;
 
 	{
@@ -4197,6 +4279,8 @@ bool SLoadTextureBitsFromFile( IVTFTexture **ppOutVtfTexture, FileHandle_t hFile
 		g_pFullFileSystem->Seek( hFile, nHeaderSize, FILESYSTEM_SEEK_HEAD );
 	}
 
+	int nHeaderBytesRead = buf.TellMaxPut();
+
 	// Unserialize the header only
 	// need the header first to determine remainder of data
 	if ( !( *ppOutVtfTexture )->Unserialize( buf, true ) )
@@ -4232,12 +4316,6 @@ bool SLoadTextureBitsFromFile( IVTFTexture **ppOutVtfTexture, FileHandle_t hFile
 		nFileSize = nActualFileSize;
 	}
 
-	// Read only the portion of the file that we care about
-	g_pFullFileSystem->Seek( hFile, 0, FILESYSTEM_SEEK_HEAD );
-	int nBytesOptimalRead = GetOptimalReadBuffer( &buf, hFile, nFileSize );
-	int nBytesRead = g_pFullFileSystem->ReadEx( buf.Base(), nBytesOptimalRead, nFileSize, hFile );
-	buf.SeekPut( CUtlBuffer::SEEK_HEAD, nBytesRead );
-
 	// Some hardware doesn't support copying textures to other textures. For them, we need to reread the 
 	// whole file, so if they are doing the final read (the fine levels) then reread everything by stripping
 	// off the flags we are trying to pass in.
@@ -4245,11 +4323,34 @@ bool SLoadTextureBitsFromFile( IVTFTexture **ppOutVtfTexture, FileHandle_t hFile
 	if ( !HardwareConfig()->CanStretchRectFromTextures() && ( nForceFlags & TEXTUREFLAGS_STREAMABLE_FINE ) )
 		nForceFlags = 0;
 
-	// NOTE: Skipping mip levels here will cause the size to be changed
-	bool bRetVal = ( *ppOutVtfTexture )->UnserializeEx( buf, false, nForceFlags, nMipSkipCount );
+	bool bRetVal;
+	bool bStreamed = mat_texture_stream_vtf.GetBool();
+	int nDataBytesRead;
+	if ( bStreamed )
+	{
+		// Reads the remaining resources and each kept mip level directly into the texture, coarsest first
+		CVTFFileRangeReader reader( hFile );
+		bRetVal = ( *ppOutVtfTexture )->UnserializeFromReader( buf, &reader, nForceFlags, nMipSkipCount );
+		nDataBytesRead = reader.BytesRead();
+	}
+	else
+	{
+		// Read only the portion of the file that we care about
+		g_pFullFileSystem->Seek( hFile, 0, FILESYSTEM_SEEK_HEAD );
+		int nBytesOptimalRead = GetOptimalReadBuffer( &buf, hFile, nFileSize );
+		int nBytesRead = g_pFullFileSystem->ReadEx( buf.Base(), nBytesOptimalRead, nFileSize, hFile );
+		buf.SeekPut( CUtlBuffer::SEEK_HEAD, nBytesRead );
+		nDataBytesRead = nBytesRead;
+
+		// NOTE: Skipping mip levels here will cause the size to be changed
+		bRetVal = ( *ppOutVtfTexture )->UnserializeEx( buf, false, nForceFlags, nMipSkipCount );
+	}
 
 	FreeOptimalReadBuffer( 6*1024*1024 );
 
+	loadTimer.End();
+	g_VTFLoadStats[ bStreamed ].Add( nActualFileSize, nHeaderBytesRead + nDataBytesRead, loadTimer.GetDuration().GetMicroseconds() );
+
 	if ( !bRetVal )
 	{
 		Warning( "Error reading texture data \"%s\"\n", pCacheFileName );
@@ -157,5 +157,9 @@ extern void ExpandPatchFile( KeyValues& keyValues, KeyValues &patchKeyValues );
 // work properly - the patch keys need to be reapplied when the fallback VMT is loaded). It may contain
 // previously accumulated patch keys on entry, and may contain more encountered patch keys on exit.
 extern bool LoadVMTFile( KeyValues &vmtKeyValues, KeyValues &patchKeyValues, const char *pMaterialName, bool bUsesUNCFilename, CUtlVector<FileNameHandle_t> *pIncludes  );
+// LoadVMTFile split in two: ReadVMTFile only reads the .vmt and is safe on any thread. The KeyValues
+// parser isn't reentrant, so LoadVMTFileFromBuffer (which also reads any patch includes) is not.
+extern bool ReadVMTFile( CUtlBuffer &buf, const char *pMaterialName, bool bUsesUNCFilename );
+extern bool LoadVMTFileFromBuffer( KeyValues &vmtKeyValues, KeyValues &patchKeyValues, const char *pMaterialName, bool bUsesUNCFilename, CUtlBuffer &buf, CUtlVector<FileNameHandle_t> *pIncludes );
 
 #endif // IMATERIALINTERNAL_H
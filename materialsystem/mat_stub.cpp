@@ -915,6 +915,19 @@ public:
 		return &g_DummyMaterial;
 	}
 
+	virtual void FindMaterials( const char * const *ppMaterialNames, int nCount, const char *pTextureGroupName, IMaterial **ppMaterialsOut, bool bComplain = true )
+	{
+		if ( m_pRealMaterialSystem )
+		{
+			m_pRealMaterialSystem->FindMaterials( ppMaterialNames, nCount, pTextureGroupName, ppMaterialsOut, bComplain );
+			return;
+		}
+		for ( int i = 0; ppMaterialsOut && i < nCount; ++i )
+		{
+			ppMaterialsOut[i] = &g_DummyMaterial;
+		}
+	}
+
 	virtual IMaterial *FindProceduralMaterial( const char *pMaterialName, const char *pTextureGroupName, KeyValues *pVMTKeyValues )
 	{
 		if ( m_pRealMaterialSystem )
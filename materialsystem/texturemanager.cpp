@@ -25,6 +25,7 @@
 #include "materialsystem/imesh.h"
 #include "materialsystem/ishaderapi.h"
 #include "vstdlib/random.h"
+#include "tier1/kernelbenchmark.h"
 #include "imorphinternal.h"
 #include "tier1/utlrbtree.h"
 #include "tier1/utlpair.h"
@@ -56,6 +57,15 @@ class AsyncReader;
 
 #define MAX_READS_OUTSTANDING 2
 
+// The vtf library only fans conversions out from the main thread, which is also
+// where convars change, so the setting is pushed to it here rather than per texture
+static void ConVarChanged_mat_texture_threaded_convert( IConVar *var, const char *pOldValue, float flOldValue );
+static ConVar mat_texture_threaded_convert( "mat_texture_threaded_convert", "1", 0, "Spread main thread texture format conversion across the thread pool", &ConVarChanged_mat_texture_threaded_convert );
+static void ConVarChanged_mat_texture_threaded_convert( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	VTFSetThreadedProcessing( mat_texture_threaded_convert.GetBool() );
+}
+
 static ImageFormat GetImageFormatRawReadback( ImageFormat fmt );
 
 #ifdef STAGING_ONLY
@@ -1493,6 +1503,8 @@ void CTextureManager::Init( int nFlags )
 	color32 color, color2;
 	m_iNextTexID = 4096;
 
+	VTFSetThreadedProcessing( mat_texture_threaded_convert.GetBool() );
+
 	// setup the checkerboard generator for failed texture loading
 	color.r = color.g = color.b = 0; color.a = 128;
 	color2.r = color2.b = color2.a = 255; color2.g = 0;
@@ -3117,6 +3129,155 @@ CON_COMMAND( mat_evict_all, "Evict all fine mipmaps from the gpu" )
 	TextureManager()->EvictAllTextures();
 }
 
+//-----------------------------------------------------------------------------
+// Image kernel benchmark: times the bitmap library's format conversions and
+// mipmap filters with and without its SIMD kernels over common texture sizes,
+// and checks both produce the same bytes
+//-----------------------------------------------------------------------------
+struct ImageKernelCase_t
+{
+	const char *m_pName;
+	ImageFormat m_SrcFormat;
+	ImageFormat m_DstFormat;
+	int m_nResampleFlags;	// -1 for a plain conversion, -2 for GenerateMipmapLevelsLQ
+};
+
+static const ImageKernelCase_t s_ImageKernelCases[] =
+{
+	{ "RGBA8888 -> BGRA8888",		IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGRA8888,	-1 },
+	{ "BGRA8888 -> RGBA8888",		IMAGE_FORMAT_BGRA8888,		IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "BGRX8888 -> RGBA8888",		IMAGE_FORMAT_BGRX8888,		IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "RGB888 -> RGBA8888",			IMAGE_FORMAT_RGB888,		IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "BGR888 -> RGBA8888",			IMAGE_FORMAT_BGR888,		IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "RGBA8888 -> BGR888",			IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGR888,	-1 },
+	{ "RGBA8888 -> BGR565",			IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGR565,	-1 },
+	{ "BGR565 -> RGBA8888",			IMAGE_FORMAT_BGR565,		IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "RGBA8888 -> BGRA4444",		IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGRA4444,	-1 },
+	{ "BGRA4444 -> RGBA8888",		IMAGE_FORMAT_BGRA4444,		IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "RGBA8888 -> BGRA5551",		IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGRA5551,	-1 },
+	{ "BGRA5551 -> RGBA8888",		IMAGE_FORMAT_BGRA5551,		IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "I8 -> RGBA8888",				IMAGE_FORMAT_I8,			IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "IA88 -> RGBA8888",			IMAGE_FORMAT_IA88,			IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "RGBA16161616 -> RGBA8888",	IMAGE_FORMAT_RGBA16161616,	IMAGE_FORMAT_RGBA8888,	-1 },
+	{ "mipmaps (LQ box)",			IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_RGBA8888,	-2 },
+	{ "resample 1/2 (box)",			IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_RGBA8888,	0 },
+	{ "resample 1/2 (nice)",		IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_RGBA8888,	ImageLoader::RESAMPLE_NICE_FILTER },
+	{ "resample 1/2 (normalmap)",	IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_RGBA8888,	ImageLoader::RESAMPLE_NORMALMAP },
+};
+
+static void RunImageKernelCase( const ImageKernelCase_t &kernelCase, unsigned char *pSrc, unsigned char *pDst, int nSize )
+{
+	if ( kernelCase.m_nResampleFlags == -1 )
+	{
+		ImageLoader::ConvertImageFormat( pSrc, kernelCase.m_SrcFormat, pDst, kernelCase.m_DstFormat, nSize, nSize );
+	}
+	else if ( kernelCase.m_nResampleFlags == -2 )
+	{
+		ImageLoader::GenerateMipmapLevelsLQ( pSrc, pDst, nSize, nSize, kernelCase.m_SrcFormat, 0 );
+	}
+	else
+	{
+		ImageLoader::ResampleInfo_t info;
+		info.m_pSrc = pSrc;
+		info.m_pDest = pDst;
+		info.m_nSrcWidth = info.m_nSrcHeight = nSize;
+		info.m_nDestWidth = info.m_nDestHeight = nSize / 2;
+		info.m_flSrcGamma = info.m_flDestGamma = 2.2f;
+		info.m_nFlags = kernelCase.m_nResampleFlags;
+		ImageLoader::ResampleRGBA8888( info );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Runs one kernel case at one size, scalar (mode 0) and SIMD (mode 1), over
+// the same random source image
+//-----------------------------------------------------------------------------
+class CImageKernelBenchmark : public CKernelBenchmark< unsigned char >
+{
+public:
+	CImageKernelBenchmark( int nMaxSize ) : CKernelBenchmark< unsigned char >( 0x494d47 ), m_pCase( NULL ), m_nSize( 0 )
+	{
+		// Big enough for the widest format (RGBA16161616) and any mip chain
+		int nBufferSize = nMaxSize * nMaxSize * 8;
+		m_Source.SetCount( nBufferSize );
+		for ( int i = 0; i < nBufferSize; ++i )
+		{
+			m_Source[i] = m_Random.RandomInt( 0, 255 );
+		}
+		m_Output[0].SetCount( nBufferSize );
+		m_Output[1].SetCount( nBufferSize );
+	}
+
+	void SetCase( const ImageKernelCase_t &kernelCase, int nSize )
+	{
+		m_pCase = &kernelCase;
+		m_nSize = nSize;
+	}
+
+protected:
+	virtual bool BeginMode( int nMode )
+	{
+		ImageLoader::EnableImageSIMD( nMode != 0 );
+		V_memset( m_Output[nMode].Base(), 0xCD, m_Output[nMode].Count() );
+		return true;
+	}
+
+	virtual void RunIteration( int nMode, int nIteration )
+	{
+		RunImageKernelCase( *m_pCase, m_Source.Base(), m_Output[nMode].Base(), m_nSize );
+	}
+
+private:
+	CUtlVector< unsigned char > m_Source;
+	const ImageKernelCase_t *m_pCase;
+	int m_nSize;
+};
+
+CON_COMMAND_F( mat_image_kernel_benchmark, "Times image format conversion and mipmap kernels, scalar vs. SIMD: mat_image_kernel_benchmark [max size]", FCVAR_CHEAT )
+{
+	int nMaxSize = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 256, 4096 ) : 2048;
+
+	CImageKernelBenchmark benchmark( nMaxSize );
+
+	bool bWasEnabled = ImageLoader::EnableImageSIMD( true );
+	if ( !ImageLoader::IsImageSIMDEnabled() )
+	{
+		Warning( "mat_image_kernel_benchmark: no SIMD kernels on this CPU/build, timing scalar only\n" );
+	}
+
+	Msg( "%-26s %6s %12s %12s %8s\n", "kernel", "size", "scalar ms", "simd ms", "speedup" );
+	int nMismatches = 0;
+	for ( int c = 0; c < ARRAYSIZE( s_ImageKernelCases ); ++c )
+	{
+		const ImageKernelCase_t &kernelCase = s_ImageKernelCases[c];
+		for ( int nSize = 256; nSize <= nMaxSize; nSize *= 2 )
+		{
+			// Roughly the same number of pixels for every size; the nice filter is much slower
+			int nIterations = MAX( 1, ( 1 << 22 ) / ( nSize * nSize ) );
+			if ( kernelCase.m_nResampleFlags > 0 && ( kernelCase.m_nResampleFlags & ImageLoader::RESAMPLE_NICE_FILTER ) )
+			{
+				nIterations = 1;
+			}
+
+			benchmark.SetCase( kernelCase, nSize );
+			benchmark.Run( 2, nIterations );
+
+			bool bMatch = benchmark.OutputMatches();
+			if ( !bMatch )
+			{
+				++nMismatches;
+			}
+
+			Msg( "%-26s %6d %12.3f %12.3f %7.2fx%s\n", kernelCase.m_pName, nSize,
+				benchmark.GetTime( 0 ) * 1000.0 / nIterations, benchmark.GetTime( 1 ) * 1000.0 / nIterations,
+				benchmark.GetSpeedup(), bMatch ? "" : "  MISMATCH" );
+		}
+	}
+
+	ImageLoader::EnableImageSIMD( bWasEnabled );
+	Msg( "mat_image_kernel_benchmark: %s\n", nMismatches ? "SIMD output DIFFERS from scalar" : "SIMD output matches scalar" );
+}
+
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
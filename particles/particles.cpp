@@ -19,6 +19,7 @@
 #include "materialsystem/itexture.h"
 #include "materialsystem/imesh.h"
 #include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
 #include "tier1/KeyValues.h"
 #include "tier1/lzmaDecoder.h"
 #include "random_floats.h"
@@ -1921,11 +1922,25 @@ void CParticleCollection::SimulateFirstFrame( )
 void CParticleCollection::Simulate( float dt, bool updateBboxOnly )
 {
 	VPROF_BUDGET( "CParticleCollection::Simulate", VPROF_BUDGETGROUP_PARTICLE_SIMULATION );
-	if ( dt < 0.0f )
+	if ( !SimulateOperators( dt, updateBboxOnly ) )
 		return;
 
+	// let children simulate
+	for (CParticleCollection *i = m_Children.m_pHead; i; i = i->m_pNext)
+	{
+		i->Simulate(dt, updateBboxOnly);
+	}
+
+	FinishSimulation( dt );
+}
+
+bool CParticleCollection::SimulateOperators( float dt, bool updateBboxOnly )
+{
+	if ( dt < 0.0f )
+		return false;
+
 	if ( !m_pDef )
-		return;
+		return false;
 
 	// Don't do anything until we've hit t == 0
 	// This is used for delayed children
@@ -1937,7 +1952,7 @@ void CParticleCollection::Simulate( float dt, bool updateBboxOnly )
 			m_fl4CurTime = ReplicateX4( m_flCurTime );
 			UpdatePrevControlPoints( dt );
 		}
-		return;
+		return false;
 	}
 
 	// run initializers if necessary (once we hit t == 0)
@@ -1948,7 +1963,7 @@ void CParticleCollection::Simulate( float dt, bool updateBboxOnly )
 	}
 
 	if ( dt < 1.0e-22 )
-		return;
+		return false;
 
 
 #if MEASURE_PARTICLE_PERF
@@ -2096,22 +2111,19 @@ void CParticleCollection::Simulate( float dt, bool updateBboxOnly )
 #endif
 	}
 
-	// let children simulate
-	for (CParticleCollection *i = m_Children.m_pHead; i; i = i->m_pNext)
-	{
-		LoanKillListTo(i);								// re-use the allocated kill list for the children
-		i->Simulate(dt, updateBboxOnly);
-		i->m_pParticleKillList = NULL;
-	}
-
+	// children attach their own kill list, so they can be simulated on other threads
 	if (bAttachedKillList)
 		g_pParticleSystemMgr->DetachKillList(this);
 
+	return true;
+}
+
+void CParticleCollection::FinishSimulation( float dt )
+{
 	UpdatePrevControlPoints(dt);
 
 	// Bloat the bounding box by bounds around the control point
 	BloatBoundsUsingControlPoint();
-
 }
 
 
@@ -3226,6 +3238,114 @@ float CParticleSystemMgr::GetLastSimulationTime() const
 	return m_flLastSimulationTime;
 }
 
+
+//-----------------------------------------------------------------------------
+// Frame-level simulation of many collections
+//-----------------------------------------------------------------------------
+struct ParticleSimulateItem_t
+{
+	CParticleCollection *m_pCollection;
+	float m_flDt;
+	bool m_bSimulated;
+};
+
+// A job is either one top-level collection or all the children of one parent.
+// Siblings stay on the same job because world collision operators share their
+// parent's collision cache.
+struct ParticleSimulateJob_t
+{
+	ParticleSimulateItem_t *m_pItems;
+	int m_nCount;
+};
+
+static void SimulateParticleJob( ParticleSimulateJob_t &job )
+{
+	// Enable FP exceptions here when FP_EXCEPTIONS_ENABLED is defined,
+	// to help track down bad math.
+	FPExceptionEnabler enableExceptions;
+
+	for ( int i = 0; i < job.m_nCount; ++i )
+	{
+		ParticleSimulateItem_t &item = job.m_pItems[i];
+		item.m_bSimulated = item.m_pCollection->SimulateOperators( item.m_flDt, false );
+	}
+}
+
+void CParticleSystemMgr::SimulateCollections( CParticleCollection **ppCollections, const float *pDt, int nCount, bool bThreaded )
+{
+	VPROF_BUDGET( "CParticleSystemMgr::SimulateCollections", VPROF_BUDGETGROUP_PARTICLE_SIMULATION );
+
+	// Items are appended a hierarchy level at a time, so parents always precede their children
+	CUtlVector< ParticleSimulateItem_t > items;
+	CUtlVector< int > jobStart;
+	items.EnsureCapacity( nCount );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		ParticleSimulateItem_t &item = items[ items.AddToTail() ];
+		item.m_pCollection = ppCollections[i];
+		item.m_flDt = pDt[i];
+		item.m_bSimulated = false;
+		jobStart.AddToTail( i );
+	}
+
+	CUtlVector< ParticleSimulateJob_t > jobs;
+	int nLevelStart = 0;
+	while ( nLevelStart < items.Count() )
+	{
+		int nLevelEnd = items.Count();
+
+		// items won't move again until the next level is gathered, so jobs can point into it
+		jobs.RemoveAll();
+		for ( int i = 0; i < jobStart.Count(); ++i )
+		{
+			int nEnd = ( i + 1 < jobStart.Count() ) ? jobStart[i+1] : nLevelEnd;
+			ParticleSimulateJob_t &job = jobs[ jobs.AddToTail() ];
+			job.m_pItems = items.Base() + jobStart[i];
+			job.m_nCount = nEnd - jobStart[i];
+		}
+
+		if ( bThreaded && jobs.Count() > 1 )
+		{
+			ParallelProcess( "CParticleSystemMgr::SimulateCollections", jobs.Base(), jobs.Count(), SimulateParticleJob );
+		}
+		else
+		{
+			for ( int i = 0; i < jobs.Count(); ++i )
+			{
+				SimulateParticleJob( jobs[i] );
+			}
+		}
+
+		// children of the collections that simulated make up the next level
+		jobStart.RemoveAll();
+		for ( int i = nLevelStart; i < nLevelEnd; ++i )
+		{
+			if ( !items[i].m_bSimulated || !items[i].m_pCollection->m_Children.m_pHead )
+				continue;
+
+			jobStart.AddToTail( items.Count() );
+			float flDt = items[i].m_flDt;
+			for ( CParticleCollection *pChild = items[i].m_pCollection->m_Children.m_pHead; pChild; pChild = pChild->m_pNext )
+			{
+				ParticleSimulateItem_t &child = items[ items.AddToTail() ];
+				child.m_pCollection = pChild;
+				child.m_flDt = flDt;
+				child.m_bSimulated = false;
+			}
+		}
+		nLevelStart = nLevelEnd;
+	}
+
+	// Merge step: walking backwards finishes children before the parents that include their bounds
+	for ( int i = items.Count(); --i >= 0; )
+	{
+		if ( items[i].m_bSimulated )
+		{
+			items[i].m_pCollection->FinishSimulation( items[i].m_flDt );
+		}
+	}
+}
+
 bool CParticleSystemMgr::Debug_FrameWarningNeededTestAndReset()
 {
 	bool bTemp = m_bFrameWarningNeeded;
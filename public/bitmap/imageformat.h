@@ -406,6 +406,12 @@ namespace ImageLoader
 	void ByteSwapImageData( unsigned char *pImageData, int nImageSize, ImageFormat imageFormat, int width = 0, int stride = 0 );
 	bool IsFormatValidForConversion( ImageFormat fmt );
 
+	// The SSE2/SSSE3 (NEON) conversion and resampling kernels are used when the CPU
+	// supports them. Disabling them forces the scalar loops, which give identical results.
+	// Returns the previous setting (not whether the CPU supports them) for restoring it
+	bool EnableImageSIMD( bool bEnable );
+	bool IsImageSIMDEnabled();
+
 	//-----------------------------------------------------------------------------
 	// convert back and forth from D3D format to ImageFormat, regardless of
 	// whether it's supported or not
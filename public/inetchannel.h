@@ -85,6 +85,9 @@ public:
 	virtual int		GetMaxRoutablePayloadSize() = 0;
 
 	virtual int		GetProtocolVersion() = 0;
+
+	// Room left in the reliable or unreliable stream before it overflows
+	virtual int		GetNumBitsLeft( bool bReliable ) = 0;
 };
 
 
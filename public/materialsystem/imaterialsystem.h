@@ -70,7 +70,7 @@ typedef uint64 VertexFormat_t;
 // V081 - 10/25/2016 - Added new Suspend/Resume texture streaming interfaces. Might also have added more calls here due
 //                     to the streaming work that didn't get bumped, but we're not guarding versions on the TF branch
 //                     very judiciously since we need to audit them when merging to SDK branch either way.
-#define MATERIAL_SYSTEM_INTERFACE_VERSION "VMaterialSystem081"
+#define MATERIAL_SYSTEM_INTERFACE_VERSION "VMaterialSystem082"
 
 #ifdef POSIX
 #define ABSOLUTE_MINIMUM_DXLEVEL 90
@@ -1093,6 +1093,10 @@ public:
 
 	// Performs final verification of all compositor templates (after they've all been initially loaded).
 	virtual bool				VerifyTextureCompositorTemplates( ) = 0;
+
+	// Finds a list of materials at once, equivalent to calling FindMaterial for each name in order.
+	// The .vmt files are read and parsed on the thread pool. ppMaterialsOut may be NULL to just precache.
+	virtual void				FindMaterials( const char * const *ppMaterialNames, int nCount, const char *pTextureGroupName, IMaterial **ppMaterialsOut, bool bComplain = true ) = 0;
 };
 
 
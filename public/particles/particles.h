@@ -395,6 +395,11 @@ public:
 	void SetLastSimulationTime( float flTime );
 	float GetLastSimulationTime() const;
 
+	// Simulates a frame's worth of top-level collections (a negative dt skips one).
+	// Each level of the child hierarchies runs on the thread pool once its parents
+	// are done; bounds are merged afterwards, children before their parents.
+	void SimulateCollections( CParticleCollection **ppCollections, const float *pDt, int nCount, bool bThreaded = true );
+
 	int Debug_GetTotalParticleCount() const;
 	bool Debug_FrameWarningNeededTestAndReset();
 	float ParticleThrottleScaling() const;		// Returns 1.0 = not restricted, 0.0 = fully restricted (i.e. don't draw!)
@@ -1075,6 +1080,12 @@ public:
 	void Simulate( float dt, bool updateBboxOnly = false );
 	void SkipToTime( float t );
 
+	// The two halves of Simulate(): running this collection's own operators (returns
+	// false if the children shouldn't be run this frame), and updating prev control
+	// points and bounds once the children are done
+	bool SimulateOperators( float dt, bool updateBboxOnly );
+	void FinishSimulation( float dt );
+
 	// the camera objetc may be compared for equality against control point objects
 	void Render( IMatRenderContext *pRenderContext, bool bTranslucentOnly = false, void *pCameraObject = NULL );
 
@@ -1379,7 +1390,6 @@ private:
 	CParticleCollection *m_pNextDef;
 	CParticleCollection *m_pPrevDef;
 
-	void LoanKillListTo( CParticleCollection *pBorrower ) const;
 	bool HasAttachedKillList( void ) const;
 
 
@@ -1490,13 +1500,6 @@ inline void CParticleCollection::SwapPosAndPrevPos( void )
 	V_swap( m_pParticleAttributes[ PARTICLE_ATTRIBUTE_XYZ ], m_pParticleAttributes[ PARTICLE_ATTRIBUTE_PREV_XYZ ] );
 }
 
-inline void CParticleCollection::LoanKillListTo( CParticleCollection *pBorrower ) const
-{
-	Assert(! pBorrower->m_pParticleKillList );
-	pBorrower->m_nNumParticlesToKill = 0;
-	pBorrower->m_pParticleKillList = m_pParticleKillList;
-}
-
 inline void CParticleCollection::SetAttributeToConstant( int nAttribute, float fValue )
 {
 	float *fconst = m_pConstantAttributes + 4*3*nAttribute;
@@ -0,0 +1,105 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Scaffolding for the console commands that time a reference
+//			implementation of some work against an optimized one (scalar vs.
+//			SIMD, serial vs. threaded) and check the two agree.
+//
+//=============================================================================//
+
+#ifndef KERNELBENCHMARK_H
+#define KERNELBENCHMARK_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "tier0/dbg.h"
+#include "tier1/utlvector.h"
+#include "tier1/strtools.h"
+#include "vstdlib/random.h"
+
+//-----------------------------------------------------------------------------
+// Runs the same workload once per mode, mode 0 being the reference, and times
+// each mode. Derived classes build their input from m_Random (seeded, so every
+// run sees the same data), do one iteration of work in RunIteration and leave
+// what the mode produced in m_Output[nMode] for the comparison.
+//-----------------------------------------------------------------------------
+template< class T >
+class CKernelBenchmark
+{
+public:
+	enum
+	{
+		MAX_MODES = 2
+	};
+
+	explicit CKernelBenchmark( int nSeed ) : m_nModes( 0 )
+	{
+		m_Random.SetSeed( nSeed );
+		for ( int nMode = 0; nMode < MAX_MODES; ++nMode )
+		{
+			m_flTime[nMode] = 0.0;
+		}
+	}
+
+	virtual ~CKernelBenchmark() {}
+
+	// Runs nIterations iterations in each of the first nModes modes.
+	// Returns false if BeginMode couldn't set a mode up.
+	bool Run( int nModes, int nIterations )
+	{
+		Assert( nModes >= 1 && nModes <= MAX_MODES );
+		m_nModes = 0;
+		for ( int nMode = 0; nMode < nModes; ++nMode )
+		{
+			if ( !BeginMode( nMode ) )
+				return false;
+
+			double flStartTime = Plat_FloatTime();
+			for ( int nIteration = 0; nIteration < nIterations; ++nIteration )
+			{
+				RunIteration( nMode, nIteration );
+			}
+			m_flTime[nMode] = Plat_FloatTime() - flStartTime;
+
+			EndMode( nMode );
+			m_nModes = nMode + 1;
+		}
+		return true;
+	}
+
+	// Number of modes the last Run completed
+	int GetModeCount() const { return m_nModes; }
+
+	// Seconds spent in nMode by the last Run
+	double GetTime( int nMode ) const { return m_flTime[nMode]; }
+
+	// How many times faster nMode ran than the reference
+	double GetSpeedup( int nMode = 1 ) const
+	{
+		return ( m_flTime[nMode] > 0.0 ) ? m_flTime[0] / m_flTime[nMode] : 0.0;
+	}
+
+	// True if nMode's output is byte for byte the reference's
+	bool OutputMatches( int nMode = 1 ) const
+	{
+		return ( m_Output[0].Count() == m_Output[nMode].Count() ) &&
+			!V_memcmp( m_Output[0].Base(), m_Output[nMode].Base(), m_Output[0].Count() * sizeof( T ) );
+	}
+
+	const CUtlVector< T > &GetOutput( int nMode ) const { return m_Output[nMode]; }
+
+protected:
+	virtual bool BeginMode( int nMode ) { return true; }
+	virtual void RunIteration( int nMode, int nIteration ) = 0;
+	virtual void EndMode( int nMode ) {}
+
+	CUniformRandomStream m_Random;
+	CUtlVector< T > m_Output[MAX_MODES];
+
+private:
+	double m_flTime[MAX_MODES];
+	int m_nModes;
+};
+
+#endif // KERNELBENCHMARK_H
@@ -300,6 +300,17 @@ public:
 	virtual unsigned int	ReadStat( int statID ) = 0;
 };
 
+// statIDs for IPhysicsCollision::ReadStat()
+enum
+{
+	PHYSCOLLISION_STAT_VCOLLIDE_UNIQUE_SOLIDS = 0,	// solids resident in the shared vcollide cache
+	PHYSCOLLISION_STAT_VCOLLIDE_SHARED_REFS,		// loads satisfied by an already resident solid
+	PHYSCOLLISION_STAT_VCOLLIDE_RESIDENT_BYTES,		// serialized size of the resident solids
+	PHYSCOLLISION_STAT_VCOLLIDE_SAVED_BYTES,		// bytes not duplicated because solids are shared
+	PHYSCOLLISION_STAT_VCOLLIDE_LOAD_USEC,			// time spent unserializing unique solids
+	PHYSCOLLISION_STAT_VCOLLIDE_SAVED_USEC,			// estimated unserialize time avoided by sharing
+};
+
 // this can be used to post-process a collision model
 abstract_class ICollisionQuery
 {
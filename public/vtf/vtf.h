@@ -172,6 +172,17 @@ enum LookDir_t
 //-----------------------------------------------------------------------------
 #define IMAGE_FORMAT_DEFAULT	((ImageFormat)-2)
 
+//-----------------------------------------------------------------------------
+// Random access to the bytes of a VTF file, used by UnserializeFromReader
+// to pull in only the mip levels it keeps
+//-----------------------------------------------------------------------------
+abstract_class IVTFRangeReader
+{
+public:
+	// Reads nSize bytes starting at nOffset into pDest, returns the number of bytes read
+	virtual int ReadRange( void *pDest, int nOffset, int nSize ) = 0;
+};
+
 //-----------------------------------------------------------------------------
 // Interface to get at various bits of a VTF texture
 //-----------------------------------------------------------------------------
@@ -360,6 +371,11 @@ public:
 	// Data is included in [ finest, coarsest ] mips--other ranges have garbage. This is particularly useful for 
 	// streaming textures.
 	virtual void GetMipmapRange( int* pOutFinest, int* pOutCoarsest ) = 0;
+
+	// Like UnserializeEx, but headerBuf only needs the header + resource dictionary (VTFFileHeaderSize bytes);
+	// the rest is read through pReader, and the image data goes straight into the texture one mip level
+	// at a time, coarsest first, without ever touching the skipped levels.
+	virtual bool UnserializeFromReader( CUtlBuffer &headerBuf, IVTFRangeReader *pReader, int nForceFlags = 0, int nSkipMipLevels = 0 ) = 0;
 };
 
 //-----------------------------------------------------------------------------
@@ -368,6 +384,14 @@ public:
 IVTFTexture *CreateVTFTexture();
 void DestroyVTFTexture( IVTFTexture *pTexture );
 
+//-----------------------------------------------------------------------------
+// Lets tools spread GenerateMipmaps and ConvertImageFormat over the vstdlib
+// thread pool. Output is byte-identical to the serial path; bVerify also runs
+// the serial path and warns if the two ever disagree.
+//-----------------------------------------------------------------------------
+void VTFSetThreadedProcessing( bool bEnable, bool bVerify = false );
+bool VTFIsThreadedProcessingEnabled();
+
 //-----------------------------------------------------------------------------
 // Allows us to only load in the first little bit of the VTF file to get info
 // Clients should read this much into a UtlBuffer and then pass it in to
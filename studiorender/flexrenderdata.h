@@ -185,6 +185,7 @@ private:
 	CacheIndex_t*	m_pFirstWorldIndex;
 
 	friend class CStudioRender;
+	friend class CFlexBenchmark;
 };
 
 
@@ -22,6 +22,11 @@
 #include "tier1/convar.h"
 #include "tier1/KeyValues.h"
 #include "tier0/vprof.h"
+#include "datacache/imdlcache.h"
+#include "mathlib/ssemath.h"
+#include "vstdlib/jobthread.h"
+#include "vstdlib/random.h"
+#include "tier1/kernelbenchmark.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -196,10 +201,17 @@ float CStudioRender::RampFlexWeight( mstudioflex_t &flex, float w )
 	return w;
 }
 
+static ConVar r_flex_threaded( "r_flex_threaded", "1", 0, "Accumulate software flex deltas of heavily flexed meshes on the thread pool" );
+
+// Below this many deltas per mesh job overhead outweighs the parallel accumulation
+#define FLEX_THREADED_MIN_DELTAS		2048
+#define FLEX_ACCUMULATE_BATCH_VERTS		256
+
 //-----------------------------------------------------------------------------
 // Setup the flex verts for this rendering
+// nThreaded: -1 follows r_flex_threaded, 0/1 forces serial/threaded accumulation
 //-----------------------------------------------------------------------------
-void CStudioRender::R_StudioFlexVerts( mstudiomesh_t *pmesh, int lod )
+void CStudioRender::R_StudioFlexVerts( mstudiomesh_t *pmesh, int lod, int nThreaded )
 {
 	VPROF_BUDGET( "CStudioRender::R_StudioFlexVerts", VPROF_BUDGETGROUP_MODEL_RENDERING );
 
@@ -253,10 +265,30 @@ void CStudioRender::R_StudioFlexVerts( mstudiomesh_t *pmesh, int lod )
 	
 	m_VertexCache.SetupComputation( pmesh, true );
 
-	// apply flex weights
-	int i, j, n;
+	// Flexed verts created for this mesh are appended after those of earlier meshes
+	const int nFirstFlexVertex = m_VertexCache.m_FlexVertexCount;
+	const int nLODVertexCount = pmesh->vertexdata.numLODVertexes[lod];
+
+	int nMaxDeltas = 0;
+	for ( int i = 0; i < pmesh->numflexes; i++ )
+	{
+		nMaxDeltas += pflex[i].numverts;
+	}
+
+	m_FlexDeltaVertex.SetCount( nMaxDeltas );
+	m_FlexDeltaAnim.SetCount( nMaxDeltas );
+	m_FlexDeltaWeight.SetCount( nMaxDeltas );
+	m_FlexDeltaSide.SetCount( nMaxDeltas );
+
+	int *pDeltaVertex = m_FlexDeltaVertex.Base();
+	mstudiovertanim_t **ppDeltaAnim = m_FlexDeltaAnim.Base();
+	float *pDeltaWeight = m_FlexDeltaWeight.Base();
+	float *pDeltaSide = m_FlexDeltaSide.Base();
+	int nDeltaCount = 0;
 
-	for (i = 0; i < pmesh->numflexes; i++)
+	// Gather the deltas of each active flex. Flexed verts are created in the same order
+	// as the old per-delta loop, so the flex vertex list (and overflow behaviour) is unchanged
+	for ( int i = 0; i < pmesh->numflexes; i++ )
 	{
 		float w1 = RampFlexWeight( pflex[i], m_pFlexWeights[ pflex[i].flexdesc ] );
 		float w2 = RampFlexWeight( pflex[i], m_pFlexDelayedWeights[ pflex[i].flexdesc ] );
@@ -285,62 +317,291 @@ void CStudioRender::R_StudioFlexVerts( mstudiomesh_t *pmesh, int lod )
 		// we're going to ignore it.
 		byte *pvanim = pflex[i].pBaseVertanim();
 		int nVAnimSizeBytes = pflex[i].VertAnimSizeBytes();
+		int nFirstDelta = nDeltaCount;
 
-		for (j = 0; j < pflex[i].numverts; j++)
+		for ( int j = 0; j < pflex[i].numverts; j++ )
 		{
 			mstudiovertanim_t *pAnim = (mstudiovertanim_t*)( pvanim + j * nVAnimSizeBytes );
-			n = pAnim->index;
+			int n = pAnim->index;
 
 			// Only flex the indices that are (still) part of this mesh
 			// need lod restriction here
-			if (n < pmesh->vertexdata.numLODVertexes[lod])
+			if ( n >= nLODVertexCount )
+				continue;
+
+			CachedPosNormTan_t* pFlexedVertex;
+			if (!m_VertexCache.IsVertexFlexed(n))
 			{
+				// Add a new flexed vert to the flexed vertex list
+				pFlexedVertex = m_VertexCache.CreateFlexVertex(n);
+				// skip processing if no more flexed verts can be allocated
+				if (pFlexedVertex == NULL)
+					continue;
+
 				mstudiovertex_t &vert = pVertices[n];
+				VectorCopy( vert.m_vecPosition, pFlexedVertex->m_Position );
+				VectorCopy( vert.m_vecNormal, pFlexedVertex->m_Normal );
 
-				CachedPosNormTan_t* pFlexedVertex;
-				if (!m_VertexCache.IsVertexFlexed(n))
+				if (pStudioTangentS)
 				{
-					// Add a new flexed vert to the flexed vertex list
-					pFlexedVertex = m_VertexCache.CreateFlexVertex(n);
-					// skip processing if no more flexed verts can be allocated
-					if (pFlexedVertex == NULL)
-						continue;
-
-					VectorCopy( vert.m_vecPosition, pFlexedVertex->m_Position );
-					VectorCopy( vert.m_vecNormal, pFlexedVertex->m_Normal );
-
-					if (pStudioTangentS)
-					{
-						Vector4DCopy( pStudioTangentS[n], pFlexedVertex->m_TangentS );
-						Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
-					}
-				}
-				else
-				{
-					pFlexedVertex = m_VertexCache.GetFlexVertex(n);
+					Vector4DCopy( pStudioTangentS[n], pFlexedVertex->m_TangentS );
+					Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
 				}
+			}
+			else
+			{
+				pFlexedVertex = m_VertexCache.GetFlexVertex(n);
+			}
 
-				float s = pAnim->speed * (1.0F/255.0F);
-				float b = pAnim->side * (1.0F/255.0F);
+			pDeltaVertex[nDeltaCount] = pFlexedVertex - &m_VertexCache.m_pFlexVerts[nFirstFlexVertex];
+			ppDeltaAnim[nDeltaCount] = pAnim;
+			pDeltaWeight[nDeltaCount] = pAnim->speed * (1.0F/255.0F);
+			pDeltaSide[nDeltaCount] = pAnim->side * (1.0F/255.0F);
+			++nDeltaCount;
+		}
 
-				float w = (w1 * s + (1.0f - s) * w2) * (1.0f - b) + b * (w3 * s + (1.0f - s) * w4);
+		// Blend the speed/side weights four deltas at a time; the tail uses the
+		// same expression so serial and SIMD weights are bit-identical
+		// w = (w1 * s + (1 - s) * w2) * (1 - b) + b * (w3 * s + (1 - s) * w4)
+		fltx4 fl4W1 = ReplicateX4( w1 );
+		fltx4 fl4W2 = ReplicateX4( w2 );
+		fltx4 fl4W3 = ReplicateX4( w3 );
+		fltx4 fl4W4 = ReplicateX4( w4 );
 
-				// Accumulate weighted deltas
-				pFlexedVertex->m_Position += pAnim->GetDeltaFixed( flVertAnimFixedPointScale ) * w;
-				pFlexedVertex->m_Normal += pAnim->GetNDeltaFixed( flVertAnimFixedPointScale ) * w;
+		int d = nFirstDelta;
+		for ( ; d + 4 <= nDeltaCount; d += 4 )
+		{
+			fltx4 s = LoadUnalignedSIMD( &pDeltaWeight[d] );
+			fltx4 b = LoadUnalignedSIMD( &pDeltaSide[d] );
+			fltx4 oneMinusS = SubSIMD( Four_Ones, s );
+			fltx4 wa = AddSIMD( MulSIMD( fl4W1, s ), MulSIMD( oneMinusS, fl4W2 ) );
+			fltx4 wb = AddSIMD( MulSIMD( fl4W3, s ), MulSIMD( oneMinusS, fl4W4 ) );
+			fltx4 w = AddSIMD( MulSIMD( wa, SubSIMD( Four_Ones, b ) ), MulSIMD( b, wb ) );
+			StoreUnalignedSIMD( &pDeltaWeight[d], w );
+		}
+		for ( ; d < nDeltaCount; ++d )
+		{
+			float s = pDeltaWeight[d];
+			float b = pDeltaSide[d];
+			pDeltaWeight[d] = (w1 * s + (1.0f - s) * w2) * (1.0f - b) + b * (w3 * s + (1.0f - s) * w4);
+		}
+	}
 
-				if ( pStudioTangentS )
-				{
-					pFlexedVertex->m_TangentS.AsVector3D() += pAnim->GetNDeltaFixed( flVertAnimFixedPointScale ) * w;
-					Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
-				}
+	const int nFlexedVertexCount = m_VertexCache.m_FlexVertexCount - nFirstFlexVertex;
+	if ( nDeltaCount > 0 )
+	{
+		// Bucket the deltas by flexed vertex (a stable counting sort), so each vertex sums
+		// its deltas in flex order exactly like the serial loop did, but touches memory once
+		m_FlexVertexFirstDelta.SetCount( nFlexedVertexCount + 1 );
+		m_FlexSortedAnim.SetCount( nDeltaCount );
+		m_FlexSortedWeight.SetCount( nDeltaCount );
+
+		int *pFirstDelta = m_FlexVertexFirstDelta.Base();
+		V_memset( pFirstDelta, 0, ( nFlexedVertexCount + 1 ) * sizeof(int) );
+		for ( int d = 0; d < nDeltaCount; ++d )
+		{
+			++pFirstDelta[ pDeltaVertex[d] + 1 ];
+		}
+		for ( int v = 0; v < nFlexedVertexCount; ++v )
+		{
+			pFirstDelta[v + 1] += pFirstDelta[v];
+		}
+
+		mstudiovertanim_t **ppSortedAnim = m_FlexSortedAnim.Base();
+		float *pSortedWeight = m_FlexSortedWeight.Base();
+		for ( int d = 0; d < nDeltaCount; ++d )
+		{
+			int nSlot = pFirstDelta[ pDeltaVertex[d] ]++;
+			ppSortedAnim[nSlot] = ppDeltaAnim[d];
+			pSortedWeight[nSlot] = pDeltaWeight[d];
+		}
+
+		// Each start was advanced to the next vertex's start; shift them back
+		for ( int v = nFlexedVertexCount; v > 0; --v )
+		{
+			pFirstDelta[v] = pFirstDelta[v - 1];
+		}
+		pFirstDelta[0] = 0;
+
+		FlexAccumulateBatch_t batch;
+		batch.m_pFlexVerts = &m_VertexCache.m_pFlexVerts[nFirstFlexVertex];
+		batch.m_flFixedPointScale = flVertAnimFixedPointScale;
+		batch.m_bHasTangentData = ( pStudioTangentS != NULL );
+
+		bool bThreaded = ( nThreaded >= 0 ) ? ( nThreaded != 0 ) : r_flex_threaded.GetBool();
+		bThreaded = bThreaded && ( nDeltaCount >= FLEX_THREADED_MIN_DELTAS ) && g_pThreadPool && ( g_pThreadPool->NumIdleThreads() > 0 );
+		if ( bThreaded )
+		{
+			m_FlexBatches.RemoveAll();
+			for ( int v = 0; v < nFlexedVertexCount; v += FLEX_ACCUMULATE_BATCH_VERTS )
+			{
+				batch.m_nFirstVertex = v;
+				batch.m_nVertexCount = MIN( FLEX_ACCUMULATE_BATCH_VERTS, nFlexedVertexCount - v );
+				m_FlexBatches.AddToTail( batch );
 			}
+			ParallelProcess( "CStudioRender::AccumulateFlexDeltas", m_FlexBatches.Base(), m_FlexBatches.Count(), this, &CStudioRender::AccumulateFlexDeltas );
+		}
+		else
+		{
+			batch.m_nFirstVertex = 0;
+			batch.m_nVertexCount = nFlexedVertexCount;
+			AccumulateFlexDeltas( batch );
 		}
 	}
 
 	m_VertexCache.RenormalizeFlexVertices( vertData->HasTangentData() );
 }
 
+//-----------------------------------------------------------------------------
+// Sums the bucketed, pre-weighted deltas into a run of flexed vertices.
+// Only reads shared scratch and writes its own vertices, so batches may run in parallel
+//-----------------------------------------------------------------------------
+void CStudioRender::AccumulateFlexDeltas( FlexAccumulateBatch_t &batch )
+{
+	const int *pFirstDelta = m_FlexVertexFirstDelta.Base();
+	mstudiovertanim_t * const *ppAnim = m_FlexSortedAnim.Base();
+	const float *pWeight = m_FlexSortedWeight.Base();
+	const float flScale = batch.m_flFixedPointScale;
+
+	int nEnd = batch.m_nFirstVertex + batch.m_nVertexCount;
+	for ( int v = batch.m_nFirstVertex; v < nEnd; ++v )
+	{
+		CachedPosNormTan_t *pFlexedVertex = &batch.m_pFlexVerts[v];
+
+		fltx4 vPosition = LoadUnaligned3SIMD( pFlexedVertex->m_Position.Base() );
+		fltx4 vNormal = LoadUnaligned3SIMD( pFlexedVertex->m_Normal.Base() );
+		fltx4 vTangentS = LoadUnaligned3SIMD( pFlexedVertex->m_TangentS.Base() );
+
+		for ( int d = pFirstDelta[v]; d < pFirstDelta[v + 1]; ++d )
+		{
+			Vector4DAligned vDelta, vNDelta;
+			ppAnim[d]->GetDeltaFixed4DAligned( &vDelta, flScale );
+			ppAnim[d]->GetNDeltaFixed4DAligned( &vNDelta, flScale );
+
+			// Accumulate weighted deltas (tangents use the normal deltas)
+			fltx4 w = ReplicateX4( pWeight[d] );
+			fltx4 vNDeltaWeighted = MulSIMD( LoadAlignedSIMD( vNDelta.Base() ), w );
+			vPosition = AddSIMD( vPosition, MulSIMD( LoadAlignedSIMD( vDelta.Base() ), w ) );
+			vNormal = AddSIMD( vNormal, vNDeltaWeighted );
+			vTangentS = AddSIMD( vTangentS, vNDeltaWeighted );
+		}
+
+		// 3-wide stores leave the tangent's handedness in w untouched
+		StoreUnaligned3SIMD( pFlexedVertex->m_Position.Base(), vPosition );
+		StoreUnaligned3SIMD( pFlexedVertex->m_Normal.Base(), vNormal );
+		if ( batch.m_bHasTangentData )
+		{
+			StoreUnaligned3SIMD( pFlexedVertex->m_TangentS.Base(), vTangentS );
+			Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Flexes the default submodels of a model with random (but repeatable) weights,
+// serial (mode 0) and threaded (mode 1). Runs on a private instance so it can't
+// race the render thread's vertex cache. One iteration flexes the whole model.
+//-----------------------------------------------------------------------------
+class CFlexBenchmark : public CKernelBenchmark< CachedPosNormTan_t >
+{
+public:
+	CFlexBenchmark( studiohdr_t *pStudioHdr ) : CKernelBenchmark< CachedPosNormTan_t >( 0x464c4558 ), m_pStudioHdr( pStudioHdr )
+	{
+		m_FlexWeights.SetCount( pStudioHdr->numflexdesc );
+		m_FlexDelayedWeights.SetCount( pStudioHdr->numflexdesc );
+		for ( int i = 0; i < pStudioHdr->numflexdesc; ++i )
+		{
+			m_FlexWeights[i] = m_Random.RandomFloat( 0.0f, 1.0f );
+			m_FlexDelayedWeights[i] = m_Random.RandomFloat( 0.0f, 1.0f );
+		}
+
+		m_pRender = new CStudioRender;
+		m_pRender->m_pStudioHdr = pStudioHdr;
+		m_pRender->m_pFlexWeights = m_FlexWeights.Base();
+		m_pRender->m_pFlexDelayedWeights = m_FlexDelayedWeights.Base();
+	}
+
+	~CFlexBenchmark()
+	{
+		delete m_pRender;
+	}
+
+	int GetFlexVertexCount() const { return m_pRender->m_VertexCache.m_FlexVertexCount; }
+
+protected:
+	virtual void RunIteration( int nMode, int nIteration )
+	{
+		m_pRender->m_VertexCache.StartModel();
+		for ( int nBodyPart = 0; nBodyPart < m_pStudioHdr->numbodyparts; ++nBodyPart )
+		{
+			// Only the default submodel, as drawing body 0 would
+			mstudiomodel_t *pSubModel = m_pStudioHdr->pBodypart( nBodyPart )->pModel( 0 );
+			m_pRender->m_VertexCache.SetBodyPart( nBodyPart );
+			m_pRender->m_VertexCache.SetModel( 0 );
+			for ( int nMesh = 0; nMesh < pSubModel->nummeshes; ++nMesh )
+			{
+				mstudiomesh_t *pMesh = pSubModel->pMesh( nMesh );
+				if ( pMesh->numflexes == 0 )
+					continue;
+
+				m_pRender->m_VertexCache.SetMesh( nMesh );
+				m_pRender->R_StudioFlexVerts( pMesh, 0, nMode );
+			}
+		}
+	}
+
+	virtual void EndMode( int nMode )
+	{
+		m_Output[nMode].CopyArray( m_pRender->m_VertexCache.m_pFlexVerts, m_pRender->m_VertexCache.m_FlexVertexCount );
+	}
+
+private:
+	studiohdr_t *m_pStudioHdr;
+	CStudioRender *m_pRender;
+	CUtlVector< float > m_FlexWeights;
+	CUtlVector< float > m_FlexDelayedWeights;
+};
+
+CON_COMMAND_F( r_flex_benchmark, "Times software flexing of a model, serial vs. threaded: r_flex_benchmark [model] [iterations]", FCVAR_CHEAT )
+{
+	const char *pModelName = ( args.ArgC() > 1 ) ? args[1] : "models/alyx.mdl";
+	int nIterations = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 1000;
+
+	MDLHandle_t hModel = g_pMDLCache->FindMDL( pModelName );
+	if ( hModel == MDLHANDLE_INVALID )
+	{
+		Warning( "r_flex_benchmark: couldn't find %s\n", pModelName );
+		return;
+	}
+
+	studiohdr_t *pStudioHdr = g_pMDLCache->GetStudioHdr( hModel );
+	if ( !pStudioHdr || g_pMDLCache->IsErrorModel( hModel ) )
+	{
+		Warning( "r_flex_benchmark: couldn't load %s\n", pModelName );
+	}
+	else if ( pStudioHdr->numflexdesc == 0 )
+	{
+		Warning( "r_flex_benchmark: %s has no flexes\n", pModelName );
+	}
+	else
+	{
+		static const char *s_pModeName[2] = { "serial", "threaded" };
+
+		CFlexBenchmark benchmark( pStudioHdr );
+		benchmark.Run( 2, nIterations );
+
+		Msg( "r_flex_benchmark: %s, %d flexed verts, %d iterations, %d idle threads\n",
+			pStudioHdr->pszName(), benchmark.GetFlexVertexCount(), nIterations, g_pThreadPool ? g_pThreadPool->NumIdleThreads() : 0 );
+		for ( int nMode = 0; nMode < 2; ++nMode )
+		{
+			Msg( "  %-8s %9.2f ms total, %8.2f us/model\n", s_pModeName[nMode], benchmark.GetTime( nMode ) * 1000.0f, benchmark.GetTime( nMode ) * 1000000.0f / nIterations );
+		}
+		Msg( "  threaded results %s serial\n", benchmark.OutputMatches() ? "match" : "DIFFER from" );
+	}
+
+	g_pMDLCache->Release( hModel );
+}
+
 // REMOVED!!  Look in version 32 if you need it.
 //static void R_StudioEyeballNormals( const mstudioeyeball_t *peyeball, int count, const Vector *psrcverts, Vector *pdestnorms )
 
@@ -558,7 +558,18 @@ private:
 	void RemoveDecalListFromLRU( StudioDecalHandle_t h );
 
 	// Helper methods related to flexing vertices
-	void R_StudioFlexVerts( mstudiomesh_t *pmesh, int lod );
+	void R_StudioFlexVerts( mstudiomesh_t *pmesh, int lod, int nThreaded = -1 );
+
+	// A run of flexed vertices (relative to the mesh's first flexed vertex) accumulated by one job
+	struct FlexAccumulateBatch_t
+	{
+		CachedPosNormTan_t *m_pFlexVerts;
+		int m_nFirstVertex;
+		int m_nVertexCount;
+		float m_flFixedPointScale;
+		bool m_bHasTangentData;
+	};
+	void AccumulateFlexDeltas( FlexAccumulateBatch_t &batch );
 
 	// Flex stats
 	void GetFlexStats( );
@@ -632,6 +643,17 @@ private:
 	// Flex data
 	CCachedRenderData	m_VertexCache;
 
+	// Software flex scratch, reused from mesh to mesh. Deltas are gathered flex by flex,
+	// then bucketed per flexed vertex (keeping flex order) for accumulation
+	CUtlVector< int >					m_FlexDeltaVertex;
+	CUtlVector< mstudiovertanim_t* >	m_FlexDeltaAnim;
+	CUtlVector< float >					m_FlexDeltaWeight;
+	CUtlVector< float >					m_FlexDeltaSide;
+	CUtlVector< int >					m_FlexVertexFirstDelta;
+	CUtlVector< mstudiovertanim_t* >	m_FlexSortedAnim;
+	CUtlVector< float >					m_FlexSortedWeight;
+	CUtlVector< FlexAccumulateBatch_t >	m_FlexBatches;
+
 	// Cached variables:
 	bool m_bSkippedMeshes : 1;
 	bool m_bDrawTranslucentSubModels : 1;
@@ -642,6 +664,7 @@ private:
 	friend class CGlintTextureRegenerator;
 	friend struct mstudiomodel_t;
 	friend class CStudioRenderContext;
+	friend class CFlexBenchmark;
 };
 
 
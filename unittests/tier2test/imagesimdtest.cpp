@@ -0,0 +1,213 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Checks the bitmap library's SIMD image kernels against its scalar
+//			loops at sizes that leave the SIMD loops a tail to hand off
+//
+//=============================================================================//
+
+#include "tier0/dbg.h"
+#include "unitlib/unitlib.h"
+#include "tier1/utlvector.h"
+#include "bitmap/imageformat.h"
+
+DEFINE_TESTSUITE( ImageSIMDTestSuite )
+
+// Odd, non-multiple-of-4 and 1-3 pixel rows, plus a few sizes the SIMD loops cover exactly
+static const int s_nWidths[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 13, 15, 16, 17, 31, 33 };
+static const int s_nHeights[] = { 1, 2, 3, 5, 8 };
+
+// Bytes past the end of each output that no kernel may write
+static const int IMAGE_GUARD_BYTES = 64;
+
+static const ImageFormat s_ConversionFormats[][2] =
+{
+	{ IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGRA8888 },
+	{ IMAGE_FORMAT_BGRA8888,		IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_BGRX8888,		IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_RGB888,			IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_BGR888,			IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGR888 },
+	{ IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGR565 },
+	{ IMAGE_FORMAT_BGR565,			IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGRA4444 },
+	{ IMAGE_FORMAT_BGRA4444,		IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_RGBA8888,		IMAGE_FORMAT_BGRA5551 },
+	{ IMAGE_FORMAT_BGRA5551,		IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_I8,				IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_IA88,			IMAGE_FORMAT_RGBA8888 },
+	{ IMAGE_FORMAT_RGBA16161616,	IMAGE_FORMAT_RGBA8888 },
+};
+
+//-----------------------------------------------------------------------------
+// Source pixels: a fixed pseudo random sequence, so failures reproduce
+//-----------------------------------------------------------------------------
+static void FillSourceImage( CUtlVector< unsigned char > &src, int nBytes )
+{
+	src.SetCount( nBytes );
+	unsigned int nSeed = 0x494d47;
+	for ( int i = 0; i < nBytes; ++i )
+	{
+		nSeed = nSeed * 1103515245 + 12345;
+		src[i] = (unsigned char)( nSeed >> 16 );
+	}
+}
+
+static void PrepareOutput( CUtlVector< unsigned char > &dst, int nBytes )
+{
+	dst.SetCount( nBytes + IMAGE_GUARD_BYTES );
+	V_memset( dst.Base(), 0xCD, dst.Count() );
+}
+
+static bool GuardIntact( const CUtlVector< unsigned char > &dst, int nBytes )
+{
+	for ( int i = nBytes; i < dst.Count(); ++i )
+	{
+		if ( dst[i] != 0xCD )
+			return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Compares the scalar (index 0) and SIMD (index 1) outputs of one kernel run
+//-----------------------------------------------------------------------------
+static bool CheckOutputs( const char *pKernel, int nWidth, int nHeight, const CUtlVector< unsigned char > *pDst, int nBytes )
+{
+	bool bMatch = !V_memcmp( pDst[0].Base(), pDst[1].Base(), nBytes );
+	bool bGuard = GuardIntact( pDst[0], nBytes ) && GuardIntact( pDst[1], nBytes );
+	if ( !bMatch )
+	{
+		Warning( "%s %dx%d: SIMD output differs from scalar\n", pKernel, nWidth, nHeight );
+	}
+	if ( !bGuard )
+	{
+		Warning( "%s %dx%d: wrote past the end of the image\n", pKernel, nWidth, nHeight );
+	}
+	return bMatch && bGuard;
+}
+
+static void ConversionTests()
+{
+	CUtlVector< unsigned char > src;
+	CUtlVector< unsigned char > dst[2];
+
+	for ( int f = 0; f < ARRAYSIZE( s_ConversionFormats ); ++f )
+	{
+		ImageFormat srcFormat = s_ConversionFormats[f][0];
+		ImageFormat dstFormat = s_ConversionFormats[f][1];
+
+		char pKernel[64];
+		V_snprintf( pKernel, sizeof( pKernel ), "%s -> %s", ImageLoader::GetName( srcFormat ), ImageLoader::GetName( dstFormat ) );
+
+		for ( int w = 0; w < ARRAYSIZE( s_nWidths ); ++w )
+		{
+			for ( int h = 0; h < ARRAYSIZE( s_nHeights ); ++h )
+			{
+				int nWidth = s_nWidths[w];
+				int nHeight = s_nHeights[h];
+				int nDstBytes = ImageLoader::GetMemRequired( nWidth, nHeight, 1, dstFormat, false );
+				FillSourceImage( src, ImageLoader::GetMemRequired( nWidth, nHeight, 1, srcFormat, false ) );
+
+				for ( int nMode = 0; nMode < 2; ++nMode )
+				{
+					ImageLoader::EnableImageSIMD( nMode != 0 );
+					PrepareOutput( dst[nMode], nDstBytes );
+					Shipping_Assert( ImageLoader::ConvertImageFormat( src.Base(), srcFormat, dst[nMode].Base(), dstFormat, nWidth, nHeight ) );
+				}
+
+				Shipping_Assert( CheckOutputs( pKernel, nWidth, nHeight, dst, nDstBytes ) );
+			}
+		}
+	}
+}
+
+static void MipmapTests()
+{
+	CUtlVector< unsigned char > src;
+	CUtlVector< unsigned char > dst[2];
+
+	for ( int w = 0; w < ARRAYSIZE( s_nWidths ); ++w )
+	{
+		for ( int h = 0; h < ARRAYSIZE( s_nHeights ); ++h )
+		{
+			int nWidth = s_nWidths[w];
+			int nHeight = s_nHeights[h];
+
+			// GenerateMipmapLevelsLQ always writes at least one level below the top one
+			if ( nWidth == 1 && nHeight == 1 )
+				continue;
+
+			int nDstBytes = ImageLoader::GetMemRequired( nWidth, nHeight, 1, IMAGE_FORMAT_RGBA8888, true );
+			FillSourceImage( src, ImageLoader::GetMemRequired( nWidth, nHeight, 1, IMAGE_FORMAT_RGBA8888, false ) );
+
+			for ( int nMode = 0; nMode < 2; ++nMode )
+			{
+				ImageLoader::EnableImageSIMD( nMode != 0 );
+				PrepareOutput( dst[nMode], nDstBytes );
+				ImageLoader::GenerateMipmapLevelsLQ( src.Base(), dst[nMode].Base(), nWidth, nHeight, IMAGE_FORMAT_RGBA8888, 0 );
+			}
+
+			Shipping_Assert( CheckOutputs( "mipmaps (LQ box)", nWidth, nHeight, dst, nDstBytes ) );
+		}
+	}
+}
+
+static void ResampleTests()
+{
+	// ResampleRGBA8888 only downsamples power of two images
+	static const int s_nSizes[] = { 1, 2, 4, 8, 16 };
+	static const int s_nFlags[] = { 0, ImageLoader::RESAMPLE_NICE_FILTER, ImageLoader::RESAMPLE_NORMALMAP };
+
+	CUtlVector< unsigned char > src;
+	CUtlVector< unsigned char > dst[2];
+
+	for ( int f = 0; f < ARRAYSIZE( s_nFlags ); ++f )
+	{
+		for ( int w = 1; w < ARRAYSIZE( s_nSizes ); ++w )
+		{
+			for ( int h = 0; h < ARRAYSIZE( s_nSizes ); ++h )
+			{
+				ImageLoader::ResampleInfo_t info;
+				info.m_nSrcWidth = s_nSizes[w];
+				info.m_nSrcHeight = s_nSizes[h];
+				info.m_nDestWidth = s_nSizes[w] / 2;
+				info.m_nDestHeight = MAX( 1, s_nSizes[h] / 2 );
+				info.m_flSrcGamma = info.m_flDestGamma = 2.2f;
+				info.m_nFlags = s_nFlags[f];
+
+				int nDstBytes = info.m_nDestWidth * info.m_nDestHeight * 4;
+				FillSourceImage( src, info.m_nSrcWidth * info.m_nSrcHeight * 4 );
+				info.m_pSrc = src.Base();
+
+				for ( int nMode = 0; nMode < 2; ++nMode )
+				{
+					ImageLoader::EnableImageSIMD( nMode != 0 );
+					PrepareOutput( dst[nMode], nDstBytes );
+					info.m_pDest = dst[nMode].Base();
+					Shipping_Assert( ImageLoader::ResampleRGBA8888( info ) );
+				}
+
+				Shipping_Assert( CheckOutputs( "resample 1/2", info.m_nSrcWidth, info.m_nSrcHeight, dst, nDstBytes ) );
+			}
+		}
+	}
+}
+
+DEFINE_TESTCASE( ImageSIMDTest, ImageSIMDTestSuite )
+{
+	Msg( "Running image SIMD kernel tests\n" );
+
+	bool bWasEnabled = ImageLoader::EnableImageSIMD( true );
+	if ( !ImageLoader::IsImageSIMDEnabled() )
+	{
+		Msg( "No SIMD image kernels on this CPU/build, skipping\n" );
+		ImageLoader::EnableImageSIMD( bWasEnabled );
+		return;
+	}
+
+	ConversionTests();
+	MipmapTests();
+	ResampleTests();
+
+	ImageLoader::EnableImageSIMD( bWasEnabled );
+}
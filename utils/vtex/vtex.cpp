@@ -47,8 +47,15 @@
 
 #include "tier2/tier2.h"
 #include "tier1/checksum_crc.h"
+#include "tier1/utlstring.h"
+#include "tier1/utlvector.h"
+#include "vstdlib/jobthread.h"
 #include "imageutils.h"
 
+#ifdef POSIX
+#include <dirent.h>
+#endif
+
 #define FF_TRYAGAIN 1
 #define FF_DONTPROCESS 2
 
@@ -71,6 +78,12 @@ static bool g_bUsedAsLaunchableDLL = false;
 
 static char g_ForcedOutputDir[MAX_PATH];
 
+static bool g_bThreaded = true;
+static bool g_bVerifyThreads = false;
+static int g_nThreads = -1;
+static const char *g_pBatchDir = NULL;
+static const char *g_pBatchExt = "tga";
+
 
 #define MAX_VMT_PARAMS	16
 
@@ -2279,6 +2292,11 @@ void Usage( void )
 		"-quickconvert     : use with \"-dontusegamedir -quickconvert\" to upgrade old .vmt files\n"
 		"-crcvalidate      : validate .vmt against the sources\n"
 		"-crcforce         : generate a new .vmt even if sources crc matches\n"
+		"-threads n        : number of worker threads for mip generation and compression\n"
+		"-nothreads        : process every texture on the main thread only\n"
+		"-verifythreads    : also run the serial path and warn if the output differs\n"
+		"-batchdir dir     : convert every source file under dir (recursively)\n"
+		"-batchext ext     : source extension used by -batchdir (default tga)\n"
 		"\teg: -vmtparam $ignorez 1 -vmtparam $translucent 1\n"
 		"Note that you can use wildcards and that you can also chain them\n"
 		"e.g. materialsrc/monster1/*.tga materialsrc/monster2/*.tga\n" );
@@ -2399,6 +2417,73 @@ int Find_Files( WIN32_FIND_DATA &wfd, HANDLE &hResult, const char *basedir, cons
 }
 #endif
 
+//-----------------------------------------------------------------------------
+// Collects every source file with the given extension under a directory
+//-----------------------------------------------------------------------------
+static void Find_BatchFiles( const char *pDir, const char *pExt, CUtlVector< CUtlString > &files );
+
+static void AddBatchEntry( const char *pDir, const char *pName, bool bIsDir, const char *pExt, CUtlVector< CUtlString > &files )
+{
+	// Skip . and .. along with hidden files
+	if ( pName[0] == '.' )
+		return;
+
+	char pPath[MAX_PATH];
+	Q_snprintf( pPath, sizeof(pPath), "%s/%s", pDir, pName );
+	if ( bIsDir )
+	{
+		Find_BatchFiles( pPath, pExt, files );
+		return;
+	}
+
+	const char *pFileExt = Q_GetFileExtension( pName );
+	if ( pFileExt && !Q_stricmp( pFileExt, pExt ) )
+	{
+		files.AddToTail( CUtlString( pPath ) );
+	}
+}
+
+static void Find_BatchFiles( const char *pDir, const char *pExt, CUtlVector< CUtlString > &files )
+{
+#ifdef WIN32
+	char pSearch[MAX_PATH];
+	Q_snprintf( pSearch, sizeof(pSearch), "%s\\*", pDir );
+
+	WIN32_FIND_DATA wfd;
+	HANDLE hFind = FindFirstFile( pSearch, &wfd );
+	if ( hFind == INVALID_HANDLE_VALUE )
+		return;
+
+	do
+	{
+		AddBatchEntry( pDir, wfd.cFileName, ( wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0, pExt, files );
+	} while ( FindNextFile( hFind, &wfd ) );
+
+	FindClose( hFind );
+#else
+	DIR *pDirHandle = opendir( pDir );
+	if ( !pDirHandle )
+		return;
+
+	while ( struct dirent *pEntry = readdir( pDirHandle ) )
+	{
+		char pPath[MAX_PATH];
+		Q_snprintf( pPath, sizeof(pPath), "%s/%s", pDir, pEntry->d_name );
+
+		struct _stat buf;
+		bool bIsDir = ( _stat( pPath, &buf ) != -1 ) && S_ISDIR( buf.st_mode );
+		AddBatchEntry( pDir, pEntry->d_name, bIsDir, pExt, files );
+	}
+
+	closedir( pDirHandle );
+#endif
+}
+
+static int CompareBatchFiles( const CUtlString *pA, const CUtlString *pB )
+{
+	return Q_stricmp( pA->Get(), pB->Get() );
+}
+
 bool Process_File( char *pInputBaseName, int maxlen )
 {
 	char outputDir[1024];
@@ -2702,6 +2787,12 @@ int CVTex::VTex( int argc, char **argv )
 		return -1;
 	}
 
+	g_bThreaded = true;
+	g_bVerifyThreads = false;
+	g_nThreads = -1;
+	g_pBatchDir = NULL;
+	g_pBatchExt = "tga";
+
 	g_UseGameDir = false; // make sure this is initialized to true.
 	bool bCreatedFilesystem = false;
 
@@ -2746,6 +2837,47 @@ int CVTex::VTex( int argc, char **argv )
 		{
 			i++;
 		}
+		else if ( stricmp( argv[i], "-nothreads" ) == 0 )
+		{
+			i++;
+			g_bThreaded = false;
+		}
+		else if ( stricmp( argv[i], "-verifythreads" ) == 0 )
+		{
+			i++;
+			g_bVerifyThreads = true;
+		}
+		else if ( stricmp( argv[i], "-threads" ) == 0 )
+		{
+			i++;
+			if ( i < argc )
+			{
+				g_nThreads = atoi( argv[i] );
+				i++;
+			}
+		}
+		else if ( stricmp( argv[i], "-batchdir" ) == 0 )
+		{
+			i++;
+			if ( i < argc )
+			{
+				g_pBatchDir = argv[i];
+				i++;
+			}
+		}
+		else if ( stricmp( argv[i], "-batchext" ) == 0 )
+		{
+			i++;
+			if ( i < argc )
+			{
+				g_pBatchExt = argv[i];
+				if ( g_pBatchExt[0] == '.' )
+				{
+					++g_pBatchExt;
+				}
+				i++;
+			}
+		}
 		else if( stricmp( argv[i], "-vmtparam" ) == 0 )
 		{
 			if( g_NumVMTParams < MAX_VMT_PARAMS )
@@ -2796,12 +2928,59 @@ int CVTex::VTex( int argc, char **argv )
 
 	if (g_UseGameDir && !g_pFileSystem)
 	{
-		FileSystem_Init( argv[i] );
+		// gameinfo.txt is searched for above the first input file. A -batchdir run may have
+		// none, so use the batch directory then; NULL falls back to the current directory.
+		char pBatchDirPath[MAX_PATH];
+		const char *pGameInfoSearchPath = NULL;
+		if ( i < argc )
+		{
+			pGameInfoSearchPath = argv[i];
+		}
+		else if ( g_pBatchDir )
+		{
+			V_strcpy_safe( pBatchDirPath, g_pBatchDir );
+			V_AppendSlash( pBatchDirPath, sizeof( pBatchDirPath ) );
+			pGameInfoSearchPath = pBatchDirPath;
+		}
+
+		FileSystem_Init( pGameInfoSearchPath );
 		bCreatedFilesystem = true;
 
 		Q_FixSlashes( gamedir, '/' );
 	}
 
+	// Every texture shares one worker pool for its mips, faces and DXT block rows
+	bool bStartedThreadPool = false;
+	if ( g_bThreaded && ( g_nThreads != 0 ) && g_pThreadPool )
+	{
+		if ( g_pThreadPool->NumThreads() == 0 )
+		{
+			ThreadPoolStartParams_t startParams;
+			startParams.nThreads = g_nThreads;
+			bStartedThreadPool = g_pThreadPool->Start( startParams, "VTex" );
+		}
+		VTFSetThreadedProcessing( g_pThreadPool->NumThreads() > 0, g_bVerifyThreads );
+	}
+
+	if ( g_pBatchDir )
+	{
+		CUtlVector< CUtlString > batchFiles;
+		Find_BatchFiles( g_pBatchDir, g_pBatchExt, batchFiles );
+		batchFiles.Sort( CompareBatchFiles );
+
+		if ( !g_Quiet )
+		{
+			printf( "batch: %d .%s file(s) under %s\n", batchFiles.Count(), g_pBatchExt, g_pBatchDir );
+		}
+
+		for ( int k = 0; k < batchFiles.Count(); ++k )
+		{
+			char pInputBaseName[MAX_PATH];
+			Q_strncpy( pInputBaseName, batchFiles[k].Get(), sizeof(pInputBaseName) );
+			Process_File( pInputBaseName, sizeof(pInputBaseName) );
+		}
+	}
+
 	// Parse args
 	for( ; i < argc; i++ )
 	{
@@ -2819,6 +2998,12 @@ int CVTex::VTex( int argc, char **argv )
 		}
 	}
 
+	VTFSetThreadedProcessing( false );
+	if ( bStartedThreadPool )
+	{
+		g_pThreadPool->Stop();
+	}
+
 	if ( bCreatedFilesystem )
 	{
 		FileSystem_Term();
@@ -29,6 +29,9 @@
 
 #include "mathlib/polyhedron.h"
 #include "tier1/byteswap.h"
+#include "tier1/generichash.h"
+#include "tier1/utlmap.h"
+#include "tier0/icommandline.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -117,7 +120,7 @@ public:
 
 	virtual IPhysicsCollision *ThreadContextCreate( void );
 	virtual void			ThreadContextDestroy( IPhysicsCollision *pThreadContex );
-	virtual unsigned int	ReadStat( int statID ) { return 0; }
+	virtual unsigned int	ReadStat( int statID );
 	virtual void			CollideGetMassCenter( CPhysCollide *pCollide, Vector *pOutMassCenter );
 	virtual void			CollideSetMassCenter( CPhysCollide *pCollide, const Vector &massCenter );
 
@@ -1587,7 +1590,7 @@ bool CPhysicsCollision::IsBoxIntersectingCone( const Vector &boxAbsMins, const V
 // Free a collide that was created with ConvertConvexToCollide()
 void CPhysicsCollision::DestroyCollide( CPhysCollide *pCollide )
 {
-	if ( !IsBBoxCache( pCollide ) )
+	if ( !IsBBoxCache( pCollide ) && !g_VCollideCache.Release( pCollide ) )
 	{
 		delete pCollide;
 	}
@@ -1624,6 +1627,204 @@ float CPhysicsCollision::CollideSurfaceArea( CPhysCollide *pCollide )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Content-hashed cache of the solids created by VCollideLoad().
+//			Maps with many copies of a prop (or models built from the same .phy)
+//			load identical collision blobs; those share one read-only CPhysCollide
+//			(and with it the leafmap used by the trace code) and are refcounted
+//			until the last vcollide_t referencing them is unloaded.
+//-----------------------------------------------------------------------------
+class CVCollideCache
+{
+public:
+	CVCollideCache();
+
+	CPhysCollide *Load( const char *pBuffer, int size, int index, bool swap );
+	// returns false if the collide isn't owned by the cache (caller deletes it)
+	bool Release( CPhysCollide *pCollide );
+	bool IsShared( const CPhysCollide *pCollide );
+	unsigned int ReadStat( int statID );
+
+private:
+	struct entry_t
+	{
+		uint64			hash;
+		int				size;
+		int				index;
+		bool			swap;
+		int				refCount;
+		CPhysCollide	*pCollide;
+		char			*pBytes;		// copy of the serialized solid, compared on a hash match
+	};
+	static bool EntryLessFunc( const entry_t &lhs, const entry_t &rhs );
+
+	CThreadFastMutex							m_mutex;
+	CUtlRBTree<entry_t, int>					m_entries;
+	CUtlMap<const CPhysCollide *, int, int>		m_collideEntry;
+	int											m_enabled;		// -1 until the command line is checked
+
+	unsigned int	m_residentBytes;
+	unsigned int	m_savedBytes;
+	unsigned int	m_sharedRefs;
+	double			m_loadTime;
+	unsigned int	m_loadBytes;
+	double			m_hitTime;
+	unsigned int	m_hitBytes;
+};
+
+static CVCollideCache g_VCollideCache;
+
+CVCollideCache::CVCollideCache() : m_entries( 0, 0, EntryLessFunc ), m_collideEntry( 0, 0, DefLessFunc(const CPhysCollide *) )
+{
+	m_enabled = -1;
+	m_residentBytes = 0;
+	m_savedBytes = 0;
+	m_sharedRefs = 0;
+	m_loadTime = 0;
+	m_loadBytes = 0;
+	m_hitTime = 0;
+	m_hitBytes = 0;
+}
+
+bool CVCollideCache::EntryLessFunc( const entry_t &lhs, const entry_t &rhs )
+{
+	if ( lhs.hash != rhs.hash )
+		return lhs.hash < rhs.hash;
+	if ( lhs.size != rhs.size )
+		return lhs.size < rhs.size;
+	if ( lhs.index != rhs.index )
+		return lhs.index < rhs.index;
+	return lhs.swap < rhs.swap;
+}
+
+CPhysCollide *CVCollideCache::Load( const char *pBuffer, int size, int index, bool swap )
+{
+	if ( m_enabled < 0 )
+	{
+		m_enabled = CommandLine()->FindParm( "-novcollideshare" ) ? 0 : 1;
+	}
+
+	double start = Plat_FloatTime();
+	entry_t search;
+	bool bCache = ( m_enabled != 0 );
+	if ( bCache )
+	{
+		// the solid index is stored in the surface and the byte order changes the result, so both are part of the key
+		search.hash = MurmurHash64( pBuffer, size, 0x5643 );
+		search.size = size;
+		search.index = index;
+		search.swap = swap;
+		search.refCount = 1;
+		search.pCollide = NULL;
+		search.pBytes = NULL;
+
+		AUTO_LOCK( m_mutex );
+		int entry = m_entries.Find( search );
+		if ( m_entries.IsValidIndex( entry ) && memcmp( m_entries[entry].pBytes, pBuffer, size ) )
+		{
+			// a different solid with the same hash, load this one without sharing it
+			entry = m_entries.InvalidIndex();
+			bCache = false;
+		}
+		if ( m_entries.IsValidIndex( entry ) )
+		{
+			entry_t &cached = m_entries[entry];
+			cached.refCount++;
+			m_savedBytes += size;
+			m_sharedRefs++;
+			m_hitBytes += size;
+			m_hitTime += Plat_FloatTime() - start;
+			return cached.pCollide;
+		}
+	}
+
+	char *tmpbuf = new char[size];
+	memcpy(tmpbuf, pBuffer, size);
+	CPhysCollide *pCollide = CPhysCollide::UnserializeFromBuffer( tmpbuf, size, index, swap );
+	delete[] tmpbuf;
+
+	if ( bCache && pCollide )
+	{
+		AUTO_LOCK( m_mutex );
+		search.pCollide = pCollide;
+		search.pBytes = new char[size];
+		memcpy( search.pBytes, pBuffer, size );
+		m_collideEntry.Insert( pCollide, m_entries.Insert( search ) );
+		m_residentBytes += size;
+		m_loadBytes += size;
+		m_loadTime += Plat_FloatTime() - start;
+	}
+	return pCollide;
+}
+
+bool CVCollideCache::Release( CPhysCollide *pCollide )
+{
+	if ( !m_enabled )
+		return false;
+
+	AUTO_LOCK( m_mutex );
+	int map = m_collideEntry.Find( pCollide );
+	if ( !m_collideEntry.IsValidIndex( map ) )
+		return false;
+
+	int entry = m_collideEntry[map];
+	entry_t &cached = m_entries[entry];
+	if ( --cached.refCount > 0 )
+	{
+		m_savedBytes -= cached.size;
+		return true;
+	}
+
+	m_residentBytes -= cached.size;
+	m_collideEntry.RemoveAt( map );
+	delete[] cached.pBytes;
+	m_entries.RemoveAt( entry );
+	delete pCollide;
+	return true;
+}
+
+bool CVCollideCache::IsShared( const CPhysCollide *pCollide )
+{
+	if ( !m_enabled )
+		return false;
+
+	AUTO_LOCK( m_mutex );
+	int map = m_collideEntry.Find( pCollide );
+	return m_collideEntry.IsValidIndex( map ) && m_entries[m_collideEntry[map]].refCount > 1;
+}
+
+unsigned int CVCollideCache::ReadStat( int statID )
+{
+	AUTO_LOCK( m_mutex );
+	switch( statID )
+	{
+	case PHYSCOLLISION_STAT_VCOLLIDE_UNIQUE_SOLIDS:
+		return m_entries.Count();
+	case PHYSCOLLISION_STAT_VCOLLIDE_SHARED_REFS:
+		return m_sharedRefs;
+	case PHYSCOLLISION_STAT_VCOLLIDE_RESIDENT_BYTES:
+		return m_residentBytes;
+	case PHYSCOLLISION_STAT_VCOLLIDE_SAVED_BYTES:
+		return m_savedBytes;
+	case PHYSCOLLISION_STAT_VCOLLIDE_LOAD_USEC:
+		return (unsigned int)( m_loadTime * 1e6 );
+	case PHYSCOLLISION_STAT_VCOLLIDE_SAVED_USEC:
+		{
+			// estimate what the shared loads would have cost at the measured unserialize rate
+			if ( !m_loadBytes )
+				return 0;
+			double saved = m_loadTime * ( (double)m_hitBytes / (double)m_loadBytes ) - m_hitTime;
+			return saved > 0 ? (unsigned int)( saved * 1e6 ) : 0;
+		}
+	}
+	return 0;
+}
+
+unsigned int CPhysicsCollision::ReadStat( int statID )
+{
+	return g_VCollideCache.ReadStat( statID );
+}
+
 // loads a set of solids into a vcollide_t
 void CPhysicsCollision::VCollideLoad( vcollide_t *pOutput, int solidCount, const char *pBuffer, int bufferSize, bool swap )
 {
@@ -1641,13 +1842,8 @@ void CPhysicsCollision::VCollideLoad( vcollide_t *pOutput, int solidCount, const
 		memcpy( &size, pBuffer + position, sizeof(int) );
 		position += sizeof(int);
 
-		char *tmpbuf = new char[size];
-		memcpy(tmpbuf, pBuffer + position, size);
-
-		pOutput->solids[i] = CPhysCollide::UnserializeFromBuffer( tmpbuf, size, i, swap );
+		pOutput->solids[i] = g_VCollideCache.Load( pBuffer + position, size, i, swap );
 		position += size;
-
-		delete[] tmpbuf;
 	}
 
 	END_IVP_ALLOCATION();
@@ -1667,7 +1863,8 @@ void CPhysicsCollision::VCollideUnload( vcollide_t *pVCollide )
 		// HACKHACK: 1024 is just "some big number"
 		// GetActiveEnvironmentByIndex() will eventually return NULL when there are no more environments.
 		// In HL2 & TF2, there are only 2 environments - so j > 1 is probably an error!
-		for ( int j = 0; j < 1024; j++ )
+		// Other vcollides may still be using a shared solid, so only the last reference is checked.
+		for ( int j = 0; j < 1024 && !g_VCollideCache.IsShared( pVCollide->solids[i] ); j++ )
 		{
 			IPhysicsEnvironment *pEnv = g_PhysicsInternal->GetActiveEnvironmentByIndex( j );
 			if ( !pEnv )
@@ -1680,7 +1877,10 @@ void CPhysicsCollision::VCollideUnload( vcollide_t *pVCollide )
 			}
 		}
 #endif
-		delete pVCollide->solids[i];
+		if ( !g_VCollideCache.Release( pVCollide->solids[i] ) )
+		{
+			delete pVCollide->solids[i];
+		}
 	}
 	delete[] pVCollide->solids;
 	delete[] pVCollide->pKeyValues;
@@ -1717,6 +1917,7 @@ void CPhysicsCollision::CollideGetMassCenter( CPhysCollide *pCollide, Vector *pO
 
 void CPhysicsCollision::CollideSetMassCenter( CPhysCollide *pCollide, const Vector &massCenter )
 {
+	AssertMsg( !g_VCollideCache.IsShared( pCollide ), "Modifying a shared vcollide solid!\n" );
 	pCollide->SetMassCenter( massCenter );
 }
 
@@ -1736,6 +1937,7 @@ Vector CPhysicsCollision::CollideGetOrthographicAreas( const CPhysCollide *pColl
 
 void CPhysicsCollision::CollideSetOrthographicAreas( CPhysCollide *pCollide, const Vector &areas )
 {
+	AssertMsg( !pCollide || !g_VCollideCache.IsShared( pCollide ), "Modifying a shared vcollide solid!\n" );
 	if ( pCollide )
 		pCollide->SetOrthographicAreas( areas );
 }
@@ -117,6 +117,8 @@ public:
 //-----------------------------------------------------------------------------
 // Implementation of the VTF Texture
 //-----------------------------------------------------------------------------
+struct ConvertImageJob_t;
+
 class CVTFTexture : public IVTFTexture
 {
 public:
@@ -159,6 +161,8 @@ public:
 
 	virtual void GetMipmapRange( int* pOutFinest, int* pOutCoarsest );
 
+	virtual bool UnserializeFromReader( CUtlBuffer &headerBuf, IVTFRangeReader *pReader, int nForceFlags = 0, int nSkipMipLevels = 0 );
+
 	// Attributes...
 	virtual int Width() const;
 	virtual int Height() const;
@@ -323,6 +327,10 @@ private:
 
 	// Unserialization of image data
 	bool LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header, int nSkipMipLevels );
+	bool LoadImageDataFromReader( IVTFRangeReader *pReader, int nImageOffset, const VTFFileHeader_t &header, int nSkipMipLevels );
+
+	// Fixes up the mip count + size for skipped mip levels
+	bool SkipMipLevels( const VTFFileHeader_t &header, int nSkipMipLevels );
 
 	// Shutdown
 	void Shutdown();
@@ -350,6 +358,10 @@ private:
 	// Computes the location of a particular face, frame, and mip level
 	int GetImageOffset( int iFrame, int iFace, int iMipLevel, ImageFormat fmt ) const;
 
+	// Splits a conversion of every frame, face, mip and slice into jobs writing to pConvertedImage.
+	// bSplitRows also splits faces into bands of block rows (DXT compression only)
+	void BuildConvertImageJobs( CUtlVector<ConvertImageJob_t> &jobs, unsigned char *pConvertedImage, ImageFormat fmt, bool bNormalToDUDV, bool bSplitRows );
+
 	// Determines if the vtf or vtfx file needs to be swapped to the current platform
 	bool SetupByteSwap( CUtlBuffer &buf );
 
@@ -16,6 +16,7 @@
 #include "s3tc_decode.h"
 #include "utlvector.h"
 #include "vprof_telemetry.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -197,6 +198,30 @@ void DestroyVTFTexture( IVTFTexture *pTexture )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Threaded mipmap generation and format conversion (used by vtex)
+//-----------------------------------------------------------------------------
+static bool s_bThreadedProcessing = false;
+static bool s_bVerifyThreadedProcessing = false;
+
+void VTFSetThreadedProcessing( bool bEnable, bool bVerify )
+{
+	s_bThreadedProcessing = bEnable;
+	s_bVerifyThreadedProcessing = bEnable && bVerify;
+}
+
+bool VTFIsThreadedProcessingEnabled()
+{
+	return s_bThreadedProcessing;
+}
+
+static bool VTFShouldUseThreadPool( int nJobs )
+{
+	// Only the main thread fans out, so a texture being built from inside a job never waits on the pool.
+	// That's also the only thread that sets s_bThreadedProcessing, so check it first
+	return ThreadInMainThread() && s_bThreadedProcessing && ( nJobs > 1 ) && g_pThreadPool && ( g_pThreadPool->NumThreads() > 0 );
+}
+
 //-----------------------------------------------------------------------------
 // Allows us to only load in the first little bit of the VTF file to get info
 //-----------------------------------------------------------------------------
@@ -659,7 +684,7 @@ bool CVTFTexture::LoadLowResData( CUtlBuffer &buf )
 //-----------------------------------------------------------------------------
 // Unserialization of image data
 //-----------------------------------------------------------------------------
-bool CVTFTexture::LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header, int nSkipMipLevels )
+bool CVTFTexture::SkipMipLevels( const VTFFileHeader_t &header, int nSkipMipLevels )
 {
 	// Fix up the mip count + size based on how many mip levels we skip...
 	if (nSkipMipLevels > 0)
@@ -675,6 +700,13 @@ bool CVTFTexture::LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header,
 		ComputeMipLevelDimensions( nSkipMipLevels, &m_nWidth, &m_nHeight, &m_nDepth );
 		m_nMipCount -= nSkipMipLevels;
 	}
+	return true;
+}
+
+bool CVTFTexture::LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header, int nSkipMipLevels )
+{
+	if ( !SkipMipLevels( header, nSkipMipLevels ) )
+		return false;
 
 	// read the texture image (including mipmaps if they are there and needed.)
 	int iImageSize = ComputeFaceSize();
@@ -741,6 +773,59 @@ retryCubemapLoad:
 	return bOk;
 }
 
+//-----------------------------------------------------------------------------
+// Unserialization of image data through a range reader
+//-----------------------------------------------------------------------------
+bool CVTFTexture::LoadImageDataFromReader( IVTFRangeReader *pReader, int nImageOffset, const VTFFileHeader_t &header, int nSkipMipLevels )
+{
+	if ( !SkipMipLevels( header, nSkipMipLevels ) )
+		return false;
+
+	int iImageSize = ComputeFaceSize();
+	iImageSize *= m_nFaceCount * m_nFrameCount;
+
+	if ( !AllocateImageData( iImageSize ) )
+		return false;
+
+	// On disk each mip level holds every frame and face back to back, smallest level first,
+	// so the levels we skipped are simply never read. Single-face textures read in place.
+	int nSliceCount = m_nFrameCount * m_nFaceCount;
+	CUtlMemory<unsigned char> levelBuffer;
+	int nOffset = nImageOffset;
+	for (int iMip = m_nMipCount; --iMip >= 0; )
+	{
+		// NOTE: This is for older versions...
+		if ( header.numMipLevels - nSkipMipLevels <= iMip )
+			continue;
+
+		int iMipSize = ComputeMipSize( iMip );
+		int nLevelSize = iMipSize * nSliceCount;
+		if ( nSliceCount == 1 )
+		{
+			if ( pReader->ReadRange( ImageData( 0, 0, iMip ), nOffset, iMipSize ) != iMipSize )
+				return false;
+		}
+		else
+		{
+			levelBuffer.EnsureCapacity( nLevelSize );
+			if ( pReader->ReadRange( levelBuffer.Base(), nOffset, nLevelSize ) != nLevelSize )
+				return false;
+
+			unsigned char *pSrc = levelBuffer.Base();
+			for (int iFrame = 0; iFrame < m_nFrameCount; ++iFrame)
+			{
+				for (int iFace = 0; iFace < m_nFaceCount; ++iFace, pSrc += iMipSize)
+				{
+					memcpy( ImageData( iFrame, iFace, iMip ), pSrc, iMipSize );
+				}
+			}
+		}
+		nOffset += nLevelSize;
+	}
+
+	return true;
+}
+
 void *CVTFTexture::SetResourceData( uint32 eType, void const *pData, size_t nNumBytes )
 {
 	Assert( ( eType & RSRCF_MASK ) == 0 );
@@ -1197,6 +1282,72 @@ bool CVTFTexture::UnserializeEx( CUtlBuffer &buf, bool bHeaderOnly, int nForceFl
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// Unserialization that reads only the parts of the file it needs
+//-----------------------------------------------------------------------------
+bool CVTFTexture::UnserializeFromReader( CUtlBuffer &headerBuf, IVTFRangeReader *pReader, int nForceFlags, int nSkipMipLevels )
+{
+	tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "%s (nForceFlags: %d, skipMips: %d)", __FUNCTION__, nForceFlags, nSkipMipLevels );
+
+	// headerBuf holds the start of the file
+	headerBuf.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+	if ( !UnserializeEx( headerBuf, true, nForceFlags, nSkipMipLevels ) )
+		return false;
+
+	headerBuf.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+	VTFFileHeader_t header;
+	if ( !ReadHeader( headerBuf, header ) )
+		return false;
+	header.flags |= nForceFlags;
+
+	ResourceEntryInfo const *pImageDataInfo = FindResourceEntryInfo( VTF_LEGACY_RSRC_IMAGE );
+	if ( !pImageDataInfo )
+		return false;
+	int nImageOffset = pImageDataInfo->resData;
+
+	// Everything but the image data has to sit in front of it; 360 data needs swapping and
+	// pre-7.5 cubemaps may carry a spheremap we can only detect by size, so those take the
+	// buffered path
+	bool bStreamable = !IsX360() && !( IsCubeMap() && ( header.version[0] == 7 ) && ( header.version[1] < 5 ) );
+	for ( int i = 0; bStreamable && ( i < m_arrResourcesInfo.Count() ); ++i )
+	{
+		ResourceEntryInfo const &rei = m_arrResourcesInfo[i];
+		if ( ( rei.eType & RSRCF_HAS_NO_DATA_CHUNK ) == 0 && ( rei.eType & ~RSRCF_MASK ) != VTF_LEGACY_RSRC_IMAGE && int( rei.resData ) >= nImageOffset )
+		{
+			bStreamable = false;
+		}
+	}
+
+	// Pull in whatever is still missing ahead of the image data (or up to the end of the mips we keep)
+	int nPrefixSize = bStreamable ? nImageOffset : FileSize( nSkipMipLevels );
+	CUtlBuffer buf;
+	buf.EnsureCapacity( nPrefixSize );
+	int nHave = MIN( headerBuf.TellMaxPut(), nPrefixSize );
+	memcpy( buf.Base(), headerBuf.Base(), nHave );
+	if ( nHave < nPrefixSize )
+	{
+		nHave += MAX( 0, pReader->ReadRange( (unsigned char *)buf.Base() + nHave, nHave, nPrefixSize - nHave ) );
+	}
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, nHave );
+
+	if ( !bStreamable )
+		return UnserializeEx( buf, false, nForceFlags, nSkipMipLevels );
+
+	// Load the low res image
+	if ( ResourceEntryInfo const *pLowResDataInfo = FindResourceEntryInfo( VTF_LEGACY_RSRC_LOW_RES_IMAGE ) )
+	{
+		buf.SeekGet( CUtlBuffer::SEEK_HEAD, pLowResDataInfo->resData );
+		if ( !LoadLowResData( buf ) )
+			return false;
+	}
+
+	// Load any new resources
+	if ( !LoadNewResources( buf ) )
+		return false;
+
+	return LoadImageDataFromReader( pReader, nImageOffset, header, nSkipMipLevels );
+}
+
 void CVTFTexture::GetMipmapRange( int* pOutFinest, int* pOutCoarsest )
 {
 	if ( pOutFinest )
@@ -1837,6 +1988,115 @@ void CVTFTexture::ComputeMipLevelSubRect( Rect_t *pSrcRect, int nMipLevel, Rect_
 }
 
 
+//-----------------------------------------------------------------------------
+// One face slice (or band of block rows) worth of format conversion
+//-----------------------------------------------------------------------------
+// Rows per job when a single large face is compressed to DXT on several threads
+#define VTF_DXT_BAND_ROWS	64
+
+struct ConvertImageJob_t
+{
+	unsigned char *m_pSrc;
+	unsigned char *m_pDst;
+	ImageFormat m_SrcFormat;
+	ImageFormat m_DstFormat;
+	int m_nWidth;
+	int m_nHeight;
+	bool m_bNormalToDUDV;
+};
+
+static void ProcessConvertImageJob( ConvertImageJob_t &job )
+{
+	if( job.m_bNormalToDUDV )
+	{
+		if( job.m_DstFormat == IMAGE_FORMAT_UV88 )
+		{
+			ImageLoader::ConvertNormalMapRGBA8888ToDUDVMapUV88( job.m_pSrc,
+				job.m_nWidth, job.m_nHeight, job.m_pDst );
+		}
+		else if( job.m_DstFormat == IMAGE_FORMAT_UVWQ8888 )
+		{
+			ImageLoader::ConvertNormalMapRGBA8888ToDUDVMapUVWQ8888( job.m_pSrc,
+				job.m_nWidth, job.m_nHeight, job.m_pDst );
+		}
+		else if ( job.m_DstFormat == IMAGE_FORMAT_UVLX8888 )
+		{
+			ImageLoader::ConvertNormalMapRGBA8888ToDUDVMapUVLX8888( job.m_pSrc,
+				job.m_nWidth, job.m_nHeight, job.m_pDst );
+		}
+		else
+		{
+			// ConvertImageFormat rejects these before building any jobs
+			Assert( 0 );
+			return;
+		}
+	}
+	else
+	{
+		ImageLoader::ConvertImageFormat( job.m_pSrc, job.m_SrcFormat, 
+			job.m_pDst, job.m_DstFormat, job.m_nWidth, job.m_nHeight );
+	}
+}
+
+static void RunConvertImageJobs( CUtlVector<ConvertImageJob_t> &jobs, bool bThreaded )
+{
+	if ( !bThreaded )
+	{
+		for ( int i = 0; i < jobs.Count(); ++i )
+		{
+			ProcessConvertImageJob( jobs[i] );
+		}
+		return;
+	}
+
+	// The first job runs here so any one-time compressor setup happens before the pool fans out
+	ProcessConvertImageJob( jobs[0] );
+	ParallelProcess( "VTFConvertImageFormat", jobs.Base() + 1, jobs.Count() - 1, &ProcessConvertImageJob );
+}
+
+//-----------------------------------------------------------------------------
+// One job per face slice of every frame, face and mip level. With bSplitRows,
+// big slices are further split into bands of VTF_DXT_BAND_ROWS rows
+//-----------------------------------------------------------------------------
+void CVTFTexture::BuildConvertImageJobs( CUtlVector<ConvertImageJob_t> &jobs, unsigned char *pConvertedImage, ImageFormat fmt, bool bNormalToDUDV, bool bSplitRows )
+{
+	for (int iMip = 0; iMip < m_nMipCount; ++iMip)
+	{
+		int nMipWidth, nMipHeight, nMipDepth;
+		ComputeMipLevelDimensions( iMip, &nMipWidth, &nMipHeight, &nMipDepth );
+
+ 		int nSrcFaceStride = ImageLoader::GetMemRequired( nMipWidth, nMipHeight, 1, m_Format, false ); 
+ 		int nDstFaceStride = ImageLoader::GetMemRequired( nMipWidth, nMipHeight, 1, fmt, false ); 
+		int nBandRows = bSplitRows ? VTF_DXT_BAND_ROWS : nMipHeight;
+
+		for (int iFrame = 0; iFrame < m_nFrameCount; ++iFrame)
+		{
+			for (int iFace = 0; iFace < m_nFaceCount; ++iFace)
+			{
+				unsigned char *pSrcData = ImageData( iFrame, iFace, iMip );
+				unsigned char *pDstData = pConvertedImage + 
+					GetImageOffset( iFrame, iFace, iMip, fmt );
+
+				for ( int z = 0; z < nMipDepth; ++z, pSrcData += nSrcFaceStride, pDstData += nDstFaceStride )
+				{
+					for ( int y = 0; y < nMipHeight; y += nBandRows )
+					{
+						ConvertImageJob_t &job = jobs[ jobs.AddToTail() ];
+						job.m_pSrc = pSrcData + ImageLoader::GetMemRequired( nMipWidth, y, 1, m_Format, false );
+						job.m_pDst = pDstData + ImageLoader::GetMemRequired( nMipWidth, y, 1, fmt, false );
+						job.m_SrcFormat = m_Format;
+						job.m_DstFormat = fmt;
+						job.m_nWidth = nMipWidth;
+						job.m_nHeight = MIN( nBandRows, nMipHeight - y );
+						job.m_bNormalToDUDV = bNormalToDUDV;
+					}
+				}
+			}
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Converts the texture's image format. Use IMAGE_FORMAT_DEFAULT
 // if you want to be able to use various tool functions below
@@ -1880,55 +2140,29 @@ void CVTFTexture::ConvertImageFormat( ImageFormat fmt, bool bNormalToDUDV )
 	if ( !pConvertedImage )
 		return;
 
-	for (int iMip = 0; iMip < m_nMipCount; ++iMip)
-	{
-		int nMipWidth, nMipHeight, nMipDepth;
-		ComputeMipLevelDimensions( iMip, &nMipWidth, &nMipHeight, &nMipDepth );
+	// The DXT compressor works on independent 4x4 blocks, so big faces can also be
+	// split into bands of block rows without changing a single output byte
+	bool bSplitRows = !bNormalToDUDV && !ImageLoader::IsCompressed( m_Format ) &&
+		( fmt == IMAGE_FORMAT_DXT1 || fmt == IMAGE_FORMAT_DXT5 || fmt == IMAGE_FORMAT_DXT1_RUNTIME || fmt == IMAGE_FORMAT_DXT5_RUNTIME );
 
- 		int nSrcFaceStride = ImageLoader::GetMemRequired( nMipWidth, nMipHeight, 1, m_Format, false ); 
- 		int nDstFaceStride = ImageLoader::GetMemRequired( nMipWidth, nMipHeight, 1, fmt, false ); 
+	CUtlVector<ConvertImageJob_t> jobs;
+	BuildConvertImageJobs( jobs, pConvertedImage, fmt, bNormalToDUDV, bSplitRows && s_bThreadedProcessing );
 
-		for (int iFrame = 0; iFrame < m_nFrameCount; ++iFrame)
-		{
-			for (int iFace = 0; iFace < m_nFaceCount; ++iFace)
-			{
-				unsigned char *pSrcData = ImageData( iFrame, iFace, iMip );
-				unsigned char *pDstData = pConvertedImage + 
-					GetImageOffset( iFrame, iFace, iMip, fmt );
+	bool bThreaded = VTFShouldUseThreadPool( jobs.Count() );
+	RunConvertImageJobs( jobs, bThreaded );
 
-				for ( int z = 0; z < nMipDepth; ++z, pSrcData += nSrcFaceStride, pDstData += nDstFaceStride )
-				{
-					if( bNormalToDUDV )
-					{
-						if( fmt == IMAGE_FORMAT_UV88 )
-						{
-							ImageLoader::ConvertNormalMapRGBA8888ToDUDVMapUV88( pSrcData,
-								nMipWidth, nMipHeight, pDstData );
-						}
-						else if( fmt == IMAGE_FORMAT_UVWQ8888 )
-						{
-							ImageLoader::ConvertNormalMapRGBA8888ToDUDVMapUVWQ8888( pSrcData,
-								nMipWidth, nMipHeight, pDstData );
-						}
-						else if ( fmt == IMAGE_FORMAT_UVLX8888 )
-						{
-							ImageLoader::ConvertNormalMapRGBA8888ToDUDVMapUVLX8888( pSrcData,
-								nMipWidth, nMipHeight, pDstData );
-						}
-						else
-						{
-							Assert( 0 );
-							return;
-						}
-					}
-					else
-					{
-						ImageLoader::ConvertImageFormat( pSrcData, m_Format, 
-							pDstData, fmt, nMipWidth, nMipHeight );
-					}
-				}
-			}
+	if ( bThreaded && s_bVerifyThreadedProcessing )
+	{
+		// The reference converts whole faces, so it also checks the banding
+		unsigned char *pSerialImage = new unsigned char[ iConvertedSize ];
+		CUtlVector<ConvertImageJob_t> serialJobs;
+		BuildConvertImageJobs( serialJobs, pSerialImage, fmt, bNormalToDUDV, false );
+		RunConvertImageJobs( serialJobs, false );
+		if ( memcmp( pSerialImage, pConvertedImage, iConvertedSize ) )
+		{
+			Warning( "VTF: threaded conversion to %s doesn't match the serial result!\n", ImageLoader::GetName( fmt ) );
 		}
+		delete [] pSerialImage;
 	}
 
 	if ( !AllocateImageData(iConvertedSize) )
@@ -2498,6 +2732,71 @@ void CVTFTexture::NormalizeTopMipLevel()
 	}
 }
 
+//-----------------------------------------------------------------------------
+// One frame/face of one mip level worth of resampling
+//-----------------------------------------------------------------------------
+struct MipmapJob_t
+{
+	ImageLoader::ResampleInfo_t m_Info;
+	ImageFormat m_Format;
+	int m_nMipLevel;
+	bool m_bNormalize;
+};
+
+static void ProcessMipmapJob( MipmapJob_t &job )
+{
+	if( job.m_Format == IMAGE_FORMAT_RGBA32323232F )
+	{
+		ImageLoader::ResampleRGBA32323232F( job.m_Info );
+	}
+	else if( job.m_Format == IMAGE_FORMAT_RGB323232F )
+	{
+		ImageLoader::ResampleRGB323232F( job.m_Info );
+	}
+	else
+	{
+		ImageLoader::ResampleRGBA8888( job.m_Info );
+	}
+	if ( job.m_bNormalize )
+	{
+		ImageLoader::NormalizeNormalMapRGBA8888( job.m_Info.m_pDest, job.m_Info.m_nDestWidth * job.m_Info.m_nDestHeight * job.m_Info.m_nDestDepth );
+	}
+}
+
+// Each mip level is filtered from the level 4 above it (or mip 0), so mips 1-4 only
+// depend on mip 0, mips 5-8 only on mips 1-4, and so on
+static inline int MipmapJobWave( int nMipLevel )
+{
+	return ( nMipLevel - 1 ) / 4;
+}
+
+static void RunMipmapJobs( CUtlVector<MipmapJob_t> &jobs, bool bThreaded )
+{
+	int nFirst = 0;
+	while ( nFirst < jobs.Count() )
+	{
+		int nWave = MipmapJobWave( jobs[nFirst].m_nMipLevel );
+		int nLast = nFirst + 1;
+		while ( nLast < jobs.Count() && MipmapJobWave( jobs[nLast].m_nMipLevel ) == nWave )
+		{
+			++nLast;
+		}
+
+		if ( bThreaded && ( nLast - nFirst > 1 ) )
+		{
+			ParallelProcess( "VTFGenerateMipmaps", jobs.Base() + nFirst, nLast - nFirst, &ProcessMipmapJob );
+		}
+		else
+		{
+			for ( int i = nFirst; i < nLast; ++i )
+			{
+				ProcessMipmapJob( jobs[i] );
+			}
+		}
+		nFirst = nLast;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Generates mipmaps from the base mip levels
 //-----------------------------------------------------------------------------
@@ -2570,6 +2869,7 @@ void CVTFTexture::GenerateMipmaps()
 		}
 	}
 
+	CUtlVector<MipmapJob_t> jobs;
 	for ( int iMipLevel = 1; iMipLevel < m_nMipCount; ++iMipLevel )
 	{
 		ComputeMipLevelDimensions( iMipLevel, &info.m_nDestWidth, &info.m_nDestHeight, &info.m_nDestDepth );
@@ -2642,31 +2942,41 @@ void CVTFTexture::GenerateMipmaps()
 		{
 			for ( int iFace = 0; iFace < m_nFaceCount; ++iFace )
 			{
-				unsigned char *pSrcLevel = ImageData( iFrame, iFace, nSrcMipLevel );
-				unsigned char *pDstLevel = ImageData( iFrame, iFace, iMipLevel );
-
-				info.m_pSrc = pSrcLevel;
-				info.m_pDest = pDstLevel;
-				ComputeMipLevelDimensions( nSrcMipLevel, &info.m_nSrcWidth, &info.m_nSrcHeight, &info.m_nSrcDepth );
-				if( m_Format == IMAGE_FORMAT_RGBA32323232F )
-				{
-					ImageLoader::ResampleRGBA32323232F( info );
-				}
-				else if( m_Format == IMAGE_FORMAT_RGB323232F )
-				{
-					ImageLoader::ResampleRGB323232F( info );
-				}
-				else
-				{
-					ImageLoader::ResampleRGBA8888( info );
-				}
-				if ( Flags() & TEXTUREFLAGS_NORMAL )
-				{
-					ImageLoader::NormalizeNormalMapRGBA8888( pDstLevel, info.m_nDestWidth * info.m_nDestHeight * info.m_nDestDepth );
-				}
+				MipmapJob_t &job = jobs[ jobs.AddToTail() ];
+				job.m_Info = info;
+				job.m_Info.m_pSrc = ImageData( iFrame, iFace, nSrcMipLevel );
+				job.m_Info.m_pDest = ImageData( iFrame, iFace, iMipLevel );
+				ComputeMipLevelDimensions( nSrcMipLevel, &job.m_Info.m_nSrcWidth, &job.m_Info.m_nSrcHeight, &job.m_Info.m_nSrcDepth );
+				job.m_Format = m_Format;
+				job.m_nMipLevel = iMipLevel;
+				job.m_bNormalize = ( Flags() & TEXTUREFLAGS_NORMAL ) != 0;
 			}
 		}
 	}
+
+	bool bThreaded = VTFShouldUseThreadPool( jobs.Count() );
+	if ( bThreaded && s_bVerifyThreadedProcessing )
+	{
+		// Mips are generated in place, so build the serial reference first and restore mip 0 from a copy
+		unsigned char *pOriginal = new unsigned char[ m_nImageAllocSize ];
+		memcpy( pOriginal, m_pImageData, m_nImageAllocSize );
+		RunMipmapJobs( jobs, false );
+
+		unsigned char *pSerialImage = new unsigned char[ m_nImageAllocSize ];
+		memcpy( pSerialImage, m_pImageData, m_nImageAllocSize );
+		memcpy( m_pImageData, pOriginal, m_nImageAllocSize );
+		RunMipmapJobs( jobs, true );
+
+		if ( memcmp( pSerialImage, m_pImageData, m_nImageAllocSize ) )
+		{
+			Warning( "VTF: threaded mipmap generation doesn't match the serial result!\n" );
+		}
+		delete [] pSerialImage;
+		delete [] pOriginal;
+		return;
+	}
+
+	RunMipmapJobs( jobs, bThreaded );
 }
 
 void CVTFTexture::PutOneOverMipLevelInAlpha()